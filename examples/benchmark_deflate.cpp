@@ -0,0 +1,89 @@
+// EWSS permessage-deflate broadcast benchmark
+// Measures: CPU time to prepare one broadcast for N subscribers when every connection
+// compresses with its own context vs. compress-once with server_no_context_takeover.
+// Runs the codec path the reactor takes, without sockets (a reactor holds at most
+// kMaxConnections, so N subscribers would span several reactors).
+//
+// Usage: ./benchmark_deflate [subscribers] [broadcasts] [payload_size]
+
+#include "ewss.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if EWSS_HAS_DEFLATE
+
+namespace {
+
+// Market-data style JSON: repetitive keys, slowly changing values
+std::string make_payload(size_t size, int seq) {
+  std::string out = "[";
+  for (int i = 0; out.size() < size; ++i) {
+    out += "{\"sym\":\"EWSS" + std::to_string(i % 16) + "\",\"px\":" + std::to_string(1000 + (seq + i) % 37) +
+           ",\"qty\":" + std::to_string((seq * 7 + i) % 500) + "},";
+  }
+  out.back() = ']';
+  return out;
+}
+
+double now_us() {
+  return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  size_t subscribers = argc > 1 ? std::stoul(argv[1]) : 1000;
+  int broadcasts = argc > 2 ? std::stoi(argv[2]) : 50;
+  size_t payload_size = argc > 3 ? std::stoul(argv[3]) : 4096;
+
+  std::vector<std::string> payloads;
+  for (int i = 0; i < broadcasts; ++i) payloads.push_back(make_payload(payload_size, i));
+
+  // Per-connection contexts: one deflate per subscriber per message
+  std::vector<std::unique_ptr<ewss::deflate::Compressor>> contexts;
+  for (size_t i = 0; i < subscribers; ++i) contexts.push_back(std::make_unique<ewss::deflate::Compressor>(15, 6));
+  std::string out;
+  size_t per_conn_bytes = 0;
+  double start = now_us();
+  for (const auto& p : payloads) {
+    for (auto& c : contexts) {
+      c->compress(p, out, false);
+      per_conn_bytes += out.size();
+    }
+  }
+  double per_conn_us = (now_us() - start) / broadcasts;
+
+  // Compress once, share the frame by reference
+  size_t shared_bytes = 0;
+  start = now_us();
+  for (const auto& p : payloads) {
+    ewss::SharedFrame plain = ewss::SharedFrame::encode({}, p, ewss::ws::OpCode::kText);
+    ewss::SharedFrame deflated = ewss::deflate::compress_shared(plain, 15, 6);
+    for (size_t i = 0; i < subscribers; ++i) {
+      ewss::SharedFrame ref = deflated;  // What each subscriber's send_encoded() holds
+      shared_bytes += ref.payload().size();
+    }
+  }
+  double shared_us = (now_us() - start) / broadcasts;
+
+  std::printf("subscribers=%zu broadcasts=%d payload=%zu\n", subscribers, broadcasts, payload_size);
+  std::printf("  per-connection deflate: %10.1f us/broadcast, %6.1f bytes/subscriber\n", per_conn_us,
+              static_cast<double>(per_conn_bytes) / (static_cast<double>(subscribers) * broadcasts));
+  std::printf("  compress-once shared:   %10.1f us/broadcast, %6.1f bytes/subscriber\n", shared_us,
+              static_cast<double>(shared_bytes) / (static_cast<double>(subscribers) * broadcasts));
+  std::printf("  speedup: %.0fx\n", per_conn_us / (shared_us > 0 ? shared_us : 1));
+  return 0;
+}
+
+#else
+
+int main() {
+  std::printf("benchmark_deflate: built without zlib (EWSS_WITH_ZLIB)\n");
+  return 0;
+}
+
+#endif
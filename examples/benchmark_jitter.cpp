@@ -0,0 +1,153 @@
+// EWSS reactor jitter benchmark
+// Measures: how late the reactor wakes up for a periodic timerfd, once with the
+// default scheduling and once with a RealtimePolicy (SCHED_FIFO, pinned CPU, 1 ns
+// timer slack). Optional load threads compete for the CPUs meanwhile, the way
+// other processes do on a shared controller. Wake-up lateness lands in a
+// LatencyHistogram (log2 microsecond buckets) per run.
+//
+// SCHED_FIFO needs root or CAP_SYS_NICE; without it the second run reports the
+// refusal and measures affinity + slack only.
+// Usage: ./benchmark_jitter [seconds] [period_us] [priority] [cpu] [load_threads] [port]
+
+#include "ewss.hpp"
+
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct RunResult {
+  uint64_t counts[ewss::LatencyHistogram::kBuckets] = {};
+  uint64_t wakeups = 0;
+  uint64_t missed = 0;  // Extra expirations: whole periods slept through
+  uint64_t max_ns = 0;
+  uint64_t realtime_failures = 0;
+};
+
+uint64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + static_cast<uint64_t>(ts.tv_nsec);
+}
+
+// Busy bursts with short sleeps, so the scheduler keeps preempting and migrating
+void load_loop(const std::atomic<bool>& stop) {
+  volatile uint64_t sink = 0;
+  while (!stop.load(std::memory_order_relaxed)) {
+    for (int i = 0; i < 200000; ++i) sink = sink + static_cast<uint64_t>(i);
+    std::this_thread::sleep_for(std::chrono::microseconds(50));
+  }
+}
+
+// Periodic timerfd on the reactor; poll sources hold 16 bytes, so the handler
+// captures only this
+struct Probe {
+  ewss::Server* server;
+  RunResult* result;
+  ewss::LatencyHistogram hist;
+  int tfd = -1;
+  uint64_t period_ns = 0;
+  uint64_t next = 0;  // Due time of the oldest pending expiration
+  uint64_t end = 0;
+
+  void on_ready() {
+    uint64_t woke = now_ns();
+    uint64_t expirations = 0;
+    if (::read(tfd, &expirations, sizeof(expirations)) != sizeof(expirations) || expirations == 0) return;
+    uint64_t late_ns = woke > next ? woke - next : 0;
+    hist.record(late_ns / 1000);
+    result->max_ns = std::max(result->max_ns, late_ns);
+    result->missed += expirations - 1;
+    ++result->wakeups;
+    next += expirations * period_ns;
+    if (woke >= end) server->stop();
+  }
+};
+
+RunResult run_once(uint16_t port, double seconds, uint64_t period_us, const ewss::RealtimePolicy& policy) {
+  RunResult result;
+  ewss::Server server(port);
+  server.set_poll_timeout_ms(100).set_realtime(policy);
+
+  Probe probe{&server, &result, {}};
+  probe.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (probe.tfd < 0) return result;
+  probe.period_ns = period_us * 1000;
+  probe.next = now_ns() + probe.period_ns;
+  probe.end = probe.next + static_cast<uint64_t>(seconds * 1e9);
+  struct itimerspec spec{};
+  spec.it_interval.tv_sec = static_cast<time_t>(probe.period_ns / 1000000000ull);
+  spec.it_interval.tv_nsec = static_cast<long>(probe.period_ns % 1000000000ull);
+  spec.it_value.tv_sec = static_cast<time_t>(probe.next / 1000000000ull);
+  spec.it_value.tv_nsec = static_cast<long>(probe.next % 1000000000ull);
+  timerfd_settime(probe.tfd, TFD_TIMER_ABSTIME, &spec, nullptr);
+
+  (void)server.add_poll_source(probe.tfd, POLLIN, [&probe](short) { probe.on_ready(); });
+  server.run();
+  ::close(probe.tfd);
+
+  probe.hist.copy_to(result.counts);
+  result.realtime_failures = server.stats().realtime_failures.load();
+  return result;
+}
+
+void print_result(const char* name, const RunResult& r) {
+  std::printf("%-9s wakeups=%llu missed=%llu p50=%llu us p99=%llu us p99.9=%llu us max=%.1f us", name,
+              static_cast<unsigned long long>(r.wakeups), static_cast<unsigned long long>(r.missed),
+              static_cast<unsigned long long>(ewss::LatencyHistogram::percentile(r.counts, 50)),
+              static_cast<unsigned long long>(ewss::LatencyHistogram::percentile(r.counts, 99)),
+              static_cast<unsigned long long>(ewss::LatencyHistogram::percentile(r.counts, 99.9)),
+              static_cast<double>(r.max_ns) / 1000.0);
+  if (r.realtime_failures > 0)
+    std::printf(" (%llu realtime settings refused)", static_cast<unsigned long long>(r.realtime_failures));
+  std::printf("\n");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  double seconds = argc > 1 ? std::stod(argv[1]) : 5.0;
+  uint64_t period_us = argc > 2 ? std::stoull(argv[2]) : 1000;
+  int priority = argc > 3 ? std::stoi(argv[3]) : 80;
+  int cpu = argc > 4 ? std::stoi(argv[4]) : 0;
+  unsigned load_threads = argc > 5 ? static_cast<unsigned>(std::stoul(argv[5])) : std::thread::hardware_concurrency();
+  uint16_t port = argc > 6 ? static_cast<uint16_t>(std::stoi(argv[6])) : 9098;
+  if (period_us == 0) period_us = 1;
+
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> load;
+  for (unsigned i = 0; i < load_threads; ++i) load.emplace_back([&stop]() { load_loop(stop); });
+
+  ewss::RealtimePolicy realtime;
+  realtime.priority = priority;
+  realtime.cpu = cpu;
+  realtime.timer_slack_ns = 1;
+
+  std::printf("period=%llu us, %.1f s per run, %u load threads, realtime priority=%d cpu=%d\n",
+              static_cast<unsigned long long>(period_us), seconds, load_threads, priority, cpu);
+  RunResult base = run_once(port, seconds, period_us, ewss::RealtimePolicy{});
+  RunResult rt = run_once(port, seconds, period_us, realtime);
+
+  stop = true;
+  for (auto& t : load) t.join();
+
+  print_result("default", base);
+  print_result("realtime", rt);
+  std::printf("\nwake-up lateness histogram (us, upper bound)\n%10s %12s %12s\n", "<=", "default", "realtime");
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < ewss::LatencyHistogram::kBuckets; ++i)
+    if (base.counts[i] + rt.counts[i] > 0) last = i;
+  for (uint32_t i = 0; i <= last; ++i) {
+    std::printf("%10llu %12llu %12llu\n", static_cast<unsigned long long>(ewss::LatencyHistogram::bucket_limit(i)),
+                static_cast<unsigned long long>(base.counts[i]), static_cast<unsigned long long>(rt.counts[i]));
+  }
+  return 0;
+}
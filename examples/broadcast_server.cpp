@@ -30,8 +30,10 @@ int main(int argc, char* argv[]) {
                             std::string_view msg) {
       std::lock_guard<std::mutex> lock(broadcast_mutex);
 
-      std::string broadcast_msg =
-          "Client #" + std::to_string(conn->get_id()) + ": " + std::string(msg);
+      // Formatted in the reactor's scratch arena: no heap allocation per message
+      std::string_view broadcast_msg = server.scratch().format(
+          "Client #%llu: %.*s", static_cast<unsigned long long>(conn->get_id()),
+          static_cast<int>(msg.size()), msg.data());
 
       // Broadcast to all clients
       for (auto& weak_conn : broadcast_list) {
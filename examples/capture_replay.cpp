@@ -0,0 +1,146 @@
+// EWSS capture replay
+// Re-drives the sessions in a TrafficCapture file against a server: one client
+// connection per captured connection id, frames sent in capture order at the
+// original pace scaled by `speed` (0 = as fast as possible). Server replies are
+// read and discarded so the replay never stalls on a full socket.
+//
+// Record with:  TrafficCapture cap; cap.open("load.cap"); server.set_capture(&cap);
+// Usage: ./capture_replay <file> [port] [speed] [host]
+
+#include "ewss.hpp"
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+namespace {
+
+int open_session(const char* host, uint16_t port) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  struct sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = inet_addr(host);
+  if (::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    ::close(fd);
+    return -1;
+  }
+  const char request[] =
+      "GET / HTTP/1.1\r\nHost: replay\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+      "Sec-WebSocket-Version: 13\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n\r\n";
+  char buf[1024];
+  size_t got = 0;
+  if (::send(fd, request, sizeof(request) - 1, MSG_NOSIGNAL) < 0) got = sizeof(buf);
+  while (got < sizeof(buf) - 1) {
+    ssize_t n = ::recv(fd, buf + got, sizeof(buf) - 1 - got, 0);
+    if (n <= 0) break;
+    got += static_cast<size_t>(n);
+    buf[got] = '\0';
+    if (std::strstr(buf, "\r\n\r\n") != nullptr) break;
+  }
+  if (got >= sizeof(buf) - 1 || std::strstr(buf, " 101 ") == nullptr) {
+    ::close(fd);
+    return -1;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+void discard_replies(int fd) {
+  char sink[16384];
+  while (::recv(fd, sink, sizeof(sink), 0) > 0) {
+  }
+}
+
+// Masked client frame with a fixed key, so a replay is byte-for-byte repeatable
+bool send_frame(int fd, const ewss::CapturedFrame& f, std::string& wire) {
+  static const uint8_t kMask[4] = {0x37, 0xFA, 0x21, 0x3D};
+  uint8_t header[14];
+  size_t n = ewss::ws::encode_frame_header(header, f.opcode(), f.payload.size(), true);
+  wire.assign(reinterpret_cast<const char*>(header), n);
+  wire.append(reinterpret_cast<const char*>(kMask), 4);
+  for (size_t i = 0; i < f.payload.size(); ++i) wire += static_cast<char>(f.payload[i] ^ kMask[i & 3]);
+
+  size_t sent = 0;
+  while (sent < wire.size()) {
+    ssize_t w = ::send(fd, wire.data() + sent, wire.size() - sent, MSG_NOSIGNAL);
+    if (w > 0) {
+      sent += static_cast<size_t>(w);
+    } else if (w < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      discard_replies(fd);
+      std::this_thread::yield();
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  if (argc < 2) {
+    std::cerr << "Usage: " << argv[0] << " <file> [port] [speed] [host]" << std::endl;
+    return 1;
+  }
+  uint16_t port = argc > 2 ? static_cast<uint16_t>(std::stoi(argv[2])) : 8080;
+  double speed = argc > 3 ? std::stod(argv[3]) : 1.0;
+  const char* host = argc > 4 ? argv[4] : "127.0.0.1";
+
+  ewss::CaptureReader reader;
+  if (!reader.open(argv[1]).has_value()) {
+    std::cerr << "Cannot read capture " << argv[1] << std::endl;
+    return 1;
+  }
+
+  std::unordered_map<uint64_t, int> sessions;  // Captured conn id -> replay socket
+  std::string wire;
+  uint64_t frames = 0, bytes = 0, failed = 0;
+  ewss::CapturedFrame f;
+  auto start = std::chrono::steady_clock::now();
+  uint64_t first_ts = 0;
+
+  while (reader.next(f)) {
+    if (first_ts == 0) first_ts = f.ts_ns;
+    if (speed > 0) {
+      auto due = start + std::chrono::nanoseconds(static_cast<int64_t>(static_cast<double>(f.ts_ns - first_ts) / speed));
+      std::this_thread::sleep_until(due);
+    }
+
+    auto it = sessions.find(f.conn_id);
+    if (it == sessions.end()) it = sessions.emplace(f.conn_id, open_session(host, port)).first;
+    if (it->second < 0 || !send_frame(it->second, f, wire)) {
+      ++failed;
+      continue;
+    }
+    ++frames;
+    bytes += f.payload.size();
+    discard_replies(it->second);
+    if (f.opcode() == ewss::ws::OpCode::kClose) {
+      ::close(it->second);
+      it->second = -1;
+    }
+  }
+  for (auto& s : sessions) {
+    if (s.second >= 0) ::close(s.second);
+  }
+
+  double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "Replayed " << frames << " frames (" << bytes << " payload bytes) over " << sessions.size()
+            << " sessions in " << secs << " s";
+  if (secs > 0) std::cout << " = " << static_cast<uint64_t>(static_cast<double>(frames) / secs) << " frames/s";
+  std::cout << (failed > 0 ? ", " + std::to_string(failed) + " failed" : "") << std::endl;
+  return failed > 0 ? 2 : 0;
+}
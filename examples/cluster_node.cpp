@@ -0,0 +1,49 @@
+#include "ewss.hpp"
+#include <iostream>
+#include <string>
+
+// One node of a relayed pub/sub cluster. Run several locally, e.g.:
+//   ./cluster_node 8080 1 unix:/tmp/node1.sock
+//   ./cluster_node 8081 2 unix:/tmp/node2.sock unix:/tmp/node1.sock
+// Clients send "sub:<topic>" to subscribe; any other text is published to "chat"
+// and reaches "chat" subscribers on every node.
+int main(int argc, char* argv[]) {
+  if (argc < 3) {
+    std::cerr << "Usage: " << argv[0] << " <ws-port> <node-id> [listen-addr] [peer-addr...]" << std::endl;
+    return 1;
+  }
+
+  try {
+    ewss::Server server(static_cast<uint16_t>(std::stoi(argv[1])));
+    ewss::PubSub hub;
+    hub.add_reactor(server);
+
+    ewss::RelayConfig cfg;
+    cfg.node_id = static_cast<uint32_t>(std::stoul(argv[2]));
+    if (argc > 3) cfg.listen = argv[3];
+    for (int i = 4; i < argc; ++i) cfg.peers.emplace_back(argv[i]);
+    ewss::ClusterRelay relay(hub, cfg);
+
+    server.on_message = [&server, &relay](const std::shared_ptr<ewss::Connection>& conn,
+                                          std::string_view msg) {
+      if (msg.substr(0, 4) == "sub:") {
+        server.subscribe(*conn, msg.substr(4));
+        conn->send("subscribed");
+        return;
+      }
+      relay.publish("chat", msg);
+    };
+
+    if (!relay.start().has_value()) {
+      std::cerr << "Relay failed to listen on " << cfg.listen << std::endl;
+      return 1;
+    }
+    server.run();
+
+  } catch (const std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,75 @@
+/**
+ * EWSS shared-memory IPC bridge example
+ *
+ * The parent process runs the WebSocket reactor; a forked child plays the
+ * application process. Messages travel through SPSC rings in a memfd and
+ * eventfd wakeups instead of a loopback TCP hop:
+ *
+ *   client --ws--> ewss reactor --ring--> app process
+ *   client <--ws-- ewss reactor <--ring-- app process (send command)
+ *
+ * Unrelated processes can exchange the channel fds over a Unix socket with
+ * IpcChannel::send_fds() / IpcChannel::attach_from().
+ *
+ * Usage:
+ *   ./ipc_bridge [port]
+ */
+
+#include "ewss.hpp"
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <sys/wait.h>
+
+static int run_app(int memfd, int to_app_fd, int to_server_fd) {
+  ewss::IpcChannel ch;
+  if (!ch.attach(memfd, to_app_fd, to_server_fd).has_value()) {
+    std::fprintf(stderr, "app: attach failed\n");
+    return 1;
+  }
+  std::printf("app: attached (pid %d)\n", static_cast<int>(::getpid()));
+  for (;;) {
+    ch.wait(1000);
+    ch.drain([&](const ewss::IpcChannel::Message& m) {
+      switch (m.kind) {
+        case ewss::IpcChannel::Kind::kOpen:
+          std::printf("app: connection %llu opened\n", static_cast<unsigned long long>(m.conn_id));
+          break;
+        case ewss::IpcChannel::Kind::kText:
+        case ewss::IpcChannel::Kind::kBinary:
+          ch.send(m.kind, m.conn_id, m.payload);  // echo
+          break;
+        case ewss::IpcChannel::Kind::kClose:
+          std::printf("app: connection %llu closed\n", static_cast<unsigned long long>(m.conn_id));
+          break;
+      }
+    });
+  }
+}
+
+int main(int argc, char* argv[]) {
+  uint16_t port = argc > 1 ? static_cast<uint16_t>(std::atoi(argv[1])) : 8080;
+
+  ewss::IpcChannel channel;
+  if (!channel.create().has_value()) {
+    std::fprintf(stderr, "Failed to create IPC channel\n");
+    return 1;
+  }
+
+  pid_t child = ::fork();
+  if (child == 0)
+    return run_app(::dup(channel.memfd()), ::dup(channel.to_app_fd()), ::dup(channel.to_server_fd()));
+  if (child < 0) return 1;
+
+  try {
+    ewss::Server server(port);
+    server.set_ipc_channel(&channel);
+    server.run();
+  } catch (const std::exception& e) {
+    std::fprintf(stderr, "Error: %s\n", e.what());
+  }
+  ::kill(child, SIGTERM);
+  ::waitpid(child, nullptr, 0);
+  return 0;
+}
@@ -0,0 +1,72 @@
+/**
+ * EWSS stats reader - samples a server's shared-memory stats segment
+ *
+ * The server side only needs:
+ *   server.set_stats_shm("ewss_stats", 100);
+ *
+ * Usage:
+ *   ./stats_reader [name] [interval_ms] [count]
+ *   ./stats_reader ewss_stats 1000        # print every second until Ctrl-C
+ *
+ * Reading never touches the server's sockets or reactor thread; each sample
+ * is a seqlock-validated memcpy from the mapped segment.
+ */
+
+#include "ewss.hpp"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+int main(int argc, char* argv[]) {
+  std::string name = argc > 1 ? argv[1] : "ewss_stats";
+  int interval_ms = argc > 2 ? std::atoi(argv[2]) : 1000;
+  long count = argc > 3 ? std::atol(argv[3]) : -1;
+
+  ewss::StatsSegment segment;
+  auto res = segment.open(name);
+  if (!res.has_value()) {
+    std::fprintf(stderr, "Cannot open stats segment '%s' (error %d)\n", name.c_str(),
+                 static_cast<int>(res.get_error()));
+    return 1;
+  }
+  std::printf("Attached to '%s' (writer pid %u)\n", name.c_str(), segment.writer_pid());
+
+  ewss::StatsSnapshot prev{};
+  bool have_prev = false;
+  for (long i = 0; count < 0 || i < count; ++i) {
+    ewss::StatsSnapshot snap;
+    uint64_t publishes = 0;
+    if (!segment.read(snap, &publishes)) {
+      std::fprintf(stderr, "Segment busy, skipping sample\n");
+    } else {
+      uint64_t busy = snap.loop_busy_us - (have_prev ? prev.loop_busy_us : 0);
+      uint64_t idle = snap.loop_poll_us - (have_prev ? prev.loop_poll_us : 0);
+      double util = (busy + idle) == 0 ? 0.0 : 100.0 * busy / static_cast<double>(busy + idle);
+      std::printf(
+          "#%llu conns=%llu/%llu rejected=%llu hs_err=%llu sock_err=%llu "
+          "util=%.1f%% stalls=%llu cb_max=%lluus cb_p99<=%lluus iter_p99<=%lluus "
+          "rtt_p99<=%lluus retrans=%llu\n",
+          static_cast<unsigned long long>(publishes),
+          static_cast<unsigned long long>(snap.active_connections),
+          static_cast<unsigned long long>(snap.total_connections),
+          static_cast<unsigned long long>(snap.rejected_connections),
+          static_cast<unsigned long long>(snap.handshake_errors),
+          static_cast<unsigned long long>(snap.socket_errors), util,
+          static_cast<unsigned long long>(snap.stalled_iterations),
+          static_cast<unsigned long long>(snap.max_callback_us),
+          static_cast<unsigned long long>(
+              ewss::LatencyHistogram::percentile(snap.callback_latency_us, 99.0)),
+          static_cast<unsigned long long>(
+              ewss::LatencyHistogram::percentile(snap.iteration_latency_us, 99.0)),
+          static_cast<unsigned long long>(ewss::LatencyHistogram::percentile(snap.tcp_rtt_us, 99.0)),
+          static_cast<unsigned long long>(snap.tcp_retransmits));
+      std::fflush(stdout);
+      prev = snap;
+      have_prev = true;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+  }
+  return 0;
+}
@@ -66,8 +66,24 @@
 #define EWSS_ASSERT(cond) ((void)(cond))
 #endif
 
+// Coroutine API (C++20 only; define EWSS_NO_COROUTINES to opt out)
+#if !defined(EWSS_NO_COROUTINES) && defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#define EWSS_HAS_COROUTINES 1
+#else
+#define EWSS_HAS_COROUTINES 0
+#endif
+
+// permessage-deflate (RFC 7692): define EWSS_WITH_ZLIB and link zlib to enable
+#if defined(EWSS_WITH_ZLIB) && __has_include(<zlib.h>)
+#define EWSS_HAS_DEFLATE 1
+#else
+#define EWSS_HAS_DEFLATE 0
+#endif
+
 #include <cerrno>
+#include <cstdarg>
 #include <cstddef>
+#include <cmath>
 #include <cstdint>
 #include <cstring>
 
@@ -77,24 +93,55 @@
 #include <chrono>
 #include <functional>
 #include <iostream>
+#include <map>
 #include <memory>
+#include <memory_resource>
 #include <new>
+#include <random>
 #include <string>
 #include <string_view>
+#include <thread>
 #include <type_traits>
 #include <utility>
 #include <vector>
+#if EWSS_HAS_COROUTINES
+#include <coroutine>
+#include <exception>
+#endif
 
 #include <arpa/inet.h>
 #include <fcntl.h>
+#include <linux/filter.h>
+#include <linux/sockios.h>
+#include <netdb.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 #include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <sockpp/tcp.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/sendfile.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/uio.h>
+#include <sys/un.h>
 #include <unistd.h>
 
+#if EWSS_HAS_DEFLATE
+#include <zlib.h>
+#endif
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 namespace ewss {
 
 static constexpr size_t kCacheLine = 64;
@@ -114,6 +161,7 @@ enum class ErrorCode : uint8_t {
   kSocketError = 7,
   kTimeout = 8,
   kMaxConnectionsExceeded = 9,
+  kResourceUnavailable = 10,
   kInternalError = 255
 };
 
@@ -477,24 +525,47 @@ class ScopeGuard final {
 
 class Base64 {
  public:
+  static constexpr size_t encoded_size(size_t size) { return (size + 2) / 3 * 4; }
+
   static inline std::string encode(const uint8_t* data, size_t size) {
+    std::string result(encoded_size(size), '\0');
+    encode(data, size, result.data());
+    return result;
+  }
+
+  // Into out (encoded_size(size) bytes, not terminated); returns the length
+  static inline size_t encode(const uint8_t* data, size_t size, char* out) {
     static constexpr const char kAlphabet[] =
         "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
-    std::string result;
-    result.reserve((size + 2) / 3 * 4);
+    size_t pos = 0;
     for (size_t i = 0; i < size; i += 3) {
       uint32_t b = (static_cast<uint32_t>(data[i]) << 16);
       if (i + 1 < size) b |= (static_cast<uint32_t>(data[i + 1]) << 8);
       if (i + 2 < size) b |= static_cast<uint32_t>(data[i + 2]);
-      result.push_back(kAlphabet[(b >> 18) & 0x3F]);
-      result.push_back(kAlphabet[(b >> 12) & 0x3F]);
-      result.push_back(i + 1 < size ? kAlphabet[(b >> 6) & 0x3F] : '=');
-      result.push_back(i + 2 < size ? kAlphabet[b & 0x3F] : '=');
+      out[pos++] = kAlphabet[(b >> 18) & 0x3F];
+      out[pos++] = kAlphabet[(b >> 12) & 0x3F];
+      out[pos++] = i + 1 < size ? kAlphabet[(b >> 6) & 0x3F] : '=';
+      out[pos++] = i + 2 < size ? kAlphabet[b & 0x3F] : '=';
     }
-    return result;
+    return pos;
   }
 
   static inline std::vector<uint8_t> decode(std::string_view encoded) {
+    std::vector<uint8_t> result;
+    decode_into(encoded, result);
+    return result;
+  }
+
+  // Result allocated from mr
+  static inline std::pmr::vector<uint8_t> decode(std::string_view encoded, std::pmr::memory_resource* mr) {
+    std::pmr::vector<uint8_t> result(mr);
+    decode_into(encoded, result);
+    return result;
+  }
+
+ private:
+  template <typename Vec>
+  static void decode_into(std::string_view encoded, Vec& result) {
     static constexpr uint8_t kTable[256] = {
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
@@ -513,8 +584,7 @@ class Base64 {
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
         64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64, 64,
     };
-    std::vector<uint8_t> result;
-    if (encoded.size() % 4 != 0) return result;
+    if (encoded.size() % 4 != 0) return;
     result.reserve(encoded.size() / 4 * 3);
     for (size_t i = 0; i < encoded.size(); i += 4) {
       uint32_t b =
@@ -535,7 +605,6 @@ class Base64 {
         result.push_back((b >> 16) & 0xFF);
       }
     }
-    return result;
   }
 };
 
@@ -636,6 +705,7 @@ enum class OpCode : uint8_t {
 
 struct FrameHeader {
   bool fin;
+  bool rsv1;  // permessage-deflate: compressed message
   OpCode opcode;
   bool masked;
   uint64_t payload_len;
@@ -644,6 +714,7 @@ struct FrameHeader {
 inline size_t parse_frame_header(std::string_view data, FrameHeader& header) {
   if (data.size() < 2) return 0;
   header.fin = (data[0] & 0x80) != 0;
+  header.rsv1 = (data[0] & 0x40) != 0;
   header.opcode = static_cast<OpCode>(data[0] & 0x0F);
   header.masked = (data[1] & 0x80) != 0;
   uint64_t len = data[1] & 0x7F;
@@ -704,8 +775,306 @@ inline size_t encode_frame_header(uint8_t* buf, OpCode opcode, size_t payload_le
   return pos;
 }
 
+// encode_frame() with the buffer allocated from mr
+inline std::pmr::vector<uint8_t> encode_frame(OpCode opcode, std::string_view payload, bool mask,
+                                              std::pmr::memory_resource* mr) {
+  uint8_t header[10];
+  size_t n = encode_frame_header(header, opcode, payload.size(), mask);
+  std::pmr::vector<uint8_t> frame(mr);
+  frame.reserve(n + payload.size());
+  frame.insert(frame.end(), header, header + n);
+  frame.insert(frame.end(), payload.begin(), payload.end());
+  return frame;
+}
+
+// XOR src with the 4-byte masking key into dst (dst may equal src).
+// phase is the payload offset of src[0], for continuing a split payload.
+inline void unmask_copy(uint8_t* dst, const uint8_t* src, size_t len, const uint8_t* mask_key,
+                        size_t phase = 0) {
+  uint8_t m[4];
+  for (size_t k = 0; k < 4; ++k) m[k] = mask_key[(phase + k) & 3];
+  uint32_t m32;
+  std::memcpy(&m32, m, sizeof(m32));
+  size_t i = 0;
+#if defined(__SSE2__)
+  const __m128i vm = _mm_set1_epi32(static_cast<int>(m32));
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_xor_si128(v, vm));
+  }
+#elif defined(__ARM_NEON)
+  const uint8x16_t vm = vreinterpretq_u8_u32(vdupq_n_u32(m32));
+  for (; i + 16 <= len; i += 16) vst1q_u8(dst + i, veorq_u8(vld1q_u8(src + i), vm));
+#endif
+  const uint64_t m64 = (static_cast<uint64_t>(m32) << 32) | m32;
+  for (; i + 8 <= len; i += 8) {
+    uint64_t v;
+    std::memcpy(&v, src + i, sizeof(v));
+    v ^= m64;
+    std::memcpy(dst + i, &v, sizeof(v));
+  }
+  for (; i < len; ++i) dst[i] = src[i] ^ m[i & 3];
+}
+
+// Parsed HTTP upgrade request; views point into the request buffer
+struct UpgradeRequest {
+  std::string_view path;  // Request target without query string
+  std::string_view query;  // After '?' (empty if none)
+  std::string_view key;   // Sec-WebSocket-Key value
+  std::string_view protocols;  // Sec-WebSocket-Protocol value (comma-separated offers)
+  std::string_view extensions;  // Sec-WebSocket-Extensions value
+  size_t size = 0;        // Bytes through the terminating blank line
+};
+
+// True if the comma-separated offer list contains protocol
+inline bool offers_protocol(std::string_view offers, std::string_view protocol) {
+  while (!offers.empty()) {
+    size_t comma = offers.find(',');
+    std::string_view item = offers.substr(0, comma);
+    while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+    while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+    if (item == protocol) return true;
+    if (comma == std::string_view::npos) break;
+    offers.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// Value of the first header spelled name or lower_name (empty if absent)
+inline std::string_view header_value(std::string_view data, std::string_view name, std::string_view lower_name) {
+  size_t pos = data.find(name);
+  if (pos == std::string_view::npos) pos = data.find(lower_name);
+  if (pos == std::string_view::npos) return {};
+  size_t start = pos + name.size();
+  return data.substr(start, data.find("\r\n", start) - start);
+}
+
+// Value of name in an '&'-separated query string (empty if absent; not percent-decoded)
+inline std::string_view query_param(std::string_view query, std::string_view name) {
+  while (!query.empty()) {
+    size_t amp = query.find('&');
+    std::string_view item = query.substr(0, amp);
+    if (item.size() > name.size() && item.substr(0, name.size()) == name && item[name.size()] == '=')
+      return item.substr(name.size() + 1);
+    if (amp == std::string_view::npos) break;
+    query.remove_prefix(amp + 1);
+  }
+  return {};
+}
+
+// Decimal digits only, no sign; false if empty, malformed or past uint64_t
+inline bool parse_u64(std::string_view text, uint64_t& out) {
+  if (text.empty()) return false;
+  uint64_t value = 0;
+  for (char c : text) {
+    if (c < '0' || c > '9') return false;
+    uint64_t digit = static_cast<uint64_t>(c - '0');
+    if (value > (UINT64_MAX - digit) / 10) return false;
+    value = value * 10 + digit;
+  }
+  out = value;
+  return true;
+}
+
+// data must hold the complete request header; false if it is not a usable upgrade
+inline bool parse_upgrade_request(std::string_view data, UpgradeRequest& out) {
+  size_t end_pos = data.find("\r\n\r\n");
+  if (end_pos == std::string_view::npos || data.substr(0, 4) != "GET ") return false;
+  out.size = end_pos + 4;
+
+  // Request target up to the first space, without query string
+  std::string_view target = data.substr(4, data.find(' ', 4) - 4);
+  size_t question = target.find('?');
+  out.path = target.substr(0, question);
+  out.query = question == std::string_view::npos ? std::string_view{} : target.substr(question + 1);
+
+  constexpr std::string_view kKeyHeader = "Sec-WebSocket-Key: ";
+  size_t key_pos = data.find(kKeyHeader);
+  if (key_pos == std::string_view::npos) key_pos = data.find("sec-websocket-key: ");
+  if (key_pos == std::string_view::npos) return false;
+
+  size_t value_start = key_pos + kKeyHeader.size();
+  size_t value_end = data.find("\r\n", value_start);
+  if (value_end == std::string_view::npos) return false;
+
+  std::string_view key = data.substr(value_start, value_end - value_start);
+  while (!key.empty() && (key.back() == ' ' || key.back() == '\t')) key.remove_suffix(1);
+  out.key = key;
+
+  out.protocols = header_value(data, "Sec-WebSocket-Protocol: ", "sec-websocket-protocol: ");
+  out.extensions = header_value(data, "Sec-WebSocket-Extensions: ", "sec-websocket-extensions: ");
+  return !key.empty();
+}
+
+// Request head without an Upgrade header (health probes, static files). Returns
+// false while the head is incomplete or when it asks for an upgrade
+struct PlainRequest {
+  std::string_view method;
+  std::string_view path;
+  bool keep_alive = false;
+  size_t size = 0;  // Bytes of head including the final CRLFCRLF
+};
+
+inline bool parse_plain_request(std::string_view data, PlainRequest& out) {
+  size_t end_pos = data.find("\r\n\r\n");
+  if (end_pos == std::string_view::npos) return false;
+  std::string_view head = data.substr(0, end_pos + 2);
+  if (!header_value(head, "Upgrade: ", "upgrade: ").empty()) return false;
+
+  std::string_view line = head.substr(0, head.find("\r\n"));
+  size_t sp1 = line.find(' ');
+  size_t sp2 = line.rfind(' ');
+  if (sp1 == std::string_view::npos || sp2 <= sp1) return false;
+  out.method = line.substr(0, sp1);
+  std::string_view target = line.substr(sp1 + 1, sp2 - sp1 - 1);
+  out.path = target.substr(0, target.find('?'));
+
+  // HTTP/1.1 keeps the connection unless told otherwise; 1.0 only when asked
+  std::string_view conn = header_value(head, "Connection: ", "connection: ");
+  if (line.substr(sp2 + 1) == "HTTP/1.1")
+    out.keep_alive = conn != "close" && conn != "Close";
+  else
+    out.keep_alive = conn == "keep-alive" || conn == "Keep-Alive";
+  out.size = end_pos + 4;
+  return true;
+}
+
+constexpr size_t kAcceptKeySize = Base64::encoded_size(20);
+
+// Sec-WebSocket-Accept into out; keys up to 64 bytes (RFC 6455 keys are 24) stay on the stack
+inline void accept_key(std::string_view client_key, char (&out)[kAcceptKeySize]) {
+  constexpr std::string_view kMagic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  char buf[64 + kMagic.size()];
+  std::string heap;
+  const char* key = buf;
+  size_t len = client_key.size() + kMagic.size();
+  if (client_key.size() <= 64) {
+    std::memcpy(buf, client_key.data(), client_key.size());
+    std::memcpy(buf + client_key.size(), kMagic.data(), kMagic.size());
+  } else {
+    heap.assign(client_key.data(), client_key.size()).append(kMagic);
+    key = heap.data();
+  }
+  auto hash = SHA1::compute(reinterpret_cast<const uint8_t*>(key), len);
+  Base64::encode(hash.data(), hash.size(), out);
+}
+
+inline std::string accept_key(std::string_view client_key) {
+  char out[kAcceptKeySize];
+  accept_key(client_key, out);
+  return std::string(out, sizeof(out));
+}
+
+// 101 response for client_key, selecting protocol and accepting extensions when
+// non-empty; extra is inserted verbatim (whole "Name: value\r\n" lines). Returns its
+// length, 0 if it does not fit
+inline size_t write_upgrade_response(std::string_view client_key, char* out, size_t cap,
+                                     std::string_view protocol = {}, std::string_view extensions = {},
+                                     std::string_view extra = {}) {
+  char accept[kAcceptKeySize];
+  accept_key(client_key, accept);
+  // An empty string_view may have a null data(): "%.*s" must still get a valid pointer
+  int n = snprintf(out, cap,
+      "HTTP/1.1 101 Switching Protocols\r\n"
+      "Upgrade: websocket\r\n"
+      "Connection: Upgrade\r\n"
+      "Sec-WebSocket-Accept: %.*s\r\n"
+      "%s%.*s%s"
+      "%s%.*s%s"
+      "%.*s"
+      "\r\n",
+      static_cast<int>(sizeof(accept)), accept, protocol.empty() ? "" : "Sec-WebSocket-Protocol: ",
+      static_cast<int>(protocol.size()), protocol.empty() ? "" : protocol.data(), protocol.empty() ? "" : "\r\n",
+      extensions.empty() ? "" : "Sec-WebSocket-Extensions: ",
+      static_cast<int>(extensions.size()), extensions.empty() ? "" : extensions.data(), extensions.empty() ? "" : "\r\n",
+      static_cast<int>(extra.size()), extra.empty() ? "" : extra.data());
+  return n <= 0 || static_cast<size_t>(n) >= cap ? 0 : static_cast<size_t>(n);
+}
+
+// Protocol selected by a 101 response (empty if none)
+inline std::string_view response_protocol(std::string_view response) {
+  constexpr std::string_view kHeader = "Sec-WebSocket-Protocol: ";
+  size_t pos = response.find(kHeader);
+  if (pos == std::string_view::npos) return {};
+  size_t start = pos + kHeader.size();
+  return response.substr(start, response.find("\r\n", start) - start);
+}
+
 }  // namespace ws
 
+// ============================================================================
+// Message batching - many small application messages per WebSocket frame
+// ============================================================================
+//
+// Negotiated with the "ewss.batch" subprotocol. Every binary frame then carries a
+// sequence of records, each a LEB128 varint of (length << 1 | is_binary) followed by
+// the message bytes; text frames still carry a single plain message. A 20-byte
+// update costs one byte of framing instead of a frame header, mask and callback.
+
+namespace batch {
+
+constexpr std::string_view kProtocol = "ewss.batch";
+constexpr size_t kMaxRecordHeader = 10;
+
+inline size_t encode_record_header(uint8_t* out, size_t len, bool binary) {
+  uint64_t v = (static_cast<uint64_t>(len) << 1) | (binary ? 1u : 0u);
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = static_cast<uint8_t>(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = static_cast<uint8_t>(v);
+  return n;
+}
+
+// Next record at the front of data; returns bytes consumed, 0 if truncated or malformed
+inline size_t parse_record(std::string_view data, std::string_view& msg, bool& binary) {
+  uint64_t v = 0;
+  size_t n = 0;
+  for (unsigned shift = 0;; shift += 7) {
+    if (n == data.size() || n == kMaxRecordHeader) return 0;
+    uint8_t b = static_cast<uint8_t>(data[n++]);
+    v |= static_cast<uint64_t>(b & 0x7F) << shift;
+    if ((b & 0x80) == 0) break;
+  }
+  uint64_t len = v >> 1;
+  if (len > data.size() - n) return 0;
+  binary = (v & 1) != 0;
+  msg = data.substr(n, static_cast<size_t>(len));
+  return n + static_cast<size_t>(len);
+}
+
+// Encode messages into one batch payload (for clients and tests)
+inline void append_record(std::string& out, std::string_view msg, bool binary) {
+  uint8_t hdr[kMaxRecordHeader];
+  out.append(reinterpret_cast<const char*>(hdr), encode_record_header(hdr, msg.size(), binary));
+  out.append(msg.data(), msg.size());
+}
+
+}  // namespace batch
+
+// Server-wide egress limit: a token bucket of rate_bytes_per_sec (up to burst_bytes)
+// spent in deficit-round-robin order, each visit adding quantum_bytes * weight
+struct EgressPolicy {
+  uint64_t rate_bytes_per_sec = 0;
+  uint32_t burst_bytes = 65536;
+  uint32_t quantum_bytes = 1500;
+};
+
+// TCP_INFO sampling: every interval_ms the reactor reads the kernel's view of the next
+// `batch` open connections in rotation, so a full sweep takes ceil(n / batch) intervals
+struct TcpInfoPolicy {
+  uint32_t interval_ms = 0;  // 0: off
+  uint32_t batch = 8;
+};
+
+// Outgoing batch window: a batch frame is sent once it reaches max_bytes or delay_us
+// after its first message, whichever comes first
+struct BatchPolicy {
+  uint32_t delay_us = 1000;
+  uint32_t max_bytes = 1200;
+};
+
 // ============================================================================
 // ObjectPool - O(1) acquire/release, zero heap allocation at runtime
 // ============================================================================
@@ -754,967 +1123,6922 @@ class alignas(kCacheLine) ObjectPool {
 };
 
 // ============================================================================
-// ServerStats - Atomic performance counters
+// AccountedResource - Counting std::pmr upstream for a Server's allocations
 // ============================================================================
+//
+// Connections, their receive rings, deflate/RPC/bridge state, resumption
+// sessions, the topic index, broadcast frames, the shared read buffer and the
+// scratch arena block are allocated from the Server's resource
+// (Server::set_memory_resource); the counters are mirrored into ServerStats.
+// Not included: frames published through PubSub/ClusterRelay (encoded on the
+// publisher's thread), the per-thread compress-once deflate context, and
+// std::function callbacks. The resource must outlive every connection allocated
+// from it, and its upstream must be thread-safe when reactors share it (objects
+// are freed wherever their last reference drops).
+
+class AccountedResource final : public std::pmr::memory_resource {
+ public:
+  explicit AccountedResource(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource())
+      : upstream_(upstream) {}
+  AccountedResource(const AccountedResource&) = delete;
+  AccountedResource& operator=(const AccountedResource&) = delete;
+
+  std::pmr::memory_resource* upstream() const { return upstream_; }
+  size_t bytes_in_use() const { return in_use_.load(std::memory_order_relaxed); }
+  size_t peak_bytes() const { return peak_.load(std::memory_order_relaxed); }
+  uint64_t allocations() const { return allocations_.load(std::memory_order_relaxed); }
+
+  // Servers without set_memory_resource() account here (process-wide, global heap)
+  static AccountedResource& process_default() {
+    static AccountedResource resource;
+    return resource;
+  }
 
-struct alignas(kCacheLine) ServerStats {
-  std::atomic<uint64_t> total_messages_in{0};
-  std::atomic<uint64_t> total_messages_out{0};
-  std::atomic<uint64_t> total_bytes_in{0};
-  std::atomic<uint64_t> total_bytes_out{0};
-  std::atomic<uint64_t> total_connections{0};
-  std::atomic<uint64_t> active_connections{0};
-  std::atomic<uint64_t> rejected_connections{0};
-  std::atomic<uint64_t> handshake_errors{0};
-  std::atomic<uint64_t> socket_errors{0};
-  std::atomic<uint64_t> buffer_overflows{0};
-  std::atomic<uint64_t> last_poll_latency_us{0};
-  std::atomic<uint64_t> max_poll_latency_us{0};
-  std::atomic<uint64_t> pool_acquires{0};
-  std::atomic<uint64_t> pool_releases{0};
-  std::atomic<uint64_t> pool_exhausted{0};
+ private:
+  std::pmr::memory_resource* upstream_;
+  std::atomic<size_t> in_use_{0};
+  std::atomic<size_t> peak_{0};
+  std::atomic<uint64_t> allocations_{0};
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    void* p = upstream_->allocate(bytes, alignment);
+    size_t now = in_use_.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    size_t peak = peak_.load(std::memory_order_relaxed);
+    while (now > peak && !peak_.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {
+    }
+    allocations_.fetch_add(1, std::memory_order_relaxed);
+    return p;
+  }
 
-  void reset() {
-    total_messages_in = 0; total_messages_out = 0;
-    total_bytes_in = 0; total_bytes_out = 0;
-    total_connections = 0; active_connections = 0; rejected_connections = 0;
-    handshake_errors = 0; socket_errors = 0; buffer_overflows = 0;
-    last_poll_latency_us = 0; max_poll_latency_us = 0;
-    pool_acquires = 0; pool_releases = 0; pool_exhausted = 0;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    upstream_->deallocate(p, bytes, alignment);
+    in_use_.fetch_sub(bytes, std::memory_order_relaxed);
   }
 
-  bool is_overloaded(size_t pool_capacity) const {
-    uint64_t active = active_connections.load(std::memory_order_relaxed);
-    return active > (pool_capacity * 9 / 10);
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
+
+// unique_ptr deleter for objects placed in a memory_resource by pmr_new()/pmr_bytes()
+struct PmrDelete {
+  std::pmr::memory_resource* resource = nullptr;
+  size_t bytes = 0;
+  size_t alignment = 1;
+
+  template <typename T>
+  void operator()(T* p) const {
+    p->~T();
+    resource->deallocate(p, bytes, alignment);
   }
 };
 
+template <typename T>
+using PmrPtr = std::unique_ptr<T, PmrDelete>;
+
+template <typename T, typename... Args>
+PmrPtr<T> pmr_new(std::pmr::memory_resource* resource, Args&&... args) {
+  void* p = resource->allocate(sizeof(T), alignof(T));
+  return PmrPtr<T>(new (p) T(std::forward<Args>(args)...), PmrDelete{resource, sizeof(T), alignof(T)});
+}
+
+// Uninitialized byte buffer, cache-line aligned
+inline PmrPtr<uint8_t> pmr_bytes(std::pmr::memory_resource* resource, size_t n) {
+  if (n == 0) return PmrPtr<uint8_t>(nullptr, PmrDelete{resource, 0, kCacheLine});
+  return PmrPtr<uint8_t>(static_cast<uint8_t*>(resource->allocate(n, kCacheLine)), PmrDelete{resource, n, kCacheLine});
+}
+
 // ============================================================================
-// RingBuffer - Fixed-size circular buffer with zero-copy iovec I/O
+// Static memory - Upfront reservation, pre-faulting and a heap guard
 // ============================================================================
-
-template <typename T, size_t Size>
-class alignas(kCacheLine) RingBuffer {
+//
+// Server::reserve_static_memory() (automatic at construction with
+// EWSS_STATIC_MEMORY) carves one pre-faulted, optionally locked region into
+// fixed slabs: a connection, a receive ring, an RpcSession and a BridgeLink per
+// slot, the shared read buffer and the scratch block. Once run() starts serving,
+// the reactor thread arms AllocationGuard: a heap allocation there, or a slab
+// running dry, is fatal in debug builds and counted in stats otherwise. The guard
+// sees operator new only when one translation unit defines
+// EWSS_ALLOCATION_GUARD_IMPL before including this header (it then replaces the
+// global allocation functions). Variable-size state has no slab: permessage-deflate
+// is not negotiated in this mode, and resumption sessions, topic subscriptions and
+// broadcast frames overflow the pool when used.
+
+class AllocationGuard {
  public:
-  static constexpr size_t kCapacity = Size;
-  RingBuffer() = default;
-
-  bool push(const T* data, size_t len) {
-    if (available() < len) return false;
-    for (size_t i = 0; i < len; ++i) {
-      buffer_[write_idx_] = data[i];
-      write_idx_ = (write_idx_ + 1) % kCapacity;
-    }
-    count_ += len;
-    return true;
+  // Set on a static-memory reactor thread while it serves
+  static bool& armed() {
+    static thread_local bool on = false;
+    return on;
+  }
+  // Heap allocations seen while armed on this thread
+  static uint64_t& count() {
+    static thread_local uint64_t n = 0;
+    return n;
+  }
+  // Abort on a violation (default: debug builds)
+  static bool& fatal() {
+#ifdef NDEBUG
+    static bool on = false;
+#else
+    static bool on = true;
+#endif
+    return on;
   }
 
-  size_t peek(T* data, size_t max_len) const {
-    size_t len = std::min(max_len, count_);
-    size_t idx = read_idx_;
-    for (size_t i = 0; i < len; ++i) {
-      data[i] = buffer_[idx];
-      idx = (idx + 1) % kCapacity;
-    }
-    return len;
+  static void violation(const char* what, size_t bytes) {
+    ++count();
+    if (!fatal()) return;
+    armed() = false;
+    std::fprintf(stderr, "ewss: %s of %zu bytes after startup on a static-memory reactor\n", what, bytes);
+    std::abort();
   }
 
-  void advance(size_t len) {
-    if (len > count_) len = count_;
-    read_idx_ = (read_idx_ + len) % kCapacity;
-    count_ -= len;
+  static void on_allocation(size_t bytes) {
+    if (armed()) violation("heap allocation", bytes);
   }
 
-  size_t size() const { return count_; }
-  size_t available() const { return kCapacity - count_; }
-  bool empty() const { return count_ == 0; }
+  // Sanctioned allocation on an armed thread (setup done from a callback, logging)
+  class Pause {
+   public:
+    Pause() : prev_(armed()) { armed() = false; }
+    ~Pause() { armed() = prev_; }
+    Pause(const Pause&) = delete;
+    Pause& operator=(const Pause&) = delete;
+
+   private:
+    bool prev_;
+  };
+};
 
-  void clear() { read_idx_ = 0; write_idx_ = 0; count_ = 0; }
+// Fixed-size block slabs in one mmap'd region. A request takes a block from the
+// smallest class that fits; with every fitting class empty it falls back to the
+// heap (an AllocationGuard violation). Thread-safe: connections may be released
+// off the reactor that allocated them.
+class StaticPool final : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t kMaxClasses = 6;
 
-  std::string_view view() const {
-    if (empty()) return {};
-    return std::string_view(reinterpret_cast<const char*>(buffer_.data() + read_idx_), count_);
-  }
+  struct Class {
+    size_t block_size;
+    uint32_t blocks;
+  };
 
-  // Fill iovec for writev (zero-copy send from read side)
-  size_t fill_iovec(struct iovec* iov, size_t max_iov) const {
-    if (empty() || max_iov == 0) return 0;
-    size_t contiguous = kCapacity - read_idx_;
-    if (contiguous >= count_) {
-      iov[0].iov_base = const_cast<T*>(buffer_.data() + read_idx_);
-      iov[0].iov_len = count_;
-      return 1;
+  StaticPool() = default;
+  ~StaticPool() override {
+    if (region_ != nullptr) ::munmap(region_, region_size_);
+  }
+  StaticPool(const StaticPool&) = delete;
+  StaticPool& operator=(const StaticPool&) = delete;
+
+  // Map and carve the region (block sizes rounded to cache lines); once only
+  expected<void, ErrorCode> reserve(const Class* classes, size_t n, bool prefault) {
+    if (region_ != nullptr || n == 0 || n > kMaxClasses)
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    Class sorted[kMaxClasses];
+    std::copy(classes, classes + n, sorted);
+    std::sort(sorted, sorted + n, [](const Class& a, const Class& b) { return a.block_size < b.block_size; });
+    size_t total = 0;
+    for (size_t i = 0; i < n; ++i) {
+      sorted[i].block_size = (sorted[i].block_size + kCacheLine - 1) & ~(kCacheLine - 1);
+      total += sorted[i].block_size * sorted[i].blocks;
     }
-    if (max_iov < 2) {
-      iov[0].iov_base = const_cast<T*>(buffer_.data() + read_idx_);
-      iov[0].iov_len = contiguous;
-      return 1;
+    if (total == 0) return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    void* mem = ::mmap(nullptr, total, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | (prefault ? MAP_POPULATE : 0), -1, 0);
+    if (mem == MAP_FAILED) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    region_ = static_cast<uint8_t*>(mem);
+    region_size_ = total;
+    if (prefault) std::memset(region_, 0, total);  // Also breaks copy-on-write of the zero page
+
+    uint8_t* p = region_;
+    for (size_t i = 0; i < n; ++i) {
+      Slab& slab = slabs_[i];
+      slab.block_size = sorted[i].block_size;
+      slab.begin = p;
+      slab.free_count = sorted[i].blocks;
+      for (uint32_t b = 0; b < sorted[i].blocks; ++b) {
+        void* block = p + static_cast<size_t>(b) * slab.block_size;
+        *static_cast<void**>(block) = b + 1 < sorted[i].blocks ? p + static_cast<size_t>(b + 1) * slab.block_size : nullptr;
+      }
+      slab.free = sorted[i].blocks > 0 ? p : nullptr;
+      p += slab.block_size * sorted[i].blocks;
+      slab.end = p;
     }
-    iov[0].iov_base = const_cast<T*>(buffer_.data() + read_idx_);
-    iov[0].iov_len = contiguous;
-    iov[1].iov_base = const_cast<T*>(buffer_.data());
-    iov[1].iov_len = count_ - contiguous;
-    return 2;
+    slab_count_ = n;
+    return expected<void, ErrorCode>::success();
   }
 
-  // Fill iovec for readv (zero-copy receive into write side)
-  size_t fill_iovec_write(struct iovec* iov, size_t max_iov) const {
-    size_t avail = available();
-    if (avail == 0 || max_iov == 0) return 0;
-    size_t contiguous = kCapacity - write_idx_;
-    if (contiguous >= avail) {
-      iov[0].iov_base = const_cast<T*>(buffer_.data() + write_idx_);
-      iov[0].iov_len = avail;
-      return 1;
+  size_t reserved_bytes() const { return region_size_; }
+  uint64_t fallbacks() const { return fallbacks_.load(std::memory_order_relaxed); }
+  // Free blocks of the smallest class with block_size >= bytes (0 if none)
+  uint32_t free_blocks(size_t bytes) const {
+    for (size_t i = 0; i < slab_count_; ++i)
+      if (slabs_[i].block_size >= bytes) return slabs_[i].free_count;
+    return 0;
+  }
+
+ private:
+  struct Slab {
+    size_t block_size = 0;
+    uint8_t* begin = nullptr;
+    uint8_t* end = nullptr;
+    void* free = nullptr;
+    uint32_t free_count = 0;
+  };
+
+  std::array<Slab, kMaxClasses> slabs_{};
+  size_t slab_count_ = 0;
+  uint8_t* region_ = nullptr;
+  size_t region_size_ = 0;
+  std::atomic_flag lock_ = ATOMIC_FLAG_INIT;
+  std::atomic<uint64_t> fallbacks_{0};
+
+  void lock() {
+    while (lock_.test_and_set(std::memory_order_acquire)) {
     }
-    if (max_iov < 2) {
-      iov[0].iov_base = const_cast<T*>(buffer_.data() + write_idx_);
-      iov[0].iov_len = contiguous;
-      return 1;
+  }
+  void unlock() { lock_.clear(std::memory_order_release); }
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    if (alignment <= kCacheLine) {
+      lock();
+      for (size_t i = 0; i < slab_count_; ++i) {
+        Slab& slab = slabs_[i];
+        if (slab.block_size < bytes || slab.free == nullptr) continue;
+        void* block = slab.free;
+        slab.free = *static_cast<void**>(block);
+        --slab.free_count;
+        unlock();
+        return block;
+      }
+      unlock();
     }
-    iov[0].iov_base = const_cast<T*>(buffer_.data() + write_idx_);
-    iov[0].iov_len = contiguous;
-    iov[1].iov_base = const_cast<T*>(buffer_.data());
-    iov[1].iov_len = avail - contiguous;
-    return 2;
+    fallbacks_.fetch_add(1, std::memory_order_relaxed);
+    AllocationGuard::violation("static pool overflow", bytes);
+    return std::pmr::new_delete_resource()->allocate(bytes, alignment);
   }
 
-  void commit_write(size_t len) {
-    if (len > available()) len = available();
-    write_idx_ = (write_idx_ + len) % kCapacity;
-    count_ += len;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override {
+    auto* q = static_cast<uint8_t*>(p);
+    if (q < region_ || q >= region_ + region_size_) {
+      std::pmr::new_delete_resource()->deallocate(p, bytes, alignment);
+      return;
+    }
+    lock();
+    for (size_t i = 0; i < slab_count_; ++i) {
+      Slab& slab = slabs_[i];
+      if (q < slab.begin || q >= slab.end) continue;
+      *static_cast<void**>(p) = slab.free;
+      slab.free = p;
+      ++slab.free_count;
+      break;
+    }
+    unlock();
   }
 
-  const T* read_ptr(size_t* out_len) const {
-    if (empty()) { *out_len = 0; return nullptr; }
-    size_t contiguous = kCapacity - read_idx_;
-    *out_len = (contiguous >= count_) ? count_ : contiguous;
-    return buffer_.data() + read_idx_;
-  }
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+};
 
- private:
-  alignas(kCacheLine) std::array<T, kCapacity> buffer_{};
-  size_t read_idx_ = 0;
-  size_t write_idx_ = 0;
-  size_t count_ = 0;
+struct StaticMemoryPolicy {
+  uint32_t connections = 64;        // Slots reserved (and max_connections cap)
+  size_t read_buffer_bytes = 65536; // Shared read buffer (0: none)
+  size_t scratch_bytes = 16384;     // ScratchArena block; it no longer grows
+  bool prefault = true;             // Touch every reserved page now
+  bool lock_memory = false;         // mlockall(MCL_CURRENT | MCL_FUTURE)
+  bool guard_heap = true;           // Arm AllocationGuard on the reactor thread
+  bool rpc_sessions = true;         // An RpcSession block per slot (set_rpc)
+  bool bridge_links = true;         // A BridgeLink block per slot (set_bridge)
 };
 
 // ============================================================================
-// Connection state (function-pointer state machine, no virtual)
+// RealtimeScope - SCHED_FIFO, CPU affinity and timer slack for one thread
 // ============================================================================
-
-enum class ConnectionState : uint8_t {
-  kHandshaking,  // Waiting for HTTP upgrade request
-  kOpen,         // WebSocket connection established
-  kClosing,      // Close handshake in progress
-  kClosed        // Connection closed
+//
+// Server::set_realtime() applies a RealtimePolicy to the thread calling run()
+// for as long as it serves, then restores the previous settings. SCHED_FIFO
+// needs CAP_SYS_NICE (or an RLIMIT_RTPRIO grant); what the kernel refuses is
+// logged and counted in stats().realtime_failures and the rest still applies.
+// The CPU should be one kept free of other work (isolcpus=, nohz_full=, or a
+// cpuset), otherwise FIFO priority only moves the preemption elsewhere.
+
+struct RealtimePolicy {
+  int priority = 0;             // SCHED_FIFO priority 1-99 (0: keep the current policy)
+  int cpu = -1;                 // Pin to this CPU (-1: keep the affinity / set_cpu())
+  uint64_t timer_slack_ns = 0;  // PR_SET_TIMERSLACK for poll() wake-ups (0: keep, default 50 us;
+                                // recent kernels give SCHED_FIFO threads zero slack anyway)
 };
 
-class Connection;  // Forward declaration
-
-// State handler function signatures
-using StateDataHandler = expected<void, ErrorCode> (*)(Connection& conn);
-using StateSendHandler = expected<void, ErrorCode> (*)(Connection& conn, std::string_view payload);
-using StateCloseHandler = expected<void, ErrorCode> (*)(Connection& conn, uint16_t code);
+class RealtimeScope {
+ public:
+  explicit RealtimeScope(const RealtimePolicy& policy) {
+    if (policy.priority > 0) {
+      saved_policy_ = sched_getscheduler(0);
+      if (saved_policy_ >= 0 && sched_getparam(0, &saved_param_) == 0) {
+        struct sched_param param{};
+        param.sched_priority = std::min(std::max(policy.priority, sched_get_priority_min(SCHED_FIFO)),
+                                        sched_get_priority_max(SCHED_FIFO));
+        // Reset-on-fork: children of a handler must not inherit the priority
+        if (sched_setscheduler(0, SCHED_FIFO | SCHED_RESET_ON_FORK, &param) == 0) {
+          sched_set_ = true;
+        } else {
+          fail("sched_setscheduler(SCHED_FIFO)");
+        }
+      } else {
+        fail("sched_getscheduler");
+      }
+    }
+    if (policy.cpu >= 0) {
+      cpu_set_t set;
+      CPU_ZERO(&set);
+      CPU_SET(policy.cpu, &set);
+      if (sched_getaffinity(0, sizeof(saved_affinity_), &saved_affinity_) == 0 &&
+          sched_setaffinity(0, sizeof(set), &set) == 0) {
+        affinity_set_ = true;
+      } else {
+        fail("sched_setaffinity");
+      }
+    }
+    if (policy.timer_slack_ns > 0) {
+      int prev = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+      if (prev >= 0 && prctl(PR_SET_TIMERSLACK, static_cast<unsigned long>(policy.timer_slack_ns), 0, 0, 0) == 0) {
+        saved_slack_ns_ = static_cast<uint64_t>(prev);
+        slack_set_ = true;
+      } else {
+        fail("PR_SET_TIMERSLACK");
+      }
+    }
+  }
 
-// Function pointer table (replaces virtual ProtocolHandler)
-struct StateOps {
-  ConnectionState state;
-  StateDataHandler on_data;
-  StateSendHandler on_send;
-  StateCloseHandler on_close;
-};
+  ~RealtimeScope() {
+    // Leaving SCHED_FIFO resets the slack, so the policy goes first
+    if (sched_set_) sched_setscheduler(0, saved_policy_, &saved_param_);
+    if (affinity_set_) sched_setaffinity(0, sizeof(saved_affinity_), &saved_affinity_);
+    if (slack_set_) prctl(PR_SET_TIMERSLACK, static_cast<unsigned long>(saved_slack_ns_), 0, 0, 0);
+  }
 
-// ============================================================================
-// Connection - Manages socket, buffers, and protocol state
-// ============================================================================
+  RealtimeScope(const RealtimeScope&) = delete;
+  RealtimeScope& operator=(const RealtimeScope&) = delete;
 
-class alignas(kCacheLine) Connection : public std::enable_shared_from_this<Connection> {
- public:
-  static constexpr size_t kRxBufferSize = 4096;
-  static constexpr size_t kTxBufferSize = 8192;
-  static constexpr size_t kTempReadSize = 512;
-  static constexpr size_t kHandshakeTimeout = 5000;                  // ms
-  static constexpr size_t kCloseTimeout = 5000;                      // ms
-  static constexpr size_t kTxHighWatermark = kTxBufferSize * 3 / 4;  // 75%
-  static constexpr size_t kTxLowWatermark = kTxBufferSize / 4;       // 25%
+  // Settings the kernel refused; first_failure() names the first one
+  uint32_t failures() const { return failures_; }
+  const char* first_failure() const { return first_failure_; }
+  int first_errno() const { return first_errno_; }
 
-  using ConnPtr = std::shared_ptr<Connection>;
+ private:
+  void fail(const char* what) {
+    if (failures_++ == 0) {
+      first_failure_ = what;
+      first_errno_ = errno;
+    }
+  }
 
-  // Construction (implementation below)
-  explicit Connection(sockpp::tcp_socket&& sock);
-  explicit Connection(int fd);
-  ~Connection();
+  int saved_policy_ = SCHED_OTHER;
+  struct sched_param saved_param_{};
+  cpu_set_t saved_affinity_{};
+  uint64_t saved_slack_ns_ = 0;
+  bool sched_set_ = false;
+  bool affinity_set_ = false;
+  bool slack_set_ = false;
+  uint32_t failures_ = 0;
+  const char* first_failure_ = nullptr;
+  int first_errno_ = 0;
+};
 
-  // Reactor I/O
-  expected<void, ErrorCode> handle_read();
-  expected<void, ErrorCode> handle_write();
-  expected<void, ErrorCode> handle_write_vectored();
+// ============================================================================
+// ScratchArena - Per-iteration bump allocator for handlers
+// ============================================================================
+//
+// Transient reply formatting and parsing inside callbacks: allocations bump a
+// pointer through one block and are all released when the reactor resets the
+// arena before its next poll(). Nothing from it may outlive the iteration
+// (send() copies into tx_buffer(), so formatted replies are fine). Requests that
+// do not fit spill to the heap until the reset, which then grows the block to
+// that iteration's peak so the next burst of the same size stays in place.
+
+class ScratchArena final : public std::pmr::memory_resource {
+ public:
+  static constexpr size_t kDefaultSize = 16384;
+
+  explicit ScratchArena(std::pmr::memory_resource* upstream = std::pmr::new_delete_resource()) : upstream_(upstream) {}
+  ~ScratchArena() override { release(); }
+  ScratchArena(const ScratchArena&) = delete;
+  ScratchArena& operator=(const ScratchArena&) = delete;
+
+  // Where the block and spills come from (default: global heap); drops the current block
+  void set_upstream(std::pmr::memory_resource* upstream) {
+    if (offset_ > 0 || spilled_ > 0) return;
+    size_t capacity = capacity_;
+    release();
+    upstream_ = upstream;
+    reserve(capacity);
+  }
 
-  // User API
-  void send(std::string_view payload) { send_impl(payload, false); }
-  void send_binary(std::string_view payload) { send_impl(payload, true); }
-  void close(uint16_t code = 1000);
-  bool is_closed() const;
-  bool has_data_to_send() const { return !tx_buffer_.empty(); }
-  int get_fd() const { return socket_.handle(); }
-  uint64_t get_id() const { return id_; }
+  // Size the block now instead of on first use (or at a reset after a spill)
+  void reserve(size_t bytes) {
+    if (bytes <= capacity_ || offset_ > 0) return;
+    block_ = pmr_bytes(upstream_, bytes);
+    capacity_ = bytes;
+  }
 
-  // Backpressure
-  bool is_write_paused() const { return write_paused_; }
-  size_t tx_buffer_usage() const { return tx_buffer_.size(); }
+  // Uninitialized bytes valid until the next reset()
+  char* allocate_chars(size_t n) { return static_cast<char*>(allocate(n, 1)); }
 
-  // Timeout checks
-  bool is_handshake_timed_out() const {
-    if (get_state() != ConnectionState::kHandshaking) return false;
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-        SteadyClock::now() - created_at_).count();
-    return static_cast<size_t>(elapsed) > kHandshakeTimeout;
+  std::string_view copy(std::string_view s) {
+    char* p = allocate_chars(s.size());
+    std::memcpy(p, s.data(), s.size());
+    return {p, s.size()};
   }
 
-  bool is_close_timed_out() const {
-    if (get_state() != ConnectionState::kClosing) return false;
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
-        SteadyClock::now() - closing_at_).count();
-    return static_cast<size_t>(elapsed) > kCloseTimeout;
+  // snprintf into the arena
+#if defined(__GNUC__)
+  __attribute__((format(printf, 2, 3)))
+#endif
+  std::string_view format(const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    va_list again;
+    va_copy(again, args);
+    int n = std::vsnprintf(nullptr, 0, fmt, args);
+    va_end(args);
+    if (n < 0) {
+      va_end(again);
+      return {};
+    }
+    char* p = allocate_chars(static_cast<size_t>(n) + 1);
+    std::vsnprintf(p, static_cast<size_t>(n) + 1, fmt, again);
+    va_end(again);
+    return {p, static_cast<size_t>(n)};
   }
 
-  void touch_activity() { last_activity_ = SteadyClock::now(); }
-  uint64_t idle_ms() const {
-    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
-        SteadyClock::now() - last_activity_).count());
-  }
+  // Empty pmr string backed by the arena, for incremental building
+  std::pmr::string string() { return std::pmr::string(this); }
 
-  // Callbacks
-  std::function<void(const ConnPtr&)> on_open;
-  std::function<void(const ConnPtr&, std::string_view)> on_message;
-  std::function<void(const ConnPtr&, bool)> on_close;
-  std::function<void(const ConnPtr&)> on_error;
-  std::function<void(const ConnPtr&)> on_backpressure;
-  std::function<void(const ConnPtr&)> on_drain;
+  // Keep the block size after spills (static memory: the block is all there is)
+  void set_fixed(bool fixed) { fixed_ = fixed; }
 
-  // State query
-  ConnectionState get_state() const { return ops_->state; }
-  ErrorCode get_last_error() const { return last_error_code_; }
+  // Called by the reactor between iterations
+  void reset() {
+    size_t peak = offset_ + spilled_;
+    if (peak > high_water_) high_water_ = peak;
+    if (spilled_ > 0) {
+      release_overflow();
+      offset_ = 0;
+      if (!fixed_) reserve(peak + peak / 2);
+    }
+    offset_ = 0;
+    spilled_ = 0;
+  }
 
-  // Internal API (public to avoid friend, used by state handlers)
-  void transition_to_state(ConnectionState state);
-  expected<void, ErrorCode> parse_handshake();
-  void parse_frames();
-  void write_frame(std::string_view payload, ws::OpCode opcode);
-  void write_close_frame(uint16_t code);
-  void check_high_watermark();
-  void check_low_watermark();
+  size_t used() const { return offset_ + spilled_; }
+  size_t capacity() const { return capacity_; }
+  size_t high_water() const { return high_water_; }
+  uint64_t overflows() const { return overflows_; }
 
-  sockpp::tcp_socket& socket() { return socket_; }
-  RingBuffer<uint8_t, kRxBufferSize>& rx_buffer() { return rx_buffer_; }
-  RingBuffer<uint8_t, kTxBufferSize>& tx_buffer() { return tx_buffer_; }
+  // Arena of the reactor running on this thread (set by Server::run)
+  static ScratchArena*& current() {
+    static thread_local ScratchArena* arena = nullptr;
+    return arena;
+  }
 
  private:
-  uint64_t id_;
-  sockpp::tcp_socket socket_;
-  RingBuffer<uint8_t, kRxBufferSize> rx_buffer_;
-  RingBuffer<uint8_t, kTxBufferSize> tx_buffer_;
-  const StateOps* ops_ = nullptr;
-  bool handshake_completed_ = false;
-  std::string sec_websocket_key_;
-  ErrorCode last_error_code_ = ErrorCode::kOk;
-  bool write_paused_ = false;
+  struct Overflow {
+    Overflow* next;
+    size_t bytes;
+  };
+
+  std::pmr::memory_resource* upstream_;
+  PmrPtr<uint8_t> block_;
+  size_t capacity_ = 0;
+  size_t offset_ = 0;
+  size_t spilled_ = 0;
+  size_t high_water_ = 0;
+  uint64_t overflows_ = 0;
+  Overflow* overflow_ = nullptr;
+  bool fixed_ = false;
+
+  void* do_allocate(size_t bytes, size_t alignment) override {
+    if (block_ == nullptr) reserve(kDefaultSize);
+    auto base = reinterpret_cast<uintptr_t>(block_.get());
+    uintptr_t p = (base + offset_ + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    if (p + bytes <= base + capacity_) {
+      offset_ = p + bytes - base;
+      return reinterpret_cast<void*>(p);
+    }
+    // Spill: header + payload, aligned past the header
+    ++overflows_;
+    spilled_ += bytes;
+    size_t header = (sizeof(Overflow) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+    size_t pad = alignment > alignof(std::max_align_t) ? alignment : 0;
+    auto* raw = static_cast<uint8_t*>(upstream_->allocate(header + pad + bytes, alignof(std::max_align_t)));
+    auto* node = reinterpret_cast<Overflow*>(raw);
+    node->next = overflow_;
+    node->bytes = header + pad + bytes;
+    overflow_ = node;
+    uintptr_t q = reinterpret_cast<uintptr_t>(raw) + header;
+    if (pad > 0) q = (q + alignment - 1) & ~(static_cast<uintptr_t>(alignment) - 1);
+    return reinterpret_cast<void*>(q);
+  }
 
-  using SteadyClock = std::chrono::steady_clock;
-  using TimePoint = SteadyClock::time_point;
-  TimePoint created_at_ = SteadyClock::now();
-  TimePoint closing_at_{};
-  TimePoint last_activity_ = SteadyClock::now();
+  void do_deallocate(void*, size_t, size_t) override {}  // Released wholesale by reset()
 
-  void send_impl(std::string_view payload, bool binary);
-  static std::string generate_accept_key(std::string_view client_key);
-  static void unmask_payload(uint8_t* payload, size_t len, const uint8_t* mask_key);
-  void log_error(const std::string& msg);
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+  void release_overflow() {
+    while (overflow_ != nullptr) {
+      Overflow* next = overflow_->next;
+      upstream_->deallocate(overflow_, overflow_->bytes, alignof(std::max_align_t));
+      overflow_ = next;
+    }
+  }
+
+  void release() {
+    release_overflow();
+    block_.reset();
+    capacity_ = 0;
+  }
 };
 
 // ============================================================================
-// TCP Tuning Configuration
+// LatencyHistogram - Atomic log2-bucketed histogram (microseconds)
 // ============================================================================
 
-struct TcpTuning {
-  bool tcp_nodelay = false;
-  bool tcp_quickack = false;
-  bool so_keepalive = false;
-  int keepalive_idle_s = 60;
-  int keepalive_interval_s = 10;
-  int keepalive_count = 5;
+struct LatencyHistogram {
+  static constexpr uint32_t kBuckets = 32;  // bucket i holds values in [2^(i-1), 2^i)
+
+  std::array<std::atomic<uint64_t>, kBuckets> buckets{};
+
+  static uint32_t bucket_for(uint64_t us) {
+    uint32_t b = 0;
+    while (us != 0 && b < kBuckets - 1) { us >>= 1; ++b; }
+    return b;
+  }
+
+  // Inclusive upper bound of bucket i
+  static uint64_t bucket_limit(uint32_t i) {
+    return i == 0 ? 0 : (uint64_t{1} << i) - 1;
+  }
+
+  void record(uint64_t us) { buckets[bucket_for(us)].fetch_add(1, std::memory_order_relaxed); }
+
+  void reset() { for (auto& b : buckets) b.store(0, std::memory_order_relaxed); }
+
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (const auto& b : buckets) n += b.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  void copy_to(uint64_t* out) const {
+    for (uint32_t i = 0; i < kBuckets; ++i) out[i] = buckets[i].load(std::memory_order_relaxed);
+  }
+
+  // Upper bound of the bucket containing the p-th percentile (p in [0, 100])
+  static uint64_t percentile(const uint64_t* counts, double p) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < kBuckets; ++i) total += counts[i];
+    if (total == 0) return 0;
+    uint64_t rank = static_cast<uint64_t>(static_cast<double>(total) * p / 100.0);
+    if (rank >= total) rank = total - 1;
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < kBuckets; ++i) {
+      seen += counts[i];
+      if (seen > rank) return bucket_limit(i);
+    }
+    return bucket_limit(kBuckets - 1);
+  }
 };
 
 // ============================================================================
-// TLS Configuration (optional mbedTLS, placeholder)
+// StatsSnapshot - Plain copy of ServerStats (shared-memory export layout)
 // ============================================================================
 
-struct TlsConfig {
-  std::string cert_path;
-  std::string key_path;
-  std::string ca_path;
-  bool require_client_cert = false;
-  int min_tls_version = 0;
+constexpr size_t kEgressClasses = 4;  // Traffic classes tracked by the egress shaper
+
+struct StatsSnapshot {
+  uint64_t total_messages_in;
+  uint64_t total_messages_out;
+  uint64_t total_bytes_in;
+  uint64_t total_bytes_out;
+  uint64_t total_connections;
+  uint64_t active_connections;
+  uint64_t rejected_connections;
+  uint64_t handshake_errors;
+  uint64_t socket_errors;
+  uint64_t buffer_overflows;
+  uint64_t last_poll_latency_us;
+  uint64_t max_poll_latency_us;
+  uint64_t pool_acquires;
+  uint64_t pool_releases;
+  uint64_t pool_exhausted;
+  uint64_t loop_busy_us;
+  uint64_t loop_poll_us;
+  uint64_t callback_us_total;
+  uint64_t max_callback_us;
+  uint64_t stalled_iterations;
+  uint64_t ipc_messages_in;
+  uint64_t ipc_messages_out;
+  uint64_t ipc_dropped;
+  uint64_t bridge_bytes_up;
+  uint64_t bridge_bytes_down;
+  uint64_t bridge_spliced_bytes;
+  uint64_t bridge_connect_failures;
+  uint64_t route_rejects;
+  uint64_t handoffs_accepted;
+  uint64_t migrations_in;
+  uint64_t migrations_out;
+  uint64_t migration_failures;
+  uint64_t incoming_cpu_local;
+  uint64_t incoming_cpu_remote;
+  uint64_t pubsub_frames;
+  uint64_t pubsub_deliveries;
+  uint64_t pubsub_dropped;
+  uint64_t egress_throttled;
+  uint64_t egress_bytes[kEgressClasses];
+  uint64_t deflate_shared_frames;
+  uint64_t deflate_shared_deliveries;
+  uint64_t sessions_resumed;
+  uint64_t sessions_resume_missed;
+  uint64_t resent_frames;
+  uint64_t sessions_expired;
+  uint64_t http_requests;
+  uint64_t http_not_found;
+  uint64_t mem_bytes_in_use;
+  uint64_t mem_peak_bytes;
+  uint64_t mem_allocations;
+  uint64_t static_pool_fallbacks;
+  uint64_t heap_after_start;
+  uint64_t realtime_failures;
+  uint64_t tcp_info_samples;
+  uint64_t tcp_retransmits;
+  uint64_t send_queue_holds;
+  uint64_t callback_latency_us[LatencyHistogram::kBuckets];
+  uint64_t iteration_latency_us[LatencyHistogram::kBuckets];
+  uint64_t tcp_rtt_us[LatencyHistogram::kBuckets];
+
+  double loop_utilization() const {
+    uint64_t total = loop_busy_us + loop_poll_us;
+    return total == 0 ? 0.0 : static_cast<double>(loop_busy_us) / static_cast<double>(total);
+  }
+
+  double cpu_locality() const {
+    uint64_t total = incoming_cpu_local + incoming_cpu_remote;
+    return total == 0 ? 0.0 : static_cast<double>(incoming_cpu_local) / static_cast<double>(total);
+  }
 };
 
+static_assert(std::is_trivially_copyable<StatsSnapshot>::value, "StatsSnapshot must be POD");
+
 // ============================================================================
-// Server - poll() Reactor with zero-copy I/O
+// ServerStats - Atomic performance counters
 // ============================================================================
 
-class Server {
- public:
-  using ConnPtr = std::shared_ptr<Connection>;
+struct alignas(kCacheLine) ServerStats {
+  std::atomic<uint64_t> total_messages_in{0};
+  std::atomic<uint64_t> total_messages_out{0};
+  std::atomic<uint64_t> total_bytes_in{0};
+  std::atomic<uint64_t> total_bytes_out{0};
+  std::atomic<uint64_t> total_connections{0};
+  std::atomic<uint64_t> active_connections{0};
+  std::atomic<uint64_t> rejected_connections{0};
+  std::atomic<uint64_t> handshake_errors{0};
+  std::atomic<uint64_t> socket_errors{0};
+  std::atomic<uint64_t> buffer_overflows{0};
+  std::atomic<uint64_t> last_poll_latency_us{0};
+  std::atomic<uint64_t> max_poll_latency_us{0};
+  std::atomic<uint64_t> pool_acquires{0};
+  std::atomic<uint64_t> pool_releases{0};
+  std::atomic<uint64_t> pool_exhausted{0};
+  std::atomic<uint64_t> loop_busy_us{0};         // Reactor time outside poll()
+  std::atomic<uint64_t> loop_poll_us{0};         // Reactor time blocked in poll()
+  std::atomic<uint64_t> callback_us_total{0};
+  std::atomic<uint64_t> max_callback_us{0};
+  std::atomic<uint64_t> stalled_iterations{0};
+  std::atomic<uint64_t> ipc_messages_in{0};      // Commands received from the IPC peer
+  std::atomic<uint64_t> ipc_messages_out{0};     // Events delivered to the IPC peer
+  std::atomic<uint64_t> ipc_dropped{0};          // Events dropped (IPC ring full)
+  std::atomic<uint64_t> bridge_bytes_up{0};      // Client -> backend payload bytes
+  std::atomic<uint64_t> bridge_bytes_down{0};    // Backend -> client payload bytes
+  std::atomic<uint64_t> bridge_spliced_bytes{0}; // Downstream bytes moved with splice()
+  std::atomic<uint64_t> bridge_connect_failures{0};
+  std::atomic<uint64_t> route_rejects{0};        // Upgrades refused by the route table
+  std::atomic<uint64_t> handoffs_accepted{0};    // Connections adopted from a HandshakeStage
+  std::atomic<uint64_t> migrations_in{0};        // Connections adopted from other reactors
+  std::atomic<uint64_t> migrations_out{0};       // Connections moved to other reactors
+  std::atomic<uint64_t> migration_failures{0};   // Migrations refused (not migratable, target full)
+  std::atomic<uint64_t> incoming_cpu_local{0};   // Accepted sockets whose SO_INCOMING_CPU is the reactor's
+  std::atomic<uint64_t> incoming_cpu_remote{0};  // Accepted sockets first processed on another CPU
+  std::atomic<uint64_t> pubsub_frames{0};        // Published frames fanned out by this reactor
+  std::atomic<uint64_t> pubsub_deliveries{0};    // Published frames queued to subscribers
+  std::atomic<uint64_t> pubsub_dropped{0};       // Published frames dropped (inbox or subscriber tx full)
+  std::atomic<uint64_t> egress_throttled{0};     // Shaper passes that ran out of tokens with data queued
+  std::atomic<uint64_t> egress_bytes[kEgressClasses]{};  // Shaped bytes written, per traffic class
+  std::atomic<uint64_t> deflate_shared_frames{0};      // Messages deflated once for no-context-takeover fan-out
+  std::atomic<uint64_t> deflate_shared_deliveries{0};  // Frames sent from a shared deflated copy
+  std::atomic<uint64_t> sessions_resumed{0};           // Reconnects that continued their session
+  std::atomic<uint64_t> sessions_resume_missed{0};     // Resume attempts whose token or sequence had expired
+  std::atomic<uint64_t> resent_frames{0};              // Frames replayed to resumed sessions
+  std::atomic<uint64_t> sessions_expired{0};           // Detached sessions dropped after linger_ms
+  std::atomic<uint64_t> http_requests{0};              // Plain HTTP requests answered by the HttpResponder
+  std::atomic<uint64_t> http_not_found{0};             // Plain HTTP requests for unknown paths (404)
+  std::atomic<uint64_t> mem_bytes_in_use{0};           // Bytes held from the server's AccountedResource
+  std::atomic<uint64_t> mem_peak_bytes{0};             // High-water mark of mem_bytes_in_use
+  std::atomic<uint64_t> mem_allocations{0};            // Allocations made through the server's resource
+  std::atomic<uint64_t> static_pool_fallbacks{0};      // Static-memory allocations that found no free slab block
+  std::atomic<uint64_t> heap_after_start{0};           // Heap allocations on the armed reactor thread (AllocationGuard)
+  std::atomic<uint64_t> realtime_failures{0};          // Realtime profile settings the kernel refused (see RealtimeScope)
+  std::atomic<uint64_t> tcp_info_samples{0};           // TCP_INFO readings taken by set_tcp_info_sampling()
+  std::atomic<uint64_t> tcp_retransmits{0};            // Retransmitted segments reported by TCP_INFO samples
+  std::atomic<uint64_t> send_queue_holds{0};           // Flushes cut short by the kernel send queue target
+  LatencyHistogram callback_latency_us;          // Per-callback duration (when timed)
+  LatencyHistogram iteration_latency_us;         // Per-iteration busy time
+  LatencyHistogram tcp_rtt_us;                   // Smoothed RTT per TCP_INFO sample
 
-  explicit Server(uint16_t port, const std::string& bind_addr = "");
-  ~Server();
+  void reset() {
+    total_messages_in = 0; total_messages_out = 0;
+    total_bytes_in = 0; total_bytes_out = 0;
+    total_connections = 0; active_connections = 0; rejected_connections = 0;
+    handshake_errors = 0; socket_errors = 0; buffer_overflows = 0;
+    last_poll_latency_us = 0; max_poll_latency_us = 0;
+    pool_acquires = 0; pool_releases = 0; pool_exhausted = 0;
+    loop_busy_us = 0; loop_poll_us = 0;
+    callback_us_total = 0; max_callback_us = 0; stalled_iterations = 0;
+    ipc_messages_in = 0; ipc_messages_out = 0; ipc_dropped = 0;
+    bridge_bytes_up = 0; bridge_bytes_down = 0; bridge_spliced_bytes = 0; bridge_connect_failures = 0;
+    route_rejects = 0;
+    handoffs_accepted = 0;
+    migrations_in = 0; migrations_out = 0; migration_failures = 0;
+    incoming_cpu_local = 0; incoming_cpu_remote = 0;
+    pubsub_frames = 0; pubsub_deliveries = 0; pubsub_dropped = 0;
+    egress_throttled = 0;
+    for (auto& b : egress_bytes) b = 0;
+    deflate_shared_frames = 0; deflate_shared_deliveries = 0;
+    sessions_resumed = 0; sessions_resume_missed = 0; resent_frames = 0; sessions_expired = 0;
+    http_requests = 0; http_not_found = 0;
+    mem_bytes_in_use = 0; mem_peak_bytes = 0; mem_allocations = 0;  // Mirrored from the resource
+    static_pool_fallbacks = 0; heap_after_start = 0; realtime_failures = 0;
+    tcp_info_samples = 0; tcp_retransmits = 0; send_queue_holds = 0;
+    callback_latency_us.reset(); iteration_latency_us.reset(); tcp_rtt_us.reset();
+  }
 
-  void run();
-  void stop() { is_running_ = false; }
+  void snapshot(StatsSnapshot& out) const {
+    constexpr auto kRelaxed = std::memory_order_relaxed;
+    out.total_messages_in = total_messages_in.load(kRelaxed);
+    out.total_messages_out = total_messages_out.load(kRelaxed);
+    out.total_bytes_in = total_bytes_in.load(kRelaxed);
+    out.total_bytes_out = total_bytes_out.load(kRelaxed);
+    out.total_connections = total_connections.load(kRelaxed);
+    out.active_connections = active_connections.load(kRelaxed);
+    out.rejected_connections = rejected_connections.load(kRelaxed);
+    out.handshake_errors = handshake_errors.load(kRelaxed);
+    out.socket_errors = socket_errors.load(kRelaxed);
+    out.buffer_overflows = buffer_overflows.load(kRelaxed);
+    out.last_poll_latency_us = last_poll_latency_us.load(kRelaxed);
+    out.max_poll_latency_us = max_poll_latency_us.load(kRelaxed);
+    out.pool_acquires = pool_acquires.load(kRelaxed);
+    out.pool_releases = pool_releases.load(kRelaxed);
+    out.pool_exhausted = pool_exhausted.load(kRelaxed);
+    out.loop_busy_us = loop_busy_us.load(kRelaxed);
+    out.loop_poll_us = loop_poll_us.load(kRelaxed);
+    out.callback_us_total = callback_us_total.load(kRelaxed);
+    out.max_callback_us = max_callback_us.load(kRelaxed);
+    out.stalled_iterations = stalled_iterations.load(kRelaxed);
+    out.ipc_messages_in = ipc_messages_in.load(kRelaxed);
+    out.ipc_messages_out = ipc_messages_out.load(kRelaxed);
+    out.ipc_dropped = ipc_dropped.load(kRelaxed);
+    out.bridge_bytes_up = bridge_bytes_up.load(kRelaxed);
+    out.bridge_bytes_down = bridge_bytes_down.load(kRelaxed);
+    out.bridge_spliced_bytes = bridge_spliced_bytes.load(kRelaxed);
+    out.bridge_connect_failures = bridge_connect_failures.load(kRelaxed);
+    out.route_rejects = route_rejects.load(kRelaxed);
+    out.handoffs_accepted = handoffs_accepted.load(kRelaxed);
+    out.migrations_in = migrations_in.load(kRelaxed);
+    out.migrations_out = migrations_out.load(kRelaxed);
+    out.migration_failures = migration_failures.load(kRelaxed);
+    out.incoming_cpu_local = incoming_cpu_local.load(kRelaxed);
+    out.incoming_cpu_remote = incoming_cpu_remote.load(kRelaxed);
+    out.pubsub_frames = pubsub_frames.load(kRelaxed);
+    out.pubsub_deliveries = pubsub_deliveries.load(kRelaxed);
+    out.pubsub_dropped = pubsub_dropped.load(kRelaxed);
+    out.egress_throttled = egress_throttled.load(kRelaxed);
+    for (size_t i = 0; i < kEgressClasses; ++i) out.egress_bytes[i] = egress_bytes[i].load(kRelaxed);
+    out.deflate_shared_frames = deflate_shared_frames.load(kRelaxed);
+    out.deflate_shared_deliveries = deflate_shared_deliveries.load(kRelaxed);
+    out.sessions_resumed = sessions_resumed.load(kRelaxed);
+    out.sessions_resume_missed = sessions_resume_missed.load(kRelaxed);
+    out.resent_frames = resent_frames.load(kRelaxed);
+    out.sessions_expired = sessions_expired.load(kRelaxed);
+    out.http_requests = http_requests.load(kRelaxed);
+    out.http_not_found = http_not_found.load(kRelaxed);
+    out.mem_bytes_in_use = mem_bytes_in_use.load(kRelaxed);
+    out.mem_peak_bytes = mem_peak_bytes.load(kRelaxed);
+    out.mem_allocations = mem_allocations.load(kRelaxed);
+    out.static_pool_fallbacks = static_pool_fallbacks.load(kRelaxed);
+    out.heap_after_start = heap_after_start.load(kRelaxed);
+    out.realtime_failures = realtime_failures.load(kRelaxed);
+    out.tcp_info_samples = tcp_info_samples.load(kRelaxed);
+    out.tcp_retransmits = tcp_retransmits.load(kRelaxed);
+    out.send_queue_holds = send_queue_holds.load(kRelaxed);
+    callback_latency_us.copy_to(out.callback_latency_us);
+    iteration_latency_us.copy_to(out.iteration_latency_us);
+    tcp_rtt_us.copy_to(out.tcp_rtt_us);
+  }
 
-  Server& set_max_connections(size_t max) { max_connections_ = max; return *this; }
-  Server& set_poll_timeout_ms(int t) { poll_timeout_ms_ = t; return *this; }
-  Server& set_tcp_tuning(const TcpTuning& t) { tcp_tuning_ = t; return *this; }
-  Server& set_use_writev(bool e) { use_writev_ = e; return *this; }
+  bool is_overloaded(size_t pool_capacity) const {
+    uint64_t active = active_connections.load(std::memory_order_relaxed);
+    return active > (pool_capacity * 9 / 10);
+  }
 
-  // Callbacks
-  std::function<void(const ConnPtr&)> on_connect;
-  std::function<void(const ConnPtr&, std::string_view)> on_message;
-  std::function<void(const ConnPtr&, bool)> on_close;
-  std::function<void(const ConnPtr&)> on_error;
-  std::function<void(const ConnPtr&)> on_backpressure;
-  std::function<void(const ConnPtr&)> on_drain;
+  // Event-loop utilization: busy / (busy + blocked-in-poll), 0.0 when idle
+  double loop_utilization() const {
+    uint64_t busy = loop_busy_us.load(std::memory_order_relaxed);
+    uint64_t total = busy + loop_poll_us.load(std::memory_order_relaxed);
+    return total == 0 ? 0.0 : static_cast<double>(busy) / static_cast<double>(total);
+  }
 
-  // Status
-  size_t get_connection_count() const { return connections_.size(); }
-  const ServerStats& stats() const { return stats_; }
-  void reset_stats() { stats_.reset(); }
-  uint64_t get_total_socket_errors() const { return stats_.socket_errors.load(); }
-  uint64_t get_total_handshake_errors() const { return stats_.handshake_errors.load(); }
+  // Fraction of accepted connections already on the reactor's CPU (SO_INCOMING_CPU)
+  double cpu_locality() const {
+    uint64_t local = incoming_cpu_local.load(std::memory_order_relaxed);
+    uint64_t total = local + incoming_cpu_remote.load(std::memory_order_relaxed);
+    return total == 0 ? 0.0 : static_cast<double>(local) / static_cast<double>(total);
+  }
+};
 
-  static constexpr size_t kMaxConnections = 64;
+// ============================================================================
+// LoopWatchdog - Per-callback timing and reactor stall detection
+// ============================================================================
 
- private:
-  uint16_t port_;
-  std::string bind_addr_;
-  int server_sock_ = -1;
-  bool is_running_ = false;
-  bool use_writev_ = true;
-  FixedVector<ConnPtr, kMaxConnections> connections_;
-  size_t max_connections_ = 50;
-  int poll_timeout_ms_ = 1000;
-  TcpTuning tcp_tuning_;
-  uint64_t next_conn_id_ = 1;
-  std::array<pollfd, kMaxConnections + 1> poll_fds_{};
-  ServerStats stats_;
+enum class CallbackKind : uint8_t {
+  kOpen, kMessage, kClose, kError, kBackpressure, kDrain
+};
 
-  expected<void, ErrorCode> accept_connection();
-  void handle_connection_io(ConnPtr& conn, const pollfd& pfd);
-  void remove_closed_connections();
-  void apply_tcp_tuning(int fd);
-  void log_info(const std::string& msg);
-  void log_error(const std::string& msg);
+struct StallInfo {
+  uint64_t conn_id;       // Connection that ran the slowest callback (0 if none)
+  CallbackKind kind;      // Kind of the slowest callback
+  uint64_t callback_us;   // Duration of the slowest callback
+  uint64_t iteration_us;  // Busy time of the whole iteration
+};
+
+class LoopWatchdog {
+ public:
+  explicit LoopWatchdog(ServerStats& stats) : stats_(stats) {}
+
+  void record(uint64_t conn_id, CallbackKind kind, uint64_t us) {
+    stats_.callback_us_total.fetch_add(us, std::memory_order_relaxed);
+    stats_.callback_latency_us.record(us);
+    if (us > stats_.max_callback_us.load(std::memory_order_relaxed))
+      stats_.max_callback_us.store(us, std::memory_order_relaxed);
+    if (us >= worst_us_) { worst_us_ = us; worst_conn_ = conn_id; worst_kind_ = kind; }
+  }
+
+  // Close the iteration; returns true (and fills info) if it exceeded budget_us
+  bool end_iteration(uint64_t busy_us, uint64_t budget_us, StallInfo& info) {
+    bool stalled = budget_us > 0 && busy_us > budget_us;
+    if (stalled) {
+      stats_.stalled_iterations.fetch_add(1, std::memory_order_relaxed);
+      info = {worst_conn_, worst_kind_, worst_us_, busy_us};
+    }
+    worst_us_ = 0; worst_conn_ = 0; worst_kind_ = CallbackKind::kMessage;
+    return stalled;
+  }
+
+ private:
+  ServerStats& stats_;
+  uint64_t worst_us_ = 0;
+  uint64_t worst_conn_ = 0;
+  CallbackKind worst_kind_ = CallbackKind::kMessage;
 };
 
 // ============================================================================
-// Inline implementations
+// StatsSegment - Seqlock-protected ServerStats export in POSIX shared memory
 // ============================================================================
 
-// --- State handler functions (replace virtual ProtocolHandler) ---
-
-namespace detail {
+struct StatsShmLayout {
+  static constexpr uint32_t kMagic = 0x53535745;  // "EWSS"
+  // Bump with every StatsSnapshot change; the size check below catches added fields
+  static constexpr uint32_t kVersion = 2;
+  static constexpr size_t kSnapshotSize = 155 * sizeof(uint64_t);
+  static_assert(sizeof(StatsSnapshot) == kSnapshotSize, "StatsSnapshot changed: bump kVersion and kSnapshotSize");
+
+  uint32_t magic;
+  uint32_t version;
+  uint32_t layout_size;
+  uint32_t writer_pid;
+  alignas(kCacheLine) std::atomic<uint32_t> seq;  // Odd while the writer is publishing
+  uint64_t publish_count;
+  StatsSnapshot data;
+};
 
-inline expected<void, ErrorCode> handshake_on_data(Connection& conn) {
-  auto result = conn.parse_handshake();
-  if (result.has_value()) {
-    conn.transition_to_state(ConnectionState::kOpen);
+class StatsSegment {
+ public:
+  StatsSegment() = default;
+  ~StatsSegment() { close(); }
+  StatsSegment(const StatsSegment&) = delete;
+  StatsSegment& operator=(const StatsSegment&) = delete;
+
+  // Writer side: create the named segment. An existing one is only replaced when
+  // its writer process is gone; a live writer's segment yields kInvalidState.
+  expected<void, ErrorCode> create(const std::string& name) {
+    close();
+    name_ = normalize(name);
+    fd_ = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if (fd_ < 0 && errno == EEXIST) {
+      if (!stale(name_)) return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+      ::shm_unlink(name_.c_str());
+      fd_ = ::shm_open(name_.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    }
+    if (fd_ < 0) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    owner_ = true;  // Ours from here on: close() unlinks it on any failure below
+    if (::ftruncate(fd_, sizeof(StatsShmLayout)) < 0) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    }
+    void* p = ::mmap(nullptr, sizeof(StatsShmLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    }
+    layout_ = static_cast<StatsShmLayout*>(p);
+    std::memset(static_cast<void*>(layout_), 0, sizeof(StatsShmLayout));
+    layout_->version = StatsShmLayout::kVersion;
+    layout_->layout_size = sizeof(StatsShmLayout);
+    layout_->writer_pid = static_cast<uint32_t>(::getpid());
+    std::atomic_thread_fence(std::memory_order_release);
+    layout_->magic = StatsShmLayout::kMagic;
     return expected<void, ErrorCode>::success();
   }
-  return result;
-}
 
-inline expected<void, ErrorCode> handshake_on_send(Connection&, std::string_view) {
-  return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
-}
+  // Reader side: map an existing segment read-only and validate its layout
+  expected<void, ErrorCode> open(const std::string& name) {
+    close();
+    name_ = normalize(name);
+    fd_ = ::shm_open(name_.c_str(), O_RDONLY, 0);
+    if (fd_ < 0) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    struct stat st;
+    if (::fstat(fd_, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(StatsShmLayout)) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    void* p = ::mmap(nullptr, sizeof(StatsShmLayout), PROT_READ, MAP_SHARED, fd_, 0);
+    if (p == MAP_FAILED) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    }
+    layout_ = static_cast<StatsShmLayout*>(p);
+    if (layout_->magic != StatsShmLayout::kMagic || layout_->version != StatsShmLayout::kVersion ||
+        layout_->layout_size != sizeof(StatsShmLayout)) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    return expected<void, ErrorCode>::success();
+  }
+
+  // Writer: one seqlock-protected copy of the counters (never blocks)
+  void publish(const ServerStats& stats) {
+    if (layout_ == nullptr || !owner_) return;
+    StatsSnapshot snap;
+    stats.snapshot(snap);
+    uint32_t seq = layout_->seq.load(std::memory_order_relaxed);
+    layout_->seq.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&layout_->data, &snap, sizeof(snap));
+    ++layout_->publish_count;
+    layout_->seq.store(seq + 2, std::memory_order_release);
+  }
+
+  // Reader: consistent copy, retrying while a publish is in progress
+  bool read(StatsSnapshot& out, uint64_t* publish_count = nullptr, uint32_t max_retries = 1000) const {
+    if (layout_ == nullptr) return false;
+    for (uint32_t i = 0; i < max_retries; ++i) {
+      uint32_t s1 = layout_->seq.load(std::memory_order_acquire);
+      if (s1 & 1U) continue;
+      std::memcpy(&out, &layout_->data, sizeof(out));
+      uint64_t count = layout_->publish_count;
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (layout_->seq.load(std::memory_order_relaxed) == s1) {
+        if (publish_count != nullptr) *publish_count = count;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  uint32_t writer_pid() const { return layout_ != nullptr ? layout_->writer_pid : 0; }
+  bool is_open() const { return layout_ != nullptr; }
+
+  void close() {
+    if (layout_ != nullptr) {
+      ::munmap(static_cast<void*>(layout_), sizeof(StatsShmLayout));
+      layout_ = nullptr;
+    }
+    if (fd_ >= 0) { ::close(fd_); fd_ = -1; }
+    if (owner_) { ::shm_unlink(name_.c_str()); owner_ = false; }
+  }
+
+ private:
+  int fd_ = -1;
+  StatsShmLayout* layout_ = nullptr;
+  bool owner_ = false;
+  std::string name_;
+
+  static std::string normalize(const std::string& name) {
+    return (!name.empty() && name[0] == '/') ? name : "/" + name;
+  }
+
+  // True when an existing segment carries our magic and its writer pid no longer
+  // exists. Anything unreadable or half-initialised is left alone.
+  static bool stale(const std::string& name) {
+    int fd = ::shm_open(name.c_str(), O_RDONLY, 0);
+    if (fd < 0) return false;
+    bool dead = false;
+    struct stat st;
+    if (::fstat(fd, &st) == 0 && static_cast<size_t>(st.st_size) >= sizeof(StatsShmLayout)) {
+      void* p = ::mmap(nullptr, sizeof(StatsShmLayout), PROT_READ, MAP_SHARED, fd, 0);
+      if (p != MAP_FAILED) {
+        const auto* layout = static_cast<const StatsShmLayout*>(p);
+        if (layout->magic == StatsShmLayout::kMagic && layout->writer_pid != 0)
+          dead = ::kill(static_cast<pid_t>(layout->writer_pid), 0) < 0 && errno == ESRCH;
+        ::munmap(p, sizeof(StatsShmLayout));
+      }
+    }
+    ::close(fd);
+    return dead;
+  }
+};
+
+// ============================================================================
+// RingBuffer - Fixed-size circular buffer with zero-copy iovec I/O
+// ============================================================================
+
+template <typename T, size_t Size>
+class alignas(kCacheLine) RingBuffer {
+ public:
+  static constexpr size_t kCapacity = Size;
+  RingBuffer() = default;
+
+  bool push(const T* data, size_t len) {
+    if (available() < len) return false;
+    for (size_t i = 0; i < len; ++i) {
+      buffer_[write_idx_] = data[i];
+      write_idx_ = (write_idx_ + 1) % kCapacity;
+    }
+    count_ += len;
+    return true;
+  }
+
+  size_t peek(T* data, size_t max_len) const {
+    size_t len = std::min(max_len, count_);
+    size_t idx = read_idx_;
+    for (size_t i = 0; i < len; ++i) {
+      data[i] = buffer_[idx];
+      idx = (idx + 1) % kCapacity;
+    }
+    return len;
+  }
+
+  void advance(size_t len) {
+    if (len > count_) len = count_;
+    read_idx_ = (read_idx_ + len) % kCapacity;
+    count_ -= len;
+  }
+
+  size_t size() const { return count_; }
+  size_t available() const { return kCapacity - count_; }
+  bool empty() const { return count_ == 0; }
+
+  void clear() { read_idx_ = 0; write_idx_ = 0; count_ = 0; }
+
+  std::string_view view() const {
+    if (empty()) return {};
+    return std::string_view(reinterpret_cast<const char*>(buffer_.data() + read_idx_), count_);
+  }
+
+  // Fill iovec for writev (zero-copy send from read side)
+  size_t fill_iovec(struct iovec* iov, size_t max_iov) const {
+    if (empty() || max_iov == 0) return 0;
+    size_t contiguous = kCapacity - read_idx_;
+    if (contiguous >= count_) {
+      iov[0].iov_base = const_cast<T*>(buffer_.data() + read_idx_);
+      iov[0].iov_len = count_;
+      return 1;
+    }
+    if (max_iov < 2) {
+      iov[0].iov_base = const_cast<T*>(buffer_.data() + read_idx_);
+      iov[0].iov_len = contiguous;
+      return 1;
+    }
+    iov[0].iov_base = const_cast<T*>(buffer_.data() + read_idx_);
+    iov[0].iov_len = contiguous;
+    iov[1].iov_base = const_cast<T*>(buffer_.data());
+    iov[1].iov_len = count_ - contiguous;
+    return 2;
+  }
+
+  // Fill iovec for readv (zero-copy receive into write side)
+  size_t fill_iovec_write(struct iovec* iov, size_t max_iov) const {
+    size_t avail = available();
+    if (avail == 0 || max_iov == 0) return 0;
+    size_t contiguous = kCapacity - write_idx_;
+    if (contiguous >= avail) {
+      iov[0].iov_base = const_cast<T*>(buffer_.data() + write_idx_);
+      iov[0].iov_len = avail;
+      return 1;
+    }
+    if (max_iov < 2) {
+      iov[0].iov_base = const_cast<T*>(buffer_.data() + write_idx_);
+      iov[0].iov_len = contiguous;
+      return 1;
+    }
+    iov[0].iov_base = const_cast<T*>(buffer_.data() + write_idx_);
+    iov[0].iov_len = contiguous;
+    iov[1].iov_base = const_cast<T*>(buffer_.data());
+    iov[1].iov_len = avail - contiguous;
+    return 2;
+  }
+
+  void commit_write(size_t len) {
+    if (len > available()) len = available();
+    write_idx_ = (write_idx_ + len) % kCapacity;
+    count_ += len;
+  }
+
+  const T* read_ptr(size_t* out_len) const {
+    if (empty()) { *out_len = 0; return nullptr; }
+    size_t contiguous = kCapacity - read_idx_;
+    *out_len = (contiguous >= count_) ? count_ : contiguous;
+    return buffer_.data() + read_idx_;
+  }
+
+ private:
+  alignas(kCacheLine) std::array<T, kCapacity> buffer_{};
+  size_t read_idx_ = 0;
+  size_t write_idx_ = 0;
+  size_t count_ = 0;
+};
+
+// ============================================================================
+// MpscQueue - Bounded lock-free multi-producer / single-consumer queue
+// ============================================================================
+//
+// Vyukov-style cell sequence numbers: producers claim a cell with one CAS on
+// enqueue_pos_, the consumer publishes freed cells with a release store.
+
+template <typename T, uint32_t Capacity>
+class MpscQueue {
+  static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+ public:
+  MpscQueue() noexcept {
+    for (uint32_t i = 0; i < Capacity; ++i) cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  // fill(T&) writes the element in place; false when full (any thread)
+  template <typename F>
+  bool push_with(F&& fill) {
+    uint32_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell = nullptr;
+    while (true) {
+      cell = &cells_[pos & (Capacity - 1)];
+      uint32_t seq = cell->seq.load(std::memory_order_acquire);
+      int32_t diff = static_cast<int32_t>(seq - pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    fill(cell->value);
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool push(const T& v) { return push_with([&v](T& slot) { slot = v; }); }
+
+  // consume(T&) reads the element in place; false when empty (consumer thread only)
+  template <typename F>
+  bool pop_with(F&& consume) {
+    Cell& cell = cells_[dequeue_pos_ & (Capacity - 1)];
+    uint32_t seq = cell.seq.load(std::memory_order_acquire);
+    if (static_cast<int32_t>(seq - (dequeue_pos_ + 1)) < 0) return false;
+    consume(cell.value);
+    cell.seq.store(dequeue_pos_ + Capacity, std::memory_order_release);
+    ++dequeue_pos_;
+    return true;
+  }
+
+  bool pop(T& out) { return pop_with([&out](T& v) { out = static_cast<T&&>(v); }); }
+
+  static constexpr uint32_t capacity() { return Capacity; }
+
+ private:
+  struct Cell {
+    std::atomic<uint32_t> seq;
+    T value;
+  };
+
+  std::array<Cell, Capacity> cells_;
+  alignas(kCacheLine) std::atomic<uint32_t> enqueue_pos_{0};
+  alignas(kCacheLine) uint32_t dequeue_pos_ = 0;
+};
+
+// ============================================================================
+// SharedFrame - Refcounted pre-encoded server frame
+// ============================================================================
+//
+// One allocation holds the refcount, the topic and the complete frame
+// (header + payload), so a publish is encoded once and every reactor that
+// fans it out shares the same bytes. Copies are an atomic increment. The block
+// returns to the resource it came from on whichever thread drops it last.
+
+class SharedFrame {
+ public:
+  SharedFrame() noexcept = default;
+  SharedFrame(const SharedFrame& other) noexcept : block_(other.block_) {
+    if (block_ != nullptr) block_->refs.fetch_add(1, std::memory_order_relaxed);
+  }
+  SharedFrame(SharedFrame&& other) noexcept : block_(other.block_) { other.block_ = nullptr; }
+  SharedFrame& operator=(SharedFrame other) noexcept {
+    std::swap(block_, other.block_);
+    return *this;
+  }
+  ~SharedFrame() { release(); }
+
+  // Empty on allocation failure; compressed sets RSV1 (payload already deflated)
+  static SharedFrame encode(std::string_view topic, std::string_view payload, ws::OpCode opcode,
+                            bool compressed = false,
+                            std::pmr::memory_resource* resource = std::pmr::new_delete_resource()) {
+    uint8_t header[14];
+    size_t header_len = ws::encode_frame_header(header, opcode, payload.size(), false);
+    if (compressed) header[0] |= 0x40;
+    size_t frame_len = header_len + payload.size();
+    SharedFrame f;
+    void* mem = allocate(resource, sizeof(Block) + topic.size() + frame_len);
+    if (mem == nullptr) return f;
+    f.block_ = new (mem) Block{{1}, static_cast<uint32_t>(topic.size()), static_cast<uint32_t>(frame_len), resource};
+    char* out = f.data();
+    std::memcpy(out, topic.data(), topic.size());
+    std::memcpy(out + topic.size(), header, header_len);
+    std::memcpy(out + topic.size() + header_len, payload.data(), payload.size());
+    return f;
+  }
+
+  // Copy of an already encoded server frame (RSV1 kept); empty if frame does not parse
+  static SharedFrame copy_of(std::string_view frame,
+                             std::pmr::memory_resource* resource = std::pmr::new_delete_resource()) {
+    ws::FrameHeader header;
+    size_t header_size = ws::parse_frame_header(frame, header);
+    if (header_size == 0 || frame.size() < header_size + header.payload_len) return {};
+    return encode({}, frame.substr(header_size, header.payload_len), header.opcode, header.rsv1, resource);
+  }
+
+  std::string_view topic() const { return {data(), block_->topic_len}; }
+  // Ready-to-send frame bytes
+  std::string_view bytes() const { return {data() + block_->topic_len, block_->frame_len}; }
+  ws::OpCode opcode() const { return static_cast<ws::OpCode>(bytes()[0] & 0x0F); }
+  std::string_view payload() const {
+    uint8_t len7 = static_cast<uint8_t>(bytes()[1]) & 0x7F;
+    return bytes().substr(len7 < 126 ? 2 : (len7 == 126 ? 4 : 10));
+  }
+  uint32_t use_count() const { return block_ != nullptr ? block_->refs.load(std::memory_order_relaxed) : 0; }
+  explicit operator bool() const { return block_ != nullptr; }
+
+ private:
+  struct Block {
+    std::atomic<uint32_t> refs;
+    uint32_t topic_len;
+    uint32_t frame_len;
+    std::pmr::memory_resource* resource;
+  };
+
+  static void* allocate(std::pmr::memory_resource* resource, size_t bytes) {
+#if defined(__cpp_exceptions) || defined(__EXCEPTIONS)
+    try {
+      return resource->allocate(bytes, alignof(Block));
+    } catch (const std::bad_alloc&) {
+      return nullptr;
+    }
+#else
+    return resource->allocate(bytes, alignof(Block));
+#endif
+  }
+
+  char* data() const { return reinterpret_cast<char*>(block_ + 1); }
+  void release() {
+    if (block_ != nullptr && block_->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      std::pmr::memory_resource* resource = block_->resource;
+      size_t bytes = sizeof(Block) + block_->topic_len + block_->frame_len;
+      block_->~Block();
+      resource->deallocate(block_, bytes, alignof(Block));
+    }
+    block_ = nullptr;
+  }
+
+  Block* block_ = nullptr;
+};
+
+// ============================================================================
+// permessage-deflate - RFC 7692 negotiation and raw-deflate codecs
+// ============================================================================
+//
+// With server_no_context_takeover the compressor is reset after every message, so
+// the deflated bytes depend only on the payload and the window size: one
+// compression can be shared by every connection that negotiated the same window
+// (Server::broadcast, pub/sub). Connections that keep context are compressed
+// individually.
+
+namespace deflate {
+
+struct Params {
+  bool server_no_context_takeover = false;
+  bool client_no_context_takeover = false;
+  uint8_t server_max_window_bits = 15;
+  uint8_t client_max_window_bits = 15;
+};
+
+// First acceptable permessage-deflate offer in a Sec-WebSocket-Extensions value
+inline bool parse_offer(std::string_view header, Params& out) {
+  auto trim = [](std::string_view v) {
+    while (!v.empty() && (v.front() == ' ' || v.front() == '\t')) v.remove_prefix(1);
+    while (!v.empty() && (v.back() == ' ' || v.back() == '\t')) v.remove_suffix(1);
+    return v;
+  };
+  while (!header.empty()) {
+    size_t comma = header.find(',');
+    std::string_view offer = header.substr(0, comma);
+    header = comma == std::string_view::npos ? std::string_view{} : header.substr(comma + 1);
+
+    size_t semi = offer.find(';');
+    if (trim(offer.substr(0, semi)) != "permessage-deflate") continue;
+    Params p;
+    bool ok = true;
+    while (ok && semi != std::string_view::npos) {
+      offer.remove_prefix(semi + 1);
+      semi = offer.find(';');
+      std::string_view param = trim(offer.substr(0, semi));
+      size_t eq = param.find('=');
+      std::string_view name = trim(param.substr(0, eq));
+      std::string_view value = eq == std::string_view::npos ? std::string_view{} : trim(param.substr(eq + 1));
+      if (value.size() >= 2 && value.front() == '"' && value.back() == '"') value = value.substr(1, value.size() - 2);
+      int bits = value.size() == 1 || value.size() == 2 ? std::atoi(std::string(value).c_str()) : 0;
+      if (name == "server_no_context_takeover") {
+        p.server_no_context_takeover = true;
+      } else if (name == "client_no_context_takeover") {
+        p.client_no_context_takeover = true;
+      } else if (name == "server_max_window_bits") {
+        ok = bits >= 9 && bits <= 15;  // zlib cannot produce an 8-bit raw window
+        p.server_max_window_bits = static_cast<uint8_t>(bits);
+      } else if (name == "client_max_window_bits") {
+        ok = value.empty() || (bits >= 8 && bits <= 15);  // Bare: we may pick; we keep 15
+      } else {
+        ok = false;
+      }
+    }
+    if (ok) {
+      out = p;
+      return true;
+    }
+  }
+  return false;
+}
+
+// Sec-WebSocket-Extensions response value; returns its length, 0 if it does not fit
+inline size_t write_response(const Params& p, char* out, size_t cap) {
+  char buf[128];
+  int n = snprintf(buf, sizeof(buf), "permessage-deflate%s%s",
+                   p.server_no_context_takeover ? "; server_no_context_takeover" : "",
+                   p.client_no_context_takeover ? "; client_no_context_takeover" : "");
+  if (p.server_max_window_bits < 15)
+    n += snprintf(buf + n, sizeof(buf) - static_cast<size_t>(n), "; server_max_window_bits=%u",
+                  static_cast<unsigned>(p.server_max_window_bits));
+  if (static_cast<size_t>(n) >= cap) return 0;
+  std::memcpy(out, buf, static_cast<size_t>(n));
+  return static_cast<size_t>(n);
+}
+
+#if EWSS_HAS_DEFLATE
+
+// zlib's stream state and window come from the codec's memory resource; zfree
+// gets no size, so each block carries it in a header
+inline void* zlib_alloc(void* opaque, uInt items, uInt size) {
+  auto* resource = static_cast<std::pmr::memory_resource*>(opaque);
+  size_t bytes = static_cast<size_t>(items) * size + kCacheLine;
+  auto* p = static_cast<uint8_t*>(resource->allocate(bytes, kCacheLine));
+  *reinterpret_cast<size_t*>(p) = bytes;
+  return p + kCacheLine;
+}
+
+inline void zlib_free(void* opaque, void* address) {
+  auto* p = static_cast<uint8_t*>(address) - kCacheLine;
+  static_cast<std::pmr::memory_resource*>(opaque)->deallocate(p, *reinterpret_cast<size_t*>(p), kCacheLine);
+}
+
+inline void use_resource(z_stream& zs, std::pmr::memory_resource* resource) {
+  zs.zalloc = zlib_alloc;
+  zs.zfree = zlib_free;
+  zs.opaque = resource;
+}
+
+// Raw deflate with the 00 00 FF FF sync-flush tail stripped (RFC 7692 7.2.1)
+class Compressor {
+ public:
+  Compressor(uint8_t window_bits, int level,
+             std::pmr::memory_resource* resource = std::pmr::new_delete_resource()) {
+    use_resource(zs_, resource);
+    ok_ = deflateInit2(&zs_, level, Z_DEFLATED, -static_cast<int>(window_bits), 8, Z_DEFAULT_STRATEGY) == Z_OK;
+  }
+  ~Compressor() { if (ok_) deflateEnd(&zs_); }
+  Compressor(const Compressor&) = delete;
+  Compressor& operator=(const Compressor&) = delete;
+
+  // Replaces out (std::string or std::pmr::string) with the compressed message;
+  // reset drops the context afterwards
+  template <typename String>
+  bool compress(std::string_view in, String& out, bool reset) {
+    if (!ok_) return false;
+    out.resize(deflateBound(&zs_, in.size()) + 16);
+    zs_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    zs_.avail_in = static_cast<uInt>(in.size());
+    zs_.next_out = reinterpret_cast<Bytef*>(&out[0]);
+    zs_.avail_out = static_cast<uInt>(out.size());
+    int rc = ::deflate(&zs_, Z_SYNC_FLUSH);
+    size_t len = out.size() - zs_.avail_out;
+    if (rc != Z_OK || zs_.avail_in != 0 || len < 4) {
+      deflateReset(&zs_);
+      return false;
+    }
+    out.resize(len - 4);
+    if (reset) deflateReset(&zs_);
+    return true;
+  }
+
+ private:
+  z_stream zs_{};
+  bool ok_ = false;
+};
+
+class Decompressor {
+ public:
+  explicit Decompressor(uint8_t window_bits,
+                        std::pmr::memory_resource* resource = std::pmr::new_delete_resource()) {
+    use_resource(zs_, resource);
+    ok_ = inflateInit2(&zs_, -static_cast<int>(window_bits)) == Z_OK;
+  }
+  ~Decompressor() { if (ok_) inflateEnd(&zs_); }
+  Decompressor(const Decompressor&) = delete;
+  Decompressor& operator=(const Decompressor&) = delete;
+
+  // Replaces out with the inflated message: kFrameParseError on corrupt input,
+  // kBufferFull above max_out
+  template <typename String>
+  expected<void, ErrorCode> decompress(std::string_view in, String& out, size_t max_out, bool reset) {
+    static const uint8_t kTail[4] = {0x00, 0x00, 0xFF, 0xFF};
+    if (!ok_) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    out.clear();
+    ErrorCode rc = feed(reinterpret_cast<const uint8_t*>(in.data()), in.size(), out, max_out);
+    if (rc == ErrorCode::kOk) rc = feed(kTail, sizeof(kTail), out, max_out);
+    if (rc != ErrorCode::kOk || reset) inflateReset(&zs_);
+    if (rc != ErrorCode::kOk) return expected<void, ErrorCode>::error(rc);
+    return expected<void, ErrorCode>::success();
+  }
+
+ private:
+  template <typename String>
+  ErrorCode feed(const uint8_t* in, size_t len, String& out, size_t max_out) {
+    zs_.next_in = const_cast<Bytef*>(in);
+    zs_.avail_in = static_cast<uInt>(len);
+    while (zs_.avail_in > 0) {
+      uint8_t chunk[4096];
+      zs_.next_out = chunk;
+      zs_.avail_out = sizeof(chunk);
+      int rc = ::inflate(&zs_, Z_SYNC_FLUSH);
+      if (rc != Z_OK && rc != Z_BUF_ERROR && rc != Z_STREAM_END) return ErrorCode::kFrameParseError;
+      size_t produced = sizeof(chunk) - zs_.avail_out;
+      if (out.size() + produced > max_out) return ErrorCode::kBufferFull;
+      out.append(reinterpret_cast<const char*>(chunk), produced);
+      if (rc == Z_BUF_ERROR && produced == 0) break;
+    }
+    return ErrorCode::kOk;
+  }
+
+  z_stream zs_{};
+  bool ok_ = false;
+};
+
+// Per-thread context-free compressor for a window size (reset after every message)
+inline Compressor& shared_compressor(uint8_t window_bits, int level) {
+  thread_local std::unique_ptr<Compressor> slots[8];
+  thread_local int levels[8] = {};
+  auto& slot = slots[window_bits - 8];
+  if (slot == nullptr || levels[window_bits - 8] != level) {
+    slot = std::make_unique<Compressor>(window_bits, level);
+    levels[window_bits - 8] = level;
+  }
+  return *slot;
+}
+
+// plain's message deflated once for every no-context-takeover subscriber with this window
+inline SharedFrame compress_shared(const SharedFrame& plain, uint8_t window_bits, int level,
+                                   std::pmr::memory_resource* resource = std::pmr::new_delete_resource()) {
+  thread_local std::string out;
+  if (!shared_compressor(window_bits, level).compress(plain.payload(), out, true)) return {};
+  return SharedFrame::encode(plain.topic(), out, plain.opcode(), true, resource);
+}
+
+#endif  // EWSS_HAS_DEFLATE
+
+}  // namespace deflate
+
+// Server-side permessage-deflate settings (Server::set_permessage_deflate)
+struct DeflatePolicy {
+  bool server_no_context_takeover = true;  // Asked for even if the client did not: enables compress-once
+  int level = 6;
+  size_t min_size = 64;                    // Smaller messages are sent uncompressed
+  size_t max_inflated = 1 << 20;           // Larger inflated messages close with 1009
+};
+
+// ============================================================================
+// ShmRing - SPSC variable-length record ring over caller-provided memory
+// ============================================================================
+
+// Records are {kind, len, key, payload} padded to 8 bytes and never split:
+// a record that would straddle the end is preceded by a wrap marker, so
+// consumers always see a contiguous payload they can frame from in place.
+// The header lives in the same region, so the ring works across processes
+// when the region is a shared mapping.
+class ShmRing {
+ public:
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "ShmRing needs lock-free 64-bit atomics");
+
+  struct Header {
+    alignas(kCacheLine) std::atomic<uint64_t> head;            // Producer position (monotonic bytes)
+    alignas(kCacheLine) std::atomic<uint64_t> tail;            // Consumer position (monotonic bytes)
+    alignas(kCacheLine) std::atomic<uint32_t> consumer_waiting;  // Consumer is about to block
+    uint32_t reserved;
+    uint64_t capacity;
+  };
+
+  struct Record {
+    uint32_t kind;
+    uint64_t key;
+    const uint8_t* data;
+    uint32_t len;
+  };
+
+  static constexpr size_t kRecordHeader = 16;
+  static constexpr uint32_t kWrapMarker = 0xFFFFFFFFU;
+
+  static size_t bytes_for(size_t capacity) { return sizeof(Header) + capacity; }
+
+  // Initialize a fresh ring in mem (capacity: power of two, >= 64)
+  void format(void* mem, size_t capacity) {
+    EWSS_ASSERT((capacity & (capacity - 1)) == 0 && capacity >= 64);
+    hdr_ = ::new (mem) Header{};
+    hdr_->head.store(0, std::memory_order_relaxed);
+    hdr_->tail.store(0, std::memory_order_relaxed);
+    hdr_->consumer_waiting.store(0, std::memory_order_relaxed);
+    hdr_->capacity = capacity;
+    data_ = static_cast<uint8_t*>(mem) + sizeof(Header);
+    cap_ = capacity;
+    corrupt_ = false;
+  }
+
+  // Map an already formatted ring
+  void attach(void* mem) {
+    hdr_ = static_cast<Header*>(mem);
+    data_ = static_cast<uint8_t*>(mem) + sizeof(Header);
+    cap_ = hdr_->capacity;
+    corrupt_ = false;
+  }
+
+  // Producer: copy one record into the ring (false if it does not fit)
+  bool push(uint32_t kind, uint64_t key, const void* data, uint32_t len) {
+    return push(kind, key, nullptr, 0, data, len);
+  }
+
+  // Producer: one record whose payload is prefix followed by data
+  bool push(uint32_t kind, uint64_t key, const void* prefix, uint32_t prefix_len, const void* data, uint32_t data_len) {
+    uint32_t len = prefix_len + data_len;
+    uint64_t size = record_size(len);
+    uint64_t head = hdr_->head.load(std::memory_order_relaxed);
+    uint64_t tail = hdr_->tail.load(std::memory_order_acquire);
+    uint64_t offset = head & (cap_ - 1);
+    uint64_t contiguous = cap_ - offset;
+    uint64_t needed = size > contiguous ? contiguous + size : size;
+    if (size > cap_ || needed > cap_ - (head - tail)) return false;
+
+    if (size > contiguous) {
+      std::memcpy(data_ + offset, &kWrapMarker, sizeof(kWrapMarker));
+      head += contiguous;
+      offset = 0;
+    }
+    uint8_t* dst = data_ + offset;
+    std::memcpy(dst, &kind, sizeof(kind));
+    std::memcpy(dst + 4, &len, sizeof(len));
+    std::memcpy(dst + 8, &key, sizeof(key));
+    if (prefix_len > 0) std::memcpy(dst + kRecordHeader, prefix, prefix_len);
+    if (data_len > 0) std::memcpy(dst + kRecordHeader + prefix_len, data, data_len);
+    hdr_->head.store(head + size, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer: view the oldest record in place (valid until pop()). The producer may
+  // live in another process, so positions and lengths are checked against the ring;
+  // an inconsistent ring is marked corrupt() and yields nothing from then on
+  bool peek(Record& out) {
+    if (corrupt_) return false;
+    uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+    uint64_t head = hdr_->head.load(std::memory_order_acquire);
+    if (head - tail > cap_) return fail();
+    while (tail != head) {
+      uint64_t offset = tail & (cap_ - 1);
+      const uint8_t* src = data_ + offset;
+      uint32_t kind;
+      std::memcpy(&kind, src, sizeof(kind));
+      if (kind == kWrapMarker) {
+        if (cap_ - offset > head - tail) return fail();
+        tail += cap_ - offset;
+        hdr_->tail.store(tail, std::memory_order_release);
+        continue;
+      }
+      if (cap_ - offset < kRecordHeader) return fail();
+      uint32_t len;
+      std::memcpy(&len, src + 4, sizeof(len));
+      uint64_t size = record_size(len);
+      if (size > cap_ - offset || size > head - tail) return fail();
+      out.kind = kind;
+      out.len = len;
+      std::memcpy(&out.key, src + 8, sizeof(out.key));
+      out.data = src + kRecordHeader;
+      pending_pop_ = size;
+      return true;
+    }
+    return false;
+  }
+
+  void pop() {
+    uint64_t tail = hdr_->tail.load(std::memory_order_relaxed);
+    hdr_->tail.store(tail + pending_pop_, std::memory_order_release);
+    pending_pop_ = 0;
+  }
+
+  bool empty() const {
+    return hdr_->head.load(std::memory_order_acquire) == hdr_->tail.load(std::memory_order_relaxed);
+  }
+  size_t capacity() const { return cap_; }
+  size_t max_payload() const { return cap_ / 2 - kRecordHeader; }
+  Header* header() { return hdr_; }
+  // peek() found a record or position the producer could not have written
+  bool corrupt() const { return corrupt_; }
+
+ private:
+  Header* hdr_ = nullptr;
+  uint8_t* data_ = nullptr;
+  uint64_t cap_ = 0;
+  uint64_t pending_pop_ = 0;
+  bool corrupt_ = false;
+
+  bool fail() {
+    corrupt_ = true;
+    return false;
+  }
+
+  static uint64_t record_size(uint32_t len) { return (kRecordHeader + len + 7U) & ~uint64_t{7}; }
+};
+
+// ============================================================================
+// IpcChannel - memfd-backed ring pair with eventfd wakeups
+// ============================================================================
+
+// Carries inbound WebSocket events (server -> app) and outbound send
+// commands (app -> server) keyed by connection id. The server creates the
+// channel and hands memfd()/to_app_fd()/to_server_fd() to the application
+// process (fork inheritance or send_fds()); the app calls attach().
+class IpcChannel {
+ public:
+  enum class Kind : uint32_t {
+    kOpen = 1,    // server -> app: connection opened (empty payload)
+    kText = 2,    // both ways: text message / send text
+    kBinary = 3,  // both ways: binary message / send binary
+    kClose = 4    // server -> app: closed; app -> server: close (optional 2-byte code)
+  };
+
+  struct Message {
+    Kind kind;
+    uint64_t conn_id;
+    std::string_view payload;
+  };
+
+  static constexpr size_t kDefaultRingBytes = 1U << 20;
+  static constexpr uint32_t kMagic = 0x43504957;  // "WIPC"
+
+  IpcChannel() = default;
+  ~IpcChannel() { close(); }
+  IpcChannel(const IpcChannel&) = delete;
+  IpcChannel& operator=(const IpcChannel&) = delete;
+
+  // Server side: allocate the shared region and both eventfds
+  expected<void, ErrorCode> create(size_t ring_bytes = kDefaultRingBytes) {
+    close();
+    size_t cap = 64;
+    while (cap < ring_bytes) cap <<= 1;
+    memfd_ = ::memfd_create("ewss_ipc", MFD_CLOEXEC);
+    to_app_efd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    to_server_efd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (memfd_ < 0 || to_app_efd_ < 0 || to_server_efd_ < 0) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    }
+    size_ = region_size(cap);
+    if (::ftruncate(memfd_, static_cast<off_t>(size_)) < 0 || !map()) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    }
+    auto* meta = static_cast<uint64_t*>(base_);
+    meta[1] = cap;
+    inbound_.format(ring_mem(0), cap);
+    outbound_.format(ring_mem(cap), cap);
+    meta[0] = kMagic;
+    is_server_ = true;
+    return expected<void, ErrorCode>::success();
+  }
+
+  // App side: map a channel created by the server (takes ownership of the fds)
+  expected<void, ErrorCode> attach(int memfd, int to_app_efd, int to_server_efd) {
+    close();
+    memfd_ = memfd; to_app_efd_ = to_app_efd; to_server_efd_ = to_server_efd;
+    struct stat st;
+    if (::fstat(memfd_, &st) < 0 || static_cast<size_t>(st.st_size) < kMetaSize) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (!map()) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    }
+    const auto* meta = static_cast<const uint64_t*>(base_);
+    if (meta[0] != kMagic || region_size(meta[1]) != size_) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    inbound_.attach(ring_mem(0));
+    outbound_.attach(ring_mem(meta[1]));
+    is_server_ = false;
+    return expected<void, ErrorCode>::success();
+  }
+
+  // Produce one message towards the peer; wakes it only if it is blocked
+  bool send(Kind kind, uint64_t conn_id, std::string_view payload) {
+    ShmRing& ring = tx_ring();
+    if (payload.size() > ring.max_payload()) return false;
+    if (!ring.push(static_cast<uint32_t>(kind), conn_id, payload.data(),
+                   static_cast<uint32_t>(payload.size())))
+      return false;
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (ring.header()->consumer_waiting.load(std::memory_order_relaxed) != 0) {
+      uint64_t one = 1;
+      (void)!::write(is_server_ ? to_app_efd_ : to_server_efd_, &one, sizeof(one));
+    }
+    return true;
+  }
+
+  // Consume up to max_messages; payload views are valid only inside fn. A malformed
+  // record (see broken()) stops the channel for good
+  template <typename F>
+  size_t drain(F&& fn, size_t max_messages = SIZE_MAX) {
+    ShmRing& ring = rx_ring();
+    ShmRing::Record rec;
+    size_t n = 0;
+    while (!broken_ && n < max_messages && ring.peek(rec)) {
+      if (rec.kind < static_cast<uint32_t>(Kind::kOpen) || rec.kind > static_cast<uint32_t>(Kind::kClose)) {
+        broken_ = true;
+        break;
+      }
+      fn(Message{static_cast<Kind>(rec.kind), rec.key,
+                 std::string_view(reinterpret_cast<const char*>(rec.data), rec.len)});
+      ring.pop();
+      ++n;
+    }
+    broken_ = broken_ || ring.corrupt();
+    return n;
+  }
+  // The peer wrote a record this side cannot trust; nothing more is consumed
+  bool broken() const { return broken_; }
+
+  // Announce that we are about to block on wait_fd(); false if data is already pending
+  bool arm() {
+    ShmRing& ring = rx_ring();
+    ring.header()->consumer_waiting.store(1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!broken_ && !ring.empty()) {
+      disarm();
+      return false;
+    }
+    return true;
+  }
+
+  void disarm() { rx_ring().header()->consumer_waiting.store(0, std::memory_order_relaxed); }
+
+  // Reset the eventfd after wait_fd() polled readable
+  void consume_wakeup() {
+    uint64_t count;
+    (void)!::read(wait_fd(), &count, sizeof(count));
+  }
+
+  // Block until the peer produced something or timeout_ms elapsed
+  void wait(int timeout_ms) {
+    if (!arm()) return;
+    struct pollfd pfd = {wait_fd(), POLLIN, 0};
+    if (::poll(&pfd, 1, timeout_ms) > 0) consume_wakeup();
+    disarm();
+  }
+
+  int wait_fd() const { return is_server_ ? to_server_efd_ : to_app_efd_; }
+  int memfd() const { return memfd_; }
+  int to_app_fd() const { return to_app_efd_; }
+  int to_server_fd() const { return to_server_efd_; }
+  bool is_open() const { return base_ != nullptr; }
+
+  // Pass the three channel fds to another process over a Unix socket
+  static bool send_fds(int unix_sock, const IpcChannel& ch) {
+    int fds[3] = {ch.memfd_, ch.to_app_efd_, ch.to_server_efd_};
+    char byte = 'F';
+    struct iovec iov = {&byte, 1};
+    alignas(struct cmsghdr) char ctrl[CMSG_SPACE(sizeof(fds))] = {};
+    struct msghdr msg{};
+    msg.msg_iov = &iov; msg.msg_iovlen = 1;
+    msg.msg_control = ctrl; msg.msg_controllen = sizeof(ctrl);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET; cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cm), fds, sizeof(fds));
+    return ::sendmsg(unix_sock, &msg, MSG_NOSIGNAL) == 1;
+  }
+
+  // Receive fds sent with send_fds() and attach to them
+  expected<void, ErrorCode> attach_from(int unix_sock) {
+    int fds[3];
+    char byte;
+    struct iovec iov = {&byte, 1};
+    alignas(struct cmsghdr) char ctrl[CMSG_SPACE(sizeof(fds))] = {};
+    struct msghdr msg{};
+    msg.msg_iov = &iov; msg.msg_iovlen = 1;
+    msg.msg_control = ctrl; msg.msg_controllen = sizeof(ctrl);
+    if (::recvmsg(unix_sock, &msg, 0) != 1)
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    struct cmsghdr* cm = CMSG_FIRSTHDR(&msg);
+    if (cm == nullptr || cm->cmsg_type != SCM_RIGHTS || cm->cmsg_len != CMSG_LEN(sizeof(fds)))
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    std::memcpy(fds, CMSG_DATA(cm), sizeof(fds));
+    return attach(fds[0], fds[1], fds[2]);
+  }
+
+  void close() {
+    if (base_ != nullptr) { ::munmap(base_, size_); base_ = nullptr; }
+    if (memfd_ >= 0) { ::close(memfd_); memfd_ = -1; }
+    if (to_app_efd_ >= 0) { ::close(to_app_efd_); to_app_efd_ = -1; }
+    if (to_server_efd_ >= 0) { ::close(to_server_efd_); to_server_efd_ = -1; }
+    broken_ = false;
+  }
+
+ private:
+  static constexpr size_t kMetaSize = kCacheLine;
+
+  int memfd_ = -1;
+  int to_app_efd_ = -1;
+  int to_server_efd_ = -1;
+  void* base_ = nullptr;
+  size_t size_ = 0;
+  bool is_server_ = true;
+  bool broken_ = false;
+  ShmRing inbound_;   // server -> app
+  ShmRing outbound_;  // app -> server
+
+  static size_t region_size(size_t cap) { return kMetaSize + 2 * ShmRing::bytes_for(cap); }
+  void* ring_mem(size_t cap_before) {
+    size_t off = kMetaSize + (cap_before == 0 ? 0 : ShmRing::bytes_for(cap_before));
+    return static_cast<uint8_t*>(base_) + off;
+  }
+  bool map() {
+    void* p = ::mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, memfd_, 0);
+    if (p == MAP_FAILED) return false;
+    base_ = p;
+    return true;
+  }
+  ShmRing& tx_ring() { return is_server_ ? inbound_ : outbound_; }
+  ShmRing& rx_ring() { return is_server_ ? outbound_ : inbound_; }
+};
+
+// ============================================================================
+// TrafficCapture - Inbound frames to an append-only memory-mapped file
+// ============================================================================
+//
+// The reactor pushes {conn id, timestamp, first header byte, payload} into a
+// ShmRing and never blocks: a full ring or an oversized frame is counted as
+// dropped. A writer thread drains the ring into a file mapping that grows in
+// chunks and publishes the committed length in the file header after every
+// batch, so a capture cut short by a crash is still readable. One capture per
+// reactor (the ring has a single producer).
+
+struct CaptureFileHeader {
+  static constexpr uint64_t kMagic = 0x31504143535745ULL;  // "EWSCAP1"
+  static constexpr uint32_t kVersion = 1;
+
+  uint64_t magic;
+  uint32_t version;
+  uint32_t header_size;
+  uint64_t start_ns;                 // steady_clock at open()
+  std::atomic<uint64_t> data_bytes;  // Committed record bytes after the header
+  uint64_t reserved[4];
+};
+
+// On-disk record; payload follows, padded to 8 bytes
+struct CaptureRecordHeader {
+  uint64_t ts_ns;    // steady_clock
+  uint64_t conn_id;
+  uint32_t len;
+  uint8_t flags;     // FIN | opcode of the frame as delivered (RSV1 cleared: payload is inflated)
+  uint8_t reserved[3];
+};
+
+struct CapturedFrame {
+  uint64_t ts_ns;
+  uint64_t conn_id;
+  uint8_t flags;
+  std::string_view payload;
+  ws::OpCode opcode() const { return static_cast<ws::OpCode>(flags & 0x0F); }
+};
+
+class TrafficCapture {
+ public:
+  TrafficCapture() = default;
+  ~TrafficCapture() { close(); }
+  TrafficCapture(const TrafficCapture&) = delete;
+  TrafficCapture& operator=(const TrafficCapture&) = delete;
+
+  // Create (truncate) path and start the writer; ring_bytes is a power of two
+  expected<void, ErrorCode> open(const std::string& path, size_t ring_bytes = 4U << 20);
+  // Stop the writer after draining the ring and trim the file to its contents
+  void close();
+
+  // Reactor thread: copy one delivered frame into the ring (close() only after the reactor stops)
+  void record(uint64_t conn_id, uint8_t flags, const void* payload, size_t len) {
+    if (ring_mem_ == nullptr) return;
+    if (len > ring_.max_payload() - sizeof(uint64_t)) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    uint64_t ts = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    if (ring_.push(flags, conn_id, &ts, sizeof(ts), payload, static_cast<uint32_t>(len)))
+      captured_.fetch_add(1, std::memory_order_relaxed);
+    else
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  bool is_open() const { return running_.load(std::memory_order_relaxed); }
+  uint64_t captured() const { return captured_.load(std::memory_order_relaxed); }
+  uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+  // Record bytes committed to the file so far
+  uint64_t written_bytes() const { return written_.load(std::memory_order_acquire); }
+
+ private:
+  static constexpr size_t kGrowChunk = 16U << 20;
+
+  int fd_ = -1;
+  void* ring_mem_ = nullptr;
+  size_t ring_mem_size_ = 0;
+  ShmRing ring_;
+  CaptureFileHeader* file_ = nullptr;
+  size_t mapped_ = 0;
+  std::thread writer_;
+  std::atomic<bool> running_{false};
+  std::atomic<uint64_t> captured_{0};
+  std::atomic<uint64_t> dropped_{0};
+  std::atomic<uint64_t> written_{0};  // Mirror of the header's data_bytes (the mapping moves as it grows)
+
+  bool remap(size_t size);
+  bool drain();
+};
+
+// Sequential reader over a capture file (read-only mapping)
+class CaptureReader {
+ public:
+  CaptureReader() = default;
+  ~CaptureReader() { close(); }
+  CaptureReader(const CaptureReader&) = delete;
+  CaptureReader& operator=(const CaptureReader&) = delete;
+
+  expected<void, ErrorCode> open(const std::string& path) {
+    close();
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || static_cast<size_t>(st.st_size) < sizeof(CaptureFileHeader)) {
+      ::close(fd);
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    void* p = ::mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    base_ = static_cast<const uint8_t*>(p);
+    size_ = static_cast<size_t>(st.st_size);
+    const auto* hdr = reinterpret_cast<const CaptureFileHeader*>(base_);
+    if (hdr->magic != CaptureFileHeader::kMagic || hdr->version != CaptureFileHeader::kVersion ||
+        hdr->header_size != sizeof(CaptureFileHeader)) {
+      close();
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    start_ns_ = hdr->start_ns;
+    end_ = std::min<size_t>(size_, sizeof(CaptureFileHeader) + hdr->data_bytes.load(std::memory_order_acquire));
+    rewind();
+    return expected<void, ErrorCode>::success();
+  }
+
+  // Next frame in capture order; payload views the mapping (valid until close())
+  bool next(CapturedFrame& out) {
+    if (end_ - pos_ < sizeof(CaptureRecordHeader)) return false;
+    CaptureRecordHeader rec;
+    std::memcpy(&rec, base_ + pos_, sizeof(rec));
+    size_t body = (static_cast<size_t>(rec.len) + 7U) & ~size_t{7};
+    if (end_ - pos_ - sizeof(rec) < body) return false;
+    out.ts_ns = rec.ts_ns;
+    out.conn_id = rec.conn_id;
+    out.flags = rec.flags;
+    out.payload = std::string_view(reinterpret_cast<const char*>(base_ + pos_ + sizeof(rec)), rec.len);
+    pos_ += sizeof(rec) + body;
+    return true;
+  }
+
+  void rewind() { pos_ = sizeof(CaptureFileHeader); }
+  uint64_t start_ns() const { return start_ns_; }
+
+  void close() {
+    if (base_ != nullptr) ::munmap(const_cast<uint8_t*>(base_), size_);
+    base_ = nullptr;
+    size_ = end_ = pos_ = 0;
+  }
+
+ private:
+  const uint8_t* base_ = nullptr;
+  size_t size_ = 0;
+  size_t end_ = 0;
+  size_t pos_ = 0;
+  uint64_t start_ns_ = 0;
+};
+
+inline expected<void, ErrorCode> TrafficCapture::open(const std::string& path, size_t ring_bytes) {
+  close();
+  ring_mem_size_ = ShmRing::bytes_for(ring_bytes);
+  void* mem = ::mmap(nullptr, ring_mem_size_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+  ring_mem_ = mem;
+  ring_.format(ring_mem_, ring_bytes);
+  written_ = 0;
+
+  fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd_ < 0 || !remap(kGrowChunk)) {
+    close();
+    return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+  }
+  file_->version = CaptureFileHeader::kVersion;
+  file_->header_size = sizeof(CaptureFileHeader);
+  file_->start_ns = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  file_->data_bytes.store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  file_->magic = CaptureFileHeader::kMagic;
+
+  running_ = true;
+  writer_ = std::thread([this]() {
+    while (running_.load(std::memory_order_relaxed)) {
+      if (!drain()) break;
+      if (ring_.empty()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    drain();
+  });
+  return expected<void, ErrorCode>::success();
+}
+
+inline void TrafficCapture::close() {
+  running_ = false;
+  if (writer_.joinable()) writer_.join();
+  if (file_ != nullptr) {
+    size_t used = sizeof(CaptureFileHeader) + file_->data_bytes.load(std::memory_order_relaxed);
+    ::munmap(static_cast<void*>(file_), mapped_);
+    file_ = nullptr;
+    mapped_ = 0;
+    int rc = ::ftruncate(fd_, static_cast<off_t>(used));  // On failure the header still bounds the records
+    (void)rc;
+  }
+  if (fd_ >= 0) { ::close(fd_); fd_ = -1; }
+  if (ring_mem_ != nullptr) {
+    ::munmap(ring_mem_, ring_mem_size_);
+    ring_mem_ = nullptr;
+  }
+}
+
+// Grow the file and its mapping to size bytes
+inline bool TrafficCapture::remap(size_t size) {
+  if (::ftruncate(fd_, static_cast<off_t>(size)) < 0) return false;
+  void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (p == MAP_FAILED) return false;
+  if (file_ != nullptr) ::munmap(static_cast<void*>(file_), mapped_);
+  file_ = static_cast<CaptureFileHeader*>(p);
+  mapped_ = size;
+  return true;
+}
+
+// Writer thread: move every queued record into the file; false when the file cannot grow
+inline bool TrafficCapture::drain() {
+  uint64_t used = file_->data_bytes.load(std::memory_order_relaxed);
+  ShmRing::Record r;
+  bool ok = true;
+  while (ring_.peek(r)) {
+    CaptureRecordHeader rec{};
+    std::memcpy(&rec.ts_ns, r.data, sizeof(rec.ts_ns));
+    rec.conn_id = r.key;
+    rec.len = r.len - static_cast<uint32_t>(sizeof(rec.ts_ns));
+    rec.flags = static_cast<uint8_t>(r.kind);
+    size_t size = sizeof(rec) + ((static_cast<size_t>(rec.len) + 7U) & ~size_t{7});
+    size_t offset = sizeof(CaptureFileHeader) + used;
+    if (offset + size > mapped_ && !remap(std::max(mapped_ * 2, offset + size))) {
+      ok = false;
+      break;
+    }
+    uint8_t* dst = reinterpret_cast<uint8_t*>(file_) + offset;
+    std::memcpy(dst, &rec, sizeof(rec));
+    std::memcpy(dst + sizeof(rec), r.data + sizeof(rec.ts_ns), rec.len);
+    used += size;
+    ring_.pop();
+  }
+  file_->data_bytes.store(used, std::memory_order_release);
+  written_.store(used, std::memory_order_release);
+  return ok;
+}
+
+// ============================================================================
+// TimerQueue - Fixed-capacity one-shot timers driven by the reactor
+// ============================================================================
+//
+// Binary min-heap of slot indices over a preallocated slot table. Timer ids
+// carry the slot in their low 16 bits, so cancel() is O(1); cancelled slots
+// stay in the heap until they reach the top. Reactor thread only.
+
+class TimerQueue {
+ public:
+  using Clock = std::chrono::steady_clock;
+  using TimerId = uint64_t;  // 0 is never issued
+  using Callback = FixedFunction<void(), 4 * sizeof(void*)>;
+  static constexpr uint32_t kCapacity = 256;
+
+  TimerQueue() noexcept {
+    for (uint32_t i = 0; i < kCapacity; ++i) free_[i] = static_cast<uint16_t>(kCapacity - 1 - i);
+    free_count_ = kCapacity;
+  }
+
+  // Returns 0 when all slots are in use
+  TimerId schedule_at(Clock::time_point deadline, Callback cb) {
+    if (free_count_ == 0) return 0;
+    uint16_t slot = free_[--free_count_];
+    Slot& s = slots_[slot];
+    s.deadline = deadline;
+    s.id = (next_seq_++ << 16) | slot;
+    s.cb = static_cast<Callback&&>(cb);
+    heap_[heap_size_++] = slot;
+    sift_up(heap_size_ - 1);
+    ++live_;
+    return s.id;
+  }
+
+  TimerId schedule(std::chrono::microseconds delay, Callback cb) {
+    return schedule_at(Clock::now() + delay, static_cast<Callback&&>(cb));
+  }
+
+  bool cancel(TimerId id) {
+    if (id == 0) return false;
+    Slot& s = slots_[id & 0xFFFF];
+    if (s.id != id) return false;
+    s.id = 0;
+    s.cb = nullptr;
+    --live_;
+    return true;
+  }
+
+  // poll() timeout: ms until the earliest deadline (rounded up), capped at cap_ms (-1 = no cap)
+  int timeout_ms(Clock::time_point now, int cap_ms) const {
+    if (heap_size_ == 0) return cap_ms;
+    auto wait = slots_[heap_[0]].deadline - now;
+    if (wait <= Clock::duration::zero()) return 0;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(wait + std::chrono::microseconds(999)).count();
+    if (cap_ms >= 0 && ms > cap_ms) return cap_ms;
+    return static_cast<int>(ms);
+  }
+
+  // Fire every timer due at `now`; callbacks may schedule or cancel timers
+  size_t run_expired(Clock::time_point now) {
+    size_t fired = 0;
+    for (uint32_t budget = kCapacity; budget > 0 && heap_size_ > 0; --budget) {
+      uint16_t slot = heap_[0];
+      if (slots_[slot].deadline > now) break;
+      pop_top();
+      Slot& s = slots_[slot];
+      free_[free_count_++] = slot;
+      if (s.id == 0) continue;  // Cancelled
+      s.id = 0;
+      --live_;
+      Callback cb = static_cast<Callback&&>(s.cb);
+      cb();
+      ++fired;
+    }
+    return fired;
+  }
+
+  size_t size() const { return live_; }
+  bool full() const { return free_count_ == 0; }
+
+  // Queue of the reactor running on this thread (set by Server::run)
+  static TimerQueue*& current() {
+    static thread_local TimerQueue* queue = nullptr;
+    return queue;
+  }
+
+ private:
+  struct Slot {
+    Clock::time_point deadline{};
+    TimerId id = 0;
+    Callback cb;
+  };
+
+  void sift_up(uint32_t i) {
+    while (i > 0) {
+      uint32_t parent = (i - 1) / 2;
+      if (slots_[heap_[parent]].deadline <= slots_[heap_[i]].deadline) break;
+      std::swap(heap_[parent], heap_[i]);
+      i = parent;
+    }
+  }
+
+  void pop_top() {
+    heap_[0] = heap_[--heap_size_];
+    uint32_t i = 0;
+    while (true) {
+      uint32_t l = 2 * i + 1, r = l + 1, m = i;
+      if (l < heap_size_ && slots_[heap_[l]].deadline < slots_[heap_[m]].deadline) m = l;
+      if (r < heap_size_ && slots_[heap_[r]].deadline < slots_[heap_[m]].deadline) m = r;
+      if (m == i) break;
+      std::swap(heap_[m], heap_[i]);
+      i = m;
+    }
+  }
+
+  std::array<Slot, kCapacity> slots_;
+  std::array<uint16_t, kCapacity> heap_{};
+  std::array<uint16_t, kCapacity> free_{};
+  uint32_t heap_size_ = 0;
+  uint32_t free_count_ = 0;
+  size_t live_ = 0;
+  uint64_t next_seq_ = 1;
+};
+
+// ============================================================================
+// Session resumption - Sequence-numbered resend window per session
+// ============================================================================
+//
+// A resumable connection numbers the data messages it sends (1, 2, ...) and keeps
+// the encoded frames in a bounded window that outlives the connection for
+// linger_ms. Frames are SharedFrame references, so a broadcast retained by many
+// sessions is stored once. The 101 response carries "X-Ewss-Session: <token> <n>",
+// n being the last sequence the client already holds (0 for a new session). A
+// client reconnecting with "?resume=<token>&last_seq=<n>" receives frames n+1..
+// before anything new; when n has left the window it gets a fresh session.
+// While a gap is pending, newer messages wait in the window behind it.
+
+class Connection;
+
+struct ResumePolicy {
+  uint32_t window_messages = 256;   // Frames retained per session
+  uint32_t window_bytes = 1U << 20;  // Frame bytes retained per session
+  uint32_t linger_ms = 30000;       // How long a detached session stays resumable
+  uint32_t max_sessions = 4096;     // Per reactor, attached and detached
+};
+
+class ResumeSession {
+ public:
+  ResumeSession(std::string_view token, const ResumePolicy& policy, uint8_t deflate_window = 0,
+                std::pmr::memory_resource* resource = std::pmr::new_delete_resource())
+      : token_(token, resource), window_bytes_(policy.window_bytes),
+        frames_(std::max<uint32_t>(policy.window_messages, 1), resource), deflate_window_(deflate_window) {}
+
+  const std::pmr::string& token() const { return token_; }
+  // permessage-deflate window bits the retained frames may be compressed with; 0: plain
+  uint8_t deflate_window() const { return deflate_window_; }
+  // Sequence the next message will get; [first_seq(), next_seq()) are retained
+  uint64_t next_seq() const { return next_seq_; }
+  uint64_t first_seq() const { return next_seq_ - count_; }
+  size_t retained_bytes() const { return bytes_; }
+
+  // Retain frame as next_seq(), evicting the oldest past either bound
+  void push(SharedFrame frame) {
+    if (count_ == frames_.size()) evict();
+    bytes_ += frame.bytes().size();
+    frames_[(first_ + count_) % frames_.size()] = std::move(frame);
+    ++count_;
+    ++next_seq_;
+    while (bytes_ > window_bytes_ && count_ > 1) evict();
+  }
+  const SharedFrame& at(uint64_t seq) const {
+    return frames_[(first_ + static_cast<size_t>(seq - first_seq())) % frames_.size()];
+  }
+  // A client holding everything through last_seq can continue from here
+  bool covers(uint64_t last_seq) const { return last_seq < next_seq_ && last_seq + 1 >= first_seq(); }
+
+  Connection* owner = nullptr;  // Attached connection; nullptr while detached
+  std::chrono::steady_clock::time_point detached_at{};
+
+ private:
+  std::pmr::string token_;
+  size_t window_bytes_;
+  std::pmr::vector<SharedFrame> frames_;
+  size_t first_ = 0;  // Slot of first_seq()
+  size_t count_ = 0;
+  size_t bytes_ = 0;
+  uint64_t next_seq_ = 1;
+  uint8_t deflate_window_;
+
+  void evict() {
+    bytes_ -= frames_[first_].bytes().size();
+    frames_[first_] = SharedFrame();
+    first_ = (first_ + 1) % frames_.size();
+    --count_;
+  }
+};
+
+// Per-reactor table of resumable sessions keyed by token
+class SessionStore {
+ public:
+  using Clock = std::chrono::steady_clock;
+
+  // Sessions, their windows and the table itself are allocated from resource
+  SessionStore(const ResumePolicy& policy, ServerStats& stats,
+               std::pmr::memory_resource* resource = std::pmr::new_delete_resource())
+      : policy_(policy), stats_(stats), sessions_(resource) {}
+
+  // Session for an upgrade presenting token/last_seq (empty token: none). Resumes
+  // when the window covers last_seq and its frames were encoded for the same
+  // deflate_window (resumed = true), else opens a fresh one; nullptr when the table
+  // is full of live sessions.
+  std::shared_ptr<ResumeSession> open(std::string_view token, uint64_t last_seq, uint8_t deflate_window,
+                                      bool& resumed) {
+    resumed = false;
+    if (!token.empty()) {
+      auto it = sessions_.find(token);
+      if (it != sessions_.end() && it->second->covers(last_seq) && it->second->deflate_window() == deflate_window) {
+        resumed = true;
+        stats_.sessions_resumed.fetch_add(1, std::memory_order_relaxed);
+        stats_.resent_frames.fetch_add(it->second->next_seq() - last_seq - 1, std::memory_order_relaxed);
+        return it->second;
+      }
+      stats_.sessions_resume_missed.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (sessions_.size() >= policy_.max_sessions && sweep(Clock::now()) == 0) return nullptr;
+    char fresh[33];
+    new_token(fresh);
+    std::pmr::memory_resource* resource = sessions_.get_allocator().resource();
+    auto session = std::allocate_shared<ResumeSession>(std::pmr::polymorphic_allocator<ResumeSession>(resource),
+                                                       std::string_view(fresh, 32), policy_, deflate_window, resource);
+    sessions_.emplace(session->token(), session);
+    return session;
+  }
+
+  // conn went away: keep its session for linger_ms unless another connection took it over
+  void detach(ResumeSession& session, const Connection* conn, Clock::time_point now) {
+    if (session.owner != conn) return;
+    session.owner = nullptr;
+    session.detached_at = now;
+    ++detached_;
+  }
+  void reattach(ResumeSession& session, Connection* conn) {
+    if (session.owner == nullptr && detached_ > 0) --detached_;
+    session.owner = conn;
+  }
+
+  // Drop detached sessions past linger_ms; returns how many
+  size_t sweep(Clock::time_point now) {
+    size_t removed = 0;
+    for (auto it = sessions_.begin(); it != sessions_.end();) {
+      ResumeSession& s = *it->second;
+      if (s.owner == nullptr && now - s.detached_at >= std::chrono::milliseconds(policy_.linger_ms)) {
+        it = sessions_.erase(it);
+        ++removed;
+      } else {
+        ++it;
+      }
+    }
+    detached_ -= std::min(detached_, removed);
+    stats_.sessions_expired.fetch_add(removed, std::memory_order_relaxed);
+    return removed;
+  }
+
+  size_t size() const { return sessions_.size(); }
+  size_t detached() const { return detached_; }
+  const ResumePolicy& policy() const { return policy_; }
+
+ private:
+  ResumePolicy policy_;
+  ServerStats& stats_;
+  std::pmr::map<std::pmr::string, std::shared_ptr<ResumeSession>, std::less<>> sessions_;
+  size_t detached_ = 0;
+  std::random_device random_;
+
+  void new_token(char (&token)[33]) {
+    static const char kHex[] = "0123456789abcdef";
+    for (size_t i = 0; i < 32; i += 8) {
+      uint32_t r = random_();
+      for (size_t j = 0; j < 8; ++j) token[i + j] = kHex[(r >> (4 * j)) & 0xF];
+    }
+    token[32] = '\0';
+  }
+};
+
+// ============================================================================
+// Connection state (function-pointer state machine, no virtual)
+// ============================================================================
+
+enum class ConnectionState : uint8_t {
+  kHandshaking,  // Waiting for HTTP upgrade request
+  kOpen,         // WebSocket connection established
+  kClosing,      // Close handshake in progress
+  kClosed        // Connection closed
+};
+
+class Connection;  // Forward declaration
+class BridgeLink;
+class RpcSession;
+class HttpResponder;
+#if EWSS_HAS_COROUTINES
+class RecvAwaiter;
+class DrainAwaiter;
+#endif
+
+// Per-route tx watermarks (bytes, 0 = Connection default)
+struct BufferProfile {
+  uint32_t tx_high_watermark = 0;
+  uint32_t tx_low_watermark = 0;
+};
+
+// Per-route limits (0 = unlimited)
+struct RouteLimits {
+  uint32_t max_message_size = 0;  // Larger frames close the connection with 1009
+  uint32_t max_connections = 0;   // Further upgrades on the route get 503
+  uint32_t idle_timeout_ms = 0;   // Open connections idle this long are closed
+};
+
+// State handler function signatures
+using StateDataHandler = expected<void, ErrorCode> (*)(Connection& conn);
+using StateSendHandler = expected<void, ErrorCode> (*)(Connection& conn, std::string_view payload);
+using StateCloseHandler = expected<void, ErrorCode> (*)(Connection& conn, uint16_t code);
+
+// Function pointer table (replaces virtual ProtocolHandler)
+struct StateOps {
+  ConnectionState state;
+  StateDataHandler on_data;
+  StateSendHandler on_send;
+  StateCloseHandler on_close;
+};
+
+// ============================================================================
+// Connection - Manages socket, buffers, and protocol state
+// ============================================================================
+
+// Last TCP_INFO reading of a connection, next to ewss's own queue: a growing
+// tx_buffer with a healthy path points at the peer's reads, one with a long RTT,
+// small cwnd or retransmits points at the network
+struct TcpHealth {
+  uint32_t rtt_us = 0;         // Smoothed RTT
+  uint32_t rttvar_us = 0;
+  uint32_t snd_cwnd = 0;       // Congestion window (segments)
+  uint32_t unacked = 0;        // Segments in flight
+  uint32_t unacked_bytes = 0;  // unacked * snd_mss (estimate)
+  uint32_t lost = 0;           // Segments currently presumed lost
+  uint32_t total_retrans = 0;  // Segments retransmitted over the connection's life
+  uint32_t tx_buffer = 0;      // tx_buffer_usage() at sample time
+  std::chrono::steady_clock::time_point sampled_at{};  // Epoch: never sampled
+};
+
+class alignas(kCacheLine) Connection : public std::enable_shared_from_this<Connection> {
+ public:
+  static constexpr size_t kRxBufferSize = 4096;
+  static constexpr size_t kTxBufferSize = 8192;
+  static constexpr size_t kTempReadSize = 512;
+  static constexpr size_t kHandshakeTimeout = 5000;                  // ms
+  static constexpr size_t kCloseTimeout = 5000;                      // ms
+  static constexpr size_t kTxHighWatermark = kTxBufferSize * 3 / 4;  // 75%
+  static constexpr size_t kTxLowWatermark = kTxBufferSize / 4;       // 25%
+
+  using ConnPtr = std::shared_ptr<Connection>;
+
+  // Construction (implementation below)
+  // memory: receive ring, deflate/RPC/bridge state and subscriptions (must outlive them)
+  explicit Connection(sockpp::tcp_socket&& sock,
+                      std::pmr::memory_resource* memory = std::pmr::new_delete_resource());
+  explicit Connection(int fd, std::pmr::memory_resource* memory = std::pmr::new_delete_resource());
+  ~Connection();
+
+  // Reactor I/O
+  expected<void, ErrorCode> handle_read();
+  expected<void, ErrorCode> handle_write();
+  // max_bytes caps a single writev (the egress shaper's per-visit budget)
+  expected<void, ErrorCode> handle_write_vectored(size_t max_bytes = SIZE_MAX);
+  // tx_buffer() bytes the last handle_write_vectored() put on the wire
+  size_t last_written() const { return last_written_; }
+
+  // User API
+  void send(std::string_view payload) { send_impl(payload, false); }
+  void send_binary(std::string_view payload) { send_impl(payload, true); }
+  // One binary frame of head + payload; false if not open or tx_buffer_ lacks room
+  bool send_binary(std::string_view head, std::string_view payload);
+  void close(uint16_t code = 1000);
+  bool is_closed() const;
+  bool has_data_to_send() const;
+  int get_fd() const { return socket_.handle(); }
+  uint64_t get_id() const { return id_; }
+
+  // Backpressure
+  bool is_write_paused() const { return write_paused_; }
+
+  // Egress shaping (Server::set_egress_limit): traffic class for stats().egress_bytes
+  // (< kEgressClasses) and deficit-round-robin weight (share of each round)
+  void set_egress(uint8_t traffic_class, uint16_t weight) {
+    egress_class_ = traffic_class < kEgressClasses ? traffic_class : kEgressClasses - 1;
+    egress_weight_ = weight == 0 ? 1 : weight;
+  }
+  uint8_t egress_class() const { return egress_class_; }
+  uint16_t egress_weight() const { return egress_weight_; }
+  size_t tx_buffer_usage() const { return tx_buffer_.size(); }
+  // Kernel view of the path, kept fresh by Server::set_tcp_info_sampling(); call
+  // sample_tcp_info() for a reading now (e.g. in on_backpressure). False if getsockopt fails.
+  const TcpHealth& tcp_health() const { return tcp_health_; }
+  bool sample_tcp_info();
+
+  // Keep at most `bytes` not yet sent in the kernel socket queue (SIOCOUTQNSD); the rest
+  // waits in tx_buffer(), where backpressure and the application can still see it. Also
+  // sets TCP_NOTSENT_LOWAT so POLLOUT only fires once the queue is below target. 0: off.
+  // Stays off (kernel_queue_target() == 0) where SIOCOUTQNSD is unsupported: SIOCOUTQ also
+  // counts in-flight bytes, so a hold could outlast the POLLOUT that should release it
+  void set_kernel_queue_target(uint32_t bytes);
+  uint32_t kernel_queue_target() const { return kernel_queue_target_; }
+  // The last flush stopped short at the kernel queue target, leaving data in tx_buffer()
+  bool send_held() const { return send_held_; }
+  // The upgrade completed (on_open has fired or is about to)
+  bool handshake_completed() const { return handshake_completed_; }
+
+  // Timeout checks
+  bool is_handshake_timed_out() const {
+    if (get_state() != ConnectionState::kHandshaking) return false;
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        SteadyClock::now() - created_at_).count();
+    return static_cast<size_t>(elapsed) > kHandshakeTimeout;
+  }
+
+  bool is_close_timed_out() const {
+    if (get_state() != ConnectionState::kClosing) return false;
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        SteadyClock::now() - closing_at_).count();
+    return static_cast<size_t>(elapsed) > kCloseTimeout;
+  }
+
+  void touch_activity() { last_activity_ = SteadyClock::now(); }
+  uint64_t idle_ms() const {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        SteadyClock::now() - last_activity_).count());
+  }
+
+  // Callbacks
+  std::function<void(const ConnPtr&)> on_open;
+  std::function<void(const ConnPtr&, std::string_view)> on_message;
+  std::function<void(const ConnPtr&, bool)> on_close;
+  std::function<void(const ConnPtr&)> on_error;
+  std::function<void(const ConnPtr&)> on_backpressure;
+  std::function<void(const ConnPtr&)> on_drain;
+  // Runs before the 101 response with the request path; any other status rejects the upgrade
+  std::function<int(const ConnPtr&, std::string_view path)> on_upgrade;
+
+  // Request path of the upgrade (query string stripped); empty until handshake
+  std::string_view path() const { return path_; }
+
+  // Enter kOpen for a socket upgraded elsewhere (HandshakeStage): queues the 101 response,
+  // then feeds leftover request bytes to the frame parser. False if on_upgrade refused it.
+  bool adopt_open(std::string_view path, std::string_view response, std::string_view leftover);
+
+  // Safe to hand to another reactor: open, and nothing bound to the current thread
+  // (coroutine waiters or sleeps, bridge backend, RPC calls awaiting replies)
+  bool is_migratable() const;
+
+  // Route selected during the upgrade (-1 when routing is not used)
+  int route() const { return route_; }
+  void set_route(int route, const BufferProfile& buffers, const RouteLimits& limits);
+  bool is_idle_timed_out() const {
+    return idle_timeout_ms_ > 0 && get_state() == ConnectionState::kOpen && idle_ms() > idle_timeout_ms_;
+  }
+
+  // Callback timing (nullptr disables; set by Server when a stall budget is configured)
+  void set_watchdog(LoopWatchdog* wd) { watchdog_ = wd; }
+  // Failed and rejected upgrades count in stats->handshake_errors (set by Server)
+  void set_stats(ServerStats* stats) { stats_ = stats; }
+
+  // Bridge mode: text/binary payloads go to the paired backend instead of on_message
+  void attach_bridge(PmrPtr<BridgeLink> link);
+  BridgeLink* bridge() const { return bridge_.get(); }
+  bool wants_read() const;
+
+  // Queue an already-encoded server frame (e.g. SharedFrame::bytes()); all or nothing.
+  // Re-queued as a batch record when batching is negotiated.
+  bool send_encoded(std::string_view frame);
+  // send_encoded() that a resumable session retains by reference instead of copying
+  bool send_shared(const SharedFrame& frame);
+
+  // Batching: offered during the handshake when policy is non-null (set by Server)
+  void offer_batching(const BatchPolicy* policy) { batch_offer_ = policy; }
+
+  // permessage-deflate: offered during the handshake when policy is non-null (set by Server)
+  void offer_deflate(const DeflatePolicy* policy) { deflate_offer_ = policy; }
+
+  // Plain HTTP: non-upgrade requests are answered from http while handshaking (set by Server)
+  void set_http_responder(const HttpResponder* http) { http_ = http; }
+  // Answer the plain HTTP request at the front of rx; false if there is none (or an
+  // earlier response is still being sent)
+  bool serve_http();
+  // A response is still leaving (file body pending, or the connection closes after it)
+  bool http_busy() const { return http_left_ > 0 || http_close_after_; }
+
+  // Session resumption: sessions are opened/resumed from store during the handshake
+  void offer_resumption(SessionStore* store) { resume_store_ = store; }
+  // Resumable session of this connection (token, sequence numbers); nullptr if none
+  const ResumeSession* session() const { return resume_.get(); }
+  // Leave the session resumable for the store's linger time (Server, on removal)
+  void detach_session();
+#if EWSS_HAS_DEFLATE
+  bool deflate_enabled() const { return deflate_ != nullptr; }
+  const DeflatePolicy* deflate_policy() const { return deflate_ != nullptr ? &deflate_->policy : nullptr; }
+  // Window bits when this connection can take a shared compressed frame (no context
+  // takeover, not batching); 0 otherwise
+  uint8_t deflate_shared_window() const {
+    return deflate_ != nullptr && deflate_->params.server_no_context_takeover && !batching_
+        ? deflate_->params.server_max_window_bits : 0;
+  }
+#else
+  bool deflate_enabled() const { return false; }
+#endif
+  bool batching() const { return batching_; }
+  // Send the pending batch now (also done by close() and before migration)
+  void flush_batch();
+  // Topics this connection is subscribed to (maintained by Server::subscribe)
+  std::pmr::vector<std::pmr::string>& subscriptions() { return subscriptions_; }
+
+  // RPC mode: binary messages carrying an rpc envelope go to the session instead of on_message.
+  // Attached before the upgrade, kept only if the client negotiates rpc::kProtocol
+  void attach_rpc(PmrPtr<RpcSession> session);
+  PmrPtr<RpcSession> detach_rpc() { return std::move(rpc_); }
+  RpcSession* rpc() const { return rpc_.get(); }
+  bool rpc_negotiated() const { return rpc_negotiated_; }
+
+  // Coroutine hooks: a registered waiter takes the next message / tx drain instead of
+  // on_message; both are resumed with kConnectionClosed once the connection closes.
+  using Waiter = FixedFunction<void()>;
+  void await_message(Waiter w) { async_recv_ = true; recv_waiter_ = static_cast<Waiter&&>(w); }
+  void await_drain(Waiter w) { drain_waiter_ = static_cast<Waiter&&>(w); }
+  // A coroutine sleep started from this connection's callbacks. The timer owns the suspended
+  // frame; cancelling it destroys the frame, whose awaiter unlinks the node.
+  struct Sleeper {
+    TimerQueue* queue = nullptr;
+    TimerQueue::TimerId timer = 0;
+    Connection* owner = nullptr;
+    Sleeper* prev = nullptr;
+    Sleeper* next = nullptr;
+    void link(Connection& conn);
+    void unlink();
+  };
+  // Destroy suspended coroutines without resuming them: their frames hold ConnPtrs, so
+  // nothing else frees them once the reactor stops. The caller must hold a reference.
+  void release_coroutines();
+  // Connection whose callback or coroutine is running on this thread (nullptr outside one)
+  static Connection*& current() {
+    static thread_local Connection* conn = nullptr;
+    return conn;
+  }
+  std::string_view async_message() const { return async_msg_; }
+  ErrorCode async_error() const { return async_error_; }
+  // Deliver a frame left in rx_buffer_ while no receiver was waiting (called by the reactor)
+  void resume_receiver() {
+    if (rx_stalled_ && recv_waiter_) ops_->on_data(*this);
+  }
+#if EWSS_HAS_COROUTINES
+  // co_await conn->recv(): next text/binary message; the view is valid until the next co_await
+  RecvAwaiter recv();
+  // co_await conn->send_and_drain(payload): queue a frame and resume once tx_buffer_ is empty
+  DrainAwaiter send_and_drain(std::string_view payload, bool binary = false);
+#endif
+
+  // Opcode (kText/kBinary) of the message currently being delivered to on_message
+  ws::OpCode message_opcode() const { return msg_opcode_; }
+
+  // State query
+  ConnectionState get_state() const { return ops_->state; }
+  ErrorCode get_last_error() const { return last_error_code_; }
+
+  // Internal API (public to avoid friend, used by state handlers)
+  void transition_to_state(ConnectionState state);
+  expected<void, ErrorCode> parse_handshake();
+  void parse_frames();
+  void write_frame(std::string_view payload, ws::OpCode opcode, bool compressed = false);
+  // Data frame, deflated when permessage-deflate is on and payload is large enough
+  void write_message(std::string_view payload, ws::OpCode opcode);
+  void write_close_frame(uint16_t code);
+  void check_high_watermark();
+  void check_low_watermark();
+  uint64_t& drr_deficit() { return drr_deficit_; }
+
+  sockpp::tcp_socket& socket() { return socket_; }
+  // Allocated on first use (and released when drained in shared-read mode)
+  RingBuffer<uint8_t, kRxBufferSize>& rx_buffer() {
+    if (rx_buffer_ == nullptr) rx_buffer_ = pmr_new<RingBuffer<uint8_t, kRxBufferSize>>(memory_);
+    return *rx_buffer_;
+  }
+  bool has_rx_buffer() const { return rx_buffer_ != nullptr; }
+
+  // Shared-read mode: open connections read into the reactor's scratch buffer and
+  // parse frames in place; only an incomplete trailing frame is kept in rx_buffer()
+  void set_read_scratch(uint8_t* buf, size_t size) { scratch_ = buf; scratch_size_ = size; }
+  // Record every frame this connection delivers (reactor-owned capture; nullptr stops)
+  void set_capture(TrafficCapture* capture) { capture_ = capture; }
+  RingBuffer<uint8_t, kTxBufferSize>& tx_buffer() { return tx_buffer_; }
+
+ private:
+  uint64_t id_;
+  sockpp::tcp_socket socket_;
+  std::pmr::memory_resource* memory_;
+  PmrPtr<RingBuffer<uint8_t, kRxBufferSize>> rx_buffer_;
+  RingBuffer<uint8_t, kTxBufferSize> tx_buffer_;
+  uint8_t* scratch_ = nullptr;
+  size_t scratch_size_ = 0;
+  const StateOps* ops_ = nullptr;
+  bool handshake_completed_ = false;
+  std::string sec_websocket_key_;
+  ErrorCode last_error_code_ = ErrorCode::kOk;
+  bool write_paused_ = false;
+  LoopWatchdog* watchdog_ = nullptr;
+  ServerStats* stats_ = nullptr;
+  ws::OpCode msg_opcode_ = ws::OpCode::kText;
+  PmrPtr<BridgeLink> bridge_;
+  PmrPtr<RpcSession> rpc_;
+  bool rpc_negotiated_ = false;
+  std::pmr::vector<std::pmr::string> subscriptions_{memory_};
+  const BatchPolicy* batch_offer_ = nullptr;
+  const DeflatePolicy* deflate_offer_ = nullptr;
+  TrafficCapture* capture_ = nullptr;
+  SessionStore* resume_store_ = nullptr;
+  std::shared_ptr<ResumeSession> resume_;
+  uint64_t resend_next_ = 0;  // Next sequence to copy from the window into tx_buffer_
+  const HttpResponder* http_ = nullptr;
+  int http_fd_ = -1;             // File body being sent with sendfile() (owned by http_)
+  off_t http_off_ = 0;
+  size_t http_left_ = 0;
+  bool http_close_after_ = false;
+#if EWSS_HAS_DEFLATE
+  struct DeflateSession {
+    explicit DeflateSession(std::pmr::memory_resource* resource) : out(resource), in(resource) {}
+    deflate::Params params;
+    DeflatePolicy policy;
+    PmrPtr<deflate::Compressor> tx;  // Only with context takeover
+    PmrPtr<deflate::Decompressor> rx;
+    std::pmr::string out;  // Last compressed message
+    std::pmr::string in;   // Last inflated message
+  };
+  PmrPtr<DeflateSession> deflate_;
+  bool rx_inflated_ = false;  // deflate_->in holds the frame at the front of rx (stalled)
+#endif
+  BatchPolicy batch_policy_;
+  bool batching_ = false;
+  std::string batch_out_;              // Records of the pending outgoing batch
+  TimerQueue::TimerId batch_timer_ = 0;
+  uint32_t batch_rx_skip_ = 0;         // Records of the current batch already delivered
+  uint8_t egress_class_ = 0;
+  uint16_t egress_weight_ = 1;
+  uint64_t drr_deficit_ = 0;
+  size_t last_written_ = 0;
+  Waiter recv_waiter_;
+  Waiter drain_waiter_;
+  Sleeper* sleepers_ = nullptr;
+  std::string_view async_msg_;
+  ErrorCode async_error_ = ErrorCode::kOk;
+  bool async_recv_ = false;
+  bool rx_stalled_ = false;
+  std::string path_;
+  int route_ = -1;
+  uint32_t tx_high_watermark_ = kTxHighWatermark;
+  uint32_t tx_low_watermark_ = kTxLowWatermark;
+  uint32_t max_message_size_ = 0;
+  uint32_t idle_timeout_ms_ = 0;
+  TcpHealth tcp_health_;
+  uint32_t kernel_queue_target_ = 0;
+  bool send_held_ = false;
+
+  using SteadyClock = std::chrono::steady_clock;
+  using TimePoint = SteadyClock::time_point;
+  TimePoint created_at_ = SteadyClock::now();
+  TimePoint closing_at_{};
+  TimePoint last_activity_ = SteadyClock::now();
+
+  void send_impl(std::string_view payload, bool binary);
+  size_t consume_frames(uint8_t* data, size_t len, bool& halted);
+  bool deliver_message(std::string_view msg, ws::OpCode opcode);
+  bool inflate_message(std::string_view& msg);
+  SharedFrame encode_retained(std::string_view payload, ws::OpCode opcode);
+  void retain(SharedFrame frame);
+  void pump_resend();
+  expected<void, ErrorCode> send_http_file(size_t max_bytes);
+  void finish_http();
+  bool deliver_batch(std::string_view frame);
+  void enable_batching(const BatchPolicy& policy);
+  void queue_record(std::string_view payload, bool binary);
+  expected<void, ErrorCode> read_into_scratch();
+  // Bytes a flush may hand the kernel under kernel_queue_target_ (max_bytes when off)
+  size_t kernel_send_budget(size_t max_bytes);
+  template <typename Fn, typename... Args>
+  void invoke(CallbackKind kind, const Fn& fn, Args&&... args);
+  static void unmask_payload(uint8_t* payload, size_t len, const uint8_t* mask_key);
+  void reject_upgrade(int status);
+  // Record a definitive handshake failure (not a request still arriving)
+  expected<void, ErrorCode> fail_handshake();
+  void wake(Waiter& waiter, ErrorCode err);
+  void log_error(const std::string& msg);
+};
+
+// ============================================================================
+// TCP Tuning Configuration
+// ============================================================================
+
+struct TcpTuning {
+  bool tcp_nodelay = false;
+  bool tcp_quickack = false;
+  bool so_keepalive = false;
+  int keepalive_idle_s = 60;
+  int keepalive_interval_s = 10;
+  int keepalive_count = 5;
+};
+
+// ============================================================================
+// Bridge Configuration (WebSocket <-> raw TCP backend, websockify-style)
+// ============================================================================
+
+struct BridgeConfig {
+  std::string host;         // Backend address (numeric or resolvable name)
+  uint16_t port = 0;
+  bool use_splice = true;   // Backend -> client payload via pipe + splice()
+};
+
+// ============================================================================
+// BridgeLink - Backend socket paired with one WebSocket connection
+// ============================================================================
+
+// Upstream: client frames are unmasked straight into upstream_ and written
+// to the backend. Downstream: backend bytes become binary frames; when the
+// client tx_buffer_ is empty the payload is spliced backend -> pipe -> client
+// after writing only the frame header, so bulk data never enters userspace.
+// Invariant: bytes parked in the pipe precede anything in tx_buffer_.
+class BridgeLink {
+ public:
+  static constexpr size_t kUpstreamSize = 16384;
+  static constexpr size_t kChunkSize = 8192 - 16;  // Fits the tx_buffer_ copy fallback
+
+  BridgeLink(ServerStats& stats, bool use_splice) : stats_(stats), use_splice_(use_splice) {}
+  ~BridgeLink() {
+    if (backend_fd_ >= 0) ::close(backend_fd_);
+    if (pipe_r_ >= 0) ::close(pipe_r_);
+    if (pipe_w_ >= 0) ::close(pipe_w_);
+  }
+  BridgeLink(const BridgeLink&) = delete;
+  BridgeLink& operator=(const BridgeLink&) = delete;
+
+  expected<void, ErrorCode> connect(const struct sockaddr_in& addr) {
+    backend_fd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (backend_fd_ < 0) return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    if (use_splice_) {
+      int fds[2];
+      if (::pipe2(fds, O_NONBLOCK | O_CLOEXEC) == 0) {
+        pipe_r_ = fds[0];
+        pipe_w_ = fds[1];
+      } else {
+        use_splice_ = false;
+      }
+    }
+    if (::connect(backend_fd_, reinterpret_cast<const struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+      if (errno != EINPROGRESS) return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+      connecting_ = true;
+    }
+    return expected<void, ErrorCode>::success();
+  }
+
+  int backend_fd() const { return backend_fd_; }
+  size_t pipe_pending() const { return pipe_pending_; }
+  size_t upstream_available() const { return upstream_.available(); }
+
+  // Poll registration for the backend; fd -1 parks it (hung up, nothing to do yet)
+  int poll_fd(const Connection& conn, short& events) const;
+
+  // Unmask one client payload into the upstream ring (false: no room yet)
+  bool forward_upstream(const uint8_t* payload, size_t len, const uint8_t* mask_key) {
+    if (upstream_.available() < len) return false;
+    struct iovec iov[2];
+    size_t n = upstream_.fill_iovec_write(iov, 2);
+    size_t done = 0;
+    for (size_t k = 0; k < n && done < len; ++k) {
+      size_t part = std::min(len - done, iov[k].iov_len);
+      auto* dst = static_cast<uint8_t*>(iov[k].iov_base);
+      if (mask_key != nullptr)
+        ws::unmask_copy(dst, payload + done, part, mask_key, done);
+      else
+        std::memcpy(dst, payload + done, part);
+      done += part;
+    }
+    upstream_.commit_write(len);
+    return true;
+  }
+
+  expected<void, ErrorCode> flush_upstream() {
+    if (connecting_ || upstream_.empty()) return expected<void, ErrorCode>::success();
+    struct iovec iov[2];
+    size_t n = upstream_.fill_iovec(iov, 2);
+    ssize_t w = ::writev(backend_fd_, iov, static_cast<int>(n));
+    if (w > 0) {
+      upstream_.advance(static_cast<size_t>(w));
+      stats_.bridge_bytes_up.fetch_add(static_cast<uint64_t>(w), std::memory_order_relaxed);
+    } else if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    return expected<void, ErrorCode>::success();
+  }
+
+  // Move pipe-parked payload to the client (must complete before tx_buffer_ flushes)
+  expected<void, ErrorCode> flush_pipe(int client_fd) {
+    if (pipe_pending_ == 0) return expected<void, ErrorCode>::success();
+    ssize_t n = ::splice(pipe_r_, nullptr, client_fd, nullptr, pipe_pending_,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (n > 0) {
+      pipe_pending_ -= static_cast<size_t>(n);
+    } else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    return expected<void, ErrorCode>::success();
+  }
+
+  expected<void, ErrorCode> on_backend_ready(Connection& conn, short revents);
+
+ private:
+  ServerStats& stats_;
+  int backend_fd_ = -1;
+  int pipe_r_ = -1;
+  int pipe_w_ = -1;
+  size_t pipe_pending_ = 0;
+  bool use_splice_;
+  bool connecting_ = false;
+  bool hup_ = false;
+  RingBuffer<uint8_t, kUpstreamSize> upstream_;
+
+  expected<void, ErrorCode> read_downstream(Connection& conn);
+  expected<void, ErrorCode> splice_downstream(Connection& conn, bool& spliced);
+};
+
+// ============================================================================
+// RouteTrie - Upgrade path -> route index, flattened byte trie
+// ============================================================================
+//
+// Patterns are exact ("/chat") or prefix ("/api/*"); the longest match wins
+// and an exact match beats a prefix ending at the same node. compile() lays
+// nodes out breadth-first so each node's edges are one contiguous sorted run.
+
+class RouteTrie {
+ public:
+  static constexpr int kNoMatch = -1;
+
+  void add(std::string_view pattern, int value) { patterns_.emplace_back(std::string(pattern), value); }
+
+  void compile() {
+    struct Build {
+      std::map<char, uint32_t> next;
+      int exact = kNoMatch;
+      int prefix = kNoMatch;
+    };
+    std::vector<Build> tree(1);
+    for (const auto& [pattern, value] : patterns_) {
+      std::string_view key = pattern;
+      bool is_prefix = !key.empty() && key.back() == '*';
+      if (is_prefix) key.remove_suffix(1);
+      uint32_t node = 0;
+      for (char c : key) {
+        auto it = tree[node].next.find(c);
+        if (it == tree[node].next.end()) {
+          tree.emplace_back();
+          uint32_t child = static_cast<uint32_t>(tree.size() - 1);
+          tree[node].next.emplace(c, child);
+          node = child;
+        } else {
+          node = it->second;
+        }
+      }
+      int& slot = is_prefix ? tree[node].prefix : tree[node].exact;
+      if (slot == kNoMatch) slot = value;  // First registration wins
+    }
+
+    nodes_.assign(tree.size(), Node{});
+    labels_.clear();
+    targets_.clear();
+    std::vector<uint32_t> order{0};
+    for (size_t q = 0; q < order.size(); ++q) {
+      const Build& src = tree[order[q]];
+      Node& dst = nodes_[q];
+      dst.first_edge = static_cast<uint32_t>(labels_.size());
+      dst.edge_count = static_cast<uint32_t>(src.next.size());
+      dst.exact = src.exact;
+      dst.prefix = src.prefix;
+      for (const auto& [label, child] : src.next) {
+        labels_.push_back(label);
+        targets_.push_back(static_cast<uint32_t>(order.size()));
+        order.push_back(child);
+      }
+    }
+  }
+
+  int find(std::string_view path) const {
+    if (nodes_.empty()) return kNoMatch;
+    int best = kNoMatch;
+    uint32_t node = 0;
+    for (char c : path) {
+      const Node& n = nodes_[node];
+      if (n.prefix != kNoMatch) best = n.prefix;
+      uint32_t e = n.first_edge;
+      const uint32_t end = e + n.edge_count;
+      while (e < end && labels_[e] < c) ++e;
+      if (e == end || labels_[e] != c) return best;
+      node = targets_[e];
+    }
+    const Node& n = nodes_[node];
+    if (n.exact != kNoMatch) return n.exact;
+    return n.prefix != kNoMatch ? n.prefix : best;
+  }
+
+  size_t node_count() const { return nodes_.size(); }
+  size_t size() const { return patterns_.size(); }
+
+ private:
+  struct Node {
+    uint32_t first_edge = 0;
+    uint32_t edge_count = 0;
+    int exact = kNoMatch;
+    int prefix = kNoMatch;
+  };
+
+  std::vector<std::pair<std::string, int>> patterns_;
+  std::vector<Node> nodes_;
+  std::vector<char> labels_;       // Edge labels, sorted within each node
+  std::vector<uint32_t> targets_;  // Child node per edge
+};
+
+// Handler set, buffer profile and limits for one upgrade path
+struct Route {
+  using ConnPtr = std::shared_ptr<Connection>;
+
+  std::string path;  // Exact path, or prefix with trailing '*'
+  std::function<void(const ConnPtr&)> on_connect;
+  std::function<void(const ConnPtr&, std::string_view)> on_message;
+  std::function<void(const ConnPtr&, bool)> on_close;
+  std::function<void(const ConnPtr&)> on_error;
+  std::function<void(const ConnPtr&)> on_backpressure;
+  std::function<void(const ConnPtr&)> on_drain;
+  BufferProfile buffers;
+  RouteLimits limits;
+};
+
+// ============================================================================
+// RPC - Request/response envelope over binary WebSocket messages
+// ============================================================================
+//
+// Envelope (8 bytes, big-endian), followed by the payload:
+//   [0] type  [1] reserved  [2..3] method id  [4..7] correlation id
+// Correlation ids pick the pending-table slot directly (id % kMaxPending),
+// so replies may complete in any order without a map lookup or allocation.
+// Only clients that negotiate the "ewss.rpc" subprotocol get a session; other
+// binary messages always reach on_message untouched.
+
+namespace rpc {
+
+constexpr std::string_view kProtocol = "ewss.rpc";
+
+enum class MsgType : uint8_t {
+  kRequest = 0,
+  kResponse = 1,
+  kError = 2,   // Payload is an error message
+  kNotify = 3,  // One-way, no reply
+};
+
+constexpr size_t kHeaderSize = 8;
+
+struct Envelope {
+  MsgType type;
+  uint16_t method;
+  uint32_t correlation_id;
+  std::string_view payload;
+};
+
+inline size_t encode_header(uint8_t* out, MsgType type, uint16_t method, uint32_t correlation_id) {
+  out[0] = static_cast<uint8_t>(type);
+  out[1] = 0;
+  out[2] = static_cast<uint8_t>(method >> 8);
+  out[3] = static_cast<uint8_t>(method);
+  out[4] = static_cast<uint8_t>(correlation_id >> 24);
+  out[5] = static_cast<uint8_t>(correlation_id >> 16);
+  out[6] = static_cast<uint8_t>(correlation_id >> 8);
+  out[7] = static_cast<uint8_t>(correlation_id);
+  return kHeaderSize;
+}
+
+inline bool parse(std::string_view msg, Envelope& out) {
+  if (msg.size() < kHeaderSize) return false;
+  auto b = reinterpret_cast<const uint8_t*>(msg.data());
+  if (b[0] > static_cast<uint8_t>(MsgType::kNotify)) return false;
+  out.type = static_cast<MsgType>(b[0]);
+  out.method = static_cast<uint16_t>((b[2] << 8) | b[3]);
+  out.correlation_id = (static_cast<uint32_t>(b[4]) << 24) | (static_cast<uint32_t>(b[5]) << 16) |
+                       (static_cast<uint32_t>(b[6]) << 8) | b[7];
+  out.payload = msg.substr(kHeaderSize);
+  return true;
+}
+
+}  // namespace rpc
+
+enum class RpcStatus : uint8_t {
+  kOk,
+  kRemoteError,  // Peer answered with MsgType::kError
+  kTimeout,
+  kClosed,       // Connection went away before the reply
+};
+
+// Inbound call handed to a method handler; reply now or later via Connection::rpc()
+struct RpcRequest {
+  std::shared_ptr<Connection> conn;
+  uint16_t method;
+  uint32_t correlation_id;  // 0 for notifications
+  std::string_view payload; // Valid only during the handler call
+};
+
+// Method table shared by every connection of a Server
+class RpcDispatcher {
+ public:
+  using Handler = std::function<void(const RpcRequest&)>;
+
+  RpcDispatcher& on(uint16_t method, Handler handler) {
+    auto it = std::lower_bound(methods_.begin(), methods_.end(), method,
+                               [](const Entry& e, uint16_t m) { return e.method < m; });
+    if (it != methods_.end() && it->method == method) it->handler = std::move(handler);
+    else methods_.insert(it, Entry{method, std::move(handler)});
+    return *this;
+  }
+
+  const Handler* find(uint16_t method) const {
+    auto it = std::lower_bound(methods_.begin(), methods_.end(), method,
+                               [](const Entry& e, uint16_t m) { return e.method < m; });
+    return it != methods_.end() && it->method == method ? &it->handler : nullptr;
+  }
+
+ private:
+  struct Entry {
+    uint16_t method;
+    Handler handler;
+  };
+  std::vector<Entry> methods_;  // Sorted by method id
+};
+
+// Per-connection RPC state: outbound pending-call table and envelope dispatch
+class RpcSession {
+ public:
+  static constexpr uint32_t kMaxPending = 64;
+  using ReplyFn = FixedFunction<void(RpcStatus, std::string_view), 4 * sizeof(void*)>;
+
+  RpcSession(const RpcDispatcher* dispatcher, TimerQueue& timers) : dispatcher_(dispatcher), timers_(timers) {
+    for (uint32_t i = 0; i < kMaxPending; ++i) free_[i] = static_cast<uint8_t>(kMaxPending - 1 - i);
+    free_count_ = kMaxPending;
+  }
+  ~RpcSession();
+
+  RpcSession(const RpcSession&) = delete;
+  RpcSession& operator=(const RpcSession&) = delete;
+
+  // Outbound call; on_reply runs exactly once (reply, error, timeout or close). Fails
+  // without sending when the table or (timeout_ms > 0) the timer queue is full
+  expected<uint32_t, ErrorCode> call(Connection& conn, uint16_t method, std::string_view payload,
+                                     ReplyFn on_reply, uint32_t timeout_ms = 5000);
+  bool notify(Connection& conn, uint16_t method, std::string_view payload);
+
+  // Answer an inbound request, in any order relative to other requests
+  bool reply(Connection& conn, uint32_t correlation_id, std::string_view payload);
+  bool reply_error(Connection& conn, uint32_t correlation_id, std::string_view message);
+
+  // Handle one binary message; false when it is not an RPC envelope
+  bool on_message(Connection& conn, std::string_view msg);
+
+  // Complete every pending call with `status`
+  void fail_all(RpcStatus status);
+
+  uint32_t pending() const { return kMaxPending - free_count_; }
+
+ private:
+  struct Pending {
+    uint32_t correlation_id = 0;  // 0 = free
+    TimerQueue::TimerId timer = 0;
+    ReplyFn on_reply;
+  };
+
+  void complete(uint32_t correlation_id, RpcStatus status, std::string_view payload);
+  bool send(Connection& conn, rpc::MsgType type, uint16_t method, uint32_t correlation_id,
+            std::string_view payload);
+
+  const RpcDispatcher* dispatcher_;
+  TimerQueue& timers_;
+  std::array<Pending, kMaxPending> pending_;
+  std::array<uint8_t, kMaxPending> free_{};
+  uint32_t free_count_ = 0;
+  uint32_t next_seq_ = 1;
+};
+
+// ============================================================================
+// HttpResponder - Plain HTTP/1.1 GETs that are not WebSocket upgrades
+// ============================================================================
+//
+// Load-balancer probes and small static assets. Every response head is built at
+// registration, in keep-alive and close variants; bodies are either stored inline
+// (health) or streamed from an open file with sendfile(). Nothing is parsed
+// beyond the request line and the Connection/Upgrade headers.
+
+class HttpResponder {
+ public:
+  static constexpr size_t kMaxFileSize = 1U << 20;
+
+  struct Entry {
+    std::string head[2];  // [keep_alive]
+    std::string body;     // Inline body (health)
+    int fd = -1;          // File body (sendfile)
+    size_t file_size = 0;
+  };
+
+  explicit HttpResponder(ServerStats& stats) : stats_(stats) {
+    not_found_ = make_entry(404, "text/plain", 9);
+    not_found_.body = "Not Found";
+    not_allowed_ = make_entry(405, "text/plain", 0);
+  }
+  ~HttpResponder() {
+    for (auto& e : entries_) if (e.second.fd >= 0) ::close(e.second.fd);
+  }
+  HttpResponder(const HttpResponder&) = delete;
+  HttpResponder& operator=(const HttpResponder&) = delete;
+
+  // Fixed response for path (e.g. "/healthz")
+  HttpResponder& add_health(std::string_view path, std::string_view body = "OK",
+                            std::string_view content_type = "text/plain") {
+    Entry e = make_entry(200, content_type, body.size());
+    e.body.assign(body.data(), body.size());
+    replace(path, std::move(e));
+    return *this;
+  }
+
+  // Serve file_path at path; size and type are fixed now (kMaxFileSize at most).
+  // Register before run(): the open descriptor is shared by every transfer
+  expected<void, ErrorCode> add_file(std::string_view path, const std::string& file_path,
+                                     std::string_view content_type = {}) {
+    int fd = ::open(file_path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+    struct stat st;
+    if (::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || static_cast<size_t>(st.st_size) > kMaxFileSize) {
+      ::close(fd);
+      return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+    }
+    Entry e = make_entry(200, content_type.empty() ? mime_type(file_path) : content_type, static_cast<size_t>(st.st_size));
+    e.fd = fd;
+    e.file_size = static_cast<size_t>(st.st_size);
+    replace(path, std::move(e));
+    return expected<void, ErrorCode>::success();
+  }
+
+  // Response for method/path: 405 unless GET or HEAD, 404 when path is unknown
+  const Entry& lookup(std::string_view method, std::string_view path) const {
+    stats_.http_requests.fetch_add(1, std::memory_order_relaxed);
+    if (method != "GET" && method != "HEAD") return not_allowed_;
+    auto it = entries_.find(path);
+    if (it != entries_.end()) return it->second;
+    stats_.http_not_found.fetch_add(1, std::memory_order_relaxed);
+    return not_found_;
+  }
+
+  bool empty() const { return entries_.empty(); }
+
+  static std::string_view mime_type(std::string_view file) {
+    static const std::pair<std::string_view, std::string_view> kTypes[] = {
+        {".html", "text/html"}, {".css", "text/css"}, {".js", "application/javascript"},
+        {".json", "application/json"}, {".txt", "text/plain"}, {".svg", "image/svg+xml"},
+        {".png", "image/png"}, {".ico", "image/x-icon"}};
+    for (const auto& t : kTypes) {
+      if (file.size() >= t.first.size() && file.substr(file.size() - t.first.size()) == t.first) return t.second;
+    }
+    return "application/octet-stream";
+  }
+
+ private:
+  ServerStats& stats_;
+  std::map<std::string, Entry, std::less<>> entries_;
+  Entry not_found_;
+  Entry not_allowed_;
+
+  static const char* reason(int status) {
+    return status == 200 ? "OK" : status == 404 ? "Not Found" : "Method Not Allowed";
+  }
+
+  static Entry make_entry(int status, std::string_view content_type, size_t length) {
+    Entry e;
+    for (int keep_alive = 0; keep_alive < 2; ++keep_alive) {
+      char buf[256];
+      int n = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 %d %s\r\nContent-Type: %.*s\r\nContent-Length: %zu\r\nCache-Control: no-cache\r\n%s\r\n",
+                       status, reason(status), static_cast<int>(content_type.size()),
+                       content_type.empty() ? "" : content_type.data(), length, keep_alive ? "" : "Connection: close\r\n");
+      if (n > 0) e.head[keep_alive].assign(buf, std::min<size_t>(static_cast<size_t>(n), sizeof(buf) - 1));
+    }
+    return e;
+  }
+
+  void replace(std::string_view path, Entry&& e) {
+    auto it = entries_.find(path);
+    if (it == entries_.end()) {
+      entries_.emplace(std::string(path), std::move(e));
+      return;
+    }
+    if (it->second.fd >= 0) ::close(it->second.fd);
+    it->second = std::move(e);
+  }
+};
+
+// ============================================================================
+// TLS Configuration (optional mbedTLS, placeholder)
+// ============================================================================
+
+struct TlsConfig {
+  std::string cert_path;
+  std::string key_path;
+  std::string ca_path;
+  bool require_client_cert = false;
+  int min_tls_version = 0;
+};
+
+// ============================================================================
+// Server - poll() Reactor with zero-copy I/O
+// ============================================================================
+
+namespace detail {
+
+// Non-blocking IPv4 listening socket; -1 with a message in err on failure.
+// reuse_port joins the SO_REUSEPORT group of every listener bound the same way.
+inline int open_listener(uint16_t port, const std::string& bind_addr, std::string& err,
+                         bool reuse_port = false) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    err = "Failed to create socket";
+    return -1;
+  }
+
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if (reuse_port && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+    ::close(fd);
+    err = "Failed to set SO_REUSEPORT";
+    return -1;
+  }
+
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = bind_addr.empty() ? htonl(INADDR_ANY) : inet_addr(bind_addr.c_str());
+
+  if (bind(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+    int e = errno;
+    ::close(fd);
+    err = "Failed to bind port " + std::to_string(port) + ": " + strerror(e);
+    return -1;
+  }
+
+  if (listen(fd, 128) < 0) {
+    ::close(fd);
+    err = "Failed to listen";
+    return -1;
+  }
+
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  return fd;
+}
+
+}  // namespace detail
+
+class Server {
+ public:
+  using ConnPtr = std::shared_ptr<Connection>;
+
+  // reuse_port: one of several listeners on the same port, one per reactor
+  explicit Server(uint16_t port, const std::string& bind_addr = "", bool reuse_port = false);
+  // Reactor without a listener; connections arrive through handoff()
+  Server();
+  ~Server();
+
+  void run();
+  void stop() { is_running_.store(false, std::memory_order_relaxed); }  // Any thread
+
+  Server& set_max_connections(size_t max) { max_connections_.store(max, std::memory_order_relaxed); return *this; }
+  Server& set_poll_timeout_ms(int t) { poll_timeout_ms_ = t; return *this; }
+  Server& set_tcp_tuning(const TcpTuning& t) { tcp_tuning_ = t; return *this; }
+  // Connection::set_kernel_queue_target(bytes) for every accepted connection: data beyond
+  // `bytes` unsent in the kernel stays in tx_buffer() (stats().send_queue_holds). 0: off
+  Server& set_kernel_queue_target(uint32_t bytes) { kernel_queue_target_ = bytes; return *this; }
+  Server& set_use_writev(bool e) { use_writev_ = e; return *this; }
+  // One reactor-wide read buffer of `bytes` shared by all open connections; each
+  // connection then holds a receive ring only while it has a partial frame pending.
+  // 0 gives every connection its own ring for life (default).
+  Server& set_shared_read_buffer(size_t bytes = 65536);
+  // Accept the "ewss.batch" subprotocol when a client offers it (see batch::)
+  Server& set_batching(const BatchPolicy& policy);
+  // Resumable sessions: sequence-numbered resend windows kept across reconnects
+  // (see ResumeSession). Sessions live in this reactor; resumable connections do not migrate.
+  Server& set_resumption(const ResumePolicy& policy);
+  const SessionStore* sessions() const { return sessions_.get(); }
+  // Health probes and static files for plain (non-upgrade) HTTP requests on the
+  // WebSocket port; created on first use. Register paths before run()
+  HttpResponder& http();
+  // Record inbound frames of every connection on this reactor (nullptr stops); the
+  // capture must outlive run() and serve this reactor only
+  Server& set_capture(TrafficCapture* capture);
+#if EWSS_HAS_DEFLATE
+  // Negotiate permessage-deflate (RFC 7692) with clients that offer it. Fan-out to
+  // no-context-takeover connections compresses each message once per window size.
+  Server& set_permessage_deflate(const DeflatePolicy& policy);
+#endif
+  // Cap total egress with a token bucket and share it across writable connections by
+  // deficit round robin (Connection::set_egress weights); rate 0 disables shaping
+  Server& set_egress_limit(const EgressPolicy& policy);
+  // Sample TCP_INFO for a rotating subset of open connections (Connection::tcp_health(),
+  // stats().tcp_rtt_us and tcp_retransmits); at most policy.batch getsockopt calls per interval
+  Server& set_tcp_info_sampling(const TcpInfoPolicy& policy) { tcp_info_ = policy; return *this; }
+  // Pin the thread calling run() to cpu (-1 leaves it unpinned); also the CPU that
+  // accepted sockets are checked against for stats().cpu_locality()
+  Server& set_cpu(int cpu) { cpu_ = cpu; return *this; }
+  // Real-time profile for the thread calling run() (SCHED_FIFO priority, isolated CPU,
+  // timer slack), applied when run() starts and undone when it returns
+  Server& set_realtime(const RealtimePolicy& policy) { realtime_ = policy; return *this; }
+  // Attach a SO_ATTACH_REUSEPORT_CBPF program to this reuse_port listener's group: the
+  // SYN's receiving CPU picks listener (cpu % group_size), in bind order. Pair listener i
+  // with set_cpu(i) so packets, softirq and reactor share a core.
+  expected<void, ErrorCode> enable_cpu_steering(uint32_t group_size);
+  // Flag loop iterations whose busy time exceeds budget_us (0 disables callback timing)
+  Server& set_stall_budget_us(uint64_t us) { stall_budget_us_ = us; return *this; }
+  // Export stats to POSIX shared memory segment `name`, republished every interval_ms
+  Server& set_stats_shm(const std::string& name, uint32_t interval_ms = 100) {
+    stats_shm_name_ = name; stats_shm_interval_ms_ = interval_ms; return *this;
+  }
+  // Pair every WebSocket connection with a TCP connection to cfg.host:cfg.port
+  Server& set_bridge(const BridgeConfig& cfg);
+
+  // Dispatch upgrades by request path; with any route registered, unmatched paths get 404.
+  // Routes are compiled into a RouteTrie when run() starts.
+  Server& add_route(Route route);
+  size_t route_connections(size_t route) const {
+    return route < route_active_.size() ? route_active_[route] : 0;
+  }
+
+  // Give every connection that negotiates rpc::kProtocol ("ewss.rpc") an RpcSession
+  // dispatching inbound calls to `dispatcher` (nullptr disables)
+  Server& set_rpc(const RpcDispatcher* dispatcher) { rpc_dispatcher_ = dispatcher; return *this; }
+
+  // One-shot timers fired by the reactor (reactor thread only)
+  TimerQueue& timers() { return timers_; }
+  // Allocate connections, receive rings, the shared read buffer and the scratch
+  // arena from resource (caller-owned; must outlive this server and its
+  // connections). Call before set_shared_read_buffer() and run().
+  Server& set_memory_resource(AccountedResource* resource);
+  AccountedResource& memory_resource() { return *memory_; }
+  // Reserve every connection slot, receive ring and buffer now, in one pre-faulted
+  // (optionally mlock'ed) region, and guard the reactor thread against heap use
+  // once serving. Before run() and any connection; caps max_connections.
+  // Done at construction when built with EWSS_STATIC_MEMORY.
+  expected<void, ErrorCode> reserve_static_memory(const StaticMemoryPolicy& policy);
+  const StaticPool* static_pool() const { return static_pool_.get(); }
+  // Bump arena for transient allocations in callbacks, reset before every poll()
+  // (reactor thread only; also ScratchArena::current())
+  ScratchArena& scratch() { return scratch_; }
+
+  // Accept upgraded sockets from other threads (call before run())
+  Server& enable_handoff();
+  // Thread-safe: queue fd (already upgraded elsewhere) with its path, the 101 response to
+  // send and any bytes read past the request; the reactor takes ownership on success
+  expected<void, ErrorCode> handoff(int fd, std::string_view path, std::string_view response,
+                                    std::string_view leftover);
+  // Move an open connection to target (enable_handoff() on both) after this iteration's
+  // I/O, i.e. between frames. Reactor thread only; fd, rings, state and callbacks move as
+  // is, so callbacks must be safe on the target thread. Refused with IPC mirroring. The
+  // target resolves the path against its own routes and closes (1013) if none or full.
+  expected<void, ErrorCode> migrate(uint64_t conn_id, Server& target);
+  // Thread-safe: ask this reactor to migrate up to count connections to target
+  void shed(Server& target, uint32_t count);
+  // Active plus queued connections, for least-loaded placement (any thread)
+  uint64_t load() const {
+    return stats_.active_connections.load(std::memory_order_relaxed) +
+           handoff_pending_.load(std::memory_order_relaxed);
+  }
+
+  // Pub/sub, reactor thread: subscriptions live with the reactor that owns the connection
+  // and follow it when it migrates
+  bool subscribe(Connection& conn, std::string_view topic);
+  void unsubscribe(Connection& conn, std::string_view topic);
+  size_t subscriber_count(std::string_view topic) const;
+  // Thread-safe: queue a published frame for fan-out to this reactor's subscribers
+  // (requires enable_handoff(); false when the inbox is full)
+  bool post(const SharedFrame& frame);
+  // Reactor thread: send payload to every open connection with one encode; returns
+  // the number of connections it was queued on
+  size_t broadcast(std::string_view payload, bool binary = false);
+  // Any thread: whether this reactor has any subscriber at all
+  bool has_subscribers() const { return subscriptions_total_.load(std::memory_order_relaxed) > 0; }
+
+  // Mirror connection events into ch and execute its send/close commands (nullptr detaches).
+  // A malformed command from the app stops the channel (IpcChannel::broken(), logged once)
+  Server& set_ipc_channel(IpcChannel* ch);
+
+  // Extra fds watched by the reactor; handler runs on the reactor thread with revents
+  using PollHandler = FixedFunction<void(short)>;
+  expected<void, ErrorCode> add_poll_source(int fd, short events, PollHandler handler);
+  void remove_poll_source(int fd);
+
+  // Callbacks
+  std::function<void(const ConnPtr&)> on_connect;
+  std::function<void(const ConnPtr&, std::string_view)> on_message;
+  std::function<void(const ConnPtr&, bool)> on_close;
+  std::function<void(const ConnPtr&)> on_error;
+  std::function<void(const ConnPtr&)> on_backpressure;
+  std::function<void(const ConnPtr&)> on_drain;
+  std::function<void(const StallInfo&)> on_stall;
+
+  // Status
+  size_t get_connection_count() const { return connections_.size(); }
+  const ServerStats& stats() const { return stats_; }
+  void reset_stats() { stats_.reset(); }
+  uint64_t get_total_socket_errors() const { return stats_.socket_errors.load(); }
+  uint64_t get_total_handshake_errors() const { return stats_.handshake_errors.load(); }
+
+  static constexpr size_t kMaxConnections = 64;
+  static constexpr size_t kMaxPollSources = 8;
+  static constexpr size_t kHandoffBytes = 1280;  // path + 101 response + leftover
+  static constexpr size_t kPublishDepth = 256;   // Published frames queued per reactor
+  static constexpr size_t kConnBlockSlack = 2 * kCacheLine;  // allocate_shared control block + padding
+  static constexpr size_t kPrefaultStack = 65536;
+
+ private:
+  uint16_t port_;
+  std::string bind_addr_;
+  int server_sock_ = -1;
+  int cpu_ = -1;
+  RealtimePolicy realtime_;
+  std::atomic<bool> is_running_{false};
+  std::unique_ptr<StaticPool> static_pool_;
+  std::unique_ptr<AccountedResource> static_memory_;
+  bool guard_heap_ = false;
+  AccountedResource* memory_ = &AccountedResource::process_default();
+  PmrPtr<uint8_t> read_scratch_;
+  size_t read_scratch_size_ = 0;
+  BatchPolicy batch_policy_;
+  bool batching_ = false;
+  DeflatePolicy deflate_policy_;
+  bool deflate_enabled_ = false;
+  TrafficCapture* capture_ = nullptr;
+  PmrPtr<SessionStore> sessions_;
+  uint64_t session_sweep_timer_ = 0;
+  std::unique_ptr<HttpResponder> http_;
+  EgressPolicy egress_;
+  double egress_tokens_ = 0;
+  std::chrono::steady_clock::time_point egress_refill_{};
+  uint32_t drr_cursor_ = 0;      // connections_ index the next shaper pass starts at
+  uint64_t drr_resume_id_ = 0;   // Connection cut short by the bucket; resumes without a new quantum
+  FixedVector<uint32_t, kMaxConnections> egress_ready_;
+  TcpInfoPolicy tcp_info_;
+  uint32_t tcp_info_cursor_ = 0;  // connections_ index the next sampling batch starts at
+  std::chrono::steady_clock::time_point tcp_info_due_{};
+  bool use_writev_ = true;
+  FixedVector<ConnPtr, kMaxConnections> connections_;
+  std::atomic<size_t> max_connections_{50};  // Read by migrating reactors on their own threads
+  int poll_timeout_ms_ = 1000;
+  TcpTuning tcp_tuning_;
+  uint32_t kernel_queue_target_ = 0;
+  struct PollSource {
+    int fd;
+    short events;
+    PollHandler handler;
+  };
+  FixedVector<PollSource, kMaxPollSources> poll_sources_;
+  std::array<pollfd, 2 * kMaxConnections + kMaxPollSources + 1> poll_fds_{};
+  std::array<uint32_t, kMaxConnections> backend_conn_idx_{};
+  ServerStats stats_;
+  LoopWatchdog watchdog_{stats_};
+  uint64_t stall_budget_us_ = 0;
+  StatsSegment stats_shm_;
+  std::string stats_shm_name_;
+  uint32_t stats_shm_interval_ms_ = 100;
+  IpcChannel* ipc_ = nullptr;
+  bool ipc_broken_logged_ = false;
+  bool bridge_enabled_ = false;
+  bool bridge_use_splice_ = true;
+  struct sockaddr_in bridge_addr_{};
+  std::vector<Route> routes_;
+  RouteTrie route_trie_;
+  std::vector<uint32_t> route_active_;
+  TimerQueue timers_;
+  ScratchArena scratch_{memory_};
+  const RpcDispatcher* rpc_dispatcher_ = nullptr;
+  struct Handoff {
+    int fd;
+    uint16_t path_len;
+    uint16_t response_len;
+    uint16_t leftover_len;
+    char data[kHandoffBytes];
+  };
+  struct HandoffInbox {
+    MpscQueue<Handoff, kMaxConnections> queue;
+    MpscQueue<ConnPtr, kMaxConnections> migrants;
+    MpscQueue<SharedFrame, kPublishDepth> published;
+    int efd = -1;
+  };
+  std::unique_ptr<HandoffInbox> handoff_;
+  std::atomic<uint64_t> handoff_pending_{0};
+  struct Migration {
+    uint64_t conn_id;
+    Server* target;
+  };
+  FixedVector<Migration, kMaxConnections> migrations_;
+  std::atomic<Server*> shed_target_{nullptr};
+  std::atomic<uint32_t> shed_count_{0};
+  // Topic -> subscribers, allocated from memory_ on the first subscription
+  using TopicIndex = std::pmr::map<std::pmr::string, std::pmr::vector<Connection*>, std::less<>>;
+  PmrPtr<TopicIndex> topics_;
+  std::atomic<uint64_t> subscriptions_total_{0};
+
+  TopicIndex& topic_index();
+  expected<void, ErrorCode> accept_connection();
+  Connection& add_connection(int fd);
+  void sync_memory_stats();
+  void bind_handlers(Connection& conn, const Route* route);
+  int select_route(Connection& conn, std::string_view path);
+  void handle_connection_io(ConnPtr& conn, const pollfd& pfd);
+  void refill_egress(std::chrono::steady_clock::time_point now);
+  int egress_wait_ms() const;
+  void shape_egress();
+  void sample_tcp_info(std::chrono::steady_clock::time_point now);
+  void remove_closed_connections();
+  void schedule_session_sweep();
+  Connection* find_connection(uint64_t id);
+  void bind_ipc(Connection& conn);
+  void forward_to_ipc(IpcChannel::Kind kind, uint64_t conn_id, std::string_view payload);
+  void process_ipc_commands();
+  void open_bridge(Connection& conn);
+  void accept_handoffs();
+  void process_migrations();
+  void fan_out(const SharedFrame& frame);
+  bool deliver_shared(Connection& conn, const SharedFrame& frame, SharedFrame (&deflated)[8]);
+  void index_subscriptions(Connection& conn);
+  void unindex_subscriptions(Connection& conn);
+  // Read scratch, capture, batching/deflate policies and watchdog of this reactor
+  void bind_reactor_state(Connection& conn);
+  bool adopt_migrant(ConnPtr&& conn);
+  void wake_handoff();
+  void apply_tcp_tuning(int fd);
+  void log_info(const std::string& msg);
+  void log_error(const std::string& msg);
+};
+
+// ============================================================================
+// HandshakeStage - Accept + HTTP upgrade off the reactor threads
+// ============================================================================
+//
+// Worker threads own the listening socket, read the upgrade request, run the
+// SHA-1/Base64 work and hand the socket, the prepared 101 response and any
+// bytes read past the request to the least-loaded reactor (Server::handoff).
+// Reactors keep only established traffic on their thread.
+
+class HandshakeStage {
+ public:
+  static constexpr size_t kMaxPending = 64;  // In-flight handshakes per worker
+
+  explicit HandshakeStage(uint16_t port, const std::string& bind_addr = "");
+  ~HandshakeStage();
+
+  HandshakeStage(const HandshakeStage&) = delete;
+  HandshakeStage& operator=(const HandshakeStage&) = delete;
+
+  // Register a reactor (before start()); enables its handoff inbox
+  HandshakeStage& add_reactor(Server& reactor);
+  HandshakeStage& set_threads(size_t n) { threads_count_ = n == 0 ? 1 : n; return *this; }
+  // Accept the "ewss.batch" subprotocol; reactors batch with their set_batching() policy
+  HandshakeStage& set_batching(bool enable) { batching_ = enable; return *this; }
+  // Accept the "ewss.rpc" subprotocol (preferred over batching); reactors need set_rpc()
+  HandshakeStage& set_rpc(bool enable) { rpc_ = enable; return *this; }
+
+  void start();
+  void stop();
+
+  uint64_t completed() const { return completed_.load(std::memory_order_relaxed); }
+  uint64_t failed() const { return failed_.load(std::memory_order_relaxed); }
+
+ private:
+  struct Pending {
+    int fd;
+    size_t len;
+    std::chrono::steady_clock::time_point deadline;
+    char buf[1024];
+  };
+
+  void worker();
+  bool finish(Pending& p);  // false: keep reading
+  Server* least_loaded() const;
+  void fail(int fd, const char* status);
+
+  int listen_fd_ = -1;
+  size_t threads_count_ = 1;
+  bool batching_ = false;
+  bool rpc_ = false;
+  std::vector<Server*> reactors_;
+  std::vector<std::thread> threads_;
+  std::atomic<bool> running_{false};
+  std::atomic<uint64_t> completed_{0};
+  std::atomic<uint64_t> failed_{0};
+};
+
+// ============================================================================
+// Rebalancer - Move connections off saturated reactors
+// ============================================================================
+//
+// Each tick samples every reactor's loop utilization over the last interval
+// (busy / (busy + poll) deltas). When the busiest reactor is above `high` and
+// leads the idlest by at least `gap`, it is asked to shed a share of its
+// connections proportional to the gap; the moves run on its own thread.
+
+struct RebalancePolicy {
+  double high = 0.75;      // Source utilization that triggers a move
+  double gap = 0.25;       // Minimum lead over the target
+  uint32_t max_moves = 8;  // Connections moved per tick
+};
+
+class Rebalancer {
+ public:
+  explicit Rebalancer(const RebalancePolicy& policy = RebalancePolicy{}) : policy_(policy) {}
+  ~Rebalancer() { stop(); }
+
+  Rebalancer(const Rebalancer&) = delete;
+  Rebalancer& operator=(const Rebalancer&) = delete;
+
+  // Register a reactor (before start()); enables its handoff inbox
+  Rebalancer& add_reactor(Server& reactor);
+
+  // One sampling step (any thread); returns connections requested to move
+  uint32_t tick();
+  // Utilization of reactor i measured by the last tick
+  double utilization(size_t i) const { return i < samples_.size() ? samples_[i].utilization : 0.0; }
+
+  // Tick from a background thread every interval_ms
+  void start(uint32_t interval_ms = 500);
+  void stop();
+
+ private:
+  struct Sample {
+    Server* reactor;
+    uint64_t busy_us;
+    uint64_t poll_us;
+    double utilization;
+  };
+
+  RebalancePolicy policy_;
+  std::vector<Sample> samples_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+};
+
+// ============================================================================
+// PubSub - Cross-reactor publish with per-reactor fan-out
+// ============================================================================
+//
+// publish() encodes the frame once and posts one SharedFrame reference to
+// every reactor that has subscribers; each reactor copies it into its own
+// subscribers' tx buffers on its own thread. No connection is touched from
+// the publishing thread.
+
+class PubSub {
+ public:
+  // Register a reactor (before it runs); enables its inbox
+  PubSub& add_reactor(Server& reactor) {
+    reactor.enable_handoff();
+    reactors_.push_back(&reactor);
+    return *this;
+  }
+
+  // Any thread; returns the number of reactors the frame was queued to
+  size_t publish(std::string_view topic, std::string_view payload, bool binary = false) {
+    if (!has_subscribers()) return 0;  // Skip the encode entirely
+    return publish(SharedFrame::encode(topic, payload, binary ? ws::OpCode::kBinary : ws::OpCode::kText));
+  }
+  size_t publish(const SharedFrame& frame) {
+    size_t queued = 0;
+    for (Server* reactor : reactors_)
+      if (frame && reactor->has_subscribers() && reactor->post(frame)) ++queued;
+    return queued;
+  }
+  bool has_subscribers() const {
+    for (const Server* reactor : reactors_)
+      if (reactor->has_subscribers()) return true;
+    return false;
+  }
+
+ private:
+  std::vector<Server*> reactors_;
+};
+
+// ============================================================================
+// ClusterRelay - Pub/sub across server processes
+// ============================================================================
+//
+// Links ewss processes over persistent TCP or Unix stream sockets. A publish
+// goes to the local PubSub and to every linked node in one hop; receivers
+// deliver to their own PubSub and never forward. Records are batched per link
+// (size or delay bound) and carry (origin, seq), so a node reached over two
+// links delivers each message once. The wire format is host byte order:
+// nodes are expected to share an architecture.
+//
+// Addresses: "unix:/path" or "host:port".
+
+struct RelayConfig {
+  uint32_t node_id = 0;               // Unique per process; the dedup origin
+  std::string listen;                 // Accept links here (empty: dial only)
+  std::vector<std::string> peers;     // Dialled and redialled on failure
+  uint32_t batch_delay_us = 1000;     // Oldest queued record waits at most this long
+  size_t batch_bytes = 16384;         // ...or until this much is queued for a link
+  uint32_t reconnect_ms = 500;
+};
+
+struct RelayStats {
+  std::atomic<uint64_t> published{0};   // Local publishes queued for relay
+  std::atomic<uint64_t> records_out{0}; // Records written, summed over links
+  std::atomic<uint64_t> batches_out{0}; // Link writes
+  std::atomic<uint64_t> records_in{0};  // Records delivered locally
+  std::atomic<uint64_t> duplicates{0};  // Records dropped by origin/seq
+  std::atomic<uint64_t> dropped{0};     // Outbox full or link backlog over limit
+  std::atomic<uint64_t> oversize{0};    // Publishes refused: topic or record too large for the wire
+  std::atomic<uint64_t> unlinked{0};    // Records not queued on a link that was still connecting
+  std::atomic<uint32_t> links_up{0};    // Links past the hello exchange
+};
+
+class ClusterRelay {
+ public:
+  static constexpr uint32_t kMagic = 0x52535745;      // "EWSR"
+  static constexpr size_t kHeaderSize = 19;           // len u32, origin u32, seq u64, topic_len u16, flags u8
+  static constexpr size_t kMaxRecord = 1 << 20;
+  static constexpr size_t kMaxBacklog = 4 << 20;      // Per-link unsent bytes before dropping
+  static constexpr size_t kOutboxDepth = 1024;
+
+  ClusterRelay(PubSub& hub, const RelayConfig& cfg);
+  ~ClusterRelay();
+
+  ClusterRelay(const ClusterRelay&) = delete;
+  ClusterRelay& operator=(const ClusterRelay&) = delete;
+
+  expected<void, ErrorCode> start();
+  void stop();
+
+  // Any thread: deliver locally and relay to every linked node. False (nothing
+  // delivered) when the topic or the record exceeds the wire limits, or the outbox is full
+  bool publish(std::string_view topic, std::string_view payload, bool binary = false);
+
+  const RelayStats& stats() const { return stats_; }
+
+ private:
+  struct Link {
+    int fd = -1;
+    int peer = -1;  // Index into cfg_.peers; -1 for accepted links
+    bool connecting = false;
+    bool hello_done = false;  // Peer's hello received
+    bool want_write = false;
+    uint32_t peer_id = 0;
+    std::string in;
+    std::string out;
+    size_t out_sent = 0;
+    std::chrono::steady_clock::time_point oldest{};  // First unflushed record
+  };
+
+  void run();
+  void dial(size_t peer);
+  void close_link(size_t idx);
+  void queue_hello(Link& link);
+  void drain_outbox(std::chrono::steady_clock::time_point now);
+  bool flush(Link& link);
+  bool read_link(Link& link);
+  void deliver(std::string_view record);
+  static int open_socket(const std::string& addr, bool listen, bool& in_progress);
+
+  PubSub& hub_;
+  RelayConfig cfg_;
+  RelayStats stats_;
+  int listen_fd_ = -1;
+  int wake_fd_ = -1;
+  std::vector<Link> links_;
+  std::vector<std::chrono::steady_clock::time_point> redial_at_;
+  std::vector<bool> peer_linked_;
+  std::map<uint32_t, uint64_t> last_seq_;  // Per origin
+  uint64_t next_seq_ = 0;
+  MpscQueue<SharedFrame, kOutboxDepth> outbox_;
+  std::thread thread_;
+  std::atomic<bool> running_{false};
+};
+
+// ============================================================================
+// Inline implementations
+// ============================================================================
+
+// --- State handler functions (replace virtual ProtocolHandler) ---
+
+namespace detail {
+
+// Touch Bytes of stack below the caller so the reactor never faults it in later
+template <size_t Bytes>
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void prefault_stack() {
+  volatile uint8_t buf[Bytes];
+  for (size_t i = 0; i < Bytes; i += 4096) buf[i] = 0;
+  (void)buf[0];
+}
+
+inline expected<void, ErrorCode> handshake_on_data(Connection& conn) {
+  while (conn.serve_http()) {
+  }
+  if (conn.http_busy() || conn.is_closed()) return expected<void, ErrorCode>::success();
+  auto result = conn.parse_handshake();
+  if (result.has_value()) {
+    conn.transition_to_state(ConnectionState::kOpen);
+    return expected<void, ErrorCode>::success();
+  }
+  return result;
+}
+
+inline expected<void, ErrorCode> handshake_on_send(Connection&, std::string_view) {
+  return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+}
+
+inline expected<void, ErrorCode> handshake_on_close(Connection& conn, uint16_t) {
+  conn.socket().close();
+  conn.transition_to_state(ConnectionState::kClosed);
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> open_on_data(Connection& conn) {
+  conn.parse_frames();
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> open_on_send(Connection& conn, std::string_view payload) {
+  conn.write_frame(payload, ws::OpCode::kText);
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> open_on_close(Connection& conn, uint16_t code) {
+  conn.write_close_frame(code);
+  conn.transition_to_state(ConnectionState::kClosing);
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> closing_on_data(Connection& conn) {
+  uint8_t temp[1024];
+  size_t len = conn.rx_buffer().peek(temp, sizeof(temp));
+  if (len > 0) {
+    std::string_view data(reinterpret_cast<const char*>(temp), len);
+    ws::FrameHeader header;
+    size_t header_size = ws::parse_frame_header(data, header);
+    if (header_size > 0 && header.opcode == ws::OpCode::kClose) {
+      conn.transition_to_state(ConnectionState::kClosed);
+      conn.socket().close();
+    }
+  }
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> closing_on_send(Connection&, std::string_view) {
+  return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+}
+
+inline expected<void, ErrorCode> closing_on_close(Connection&, uint16_t) {
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> closed_on_data(Connection&) {
+  return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+}
+
+inline expected<void, ErrorCode> closed_on_send(Connection&, std::string_view) {
+  return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+}
+
+inline expected<void, ErrorCode> closed_on_close(Connection&, uint16_t) {
+  return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+}
+
+}  // namespace detail
+
+// State operation tables (const, zero allocation)
+inline const StateOps kHandshakeOps = {
+    ConnectionState::kHandshaking,
+    detail::handshake_on_data, detail::handshake_on_send, detail::handshake_on_close};
+inline const StateOps kOpenOps = {
+    ConnectionState::kOpen,
+    detail::open_on_data, detail::open_on_send, detail::open_on_close};
+inline const StateOps kClosingOps = {
+    ConnectionState::kClosing,
+    detail::closing_on_data, detail::closing_on_send, detail::closing_on_close};
+inline const StateOps kClosedOps = {
+    ConnectionState::kClosed,
+    detail::closed_on_data, detail::closed_on_send, detail::closed_on_close};
+
+// --- Connection implementation ---
+
+// Shared with handshake-stage threads, hence atomic
+inline uint64_t ewss_next_conn_id() {
+  static std::atomic<uint64_t> id{1};
+  return id.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline Connection::Connection(sockpp::tcp_socket&& sock, std::pmr::memory_resource* memory)
+    : id_(ewss_next_conn_id()), socket_(std::move(sock)), memory_(memory) {
+  socket_.set_non_blocking(true);
+  ops_ = &kHandshakeOps;
+}
+
+inline Connection::Connection(int fd, std::pmr::memory_resource* memory)
+    : id_(ewss_next_conn_id()), socket_(fd), memory_(memory) {
+  socket_.set_non_blocking(true);
+  ops_ = &kHandshakeOps;
+}
+
+inline Connection::~Connection() {
+  release_coroutines();
+  if (socket_.is_open()) socket_.close();
+}
+
+inline void Connection::Sleeper::link(Connection& conn) {
+  owner = &conn;
+  prev = nullptr;
+  next = conn.sleepers_;
+  if (next != nullptr) next->prev = this;
+  conn.sleepers_ = this;
+}
+
+inline void Connection::Sleeper::unlink() {
+  if (owner == nullptr) return;
+  (prev != nullptr ? prev->next : owner->sleepers_) = next;
+  if (next != nullptr) next->prev = prev;
+  owner = nullptr;
+}
+
+inline void Connection::release_coroutines() {
+  Waiter recv = static_cast<Waiter&&>(recv_waiter_);
+  Waiter drain = static_cast<Waiter&&>(drain_waiter_);
+  async_recv_ = false;
+  while (sleepers_ != nullptr) {
+    Sleeper* s = sleepers_;
+    s->unlink();
+    s->queue->cancel(s->timer);  // Destroys the frame holding s
+  }
+}
+
+inline expected<void, ErrorCode> Connection::handle_read() {
+  if (scratch_ != nullptr && get_state() == ConnectionState::kOpen && bridge_ == nullptr && !async_recv_ &&
+      (rx_buffer_ == nullptr || rx_buffer_->empty()))
+    return read_into_scratch();
+
+  struct iovec iov[2];
+  size_t iov_count = rx_buffer().fill_iovec_write(iov, 2);
+  if (iov_count == 0) {
+    last_error_code_ = ErrorCode::kBufferFull;
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+  }
+  ssize_t n = ::readv(socket_.handle(), iov, static_cast<int>(iov_count));
+  if (n > 0) {
+    rx_buffer_->commit_write(static_cast<size_t>(n));
+    touch_activity();
+    ops_->on_data(*this);
+    // The remainder is complete again: give the memory back
+    if (scratch_ != nullptr && rx_buffer_ != nullptr && rx_buffer_->empty() && !async_recv_) rx_buffer_.reset();
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  } else if (n == 0) {
+    last_error_code_ = ErrorCode::kConnectionClosed;
+    return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+  } else {
+    int err = errno;
+    if (err != EAGAIN && err != EWOULDBLOCK) {
+      last_error_code_ = ErrorCode::kSocketError;
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  }
+}
+
+// Whole frames are dispatched straight from the scratch buffer; a trailing partial
+// frame (or anything left after a close) is copied into rx_buffer()
+inline expected<void, ErrorCode> Connection::read_into_scratch() {
+  ssize_t n = ::recv(socket_.handle(), scratch_, scratch_size_, 0);
+  if (n == 0) {
+    last_error_code_ = ErrorCode::kConnectionClosed;
+    return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+  }
+  if (n < 0) {
+    int err = errno;
+    if (err != EAGAIN && err != EWOULDBLOCK) {
+      last_error_code_ = ErrorCode::kSocketError;
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  }
+
+  touch_activity();
+  bool halted = false;
+  size_t used = consume_frames(scratch_, static_cast<size_t>(n), halted);
+  size_t rest = static_cast<size_t>(n) - used;
+  if (rest == 0 || is_closed()) {
+    rx_buffer_.reset();  // Also drops the ring left over from the handshake
+  } else if (!rx_buffer().push(scratch_ + used, rest)) {
+    // Same limit as the ring path: a frame must fit in kRxBufferSize
+    last_error_code_ = ErrorCode::kBufferFull;
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+  }
+  last_error_code_ = ErrorCode::kOk;
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> Connection::handle_write() {
+  send_held_ = false;
+  if (bridge_ != nullptr && bridge_->pipe_pending() > 0) {
+    if (!bridge_->flush_pipe(socket_.handle()).has_value()) {
+      last_error_code_ = ErrorCode::kSocketError;
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    if (bridge_->pipe_pending() > 0) return expected<void, ErrorCode>::success();
+  }
+  if (tx_buffer_.empty()) {
+    if (http_left_ > 0) return send_http_file(SIZE_MAX);
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  }
+  uint8_t temp[kTempReadSize];
+  size_t len = tx_buffer_.peek(temp, kernel_send_budget(sizeof(temp)));
+  if (len == 0) {
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  }
+  auto res = socket_.write(temp, len);
+  if (res) {
+    tx_buffer_.advance(res.value());
+    if (resume_ != nullptr) pump_resend();
+    if (http_ != nullptr && get_state() == ConnectionState::kHandshaking) finish_http();
+    check_low_watermark();
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  } else {
+    int err = res.error().value();
+    if (err != EAGAIN && err != EWOULDBLOCK) {
+      last_error_code_ = ErrorCode::kSocketError;
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+  }
+  last_error_code_ = ErrorCode::kOk;
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> Connection::handle_write_vectored(size_t max_bytes) {
+  send_held_ = false;
+  last_written_ = 0;  // Also on the early returns below, so callers never recount a previous write
+  if (bridge_ != nullptr && bridge_->pipe_pending() > 0) {
+    if (!bridge_->flush_pipe(socket_.handle()).has_value()) {
+      last_error_code_ = ErrorCode::kSocketError;
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    if (bridge_->pipe_pending() > 0) return expected<void, ErrorCode>::success();
+  }
+  if (tx_buffer_.empty()) {
+    if (http_left_ > 0) return send_http_file(max_bytes);
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  }
+  max_bytes = kernel_send_budget(max_bytes);
+  struct iovec iov[2];
+  size_t iov_count = tx_buffer_.fill_iovec(iov, 2);
+  if (iov_count == 0 || max_bytes == 0) {
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  }
+  if (iov[0].iov_len >= max_bytes) {
+    iov[0].iov_len = max_bytes;
+    iov_count = 1;
+  } else if (iov_count == 2) {
+    iov[1].iov_len = std::min(iov[1].iov_len, max_bytes - iov[0].iov_len);
+  }
+  ssize_t n = ::writev(socket_.handle(), iov, static_cast<int>(iov_count));
+  if (n > 0) {
+    tx_buffer_.advance(static_cast<size_t>(n));
+    last_written_ = static_cast<size_t>(n);
+    if (resume_ != nullptr) pump_resend();
+    if (http_ != nullptr && get_state() == ConnectionState::kHandshaking) {
+      // Head is out: the file body follows in the same budget
+      if (tx_buffer_.empty() && http_left_ > 0 && last_written_ < max_bytes)
+        return send_http_file(max_bytes - last_written_);
+      finish_http();
+    }
+    check_low_watermark();
+    last_error_code_ = ErrorCode::kOk;
+    return expected<void, ErrorCode>::success();
+  } else if (n < 0) {
+    int err = errno;
+    if (err != EAGAIN && err != EWOULDBLOCK) {
+      last_error_code_ = ErrorCode::kSocketError;
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+  }
+  last_error_code_ = ErrorCode::kOk;
+  return expected<void, ErrorCode>::success();
+}
+
+inline void Connection::send_impl(std::string_view payload, bool binary) {
+  if (get_state() != ConnectionState::kOpen) return;
+  if (resume_ != nullptr) {
+    retain(encode_retained(payload, binary ? ws::OpCode::kBinary : ws::OpCode::kText));
+    return;
+  }
+  if (batching_) {
+    queue_record(payload, binary);
+    return;
+  }
+  write_message(payload, binary ? ws::OpCode::kBinary : ws::OpCode::kText);
+  check_high_watermark();
+}
+
+inline void Connection::enable_batching(const BatchPolicy& policy) {
+  batching_ = true;
+  batch_policy_ = policy;
+  batch_out_.reserve(policy.max_bytes + batch::kMaxRecordHeader);
+}
+
+inline void Connection::queue_record(std::string_view payload, bool binary) {
+  size_t record = payload.size() + batch::kMaxRecordHeader;
+  if (!batch_out_.empty() && batch_out_.size() + record > batch_policy_.max_bytes) flush_batch();
+  batch::append_record(batch_out_, payload, binary);
+  if (batch_out_.size() >= batch_policy_.max_bytes || batch_policy_.delay_us == 0) {
+    flush_batch();
+    return;
+  }
+  if (batch_timer_ != 0) return;
+  // First record of the window: flush from the reactor's timer queue
+  TimerQueue* timers = TimerQueue::current();
+  if (timers != nullptr) {
+    std::weak_ptr<Connection> weak = weak_from_this();
+    batch_timer_ = timers->schedule(std::chrono::microseconds(batch_policy_.delay_us), [weak]() {
+      if (auto conn = weak.lock()) {
+        conn->batch_timer_ = 0;
+        conn->flush_batch();
+      }
+    });
+  }
+  if (batch_timer_ == 0) flush_batch();  // No timer available: no window
+}
+
+inline void Connection::flush_batch() {
+  if (batch_timer_ != 0) {
+    if (TimerQueue::current() != nullptr) TimerQueue::current()->cancel(batch_timer_);
+    batch_timer_ = 0;
+  }
+  if (batch_out_.empty()) return;
+  if (get_state() == ConnectionState::kOpen) {
+    write_message(batch_out_, ws::OpCode::kBinary);
+    check_high_watermark();
+  }
+  batch_out_.clear();
+}
+
+inline void Connection::close(uint16_t code) {
+  if (get_state() == ConnectionState::kClosed) return;
+  if (get_state() == ConnectionState::kOpen) {
+    flush_batch();
+    write_close_frame(code);
+    transition_to_state(ConnectionState::kClosing);
+  } else {
+    transition_to_state(ConnectionState::kClosed);
+    socket_.close();
+  }
+}
+
+inline bool Connection::is_migratable() const {
+  return get_state() == ConnectionState::kOpen && bridge_ == nullptr && !async_recv_ && !drain_waiter_ &&
+         sleepers_ == nullptr && resume_ == nullptr && (rpc_ == nullptr || rpc_->pending() == 0);
+}
+
+inline bool Connection::is_closed() const {
+  return !socket_.is_open() || get_state() == ConnectionState::kClosed;
+}
+
+inline void Connection::transition_to_state(ConnectionState state) {
+  switch (state) {
+    case ConnectionState::kHandshaking: ops_ = &kHandshakeOps; break;
+    case ConnectionState::kOpen:
+      ops_ = &kOpenOps;
+      invoke(CallbackKind::kOpen, on_open, shared_from_this());
+      break;
+    case ConnectionState::kClosing:
+      ops_ = &kClosingOps;
+      closing_at_ = SteadyClock::now();
+      wake(recv_waiter_, ErrorCode::kConnectionClosed);
+      wake(drain_waiter_, ErrorCode::kConnectionClosed);
+      break;
+    case ConnectionState::kClosed:
+      ops_ = &kClosedOps;
+      invoke(CallbackKind::kClose, on_close, shared_from_this(), true);
+      wake(recv_waiter_, ErrorCode::kConnectionClosed);
+      wake(drain_waiter_, ErrorCode::kConnectionClosed);
+      break;
+  }
+}
+
+inline expected<void, ErrorCode> Connection::parse_handshake() {
+  uint8_t temp[1024];
+  size_t len = rx_buffer().peek(temp, sizeof(temp));
+  if (len == 0)
+    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+
+  std::string_view data(reinterpret_cast<const char*>(temp), len);
+  if (data.find("\r\n\r\n") == std::string_view::npos)
+    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+
+  ws::UpgradeRequest req;
+  if (!ws::parse_upgrade_request(data, req)) return fail_handshake();
+
+  path_.assign(req.path.data(), req.path.size());
+  if (on_upgrade) {
+    int status = on_upgrade(shared_from_this(), path_);
+    if (status != 101) {
+      reject_upgrade(status);
+      last_error_code_ = ErrorCode::kHandshakeFailed;
+      return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+    }
+  }
+
+  char ext_buf[128];
+  size_t ext_len = 0;
+  uint8_t deflate_window = 0;  // What encode_retained() will compress with
+#if EWSS_HAS_DEFLATE
+  deflate::Params deflate_params;
+  if (deflate_offer_ != nullptr && deflate::parse_offer(req.extensions, deflate_params)) {
+    deflate_params.server_no_context_takeover |= deflate_offer_->server_no_context_takeover;
+    ext_len = deflate::write_response(deflate_params, ext_buf, sizeof(ext_buf));
+    if (ext_len > 0 && deflate_params.server_no_context_takeover) deflate_window = deflate_params.server_max_window_bits;
+  }
+#endif
+
+  std::shared_ptr<ResumeSession> session;
+  bool resumed = false;
+  uint64_t last_seq = 0;
+  char session_hdr[96];
+  size_t session_len = 0;
+  if (resume_store_ != nullptr) {
+    // Absent: nothing received yet. Malformed: no window covers UINT64_MAX, so a miss
+    std::string_view seq = ws::query_param(req.query, "last_seq");
+    if (!seq.empty() && !ws::parse_u64(seq, last_seq)) last_seq = UINT64_MAX;
+    // Retained frames are resent as encoded, so the new handshake must agree on deflate
+    session = resume_store_->open(ws::query_param(req.query, "resume"), last_seq, deflate_window, resumed);
+    if (!resumed) last_seq = 0;
+    if (session != nullptr) {
+      int n = snprintf(session_hdr, sizeof(session_hdr), "X-Ewss-Session: %s %llu\r\n", session->token().c_str(),
+                       static_cast<unsigned long long>(last_seq));
+      session_len = n > 0 ? static_cast<size_t>(n) : 0;
+    }
+  }
+
+  // One subprotocol per connection: RPC envelopes would not survive batching. Resumable
+  // sessions number whole frames, so they never batch either
+  bool use_rpc = rpc_ != nullptr && ws::offers_protocol(req.protocols, rpc::kProtocol);
+  bool batch = batch_offer_ != nullptr && !use_rpc && session == nullptr &&
+               ws::offers_protocol(req.protocols, batch::kProtocol);
+  std::string_view protocol = use_rpc ? rpc::kProtocol : batch ? batch::kProtocol : std::string_view{};
+  char response_buf[512];
+  size_t response_len = ws::write_upgrade_response(req.key, response_buf, sizeof(response_buf), protocol,
+                                                   std::string_view(ext_buf, ext_len),
+                                                   std::string_view(session_hdr, session_len));
+  if (response_len == 0) return fail_handshake();
+  rx_buffer_->advance(req.size);
+
+  if (!tx_buffer_.push(reinterpret_cast<const uint8_t*>(response_buf), response_len)) {
+    last_error_code_ = ErrorCode::kBufferFull;
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+  }
+
+  if (batch) enable_batching(*batch_offer_);
+  rpc_negotiated_ = use_rpc;
+  if (!use_rpc) rpc_.reset();
+#if EWSS_HAS_DEFLATE
+  if (ext_len > 0) {
+    deflate_ = pmr_new<DeflateSession>(memory_, memory_);
+    deflate_->params = deflate_params;
+    deflate_->policy = *deflate_offer_;
+  }
+#endif
+  if (session != nullptr) {
+    if (Connection* old = session->owner) {  // Reconnected before the old socket was noticed dead
+      old->resume_.reset();
+      old->close(1001);
+    }
+    resume_store_->reattach(*session, this);
+    resume_ = std::move(session);
+    resend_next_ = resumed ? last_seq + 1 : resume_->next_seq();
+  }
+  handshake_completed_ = true;
+  sec_websocket_key_.clear();
+  last_error_code_ = ErrorCode::kOk;
+  return expected<void, ErrorCode>::success();
+}
+
+inline void Connection::parse_frames() {
+  rx_stalled_ = false;
+  if (rx_buffer_ == nullptr) return;
+  uint8_t temp[kRxBufferSize];
+  size_t len = rx_buffer_->peek(temp, sizeof(temp));
+  bool halted = false;
+  size_t used = consume_frames(temp, len, halted);
+  if (rx_buffer_ != nullptr) rx_buffer_->advance(used);
+  if (halted) return;
+  if (bridge_ != nullptr && !bridge_->flush_upstream().has_value()) close(1011);
+}
+
+// Dispatch the complete frames at the front of data (unmasking in place). Stops at a
+// partial frame, a frame held back for the bridge or a coroutine, or a close
+// (halted); returns the bytes consumed.
+inline size_t Connection::consume_frames(uint8_t* data, size_t len, bool& halted) {
+  size_t pos = 0;
+  while (pos < len) {
+    uint8_t* frame = data + pos;
+    std::string_view view(reinterpret_cast<const char*>(frame), len - pos);
+    ws::FrameHeader header;
+    size_t header_size = ws::parse_frame_header(view, header);
+    if (header_size == 0) break;
+
+    if (max_message_size_ > 0 && header.payload_len > max_message_size_) {
+      close(1009);
+      halted = true;
+      return pos;
+    }
+
+    size_t total_frame_size = header_size + header.payload_len;
+    if (len - pos < total_frame_size) break;
+
+    const uint8_t* mask_key = nullptr;
+    if (header.masked) mask_key = frame + (header_size - 4);
+
+    uint8_t* payload = frame + header_size;
+    size_t payload_len = header.payload_len;
+
+    if (bridge_ != nullptr &&
+        (header.opcode == ws::OpCode::kText || header.opcode == ws::OpCode::kBinary ||
+         header.opcode == ws::OpCode::kContinuation)) {
+      if (!bridge_->forward_upstream(payload, payload_len, mask_key)) break;
+      pos += total_frame_size;
+      continue;
+    }
+
+    if (header.masked) unmask_payload(payload, payload_len, mask_key);
+
+    switch (header.opcode) {
+      case ws::OpCode::kText:
+      case ws::OpCode::kBinary: {
+        std::string_view msg(reinterpret_cast<const char*>(payload), payload_len);
+        if (header.rsv1 && !inflate_message(msg)) {
+          halted = true;
+          return pos;
+        }
+        bool delivered = batching_ && header.opcode == ws::OpCode::kBinary ? deliver_batch(msg)
+                                                                            : deliver_message(msg, header.opcode);
+#if EWSS_HAS_DEFLATE
+        rx_inflated_ = !delivered && header.rsv1;
+#endif
+        if (!delivered) {  // Leave it in rx_buffer_ until the next recv()
+          if (header.masked) unmask_payload(payload, payload_len, mask_key);  // Restore wire bytes
+          rx_stalled_ = true;
+          halted = true;
+          return pos;
+        }
+        if (capture_ != nullptr) capture_->record(id_, frame[0] & 0x8F, msg.data(), msg.size());
+        if (batching_ && header.opcode == ws::OpCode::kBinary && get_state() != ConnectionState::kOpen) {
+          halted = true;
+          return pos + total_frame_size;
+        }
+        break;
+      }
+      case ws::OpCode::kClose:
+        if (capture_ != nullptr) capture_->record(id_, frame[0], payload, payload_len);
+        invoke(CallbackKind::kClose, on_close, shared_from_this(), false);
+        transition_to_state(ConnectionState::kClosed);
+        socket_.close();
+        halted = true;
+        return pos + total_frame_size;
+      case ws::OpCode::kPing:
+        if (capture_ != nullptr) capture_->record(id_, frame[0], payload, payload_len);
+        write_frame(std::string_view(reinterpret_cast<const char*>(payload), payload_len),
+                    ws::OpCode::kPong);
+        break;
+      case ws::OpCode::kPong:
+        if (capture_ != nullptr) capture_->record(id_, frame[0], payload, payload_len);
+        break;
+      default:
+        break;
+    }
+    pos += total_frame_size;
+  }
+  return pos;
+}
+
+// Replace a compressed (RSV1) message with its inflated form; closes on failure
+inline bool Connection::inflate_message(std::string_view& msg) {
+#if EWSS_HAS_DEFLATE
+  if (deflate_ != nullptr) {
+    DeflateSession& d = *deflate_;
+    if (!rx_inflated_) {  // A stalled frame was inflated already; the stream must not see it twice
+      if (d.rx == nullptr) d.rx = pmr_new<deflate::Decompressor>(memory_, d.params.client_max_window_bits, memory_);
+      size_t cap = d.policy.max_inflated;
+      if (max_message_size_ > 0) cap = std::min<size_t>(cap, max_message_size_);
+      auto r = d.rx->decompress(msg, d.in, cap, d.params.client_no_context_takeover);
+      if (!r.has_value()) {
+        close(r.get_error() == ErrorCode::kBufferFull ? 1009 : 1007);
+        return false;
+      }
+    }
+    msg = d.in;
+    return true;
+  }
+#endif
+  close(1002);  // RSV1 without a negotiated extension
+  (void)msg;
+  return false;
+}
+
+// False when a coroutine receiver is registered but not waiting; redeliver later
+inline bool Connection::deliver_message(std::string_view msg, ws::OpCode opcode) {
+  msg_opcode_ = opcode;
+  if (rpc_ != nullptr && opcode == ws::OpCode::kBinary && rpc_->on_message(*this, msg)) return true;
+  if (async_recv_) {
+    if (!recv_waiter_) return false;
+    async_msg_ = msg;
+    wake(recv_waiter_, ErrorCode::kOk);
+    return true;
+  }
+  invoke(CallbackKind::kMessage, on_message, shared_from_this(), msg);
+  return true;
+}
+
+// Each record is delivered as its own message; a stall remembers how far it got
+inline bool Connection::deliver_batch(std::string_view frame) {
+  uint32_t index = 0;
+  while (!frame.empty()) {
+    std::string_view msg;
+    bool binary = false;
+    size_t used = batch::parse_record(frame, msg, binary);
+    if (used == 0) {
+      close(1007);
+      break;
+    }
+    frame.remove_prefix(used);
+    if (index++ < batch_rx_skip_) continue;
+    if (!deliver_message(msg, binary ? ws::OpCode::kBinary : ws::OpCode::kText)) {
+      batch_rx_skip_ = index - 1;
+      return false;
+    }
+    if (get_state() != ConnectionState::kOpen) break;
+  }
+  batch_rx_skip_ = 0;
+  return true;
+}
+
+inline void Connection::write_message(std::string_view payload, ws::OpCode opcode) {
+#if EWSS_HAS_DEFLATE
+  if (deflate_ != nullptr && payload.size() >= deflate_->policy.min_size) {
+    DeflateSession& d = *deflate_;
+    bool shared = d.params.server_no_context_takeover;
+    if (!shared && d.tx == nullptr)
+      d.tx = pmr_new<deflate::Compressor>(memory_, d.params.server_max_window_bits, d.policy.level, memory_);
+    deflate::Compressor& c = shared ? deflate::shared_compressor(d.params.server_max_window_bits, d.policy.level) : *d.tx;
+    if (c.compress(payload, d.out, shared)) {
+      write_frame(d.out, opcode, true);
+      return;
+    }
+  }
+#endif
+  write_frame(payload, opcode);
+}
+
+inline void Connection::write_frame(std::string_view payload, ws::OpCode opcode, bool compressed) {
+  uint8_t header_buf[14];
+  size_t header_len = ws::encode_frame_header(header_buf, opcode, payload.size(), false);
+  if (compressed) header_buf[0] |= 0x40;
+  if (!tx_buffer_.push(header_buf, header_len)) return;
+  if (!payload.empty())
+    tx_buffer_.push(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+}
+
+inline void Connection::write_close_frame(uint16_t code) {
+  uint8_t close_payload[2];
+  close_payload[0] = static_cast<uint8_t>((code >> 8) & 0xFF);
+  close_payload[1] = static_cast<uint8_t>(code & 0xFF);
+  uint8_t header_buf[14];
+  size_t header_len = ws::encode_frame_header(header_buf, ws::OpCode::kClose, 2, false);
+  if (!tx_buffer_.push(header_buf, header_len)) return;
+  tx_buffer_.push(close_payload, 2);
+}
+
+inline void Connection::unmask_payload(uint8_t* payload, size_t len, const uint8_t* mask_key) {
+  ws::unmask_copy(payload, payload, len, mask_key);
+}
+
+inline void Connection::check_high_watermark() {
+  if (!write_paused_ && tx_buffer_.size() > tx_high_watermark_) {
+    write_paused_ = true;
+    invoke(CallbackKind::kBackpressure, on_backpressure, shared_from_this());
+  }
+}
+
+inline void Connection::check_low_watermark() {
+  if (write_paused_ && tx_buffer_.size() < tx_low_watermark_) {
+    write_paused_ = false;
+    invoke(CallbackKind::kDrain, on_drain, shared_from_this());
+  }
+  if (drain_waiter_ && tx_buffer_.empty()) wake(drain_waiter_, ErrorCode::kOk);
+}
+
+// Move the waiter out first so the resumed coroutine can register again
+inline void Connection::wake(Waiter& waiter, ErrorCode err) {
+  if (!waiter) return;
+  Waiter w = static_cast<Waiter&&>(waiter);
+  async_error_ = err;
+  if (err != ErrorCode::kOk) async_msg_ = {};
+  Connection* prev = std::exchange(current(), this);
+  w();
+  current() = prev;
+}
+
+template <typename Fn, typename... Args>
+inline void Connection::invoke(CallbackKind kind, const Fn& fn, Args&&... args) {
+  if (!fn) return;
+  Connection* prev = std::exchange(current(), this);
+  if (watchdog_ == nullptr) {
+    fn(std::forward<Args>(args)...);
+    current() = prev;
+    return;
+  }
+  auto start = SteadyClock::now();
+  fn(std::forward<Args>(args)...);
+  watchdog_->record(id_, kind, static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(SteadyClock::now() - start).count()));
+  current() = prev;
+}
+
+inline bool Connection::has_data_to_send() const {
+  return !tx_buffer_.empty() || http_left_ > 0 || (bridge_ != nullptr && bridge_->pipe_pending() > 0);
+}
+
+inline bool Connection::sample_tcp_info() {
+  struct tcp_info info{};
+  socklen_t len = sizeof(info);
+  if (getsockopt(socket_.handle(), IPPROTO_TCP, TCP_INFO, &info, &len) != 0) return false;
+  tcp_health_.rtt_us = info.tcpi_rtt;
+  tcp_health_.rttvar_us = info.tcpi_rttvar;
+  tcp_health_.snd_cwnd = info.tcpi_snd_cwnd;
+  tcp_health_.unacked = info.tcpi_unacked;
+  tcp_health_.unacked_bytes = info.tcpi_unacked * info.tcpi_snd_mss;
+  tcp_health_.lost = info.tcpi_lost;
+  tcp_health_.total_retrans = info.tcpi_total_retrans;
+  tcp_health_.tx_buffer = static_cast<uint32_t>(tx_buffer_.size());
+  tcp_health_.sampled_at = SteadyClock::now();
+  return true;
+}
+
+inline void Connection::set_kernel_queue_target(uint32_t bytes) {
+  int queued = 0;
+  if (bytes > 0 && ioctl(socket_.handle(), SIOCOUTQNSD, &queued) != 0) bytes = 0;
+  kernel_queue_target_ = bytes;
+  send_held_ = false;
+#ifdef TCP_NOTSENT_LOWAT
+  // 0 restores the default (no low-water mark)
+  int lowat = bytes > 0 ? static_cast<int>(std::min<uint32_t>(bytes, INT32_MAX)) : INT32_MAX;
+  setsockopt(socket_.handle(), IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat));
+#endif
+}
+
+inline size_t Connection::kernel_send_budget(size_t max_bytes) {
+  if (kernel_queue_target_ == 0) return max_bytes;
+  // Unsent bytes only, the quantity TCP_NOTSENT_LOWAT wakes on
+  int queued = 0;
+  if (ioctl(socket_.handle(), SIOCOUTQNSD, &queued) != 0) return max_bytes;
+  size_t unsent = queued > 0 ? static_cast<size_t>(queued) : 0;
+  size_t room = unsent < kernel_queue_target_ ? kernel_queue_target_ - unsent : 0;
+  send_held_ = room < std::min(max_bytes, tx_buffer_.size());
+  return std::min(max_bytes, room);
+}
+
+inline void Connection::attach_bridge(PmrPtr<BridgeLink> link) { bridge_ = std::move(link); }
+
+inline void Connection::attach_rpc(PmrPtr<RpcSession> session) { rpc_ = std::move(session); }
+
+inline bool Connection::send_binary(std::string_view head, std::string_view payload) {
+  if (get_state() != ConnectionState::kOpen) return false;
+  const size_t len = head.size() + payload.size();
+  uint8_t header_buf[14];
+  size_t header_len = ws::encode_frame_header(header_buf, ws::OpCode::kBinary, len, false);
+  if (tx_buffer_.available() < header_len + len) return false;
+  tx_buffer_.push(header_buf, header_len);
+  tx_buffer_.push(reinterpret_cast<const uint8_t*>(head.data()), head.size());
+  tx_buffer_.push(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+  check_high_watermark();
+  return true;
+}
+
+inline bool Connection::send_encoded(std::string_view frame) {
+  if (resume_ != nullptr) {
+    if (get_state() != ConnectionState::kOpen) return false;
+    retain(SharedFrame::copy_of(frame, memory_));
+    return true;
+  }
+  if (get_state() != ConnectionState::kOpen || tx_buffer_.available() < frame.size()) return false;
+  bool requeue = batching_;
+#if EWSS_HAS_DEFLATE
+  requeue = requeue || (deflate_ != nullptr && !deflate_->params.server_no_context_takeover);
+#endif
+  if (requeue) {
+    ws::FrameHeader header;
+    size_t header_size = ws::parse_frame_header(frame, header);
+    if (header_size == 0 || tx_buffer_.available() < batch_out_.size() + frame.size() + 2 * 14) return false;
+    send_impl(frame.substr(header_size, header.payload_len), header.opcode == ws::OpCode::kBinary);
+    return true;
+  }
+  tx_buffer_.push(reinterpret_cast<const uint8_t*>(frame.data()), frame.size());
+  check_high_watermark();
+  return true;
+}
+
+inline bool Connection::send_shared(const SharedFrame& frame) {
+  if (resume_ == nullptr) return send_encoded(frame.bytes());
+  if (get_state() != ConnectionState::kOpen) return false;
+  retain(frame);
+  return true;
+}
+
+// --- Session resumption ---
+
+// Self-contained frame for the resend window: deflated only without context takeover
+inline SharedFrame Connection::encode_retained(std::string_view payload, ws::OpCode opcode) {
+#if EWSS_HAS_DEFLATE
+  if (deflate_ != nullptr && deflate_->params.server_no_context_takeover && payload.size() >= deflate_->policy.min_size) {
+    DeflateSession& d = *deflate_;
+    if (deflate::shared_compressor(d.params.server_max_window_bits, d.policy.level).compress(payload, d.out, true))
+      return SharedFrame::encode({}, d.out, opcode, true, memory_);
+  }
+#endif
+  return SharedFrame::encode({}, payload, opcode, false, memory_);
+}
+
+// Number frame into the session, then write whatever fits behind any pending gap
+inline void Connection::retain(SharedFrame frame) {
+  if (!frame || frame.bytes().size() > kTxBufferSize) return;  // Could never be written (as with send())
+  ResumeSession& s = *resume_;
+  s.push(std::move(frame));
+  if (resend_next_ < s.first_seq()) {  // Unsent frames were evicted: this client cannot keep up
+    close(1013);
+    return;
+  }
+  pump_resend();
+}
+
+inline void Connection::pump_resend() {
+  if (get_state() != ConnectionState::kOpen) return;
+  ResumeSession& s = *resume_;
+  while (resend_next_ < s.next_seq()) {
+    std::string_view bytes = s.at(resend_next_).bytes();
+    if (tx_buffer_.available() < bytes.size()) break;
+    tx_buffer_.push(reinterpret_cast<const uint8_t*>(bytes.data()), bytes.size());
+    ++resend_next_;
+  }
+  check_high_watermark();
+}
+
+inline void Connection::detach_session() {
+  if (resume_ == nullptr) return;
+  if (resume_store_ != nullptr) resume_store_->detach(*resume_, this, SessionStore::Clock::now());
+  resume_.reset();
+}
+
+inline void Connection::set_route(int route, const BufferProfile& buffers, const RouteLimits& limits) {
+  route_ = route;
+  tx_high_watermark_ = buffers.tx_high_watermark > 0
+      ? std::min<uint32_t>(buffers.tx_high_watermark, kTxBufferSize) : kTxHighWatermark;
+  tx_low_watermark_ = buffers.tx_low_watermark > 0
+      ? std::min(buffers.tx_low_watermark, tx_high_watermark_) : std::min<uint32_t>(kTxLowWatermark, tx_high_watermark_);
+  max_message_size_ = limits.max_message_size;
+  idle_timeout_ms_ = limits.idle_timeout_ms;
+}
+
+inline bool Connection::adopt_open(std::string_view path, std::string_view response,
+                                   std::string_view leftover) {
+  path_.assign(path.data(), path.size());
+  if (on_upgrade) {
+    int status = on_upgrade(shared_from_this(), path_);
+    if (status != 101) {
+      reject_upgrade(status);
+      return false;
+    }
+  }
+  tx_buffer_.push(reinterpret_cast<const uint8_t*>(response.data()), response.size());
+  std::string_view protocol = ws::response_protocol(response);
+  if (protocol == batch::kProtocol) enable_batching(batch_offer_ != nullptr ? *batch_offer_ : BatchPolicy{});
+  rpc_negotiated_ = rpc_ != nullptr && protocol == rpc::kProtocol;
+  if (!rpc_negotiated_) rpc_.reset();
+  if (!leftover.empty()) rx_buffer().push(reinterpret_cast<const uint8_t*>(leftover.data()), leftover.size());
+  handshake_completed_ = true;
+  transition_to_state(ConnectionState::kOpen);
+  if (rx_buffer_ != nullptr && !rx_buffer_->empty()) ops_->on_data(*this);
+  return true;
+}
+
+inline expected<void, ErrorCode> Connection::fail_handshake() {
+  last_error_code_ = ErrorCode::kHandshakeFailed;
+  if (stats_ != nullptr) stats_->handshake_errors.fetch_add(1, std::memory_order_relaxed);
+  return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+}
+
+// Best-effort status line straight to the socket, then drop without on_close (never opened).
+// Counted first, so a client that reads the status already sees it in the stats
+inline void Connection::reject_upgrade(int status) {
+  if (stats_ != nullptr) stats_->handshake_errors.fetch_add(1, std::memory_order_relaxed);
+  const char* reason = status == 404 ? "Not Found" : status == 503 ? "Service Unavailable" : "Forbidden";
+  char buf[128];
+  int n = snprintf(buf, sizeof(buf), "HTTP/1.1 %d %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n",
+                   status, reason);
+  if (n > 0) (void)::send(socket_.handle(), buf, static_cast<size_t>(n), MSG_NOSIGNAL);
+  ops_ = &kClosedOps;
+  socket_.close();
+}
+
+// --- Plain HTTP (HttpResponder) ---
+
+// The connection stays in kHandshaking between requests, so a keep-alive client
+// may follow up with more GETs or an upgrade; each request restarts the handshake
+// timeout, which doubles as the keep-alive idle timeout
+inline bool Connection::serve_http() {
+  if (http_ == nullptr || http_busy() || rx_buffer_ == nullptr || rx_buffer_->empty()) return false;
+  uint8_t temp[1024];
+  size_t len = rx_buffer_->peek(temp, sizeof(temp));
+  ws::PlainRequest req;
+  if (!ws::parse_plain_request(std::string_view(reinterpret_cast<const char*>(temp), len), req)) return false;
+
+  const HttpResponder::Entry& entry = http_->lookup(req.method, req.path);
+  bool head_only = req.method != "GET";  // HEAD, or a 405 without body
+  bool keep_alive = req.keep_alive && (req.method == "GET" || req.method == "HEAD");
+  const std::string& head = entry.head[keep_alive ? 1 : 0];
+  size_t inline_body = head_only || entry.fd >= 0 ? 0 : entry.body.size();
+  if (tx_buffer_.available() < head.size() + inline_body) return false;  // Retried once tx drains
+
+  rx_buffer_->advance(req.size);
+  tx_buffer_.push(reinterpret_cast<const uint8_t*>(head.data()), head.size());
+  if (inline_body > 0) tx_buffer_.push(reinterpret_cast<const uint8_t*>(entry.body.data()), inline_body);
+  if (!head_only && entry.fd >= 0 && entry.file_size > 0) {
+    http_fd_ = entry.fd;
+    http_off_ = 0;
+    http_left_ = entry.file_size;
+  }
+  http_close_after_ = !keep_alive;
+  created_at_ = SteadyClock::now();
+  return true;
+}
+
+// File body straight from the page cache once the head has left tx_buffer_
+inline expected<void, ErrorCode> Connection::send_http_file(size_t max_bytes) {
+  ssize_t n = ::sendfile(socket_.handle(), http_fd_, &http_off_, std::min(http_left_, max_bytes));
+  if (n > 0) {
+    http_left_ -= static_cast<size_t>(n);
+    last_written_ += static_cast<size_t>(n);
+    created_at_ = SteadyClock::now();
+  } else if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+    // Truncated under us: the promised Content-Length can no longer be met
+    http_left_ = 0;
+    http_close_after_ = true;
+  }
+  finish_http();
+  last_error_code_ = ErrorCode::kOk;
+  return expected<void, ErrorCode>::success();
+}
 
-inline expected<void, ErrorCode> handshake_on_close(Connection& conn, uint16_t) {
-  conn.socket().close();
-  conn.transition_to_state(ConnectionState::kClosed);
+// Response fully written: close, or carry on with a pipelined request
+inline void Connection::finish_http() {
+  if (http_left_ > 0 || !tx_buffer_.empty()) return;
+  http_fd_ = -1;
+  if (http_close_after_) {
+    ops_ = &kClosedOps;  // Never opened: no on_close
+    socket_.close();
+    return;
+  }
+  if (rx_buffer_ != nullptr && !rx_buffer_->empty()) ops_->on_data(*this);
+}
+
+// Bridged connections stop reading while the backend cannot absorb a full rx_buffer_;
+// coroutine receivers stop once unread messages fill rx_buffer_
+inline bool Connection::wants_read() const {
+  if (rx_stalled_ && rx_buffer_ != nullptr && rx_buffer_->available() == 0) return false;
+  return bridge_ == nullptr || bridge_->upstream_available() >= kRxBufferSize;
+}
+
+inline void Connection::log_error(const std::string&) {}
+
+// --- BridgeLink implementation ---
+
+inline int BridgeLink::poll_fd(const Connection& conn, short& events) const {
+  events = 0;
+  if (connecting_ || !upstream_.empty()) events |= POLLOUT;
+  if (!connecting_ && pipe_pending_ == 0 && conn.tx_buffer_usage() < Connection::kTxHighWatermark)
+    events |= POLLIN;
+  return (hup_ && events == 0) ? -1 : backend_fd_;
+}
+
+inline expected<void, ErrorCode> BridgeLink::on_backend_ready(Connection& conn, short revents) {
+  if (connecting_) {
+    if ((revents & (POLLOUT | POLLERR | POLLHUP)) == 0) return expected<void, ErrorCode>::success();
+    int err = 0;
+    socklen_t len = sizeof(err);
+    if (::getsockopt(backend_fd_, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+      stats_.bridge_connect_failures.fetch_add(1, std::memory_order_relaxed);
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    connecting_ = false;
+  }
+  if (revents & POLLHUP) hup_ = true;
+  if (revents & POLLERR) return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+  if (revents & POLLOUT) {
+    auto r = flush_upstream();
+    if (!r.has_value()) return r;
+    // Frames held back in rx_buffer_ for lack of upstream room can move now
+    if (!conn.rx_buffer().empty() && conn.get_state() == ConnectionState::kOpen) conn.parse_frames();
+  }
+  if (revents & (POLLIN | POLLHUP)) {
+    if (pipe_pending_ == 0 && conn.tx_buffer_usage() < Connection::kTxHighWatermark)
+      return read_downstream(conn);
+  }
   return expected<void, ErrorCode>::success();
 }
 
-inline expected<void, ErrorCode> open_on_data(Connection& conn) {
-  conn.parse_frames();
+inline expected<void, ErrorCode> BridgeLink::read_downstream(Connection& conn) {
+  if (use_splice_ && !conn.has_data_to_send()) {
+    bool spliced = false;
+    auto r = splice_downstream(conn, spliced);
+    if (!r.has_value() || spliced) return r;
+  }
+  auto& tx = conn.tx_buffer();
+  if (tx.available() <= 16) return expected<void, ErrorCode>::success();
+  uint8_t buf[4096];
+  size_t want = std::min(sizeof(buf), tx.available() - 16);
+  ssize_t n = ::read(backend_fd_, buf, want);
+  if (n == 0) return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) return expected<void, ErrorCode>::success();
+    return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+  }
+  conn.write_frame(std::string_view(reinterpret_cast<const char*>(buf), static_cast<size_t>(n)),
+                   ws::OpCode::kBinary);
+  conn.check_high_watermark();
+  stats_.bridge_bytes_down.fetch_add(static_cast<uint64_t>(n), std::memory_order_relaxed);
+  return expected<void, ErrorCode>::success();
+}
+
+// Header-then-splice: backend -> pipe, header -> client, pipe -> client
+inline expected<void, ErrorCode> BridgeLink::splice_downstream(Connection& conn, bool& spliced) {
+  ssize_t n = ::splice(backend_fd_, nullptr, pipe_w_, nullptr, kChunkSize,
+                       SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (n == 0) return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+  if (n < 0) {
+    if (errno == EAGAIN || errno == EWOULDBLOCK) {
+      spliced = true;  // Nothing to read; do not fall through to read()
+      return expected<void, ErrorCode>::success();
+    }
+    if (errno == EINVAL) {  // splice unsupported for this fd pair
+      use_splice_ = false;
+      return expected<void, ErrorCode>::success();
+    }
+    return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+  }
+  spliced = true;
+  size_t len = static_cast<size_t>(n);
+  stats_.bridge_bytes_down.fetch_add(len, std::memory_order_relaxed);
+
+  uint8_t header[14];
+  size_t header_len = ws::encode_frame_header(header, ws::OpCode::kBinary, len, false);
+  ssize_t w = ::send(conn.get_fd(), header, header_len, MSG_DONTWAIT | MSG_NOSIGNAL | MSG_MORE);
+  if (w == static_cast<ssize_t>(header_len)) {
+    pipe_pending_ = len;
+    stats_.bridge_spliced_bytes.fetch_add(len, std::memory_order_relaxed);
+    return flush_pipe(conn.get_fd());
+  }
+  if (w < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+
+  // Client did not take the whole header: copy this chunk through tx_buffer_
+  size_t sent = w > 0 ? static_cast<size_t>(w) : 0;
+  auto& tx = conn.tx_buffer();
+  tx.push(header + sent, header_len - sent);
+  struct iovec iov[2];
+  size_t iov_count = tx.fill_iovec_write(iov, 2);
+  ssize_t r = ::readv(pipe_r_, iov, static_cast<int>(iov_count));
+  if (r != static_cast<ssize_t>(len)) return expected<void, ErrorCode>::error(ErrorCode::kInternalError);
+  tx.commit_write(len);
+  conn.check_high_watermark();
+  return expected<void, ErrorCode>::success();
+}
+
+// --- RPC implementation ---
+
+inline RpcSession::~RpcSession() {
+  for (auto& p : pending_)
+    if (p.correlation_id != 0) timers_.cancel(p.timer);
+}
+
+inline expected<uint32_t, ErrorCode> RpcSession::call(Connection& conn, uint16_t method, std::string_view payload,
+                                                      ReplyFn on_reply, uint32_t timeout_ms) {
+  if (free_count_ == 0) return expected<uint32_t, ErrorCode>::error(ErrorCode::kBufferFull);
+  const uint8_t slot = free_[free_count_ - 1];
+  uint32_t id = next_seq_++ * kMaxPending + slot;
+  if (id == 0) id = next_seq_++ * kMaxPending + slot;  // Sequence wrapped
+  // Timer first: a call that asked for a timeout must never go out without one
+  TimerQueue::TimerId timer = 0;
+  if (timeout_ms > 0) {
+    timer = timers_.schedule(std::chrono::milliseconds(timeout_ms), [this, id]() {
+      complete(id, RpcStatus::kTimeout, {});
+    });
+    if (timer == 0) return expected<uint32_t, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+  }
+  if (!send(conn, rpc::MsgType::kRequest, method, id, payload)) {
+    if (timer != 0) timers_.cancel(timer);
+    return expected<uint32_t, ErrorCode>::error(
+        conn.get_state() == ConnectionState::kOpen ? ErrorCode::kBufferFull : ErrorCode::kInvalidState);
+  }
+  --free_count_;
+  Pending& p = pending_[slot];
+  p.correlation_id = id;
+  p.on_reply = static_cast<ReplyFn&&>(on_reply);
+  p.timer = timer;
+  return expected<uint32_t, ErrorCode>::success(id);
+}
+
+inline bool RpcSession::notify(Connection& conn, uint16_t method, std::string_view payload) {
+  return send(conn, rpc::MsgType::kNotify, method, 0, payload);
+}
+
+inline bool RpcSession::reply(Connection& conn, uint32_t correlation_id, std::string_view payload) {
+  return send(conn, rpc::MsgType::kResponse, 0, correlation_id, payload);
+}
+
+inline bool RpcSession::reply_error(Connection& conn, uint32_t correlation_id, std::string_view message) {
+  return send(conn, rpc::MsgType::kError, 0, correlation_id, message);
+}
+
+inline bool RpcSession::on_message(Connection& conn, std::string_view msg) {
+  rpc::Envelope env;
+  if (!rpc::parse(msg, env)) return false;
+  switch (env.type) {
+    case rpc::MsgType::kResponse: complete(env.correlation_id, RpcStatus::kOk, env.payload); break;
+    case rpc::MsgType::kError: complete(env.correlation_id, RpcStatus::kRemoteError, env.payload); break;
+    case rpc::MsgType::kRequest:
+    case rpc::MsgType::kNotify: {
+      const bool is_request = env.type == rpc::MsgType::kRequest;
+      const RpcDispatcher::Handler* handler = dispatcher_ != nullptr ? dispatcher_->find(env.method) : nullptr;
+      if (handler == nullptr) {
+        if (is_request) reply_error(conn, env.correlation_id, "unknown method");
+        break;
+      }
+      (*handler)(RpcRequest{conn.shared_from_this(), env.method, is_request ? env.correlation_id : 0, env.payload});
+      break;
+    }
+  }
+  return true;
+}
+
+inline void RpcSession::fail_all(RpcStatus status) {
+  for (uint32_t i = 0; i < kMaxPending; ++i)
+    if (pending_[i].correlation_id != 0) complete(pending_[i].correlation_id, status, {});
+}
+
+inline void RpcSession::complete(uint32_t correlation_id, RpcStatus status, std::string_view payload) {
+  const uint32_t slot = correlation_id % kMaxPending;
+  Pending& p = pending_[slot];
+  if (correlation_id == 0 || p.correlation_id != correlation_id) return;  // Late or unknown reply
+  if (status != RpcStatus::kTimeout) timers_.cancel(p.timer);
+  p.correlation_id = 0;
+  p.timer = 0;
+  ReplyFn cb = static_cast<ReplyFn&&>(p.on_reply);
+  free_[free_count_++] = static_cast<uint8_t>(slot);
+  if (cb) cb(status, payload);
+}
+
+inline bool RpcSession::send(Connection& conn, rpc::MsgType type, uint16_t method, uint32_t correlation_id,
+                             std::string_view payload) {
+  uint8_t header[rpc::kHeaderSize];
+  rpc::encode_header(header, type, method, correlation_id);
+  return conn.send_binary(std::string_view(reinterpret_cast<const char*>(header), sizeof(header)), payload);
+}
+
+// --- Server implementation ---
+
+inline Server::Server(uint16_t port, const std::string& bind_addr, bool reuse_port)
+    : port_(port), bind_addr_(bind_addr) {
+  std::string err;
+  server_sock_ = detail::open_listener(port_, bind_addr_, err, reuse_port);
+  if (server_sock_ < 0)
+    EWSS_THROW(std::runtime_error(err));
+  log_info("Server initialized on " + bind_addr_ + ":" + std::to_string(port_));
+#ifdef EWSS_STATIC_MEMORY
+  if (!reserve_static_memory(StaticMemoryPolicy{}).has_value())
+    EWSS_THROW(std::runtime_error("static memory reservation failed"));
+#endif
+}
+
+inline Server::Server() : port_(0) {
+#ifdef EWSS_STATIC_MEMORY
+  if (!reserve_static_memory(StaticMemoryPolicy{}).has_value())
+    EWSS_THROW(std::runtime_error("static memory reservation failed"));
+#endif
+}
+
+inline Server::~Server() {
+  if (server_sock_ >= 0) ::close(server_sock_);
+  if (handoff_ != nullptr) {
+    while (handoff_->queue.pop_with([](Handoff& h) { ::close(h.fd); })) {
+    }
+    ::close(handoff_->efd);
+  }
+}
+
+inline void Server::run() {
+  is_running_ = true;
+  stats_.reset();
+  if (cpu_ >= 0) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu_, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+      log_error("Failed to pin reactor to CPU " + std::to_string(cpu_));
+  }
+  RealtimeScope realtime(realtime_);
+  if (realtime.failures() > 0) {
+    stats_.realtime_failures.store(realtime.failures(), std::memory_order_relaxed);
+    log_error(std::string("Realtime profile incomplete: ") + realtime.first_failure() + ": " +
+              std::strerror(realtime.first_errno()));
+  }
+  auto busy_start = std::chrono::steady_clock::now();
+
+  route_trie_.compile();
+  route_active_.assign(routes_.size(), 0);
+  TimerQueue* prev_timers = TimerQueue::current();
+  TimerQueue::current() = &timers_;
+  ScratchArena* prev_scratch = ScratchArena::current();
+  ScratchArena::current() = &scratch_;
+
+  if (!stats_shm_name_.empty() && !stats_shm_.create(stats_shm_name_).has_value())
+    log_error("Failed to create stats segment " + stats_shm_name_);
+  auto next_publish = busy_start;
+
+  // Static memory: from here on the reactor thread must not touch the heap
+  const bool guard = static_pool_ != nullptr && guard_heap_;
+  if (guard) {
+    detail::prefault_stack<kPrefaultStack>();
+    AllocationGuard::count() = 0;
+    AllocationGuard::armed() = true;
+  }
+
+  while (is_running_.load(std::memory_order_relaxed)) {
+    for (uint32_t i = 0; i < connections_.size(); ++i) connections_[i]->resume_receiver();
+
+    size_t nfds = 0;
+    poll_fds_[nfds++] = {server_sock_, POLLIN, 0};
+    for (uint32_t i = 0; i < poll_sources_.size(); ++i)
+      poll_fds_[nfds++] = {poll_sources_[i].fd, poll_sources_[i].events, 0};
+    const size_t conn_base = nfds;
+
+    // Egress shaping: no POLLOUT while the bucket is short of a quantum
+    bool egress_open = true;
+    if (egress_.rate_bytes_per_sec > 0) {
+      refill_egress(std::chrono::steady_clock::now());
+      egress_open = egress_wait_ms() == 0;
+    }
+    for (uint32_t i = 0; i < connections_.size(); ++i) {
+      short events = connections_[i]->wants_read() ? POLLIN : 0;
+      if (egress_open && connections_[i]->has_data_to_send()) events |= POLLOUT;
+      poll_fds_[nfds++] = {static_cast<int>(connections_[i]->get_fd()), events, 0};
+    }
+
+    // Bridge backends follow the client sockets
+    const size_t backend_base = nfds;
+    for (uint32_t i = 0; bridge_enabled_ && i < connections_.size(); ++i) {
+      BridgeLink* link = connections_[i]->bridge();
+      if (link == nullptr || connections_[i]->is_closed()) continue;
+      short events = 0;
+      int fd = link->poll_fd(*connections_[i], events);
+      backend_conn_idx_[nfds - backend_base] = i;
+      poll_fds_[nfds++] = {fd, events, 0};
+    }
+
+    auto poll_start = std::chrono::steady_clock::now();
+
+    // Close the previous iteration: utilization accounting and stall check
+    uint64_t busy_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(poll_start - busy_start).count());
+    stats_.loop_busy_us.fetch_add(busy_us, std::memory_order_relaxed);
+    stats_.iteration_latency_us.record(busy_us);
+    StallInfo stall{};
+    if (watchdog_.end_iteration(busy_us, stall_budget_us_, stall) && on_stall) on_stall(stall);
+    scratch_.reset();
+    sync_memory_stats();
+    if (guard) stats_.heap_after_start.store(AllocationGuard::count(), std::memory_order_relaxed);
+
+    if (stats_shm_.is_open() && poll_start >= next_publish) {
+      stats_shm_.publish(stats_);
+      next_publish = poll_start + std::chrono::milliseconds(stats_shm_interval_ms_);
+    }
+
+    int timeout_ms = timers_.timeout_ms(poll_start, poll_timeout_ms_);
+    if (!egress_open) {
+      int wait = egress_wait_ms();
+      if (timeout_ms < 0 || wait < timeout_ms) timeout_ms = wait;
+    }
+    if (tcp_info_.interval_ms > 0) {
+      auto wait = std::chrono::ceil<std::chrono::milliseconds>(tcp_info_due_ - poll_start).count();
+      int due_ms = wait > 0 ? static_cast<int>(wait) : 0;
+      if (timeout_ms < 0 || due_ms < timeout_ms) timeout_ms = due_ms;
+    }
+    if (ipc_ != nullptr && !ipc_->arm()) timeout_ms = 0;
+    int ret = ::poll(poll_fds_.data(), static_cast<nfds_t>(nfds), timeout_ms);
+    auto poll_end = std::chrono::steady_clock::now();
+    busy_start = poll_end;
+    if (ipc_ != nullptr) ipc_->disarm();
+
+    uint64_t poll_us = static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(poll_end - poll_start).count());
+    stats_.loop_poll_us.fetch_add(poll_us, std::memory_order_relaxed);
+    stats_.last_poll_latency_us.store(poll_us, std::memory_order_relaxed);
+    uint64_t prev_max = stats_.max_poll_latency_us.load(std::memory_order_relaxed);
+    if (poll_us > prev_max)
+      stats_.max_poll_latency_us.store(poll_us, std::memory_order_relaxed);
+
+    if (ret < 0) break;
+    timers_.run_expired(poll_end);
+    if (tcp_info_.interval_ms > 0 && poll_end >= tcp_info_due_) sample_tcp_info(poll_end);
+    if (ipc_ != nullptr) process_ipc_commands();
+    if (ret == 0) continue;
+
+    // Handle new connections (with overload protection)
+    if (poll_fds_[0].revents & POLLIN) {
+      if (stats_.is_overloaded(max_connections_.load(std::memory_order_relaxed))) {
+        stats_.rejected_connections.fetch_add(1, std::memory_order_relaxed);
+        struct sockaddr_in client_addr;
+        socklen_t client_addr_len = sizeof(client_addr);
+        int reject_sock = accept(server_sock_,
+            reinterpret_cast<struct sockaddr*>(&client_addr), &client_addr_len);
+        if (reject_sock >= 0) ::close(reject_sock);
+      } else {
+        accept_connection();
+      }
+    }
+
+    // Auxiliary sources (eventfds, user fds)
+    for (size_t i = 1; i < conn_base; ++i) {
+      if (poll_fds_[i].revents == 0 || i - 1 >= poll_sources_.size()) continue;
+      auto& src = poll_sources_[static_cast<uint32_t>(i - 1)];
+      if (src.fd == poll_fds_[i].fd) src.handler(poll_fds_[i].revents);
+    }
+
+    // Handle client I/O
+    for (size_t i = conn_base; i < backend_base; ++i) {
+      if (i - conn_base >= connections_.size()) break;
+      handle_connection_io(connections_[static_cast<uint32_t>(i - conn_base)], poll_fds_[i]);
+      if (egress_.rate_bytes_per_sec > 0 && (poll_fds_[i].revents & POLLOUT))
+        egress_ready_.push_back(static_cast<uint32_t>(i - conn_base));
+    }
+    if (!egress_ready_.empty()) shape_egress();
+
+    // Handle backend I/O (bridge mode)
+    for (size_t i = backend_base; i < nfds; ++i) {
+      if (poll_fds_[i].revents == 0) continue;
+      auto& conn = connections_[backend_conn_idx_[i - backend_base]];
+      if (conn->is_closed() || conn->bridge() == nullptr) continue;
+      auto r = conn->bridge()->on_backend_ready(*conn, poll_fds_[i].revents);
+      if (!r.has_value()) conn->close(r.get_error() == ErrorCode::kConnectionClosed ? 1000 : 1011);
+    }
+
+    // Enforce timeouts
+    for (uint32_t i = 0; i < connections_.size(); ++i) {
+      auto& conn = connections_[i];
+      if (conn->is_handshake_timed_out() || conn->is_close_timed_out() || conn->is_idle_timed_out())
+        conn->close();
+    }
+
+    remove_closed_connections();
+    if (!migrations_.empty() || shed_count_.load(std::memory_order_relaxed) > 0) process_migrations();
+  }
+
+  if (guard) {
+    AllocationGuard::armed() = false;
+    stats_.heap_after_start.store(AllocationGuard::count(), std::memory_order_relaxed);
+  }
+  // A stopped reactor never resumes them; free the frames on the thread that owns their pool
+  for (uint32_t i = 0; i < connections_.size(); ++i) connections_[i]->release_coroutines();
+  TimerQueue::current() = prev_timers;
+  ScratchArena::current() = prev_scratch;
+  sync_memory_stats();
+  stats_shm_.publish(stats_);
+}
+
+inline expected<void, ErrorCode> Server::accept_connection() {
+  if (connections_.size() >= max_connections_.load(std::memory_order_relaxed) || connections_.full()) {
+    stats_.rejected_connections.fetch_add(1, std::memory_order_relaxed);
+    return expected<void, ErrorCode>::error(ErrorCode::kMaxConnectionsExceeded);
+  }
+
+  struct sockaddr_in client_addr;
+  socklen_t client_addr_len = sizeof(client_addr);
+  int client_sock = accept(server_sock_,
+      reinterpret_cast<struct sockaddr*>(&client_addr), &client_addr_len);
+
+  if (client_sock < 0) {
+    int err = errno;
+    if (err != EAGAIN && err != EWOULDBLOCK) {
+      stats_.socket_errors.fetch_add(1, std::memory_order_relaxed);
+      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+    }
+    return expected<void, ErrorCode>::success();
+  }
+
+  // Was the connection's traffic processed on this reactor's core?
+  int incoming_cpu = -1;
+  socklen_t cpu_len = sizeof(incoming_cpu);
+  if (getsockopt(client_sock, SOL_SOCKET, SO_INCOMING_CPU, &incoming_cpu, &cpu_len) == 0 && incoming_cpu >= 0) {
+    int reactor_cpu = cpu_ >= 0 ? cpu_ : sched_getcpu();
+    (incoming_cpu == reactor_cpu ? stats_.incoming_cpu_local : stats_.incoming_cpu_remote)
+        .fetch_add(1, std::memory_order_relaxed);
+  }
+
+  add_connection(client_sock);
+  return expected<void, ErrorCode>::success();
+}
+
+inline expected<void, ErrorCode> Server::enable_cpu_steering(uint32_t group_size) {
+  if (server_sock_ < 0 || group_size == 0) return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+  // A = receiving CPU; return A % group_size as the reuseport socket index
+  struct sock_filter code[] = {
+      {BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU)},
+      {BPF_ALU | BPF_MOD | BPF_K, 0, 0, group_size},
+      {BPF_RET | BPF_A, 0, 0, 0},
+  };
+  struct sock_fprog prog = {static_cast<unsigned short>(sizeof(code) / sizeof(code[0])), code};
+  if (setsockopt(server_sock_, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &prog, sizeof(prog)) < 0) {
+    log_error(std::string("SO_ATTACH_REUSEPORT_CBPF failed: ") + strerror(errno));
+    return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+  }
+  return expected<void, ErrorCode>::success();
+}
+
+inline Server& Server::set_memory_resource(AccountedResource* resource) {
+  memory_ = resource != nullptr ? resource : &AccountedResource::process_default();
+  scratch_.set_upstream(memory_);
+  if (read_scratch_ != nullptr) set_shared_read_buffer(read_scratch_size_);
+  // Tables configured earlier move over while they are still empty
+  if (sessions_ != nullptr && sessions_->size() == 0 && connections_.empty()) set_resumption(sessions_->policy());
+  if (topics_ != nullptr && topics_->empty()) topics_.reset();
+  sync_memory_stats();
+  return *this;
+}
+
+inline void Server::sync_memory_stats() {
+  stats_.mem_bytes_in_use.store(memory_->bytes_in_use(), std::memory_order_relaxed);
+  stats_.mem_peak_bytes.store(memory_->peak_bytes(), std::memory_order_relaxed);
+  stats_.mem_allocations.store(memory_->allocations(), std::memory_order_relaxed);
+  if (static_pool_ != nullptr)
+    stats_.static_pool_fallbacks.store(static_pool_->fallbacks(), std::memory_order_relaxed);
+}
+
+inline expected<void, ErrorCode> Server::reserve_static_memory(const StaticMemoryPolicy& policy) {
+  if (static_pool_ != nullptr || !connections_.empty() || is_running_.load())
+    return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+  uint32_t slots = std::min<uint32_t>(policy.connections, static_cast<uint32_t>(kMaxConnections));
+  StaticPool::Class classes[StaticPool::kMaxClasses];
+  size_t n = 0;
+  classes[n++] = {sizeof(Connection) + kConnBlockSlack, slots};
+  classes[n++] = {sizeof(RingBuffer<uint8_t, Connection::kRxBufferSize>), slots};
+  if (policy.rpc_sessions) classes[n++] = {sizeof(RpcSession), slots};
+  if (policy.bridge_links) classes[n++] = {sizeof(BridgeLink), slots};
+  if (policy.read_buffer_bytes > 0) classes[n++] = {policy.read_buffer_bytes, 1};
+  if (policy.scratch_bytes > 0) classes[n++] = {policy.scratch_bytes, 1};
+
+  auto pool = std::make_unique<StaticPool>();
+  auto reserved = pool->reserve(classes, n, policy.prefault);
+  if (!reserved.has_value()) {
+    log_error("Failed to map static memory region");
+    return reserved;
+  }
+  if (policy.lock_memory && ::mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+    log_error("mlockall failed: " + std::string(std::strerror(errno)));
+    return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+  }
+  static_pool_ = std::move(pool);
+  static_memory_ = std::make_unique<AccountedResource>(static_pool_.get());
+  set_memory_resource(static_memory_.get());
+  set_shared_read_buffer(policy.read_buffer_bytes);
+  scratch_.set_fixed(true);
+  scratch_.reserve(policy.scratch_bytes);
+  max_connections_.store(std::min<size_t>(max_connections_.load(std::memory_order_relaxed), slots),
+                         std::memory_order_relaxed);
+  guard_heap_ = policy.guard_heap;
   return expected<void, ErrorCode>::success();
 }
 
-inline expected<void, ErrorCode> open_on_send(Connection& conn, std::string_view payload) {
-  conn.write_frame(payload, ws::OpCode::kText);
-  return expected<void, ErrorCode>::success();
+inline Server& Server::set_shared_read_buffer(size_t bytes) {
+  read_scratch_ = pmr_bytes(memory_, bytes);
+  read_scratch_size_ = bytes;
+  for (auto& conn : connections_) conn->set_read_scratch(read_scratch_.get(), read_scratch_size_);
+  return *this;
+}
+
+inline Server& Server::set_batching(const BatchPolicy& policy) {
+  batch_policy_ = policy;
+  batching_ = true;
+  return *this;
+}
+
+inline Server& Server::set_resumption(const ResumePolicy& policy) {
+  sessions_ = pmr_new<SessionStore>(memory_, policy, stats_, memory_);
+  return *this;
+}
+
+inline Server& Server::set_capture(TrafficCapture* capture) {
+  capture_ = capture;
+  for (auto& conn : connections_) conn->set_capture(capture_);
+  return *this;
+}
+
+#if EWSS_HAS_DEFLATE
+inline Server& Server::set_permessage_deflate(const DeflatePolicy& policy) {
+  deflate_policy_ = policy;
+  deflate_enabled_ = true;
+  return *this;
+}
+#endif
+
+inline HttpResponder& Server::http() {
+  if (http_ == nullptr) http_ = std::make_unique<HttpResponder>(stats_);
+  return *http_;
+}
+
+// Wrap an accepted socket in a Connection wired to this server (caller checked capacity)
+inline Connection& Server::add_connection(int fd) {
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  apply_tcp_tuning(fd);
+
+  auto conn = std::allocate_shared<Connection>(std::pmr::polymorphic_allocator<Connection>(memory_), fd, memory_);
+  bind_handlers(*conn, nullptr);
+  conn->set_read_scratch(read_scratch_.get(), read_scratch_size_);
+  conn->set_capture(capture_);
+  conn->set_stats(&stats_);
+  if (batching_) conn->offer_batching(&batch_policy_);
+  if (deflate_enabled_ && static_pool_ == nullptr) conn->offer_deflate(&deflate_policy_);
+  conn->offer_resumption(sessions_.get());
+  conn->set_http_responder(http_.get());
+  if (kernel_queue_target_ > 0) conn->set_kernel_queue_target(kernel_queue_target_);
+  if (stall_budget_us_ > 0) conn->set_watchdog(&watchdog_);
+  if (rpc_dispatcher_ != nullptr) conn->attach_rpc(pmr_new<RpcSession>(memory_, rpc_dispatcher_, timers_));
+  if (!routes_.empty()) {
+    conn->on_upgrade = [this](const ConnPtr& c, std::string_view path) { return select_route(*c, path); };
+  }
+
+  connections_.push_back(conn);
+  stats_.total_connections.fetch_add(1, std::memory_order_relaxed);
+  stats_.active_connections.fetch_add(1, std::memory_order_relaxed);
+  return *connections_.back();
+}
+
+// Install the route's handler set (server-level callbacks when route is null)
+inline void Server::bind_handlers(Connection& conn, const Route* route) {
+  conn.on_open = route != nullptr ? route->on_connect : on_connect;
+  conn.on_message = route != nullptr ? route->on_message : on_message;
+  conn.on_close = route != nullptr ? route->on_close : on_close;
+  conn.on_error = route != nullptr ? route->on_error : on_error;
+  conn.on_backpressure = route != nullptr ? route->on_backpressure : on_backpressure;
+  conn.on_drain = route != nullptr ? route->on_drain : on_drain;
+  if (ipc_ != nullptr) bind_ipc(conn);
+  if (bridge_enabled_) {
+    conn.on_open = [this, open = conn.on_open](const ConnPtr& c) {
+      if (open) open(c);
+      open_bridge(*c);
+    };
+  }
+}
+
+inline int Server::select_route(Connection& conn, std::string_view path) {
+  int idx = route_trie_.find(path);
+  if (idx == RouteTrie::kNoMatch) {
+    stats_.route_rejects.fetch_add(1, std::memory_order_relaxed);
+    return 404;
+  }
+  const Route& route = routes_[static_cast<size_t>(idx)];
+  uint32_t& active = route_active_[static_cast<size_t>(idx)];
+  if (route.limits.max_connections > 0 && active >= route.limits.max_connections) {
+    stats_.route_rejects.fetch_add(1, std::memory_order_relaxed);
+    return 503;
+  }
+  ++active;
+  conn.set_route(idx, route.buffers, route.limits);
+  bind_handlers(conn, &route);
+  return 101;
+}
+
+inline Server& Server::add_route(Route route) {
+  route_trie_.add(route.path, static_cast<int>(routes_.size()));
+  routes_.push_back(std::move(route));
+  return *this;
+}
+
+inline void Server::handle_connection_io(ConnPtr& conn, const pollfd& pfd) {
+  if (pfd.revents & POLLIN) {
+    if (!conn->handle_read().has_value()) conn->close();
+  }
+  if ((pfd.revents & POLLOUT) && egress_.rate_bytes_per_sec == 0) {
+    auto result = use_writev_ ? conn->handle_write_vectored() : conn->handle_write();
+    if (!result.has_value()) conn->close();
+    if (conn->send_held()) stats_.send_queue_holds.fetch_add(1, std::memory_order_relaxed);
+  }
+  if (pfd.revents & (POLLERR | POLLHUP)) conn->close();
+}
+
+// --- Egress shaping ---
+
+inline Server& Server::set_egress_limit(const EgressPolicy& policy) {
+  egress_ = policy;
+  egress_.quantum_bytes = std::max<uint32_t>(1, std::min(policy.quantum_bytes, policy.burst_bytes));
+  egress_tokens_ = policy.burst_bytes;
+  egress_refill_ = std::chrono::steady_clock::now();
+  return *this;
+}
+
+inline void Server::sample_tcp_info(std::chrono::steady_clock::time_point now) {
+  tcp_info_due_ = now + std::chrono::milliseconds(tcp_info_.interval_ms);
+  const uint32_t n = connections_.size();
+  for (uint32_t visited = 0, sampled = 0; visited < n && sampled < tcp_info_.batch; ++visited) {
+    if (tcp_info_cursor_ >= n) tcp_info_cursor_ = 0;
+    Connection& conn = *connections_[tcp_info_cursor_++];
+    if (conn.get_state() != ConnectionState::kOpen) continue;
+    uint32_t prev_retrans = conn.tcp_health().total_retrans;
+    if (!conn.sample_tcp_info()) continue;
+    ++sampled;
+    const TcpHealth& h = conn.tcp_health();
+    stats_.tcp_info_samples.fetch_add(1, std::memory_order_relaxed);
+    stats_.tcp_rtt_us.record(h.rtt_us);
+    if (h.total_retrans > prev_retrans)
+      stats_.tcp_retransmits.fetch_add(h.total_retrans - prev_retrans, std::memory_order_relaxed);
+  }
+}
+
+inline void Server::refill_egress(std::chrono::steady_clock::time_point now) {
+  double elapsed = std::chrono::duration<double>(now - egress_refill_).count();
+  egress_refill_ = now;
+  egress_tokens_ = std::min<double>(egress_.burst_bytes,
+                                    egress_tokens_ + elapsed * static_cast<double>(egress_.rate_bytes_per_sec));
+}
+
+// ms until the bucket holds a full quantum again (0 if it already does)
+inline int Server::egress_wait_ms() const {
+  double missing = egress_.quantum_bytes - egress_tokens_;
+  if (missing <= 0) return 0;
+  return static_cast<int>(std::ceil(missing * 1000.0 / static_cast<double>(egress_.rate_bytes_per_sec)));
+}
+
+// Deficit round robin over the sockets that polled writable. Each visit adds
+// quantum * weight to the connection's deficit and writes up to that (and what the
+// bucket holds); a connection leaves the pass when it drains or the kernel is full.
+inline void Server::shape_egress() {
+  refill_egress(std::chrono::steady_clock::now());
+  const uint32_t n = egress_ready_.size();
+  uint32_t start = 0;
+  while (start < n && egress_ready_[start] < drr_cursor_) ++start;
+  if (start == n) start = 0;
+
+  uint32_t active = n;
+  while (active > 0 && egress_tokens_ >= 1) {
+    for (uint32_t k = 0; k < n && egress_tokens_ >= 1; ++k) {
+      uint32_t& idx = egress_ready_[(start + k) % n];
+      if (idx == UINT32_MAX) continue;
+      Connection& conn = *connections_[idx];
+      bool done = true;
+      if (!conn.is_closed() && conn.has_data_to_send()) {
+        if (conn.get_id() == drr_resume_id_)
+          drr_resume_id_ = 0;
+        else
+          conn.drr_deficit() += static_cast<uint64_t>(egress_.quantum_bytes) * conn.egress_weight();
+
+        size_t budget = static_cast<size_t>(std::min<double>(static_cast<double>(conn.drr_deficit()), egress_tokens_));
+        if (!conn.handle_write_vectored(budget).has_value()) {
+          conn.close();
+        } else {
+          if (conn.send_held()) stats_.send_queue_holds.fetch_add(1, std::memory_order_relaxed);
+          size_t sent = conn.last_written();  // on_drain may already have refilled tx_buffer()
+          conn.drr_deficit() -= std::min<uint64_t>(sent, conn.drr_deficit());
+          egress_tokens_ -= static_cast<double>(sent);
+          stats_.egress_bytes[conn.egress_class()].fetch_add(sent, std::memory_order_relaxed);
+          if (conn.has_data_to_send() && egress_tokens_ < 1) {
+            drr_cursor_ = idx;  // Bucket ran dry mid-visit: resume here next pass
+            drr_resume_id_ = conn.get_id();
+            stats_.egress_throttled.fetch_add(1, std::memory_order_relaxed);
+            break;
+          }
+          done = !conn.has_data_to_send() || sent < budget;  // Drained, or socket buffer full
+        }
+      }
+      if (done) {
+        // Idle connections bank no credit; blocked ones keep at most one round's worth
+        uint64_t round = static_cast<uint64_t>(egress_.quantum_bytes) * conn.egress_weight();
+        conn.drr_deficit() = conn.has_data_to_send() ? std::min(conn.drr_deficit(), round) : 0;
+        idx = UINT32_MAX;
+        --active;
+      }
+    }
+  }
+  egress_ready_.clear();
+}
+
+inline void Server::remove_closed_connections() {
+  uint32_t removed = 0;
+  uint32_t i = 0;
+  while (i < connections_.size()) {
+    if (connections_[i]->is_closed()) {
+      if (RpcSession* rpc = connections_[i]->rpc()) rpc->fail_all(RpcStatus::kClosed);
+      connections_[i]->detach_session();
+      unindex_subscriptions(*connections_[i]);
+      connections_[i]->subscriptions().clear();
+      int route = connections_[i]->route();
+      if (route >= 0 && route_active_[static_cast<size_t>(route)] > 0) --route_active_[static_cast<size_t>(route)];
+      if (i < connections_.size() - 1)
+        connections_[i] = static_cast<ConnPtr&&>(connections_[connections_.size() - 1]);
+      connections_.pop_back();
+      ++removed;
+    } else {
+      ++i;
+    }
+  }
+  if (removed > 0)
+    stats_.active_connections.fetch_sub(removed, std::memory_order_relaxed);
+  if (sessions_ != nullptr && sessions_->detached() > 0 && session_sweep_timer_ == 0) schedule_session_sweep();
+}
+
+// Expire detached sessions while any remain, at linger_ms granularity (at most 1 s)
+inline void Server::schedule_session_sweep() {
+  uint32_t interval = std::max<uint32_t>(1, std::min<uint32_t>(sessions_->policy().linger_ms, 1000));
+  session_sweep_timer_ = timers_.schedule(std::chrono::milliseconds(interval), [this]() {
+    session_sweep_timer_ = 0;
+    sessions_->sweep(SessionStore::Clock::now());
+    if (sessions_->detached() > 0) schedule_session_sweep();
+  });
+}
+
+inline Connection* Server::find_connection(uint64_t id) {
+  for (uint32_t i = 0; i < connections_.size(); ++i)
+    if (connections_[i]->get_id() == id) return connections_[i].get();
+  return nullptr;
 }
 
-inline expected<void, ErrorCode> open_on_close(Connection& conn, uint16_t code) {
-  conn.write_close_frame(code);
-  conn.transition_to_state(ConnectionState::kClosing);
+inline expected<void, ErrorCode> Server::add_poll_source(int fd, short events, PollHandler handler) {
+  if (!poll_sources_.emplace_back(fd, events, static_cast<PollHandler&&>(handler)))
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
   return expected<void, ErrorCode>::success();
 }
 
-inline expected<void, ErrorCode> closing_on_data(Connection& conn) {
-  uint8_t temp[1024];
-  size_t len = conn.rx_buffer().peek(temp, sizeof(temp));
-  if (len > 0) {
-    std::string_view data(reinterpret_cast<const char*>(temp), len);
-    ws::FrameHeader header;
-    size_t header_size = ws::parse_frame_header(data, header);
-    if (header_size > 0 && header.opcode == ws::OpCode::kClose) {
-      conn.transition_to_state(ConnectionState::kClosed);
-      conn.socket().close();
-    }
+inline void Server::remove_poll_source(int fd) {
+  for (uint32_t i = 0; i < poll_sources_.size(); ++i) {
+    if (poll_sources_[i].fd != fd) continue;
+    for (uint32_t j = i + 1; j < poll_sources_.size(); ++j)
+      poll_sources_[j - 1] = static_cast<PollSource&&>(poll_sources_[j]);
+    poll_sources_.pop_back();
+    return;
   }
-  return expected<void, ErrorCode>::success();
 }
 
-inline expected<void, ErrorCode> closing_on_send(Connection&, std::string_view) {
-  return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+// --- TCP bridge ---
+
+inline Server& Server::set_bridge(const BridgeConfig& cfg) {
+  std::memset(&bridge_addr_, 0, sizeof(bridge_addr_));
+  bridge_addr_.sin_family = AF_INET;
+  bridge_addr_.sin_port = htons(cfg.port);
+  if (::inet_pton(AF_INET, cfg.host.c_str(), &bridge_addr_.sin_addr) != 1) {
+    struct addrinfo hints{};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo* res = nullptr;
+    if (::getaddrinfo(cfg.host.c_str(), nullptr, &hints, &res) != 0 || res == nullptr) {
+      log_error("Cannot resolve bridge backend " + cfg.host);
+      bridge_enabled_ = false;
+      return *this;
+    }
+    bridge_addr_.sin_addr = reinterpret_cast<struct sockaddr_in*>(res->ai_addr)->sin_addr;
+    ::freeaddrinfo(res);
+  }
+  bridge_use_splice_ = cfg.use_splice;
+  bridge_enabled_ = true;
+  return *this;
 }
 
-inline expected<void, ErrorCode> closing_on_close(Connection&, uint16_t) {
-  return expected<void, ErrorCode>::success();
+inline void Server::open_bridge(Connection& conn) {
+  auto link = pmr_new<BridgeLink>(memory_, stats_, bridge_use_splice_);
+  if (!link->connect(bridge_addr_).has_value()) {
+    stats_.bridge_connect_failures.fetch_add(1, std::memory_order_relaxed);
+    conn.close(1011);
+    return;
+  }
+  apply_tcp_tuning(link->backend_fd());
+  conn.attach_bridge(std::move(link));
 }
 
-inline expected<void, ErrorCode> closed_on_data(Connection&) {
-  return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+// --- Handshake handoff ---
+
+inline Server& Server::enable_handoff() {
+  if (handoff_ != nullptr) return *this;
+  int efd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (efd < 0) {
+    log_error("Failed to create handoff eventfd");
+    return *this;
+  }
+  handoff_ = std::make_unique<HandoffInbox>();
+  handoff_->efd = efd;
+  (void)add_poll_source(efd, POLLIN, [this](short) { accept_handoffs(); });
+  return *this;
 }
 
-inline expected<void, ErrorCode> closed_on_send(Connection&, std::string_view) {
-  return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+inline expected<void, ErrorCode> Server::handoff(int fd, std::string_view path, std::string_view response,
+                                                 std::string_view leftover) {
+  if (handoff_ == nullptr) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+  if (path.size() + response.size() + leftover.size() > kHandoffBytes)
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+  // Counted before the push: the reactor's fetch_sub must never run ahead of it
+  handoff_pending_.fetch_add(1, std::memory_order_relaxed);
+  bool queued = handoff_->queue.push_with([&](Handoff& h) {
+    h.fd = fd;
+    h.path_len = static_cast<uint16_t>(path.size());
+    h.response_len = static_cast<uint16_t>(response.size());
+    h.leftover_len = static_cast<uint16_t>(leftover.size());
+    std::memcpy(h.data, path.data(), path.size());
+    std::memcpy(h.data + path.size(), response.data(), response.size());
+    std::memcpy(h.data + path.size() + response.size(), leftover.data(), leftover.size());
+  });
+  if (!queued) {
+    handoff_pending_.fetch_sub(1, std::memory_order_relaxed);
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+  }
+  wake_handoff();
+  return expected<void, ErrorCode>::success();
 }
 
-inline expected<void, ErrorCode> closed_on_close(Connection&, uint16_t) {
-  return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+inline void Server::wake_handoff() {
+  uint64_t one = 1;
+  (void)!::write(handoff_->efd, &one, sizeof(one));
 }
 
-}  // namespace detail
+inline void Server::accept_handoffs() {
+  uint64_t count;
+  (void)!::read(handoff_->efd, &count, sizeof(count));
+  while (handoff_->queue.pop_with([this](Handoff& h) {
+    handoff_pending_.fetch_sub(1, std::memory_order_relaxed);
+    if (connections_.size() >= max_connections_.load(std::memory_order_relaxed) || connections_.full()) {
+      // The client is still waiting on its upgrade response: refuse it as the stage does
+      static constexpr char kBusy[] = "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+      (void)!::send(h.fd, kBusy, sizeof(kBusy) - 1, MSG_NOSIGNAL);
+      ::close(h.fd);
+      stats_.rejected_connections.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    Connection& conn = add_connection(h.fd);
+    stats_.handoffs_accepted.fetch_add(1, std::memory_order_relaxed);
+
+    const char* p = h.data;
+    std::string_view path(p, h.path_len);
+    std::string_view response(p + h.path_len, h.response_len);
+    std::string_view leftover(p + h.path_len + h.response_len, h.leftover_len);
+    conn.adopt_open(path, response, leftover);
+  })) {
+  }
 
-// State operation tables (const, zero allocation)
-inline const StateOps kHandshakeOps = {
-    ConnectionState::kHandshaking,
-    detail::handshake_on_data, detail::handshake_on_send, detail::handshake_on_close};
-inline const StateOps kOpenOps = {
-    ConnectionState::kOpen,
-    detail::open_on_data, detail::open_on_send, detail::open_on_close};
-inline const StateOps kClosingOps = {
-    ConnectionState::kClosing,
-    detail::closing_on_data, detail::closing_on_send, detail::closing_on_close};
-inline const StateOps kClosedOps = {
-    ConnectionState::kClosed,
-    detail::closed_on_data, detail::closed_on_send, detail::closed_on_close};
+  while (handoff_->migrants.pop_with([this](ConnPtr& slot) {
+    ConnPtr conn = std::move(slot);
+    handoff_pending_.fetch_sub(1, std::memory_order_relaxed);
+    // The route index belongs to the source's table; resolve the path against ours
+    int route = routes_.empty() ? -1 : route_trie_.find(conn->path());
+    bool route_refused = !routes_.empty() && route == RouteTrie::kNoMatch;
+    if (route >= 0) {
+      uint32_t limit = routes_[static_cast<size_t>(route)].limits.max_connections;
+      route_refused = limit > 0 && route_active_[static_cast<size_t>(route)] >= limit;
+    }
+    if (route_refused) stats_.route_rejects.fetch_add(1, std::memory_order_relaxed);
+    if (connections_.full() || route_refused) {
+      stats_.rejected_connections.fetch_add(1, std::memory_order_relaxed);
+      conn->close(1013);
+      (void)conn->handle_write_vectored();
+      conn->close();
+      return;
+    }
+    // Rebind what the source reactor detached; callbacks travel as is
+    bind_reactor_state(*conn);
+    if (rpc_dispatcher_ != nullptr && conn->rpc_negotiated())
+      conn->attach_rpc(pmr_new<RpcSession>(memory_, rpc_dispatcher_, timers_));
+    if (route >= 0) {
+      const Route& r = routes_[static_cast<size_t>(route)];
+      conn->set_route(route, r.buffers, r.limits);
+      ++route_active_[static_cast<size_t>(route)];
+    } else {
+      conn->set_route(-1, BufferProfile{}, RouteLimits{});
+    }
+    index_subscriptions(*conn);
+    connections_.push_back(std::move(conn));
+    stats_.active_connections.fetch_add(1, std::memory_order_relaxed);
+    stats_.migrations_in.fetch_add(1, std::memory_order_relaxed);
+  })) {
+  }
 
-// --- Connection implementation ---
+  while (handoff_->published.pop_with([this](SharedFrame& slot) {
+    SharedFrame frame = std::move(slot);
+    fan_out(frame);
+  })) {
+  }
+}
 
-inline uint64_t& ewss_next_conn_id() {
-  static uint64_t id = 1;
-  return id;
+inline void Server::bind_reactor_state(Connection& conn) {
+  conn.set_read_scratch(read_scratch_.get(), read_scratch_size_);
+  conn.set_capture(capture_);
+  conn.set_stats(&stats_);
+  if (batching_) conn.offer_batching(&batch_policy_);
+  if (deflate_enabled_ && static_pool_ == nullptr) conn.offer_deflate(&deflate_policy_);
+  if (stall_budget_us_ > 0) conn.set_watchdog(&watchdog_);
 }
 
-inline Connection::Connection(sockpp::tcp_socket&& sock)
-    : id_(ewss_next_conn_id()++), socket_(std::move(sock)) {
-  socket_.set_non_blocking(true);
-  ops_ = &kHandshakeOps;
+// --- Pub/sub ---
+
+inline bool Server::subscribe(Connection& conn, std::string_view topic) {
+  auto& subs = conn.subscriptions();
+  if (std::find(subs.begin(), subs.end(), topic) != subs.end()) return false;
+  subs.emplace_back(topic);
+  TopicIndex& topics = topic_index();
+  auto it = topics.find(topic);
+  if (it == topics.end()) it = topics.emplace(topic, std::pmr::vector<Connection*>()).first;
+  it->second.push_back(&conn);
+  subscriptions_total_.fetch_add(1, std::memory_order_relaxed);
+  return true;
 }
 
-inline Connection::Connection(int fd)
-    : id_(ewss_next_conn_id()++), socket_(fd) {
-  socket_.set_non_blocking(true);
-  ops_ = &kHandshakeOps;
+inline void Server::unsubscribe(Connection& conn, std::string_view topic) {
+  auto& subs = conn.subscriptions();
+  auto sub = std::find(subs.begin(), subs.end(), topic);
+  if (sub == subs.end()) return;
+  subs.erase(sub);
+  if (topics_ == nullptr) return;
+  auto it = topics_->find(topic);
+  if (it == topics_->end()) return;
+  auto& members = it->second;
+  auto member = std::find(members.begin(), members.end(), &conn);
+  if (member == members.end()) return;
+  members.erase(member);
+  if (members.empty()) topics_->erase(it);
+  subscriptions_total_.fetch_sub(1, std::memory_order_relaxed);
 }
 
-inline Connection::~Connection() {
-  if (socket_.is_open()) socket_.close();
+// Add / remove conn's subscription list in this reactor's topic index
+inline void Server::index_subscriptions(Connection& conn) {
+  if (conn.subscriptions().empty()) return;
+  TopicIndex& topics = topic_index();
+  for (const auto& topic : conn.subscriptions()) topics[topic].push_back(&conn);
+  subscriptions_total_.fetch_add(conn.subscriptions().size(), std::memory_order_relaxed);
 }
 
-inline expected<void, ErrorCode> Connection::handle_read() {
-  struct iovec iov[2];
-  size_t iov_count = rx_buffer_.fill_iovec_write(iov, 2);
-  if (iov_count == 0) {
-    last_error_code_ = ErrorCode::kBufferFull;
-    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
-  }
-  ssize_t n = ::readv(socket_.handle(), iov, static_cast<int>(iov_count));
-  if (n > 0) {
-    rx_buffer_.commit_write(static_cast<size_t>(n));
-    touch_activity();
-    ops_->on_data(*this);
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
-  } else if (n == 0) {
-    last_error_code_ = ErrorCode::kConnectionClosed;
-    return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
-  } else {
-    int err = errno;
-    if (err != EAGAIN && err != EWOULDBLOCK) {
-      last_error_code_ = ErrorCode::kSocketError;
-      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
-    }
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
+inline void Server::unindex_subscriptions(Connection& conn) {
+  if (topics_ == nullptr) return;
+  for (const auto& topic : conn.subscriptions()) {
+    auto it = topics_->find(topic);
+    if (it == topics_->end()) continue;
+    auto& members = it->second;
+    auto member = std::find(members.begin(), members.end(), &conn);
+    if (member == members.end()) continue;
+    members.erase(member);
+    if (members.empty()) topics_->erase(it);
+    subscriptions_total_.fetch_sub(1, std::memory_order_relaxed);
   }
 }
 
-inline expected<void, ErrorCode> Connection::handle_write() {
-  if (tx_buffer_.empty()) {
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
-  }
-  uint8_t temp[kTempReadSize];
-  size_t len = tx_buffer_.peek(temp, sizeof(temp));
-  auto res = socket_.write(temp, len);
-  if (res) {
-    tx_buffer_.advance(res.value());
-    check_low_watermark();
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
-  } else {
-    int err = res.error().value();
-    if (err != EAGAIN && err != EWOULDBLOCK) {
-      last_error_code_ = ErrorCode::kSocketError;
-      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
-    }
-  }
-  last_error_code_ = ErrorCode::kOk;
-  return expected<void, ErrorCode>::success();
+inline size_t Server::subscriber_count(std::string_view topic) const {
+  if (topics_ == nullptr) return 0;
+  auto it = topics_->find(topic);
+  return it == topics_->end() ? 0 : it->second.size();
 }
 
-inline expected<void, ErrorCode> Connection::handle_write_vectored() {
-  if (tx_buffer_.empty()) {
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
-  }
-  struct iovec iov[2];
-  size_t iov_count = tx_buffer_.fill_iovec(iov, 2);
-  if (iov_count == 0) {
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
-  }
-  ssize_t n = ::writev(socket_.handle(), iov, static_cast<int>(iov_count));
-  if (n > 0) {
-    tx_buffer_.advance(static_cast<size_t>(n));
-    check_low_watermark();
-    last_error_code_ = ErrorCode::kOk;
-    return expected<void, ErrorCode>::success();
-  } else if (n < 0) {
-    int err = errno;
-    if (err != EAGAIN && err != EWOULDBLOCK) {
-      last_error_code_ = ErrorCode::kSocketError;
-      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
-    }
-  }
-  last_error_code_ = ErrorCode::kOk;
-  return expected<void, ErrorCode>::success();
+inline Server::TopicIndex& Server::topic_index() {
+  if (topics_ == nullptr) topics_ = pmr_new<TopicIndex>(memory_, memory_);
+  return *topics_;
 }
 
-inline void Connection::send_impl(std::string_view payload, bool binary) {
-  if (get_state() != ConnectionState::kOpen) return;
-  ws::OpCode opcode = binary ? ws::OpCode::kBinary : ws::OpCode::kText;
-  write_frame(payload, opcode);
-  check_high_watermark();
+inline bool Server::post(const SharedFrame& frame) {
+  if (handoff_ == nullptr || !handoff_->published.push(frame)) {
+    stats_.pubsub_dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  wake_handoff();
+  return true;
 }
 
-inline void Connection::close(uint16_t code) {
-  if (get_state() == ConnectionState::kClosed) return;
-  if (get_state() == ConnectionState::kOpen) {
-    write_close_frame(code);
-    transition_to_state(ConnectionState::kClosing);
-  } else {
-    transition_to_state(ConnectionState::kClosed);
-    socket_.close();
+inline void Server::fan_out(const SharedFrame& frame) {
+  stats_.pubsub_frames.fetch_add(1, std::memory_order_relaxed);
+  if (topics_ == nullptr) return;
+  auto it = topics_->find(frame.topic());
+  if (it == topics_->end()) return;
+  // Deliver to the members at publish time: on_backpressure may unsubscribe mid-walk
+  FixedVector<Connection*, kMaxConnections> members;
+  for (Connection* conn : it->second) (void)members.push_back(conn);
+  SharedFrame deflated[8];
+  uint64_t delivered = 0;
+  for (Connection* conn : members) {
+    if (deliver_shared(*conn, frame, deflated))
+      ++delivered;
+    else
+      stats_.pubsub_dropped.fetch_add(1, std::memory_order_relaxed);
   }
+  stats_.pubsub_deliveries.fetch_add(delivered, std::memory_order_relaxed);
 }
 
-inline bool Connection::is_closed() const {
-  return !socket_.is_open() || get_state() == ConnectionState::kClosed;
+inline size_t Server::broadcast(std::string_view payload, bool binary) {
+  SharedFrame frame = SharedFrame::encode({}, payload, binary ? ws::OpCode::kBinary : ws::OpCode::kText, false, memory_);
+  if (!frame) return 0;
+  SharedFrame deflated[8];
+  size_t sent = 0;
+  for (uint32_t i = 0; i < connections_.size(); ++i) {
+    Connection& conn = *connections_[i];
+    if (conn.get_state() == ConnectionState::kOpen && deliver_shared(conn, frame, deflated)) ++sent;
+  }
+  return sent;
 }
 
-inline void Connection::transition_to_state(ConnectionState state) {
-  switch (state) {
-    case ConnectionState::kHandshaking: ops_ = &kHandshakeOps; break;
-    case ConnectionState::kOpen:
-      ops_ = &kOpenOps;
-      if (on_open) on_open(shared_from_this());
-      break;
-    case ConnectionState::kClosing:
-      ops_ = &kClosingOps;
-      closing_at_ = SteadyClock::now();
-      break;
-    case ConnectionState::kClosed:
-      ops_ = &kClosedOps;
-      if (on_close) on_close(shared_from_this(), true);
-      break;
+// Queue frame on conn, substituting the compress-once variant for its window size;
+// deflated[] caches those per call (indexed by window bits - 8)
+inline bool Server::deliver_shared(Connection& conn, const SharedFrame& frame, SharedFrame (&deflated)[8]) {
+#if EWSS_HAS_DEFLATE
+  uint8_t bits = conn.deflate_shared_window();
+  if (bits != 0 && frame.payload().size() >= conn.deflate_policy()->min_size) {
+    SharedFrame& shared = deflated[bits - 8];
+    if (!shared) {
+      shared = deflate::compress_shared(frame, bits, conn.deflate_policy()->level, memory_);
+      if (shared) stats_.deflate_shared_frames.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (shared) {
+      if (!conn.send_shared(shared)) return false;
+      stats_.deflate_shared_deliveries.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
   }
+#else
+  (void)deflated;
+#endif
+  return conn.send_shared(frame);
 }
 
-inline expected<void, ErrorCode> Connection::parse_handshake() {
-  uint8_t temp[1024];
-  size_t len = rx_buffer_.peek(temp, sizeof(temp));
-  if (len == 0)
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+// --- Live migration ---
 
-  std::string_view data(reinterpret_cast<const char*>(temp), len);
-  size_t end_pos = data.find("\r\n\r\n");
-  if (end_pos == std::string_view::npos)
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+inline expected<void, ErrorCode> Server::migrate(uint64_t conn_id, Server& target) {
+  if (&target == this || target.handoff_ == nullptr || ipc_ != nullptr)
+    return expected<void, ErrorCode>::error(ErrorCode::kInvalidState);
+  if (find_connection(conn_id) == nullptr)
+    return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
+  if (!migrations_.push_back(Migration{conn_id, &target}))
+    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+  return expected<void, ErrorCode>::success();
+}
 
-  size_t handshake_size = end_pos + 4;
+inline void Server::shed(Server& target, uint32_t count) {
+  shed_target_.store(&target, std::memory_order_relaxed);
+  shed_count_.store(count, std::memory_order_release);
+  if (handoff_ != nullptr) wake_handoff();
+}
 
-  if (data.substr(0, 4) != "GET ") {
-    last_error_code_ = ErrorCode::kHandshakeFailed;
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+inline void Server::process_migrations() {
+  uint32_t shed = shed_count_.exchange(0, std::memory_order_acquire);
+  Server* shed_target = shed_target_.load(std::memory_order_relaxed);
+  // Newest connections first; they carry the least accumulated state
+  for (uint32_t i = connections_.size(); shed > 0 && i-- > 0;) {
+    if (!connections_[i]->is_migratable()) continue;
+    if (shed_target == nullptr || !migrate(connections_[i]->get_id(), *shed_target).has_value()) break;
+    --shed;
   }
 
-  // Extract Sec-WebSocket-Key
-  constexpr std::string_view kKeyHeader = "Sec-WebSocket-Key: ";
-  size_t key_pos = data.find(kKeyHeader);
-  if (key_pos == std::string_view::npos) {
-    constexpr std::string_view kKeyHeaderLower = "sec-websocket-key: ";
-    key_pos = data.find(kKeyHeaderLower);
-  }
-  if (key_pos == std::string_view::npos) {
-    last_error_code_ = ErrorCode::kHandshakeFailed;
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+  for (uint32_t m = 0; m < migrations_.size(); ++m) {
+    Server& target = *migrations_[m].target;
+    uint32_t i = 0;
+    while (i < connections_.size() && connections_[i]->get_id() != migrations_[m].conn_id) ++i;
+    if (i == connections_.size()) continue;
+    ConnPtr& conn = connections_[i];
+    if (!conn->is_migratable() || target.load() >= target.max_connections_.load(std::memory_order_relaxed)) {
+      stats_.migration_failures.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    // Detach everything bound to this reactor before the target can touch it
+    int route = conn->route();
+    conn->flush_batch();  // Its window timer lives in this reactor's queue
+    conn->set_watchdog(nullptr);
+    conn->set_read_scratch(nullptr, 0);
+    conn->set_capture(nullptr);
+    conn->offer_batching(nullptr);
+    conn->offer_deflate(nullptr);
+    PmrPtr<RpcSession> rpc = conn->detach_rpc();  // Kept until the hand-over succeeds
+    auto on_upgrade = std::move(conn->on_upgrade);
+    conn->on_upgrade = nullptr;
+    unindex_subscriptions(*conn);  // The topic list itself travels with the connection
+    if (!target.adopt_migrant(std::move(conn))) {
+      // Inbox full: conn is left intact, so put back everything detached above
+      Connection& kept = *connections_[i];
+      bind_reactor_state(kept);
+      kept.attach_rpc(std::move(rpc));
+      kept.on_upgrade = std::move(on_upgrade);
+      index_subscriptions(kept);
+      stats_.migration_failures.fetch_add(1, std::memory_order_relaxed);
+      continue;
+    }
+
+    if (route >= 0 && route_active_[static_cast<size_t>(route)] > 0) --route_active_[static_cast<size_t>(route)];
+    if (i < connections_.size() - 1) connections_[i] = static_cast<ConnPtr&&>(connections_[connections_.size() - 1]);
+    connections_.pop_back();
+    stats_.active_connections.fetch_sub(1, std::memory_order_relaxed);
+    stats_.migrations_out.fetch_add(1, std::memory_order_relaxed);
   }
+  migrations_.clear();
+}
 
-  size_t value_start = key_pos + kKeyHeader.size();
-  size_t value_end = data.find("\r\n", value_start);
-  if (value_end == std::string_view::npos) {
-    last_error_code_ = ErrorCode::kHandshakeFailed;
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+// Called from the source reactor's thread
+inline bool Server::adopt_migrant(ConnPtr&& conn) {
+  handoff_pending_.fetch_add(1, std::memory_order_relaxed);  // Before the push, as in handoff()
+  bool queued = handoff_->migrants.push_with([&conn](ConnPtr& slot) { slot = std::move(conn); });
+  if (!queued) {
+    handoff_pending_.fetch_sub(1, std::memory_order_relaxed);
+    return false;
   }
+  wake_handoff();
+  return true;
+}
 
-  std::string_view ws_key = data.substr(value_start, value_end - value_start);
-  while (!ws_key.empty() && (ws_key.back() == ' ' || ws_key.back() == '\t'))
-    ws_key.remove_suffix(1);
+// --- IPC bridge ---
 
-  if (ws_key.empty()) {
-    last_error_code_ = ErrorCode::kHandshakeFailed;
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
-  }
+inline Server& Server::set_ipc_channel(IpcChannel* ch) {
+  if (ipc_ != nullptr) remove_poll_source(ipc_->wait_fd());
+  ipc_ = ch;
+  ipc_broken_logged_ = false;
+  if (ipc_ != nullptr)
+    (void)add_poll_source(ipc_->wait_fd(), POLLIN, [this](short) { ipc_->consume_wakeup(); });
+  return *this;
+}
 
-  rx_buffer_.advance(handshake_size);
-  std::string accept_key = generate_accept_key(ws_key);
+inline void Server::bind_ipc(Connection& conn) {
+  conn.on_open = [this, open = std::move(conn.on_open)](const ConnPtr& c) {
+    if (open) open(c);
+    forward_to_ipc(IpcChannel::Kind::kOpen, c->get_id(), {});
+  };
+  conn.on_message = [this, message = std::move(conn.on_message)](const ConnPtr& c, std::string_view msg) {
+    if (message) message(c, msg);
+    forward_to_ipc(c->message_opcode() == ws::OpCode::kBinary ? IpcChannel::Kind::kBinary
+                                                               : IpcChannel::Kind::kText,
+                   c->get_id(), msg);
+  };
+  conn.on_close = [this, close = std::move(conn.on_close)](const ConnPtr& c, bool clean) {
+    if (close) close(c, clean);
+    // on_close(.., true) fires exactly once, from the transition to kClosed; the app
+    // never heard of a connection that closed while handshaking
+    if (clean && c->handshake_completed()) forward_to_ipc(IpcChannel::Kind::kClose, c->get_id(), {});
+  };
+}
 
-  char response_buf[256];
-  int response_len = snprintf(response_buf, sizeof(response_buf),
-      "HTTP/1.1 101 Switching Protocols\r\n"
-      "Upgrade: websocket\r\n"
-      "Connection: Upgrade\r\n"
-      "Sec-WebSocket-Accept: %s\r\n"
-      "\r\n",
-      accept_key.c_str());
+inline void Server::forward_to_ipc(IpcChannel::Kind kind, uint64_t conn_id, std::string_view payload) {
+  if (!ipc_->broken() && ipc_->send(kind, conn_id, payload))
+    stats_.ipc_messages_out.fetch_add(1, std::memory_order_relaxed);
+  else
+    stats_.ipc_dropped.fetch_add(1, std::memory_order_relaxed);
+}
 
-  if (response_len <= 0 || static_cast<size_t>(response_len) >= sizeof(response_buf)) {
-    last_error_code_ = ErrorCode::kHandshakeFailed;
-    return expected<void, ErrorCode>::error(ErrorCode::kHandshakeFailed);
+// Payloads are framed straight from the shared ring into tx_buffer_ (single copy)
+inline void Server::process_ipc_commands() {
+  ipc_->drain([this](const IpcChannel::Message& m) {
+    stats_.ipc_messages_in.fetch_add(1, std::memory_order_relaxed);
+    Connection* conn = find_connection(m.conn_id);
+    if (conn == nullptr) return;
+    switch (m.kind) {
+      case IpcChannel::Kind::kText: conn->send(m.payload); break;
+      case IpcChannel::Kind::kBinary: conn->send_binary(m.payload); break;
+      case IpcChannel::Kind::kClose: {
+        uint16_t code = 1000;
+        if (m.payload.size() >= 2)
+          code = static_cast<uint16_t>((static_cast<uint8_t>(m.payload[0]) << 8) |
+                                       static_cast<uint8_t>(m.payload[1]));
+        conn->close(code);
+        break;
+      }
+      default: break;
+    }
+  });
+  if (ipc_->broken() && !ipc_broken_logged_) {
+    ipc_broken_logged_ = true;
+    log_error("IPC channel stopped: malformed record from the application");
   }
+}
 
-  if (!tx_buffer_.push(reinterpret_cast<const uint8_t*>(response_buf),
-                        static_cast<size_t>(response_len))) {
-    last_error_code_ = ErrorCode::kBufferFull;
-    return expected<void, ErrorCode>::error(ErrorCode::kBufferFull);
+inline void Server::apply_tcp_tuning(int fd) {
+  int opt = 1;
+  if (tcp_tuning_.tcp_nodelay)
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+#ifdef TCP_QUICKACK
+  if (tcp_tuning_.tcp_quickack)
+    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &opt, sizeof(opt));
+#endif
+  if (tcp_tuning_.so_keepalive) {
+    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
+#ifdef TCP_KEEPIDLE
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
+               &tcp_tuning_.keepalive_idle_s, sizeof(tcp_tuning_.keepalive_idle_s));
+#endif
+#ifdef TCP_KEEPINTVL
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
+               &tcp_tuning_.keepalive_interval_s, sizeof(tcp_tuning_.keepalive_interval_s));
+#endif
+#ifdef TCP_KEEPCNT
+    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,
+               &tcp_tuning_.keepalive_count, sizeof(tcp_tuning_.keepalive_count));
+#endif
   }
+}
 
-  handshake_completed_ = true;
-  sec_websocket_key_.clear();
-  last_error_code_ = ErrorCode::kOk;
-  return expected<void, ErrorCode>::success();
+inline void Server::log_info(const std::string& msg) {
+  std::cout << "[EWSS INFO] " << msg << std::endl;
 }
 
-inline void Connection::parse_frames() {
-  while (true) {
-    uint8_t temp[4096];
-    size_t len = rx_buffer_.peek(temp, sizeof(temp));
-    if (len == 0) break;
+inline void Server::log_error(const std::string& msg) {
+  std::cerr << "[EWSS ERROR] " << msg << std::endl;
+}
 
-    std::string_view data(reinterpret_cast<const char*>(temp), len);
-    ws::FrameHeader header;
-    size_t header_size = ws::parse_frame_header(data, header);
-    if (header_size == 0) break;
+// --- HandshakeStage implementation ---
 
-    size_t total_frame_size = header_size + header.payload_len;
-    if (len < total_frame_size) break;
+inline HandshakeStage::HandshakeStage(uint16_t port, const std::string& bind_addr) {
+  std::string err;
+  listen_fd_ = detail::open_listener(port, bind_addr, err);
+  if (listen_fd_ < 0)
+    EWSS_THROW(std::runtime_error(err));
+}
 
-    const uint8_t* mask_key = nullptr;
-    if (header.masked) mask_key = temp + (header_size - 4);
+inline HandshakeStage::~HandshakeStage() {
+  stop();
+  if (listen_fd_ >= 0) ::close(listen_fd_);
+}
+
+inline HandshakeStage& HandshakeStage::add_reactor(Server& reactor) {
+  reactor.enable_handoff();
+  reactors_.push_back(&reactor);
+  return *this;
+}
 
-    uint8_t* payload = temp + header_size;
-    size_t payload_len = header.payload_len;
+inline void HandshakeStage::start() {
+  if (running_.exchange(true)) return;
+  for (size_t i = 0; i < threads_count_; ++i) threads_.emplace_back([this]() { worker(); });
+}
 
-    if (header.masked) unmask_payload(payload, payload_len, mask_key);
+inline void HandshakeStage::stop() {
+  running_ = false;
+  for (auto& t : threads_)
+    if (t.joinable()) t.join();
+  threads_.clear();
+}
 
-    switch (header.opcode) {
-      case ws::OpCode::kText:
-      case ws::OpCode::kBinary:
-        if (on_message)
-          on_message(shared_from_this(),
-                     std::string_view(reinterpret_cast<const char*>(payload), payload_len));
-        break;
-      case ws::OpCode::kClose:
-        if (on_close) on_close(shared_from_this(), false);
-        transition_to_state(ConnectionState::kClosed);
-        socket_.close();
-        return;
-      case ws::OpCode::kPing:
-        write_frame(std::string_view(reinterpret_cast<const char*>(payload), payload_len),
-                    ws::OpCode::kPong);
-        break;
-      case ws::OpCode::kPong:
-        break;
-      default:
-        break;
+inline Server* HandshakeStage::least_loaded() const {
+  Server* best = nullptr;
+  uint64_t best_load = UINT64_MAX;
+  for (Server* r : reactors_) {
+    uint64_t load = r->load();
+    if (load < best_load) {
+      best = r;
+      best_load = load;
     }
-    rx_buffer_.advance(total_frame_size);
   }
+  return best;
 }
 
-inline void Connection::write_frame(std::string_view payload, ws::OpCode opcode) {
-  uint8_t header_buf[14];
-  size_t header_len = ws::encode_frame_header(header_buf, opcode, payload.size(), false);
-  if (!tx_buffer_.push(header_buf, header_len)) return;
-  if (!payload.empty())
-    tx_buffer_.push(reinterpret_cast<const uint8_t*>(payload.data()), payload.size());
+inline void HandshakeStage::fail(int fd, const char* status) {
+  failed_.fetch_add(1, std::memory_order_relaxed);
+  if (status != nullptr) {
+    char buf[96];
+    int n = snprintf(buf, sizeof(buf), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    if (n > 0) (void)::send(fd, buf, static_cast<size_t>(n), MSG_NOSIGNAL);
+  }
+  ::close(fd);
 }
 
-inline void Connection::write_close_frame(uint16_t code) {
-  uint8_t close_payload[2];
-  close_payload[0] = static_cast<uint8_t>((code >> 8) & 0xFF);
-  close_payload[1] = static_cast<uint8_t>(code & 0xFF);
-  uint8_t header_buf[14];
-  size_t header_len = ws::encode_frame_header(header_buf, ws::OpCode::kClose, 2, false);
-  if (!tx_buffer_.push(header_buf, header_len)) return;
-  tx_buffer_.push(close_payload, 2);
+inline bool HandshakeStage::finish(Pending& p) {
+  std::string_view data(p.buf, p.len);
+  if (data.find("\r\n\r\n") == std::string_view::npos) {
+    if (p.len < sizeof(p.buf)) return false;
+    fail(p.fd, "431 Request Header Fields Too Large");
+    return true;
+  }
+  ws::UpgradeRequest req;
+  if (!ws::parse_upgrade_request(data, req)) {
+    fail(p.fd, "400 Bad Request");
+    return true;
+  }
+  std::string_view protocol;
+  if (rpc_ && ws::offers_protocol(req.protocols, rpc::kProtocol))
+    protocol = rpc::kProtocol;
+  else if (batching_ && ws::offers_protocol(req.protocols, batch::kProtocol))
+    protocol = batch::kProtocol;
+  char response[320];
+  size_t response_len = ws::write_upgrade_response(req.key, response, sizeof(response), protocol);
+  if (response_len == 0) {
+    fail(p.fd, "400 Bad Request");
+    return true;
+  }
+  // Counted first: the reactor may already be serving the client when handoff() returns
+  completed_.fetch_add(1, std::memory_order_relaxed);
+  Server* reactor = least_loaded();
+  if (reactor == nullptr ||
+      !reactor->handoff(p.fd, req.path, std::string_view(response, response_len), data.substr(req.size))) {
+    completed_.fetch_sub(1, std::memory_order_relaxed);
+    fail(p.fd, "503 Service Unavailable");
+  }
+  return true;
 }
 
-inline std::string Connection::generate_accept_key(std::string_view client_key) {
-  constexpr std::string_view kMagic = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
-  std::string key(client_key);
-  key.append(kMagic);
-  auto hash = SHA1::compute(reinterpret_cast<const uint8_t*>(key.data()), key.size());
-  return Base64::encode(hash.data(), hash.size());
+inline void HandshakeStage::worker() {
+  std::vector<Pending> pending;
+  pending.reserve(kMaxPending);
+  std::array<pollfd, kMaxPending + 1> pfds{};
+  const auto timeout = std::chrono::milliseconds(Connection::kHandshakeTimeout);
+
+  while (running_.load(std::memory_order_relaxed)) {
+    size_t n = 0;
+    pfds[n++] = {listen_fd_, static_cast<short>(pending.size() < kMaxPending ? POLLIN : 0), 0};
+    for (auto& p : pending) pfds[n++] = {p.fd, POLLIN, 0};
+    int ret = ::poll(pfds.data(), static_cast<nfds_t>(n), 50);
+    if (ret < 0 && errno != EINTR) break;
+    auto now = std::chrono::steady_clock::now();
+
+    // Walk backwards so swap-removal never revisits an entry; new sockets sit past n
+    for (size_t i = n - 1; i >= 1; --i) {
+      Pending& p = pending[i - 1];
+      bool done = false;
+      if (pfds[i].revents & (POLLIN | POLLERR | POLLHUP)) {
+        ssize_t r = ::recv(p.fd, p.buf + p.len, sizeof(p.buf) - p.len, 0);
+        if (r > 0) {
+          p.len += static_cast<size_t>(r);
+          done = finish(p);
+        } else if (r == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+          fail(p.fd, nullptr);
+          done = true;
+        }
+      } else if (now > p.deadline) {
+        fail(p.fd, nullptr);
+        done = true;
+      }
+      if (done) {
+        p = pending.back();
+        pending.pop_back();
+      }
+    }
+
+    if (pfds[0].revents & POLLIN) {
+      while (pending.size() < kMaxPending) {
+        int fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) break;
+        pending.push_back(Pending{fd, 0, now + timeout, {}});
+      }
+    }
+  }
+  for (auto& p : pending) ::close(p.fd);
 }
 
-inline void Connection::unmask_payload(uint8_t* payload, size_t len, const uint8_t* mask_key) {
-  for (size_t i = 0; i < len; ++i) payload[i] ^= mask_key[i % 4];
+// --- Rebalancer implementation ---
+
+inline Rebalancer& Rebalancer::add_reactor(Server& reactor) {
+  reactor.enable_handoff();
+  const ServerStats& st = reactor.stats();
+  samples_.push_back(Sample{&reactor, st.loop_busy_us.load(std::memory_order_relaxed),
+                            st.loop_poll_us.load(std::memory_order_relaxed), 0.0});
+  return *this;
 }
 
-inline void Connection::check_high_watermark() {
-  if (!write_paused_ && tx_buffer_.size() > kTxHighWatermark) {
-    write_paused_ = true;
-    if (on_backpressure) on_backpressure(shared_from_this());
+inline uint32_t Rebalancer::tick() {
+  if (samples_.size() < 2) return 0;
+  size_t hot = 0;
+  size_t cold = 0;
+  for (size_t i = 0; i < samples_.size(); ++i) {
+    Sample& s = samples_[i];
+    const ServerStats& st = s.reactor->stats();
+    uint64_t busy = st.loop_busy_us.load(std::memory_order_relaxed);
+    uint64_t poll = st.loop_poll_us.load(std::memory_order_relaxed);
+    // Counters restart when run() resets stats; treat that window as empty
+    uint64_t d_busy = busy >= s.busy_us ? busy - s.busy_us : 0;
+    uint64_t d_poll = poll >= s.poll_us ? poll - s.poll_us : 0;
+    s.busy_us = busy;
+    s.poll_us = poll;
+    s.utilization = d_busy + d_poll == 0 ? 0.0 : static_cast<double>(d_busy) / static_cast<double>(d_busy + d_poll);
+    if (s.utilization > samples_[hot].utilization) hot = i;
+    if (s.utilization < samples_[cold].utilization) cold = i;
   }
+
+  double u_hot = samples_[hot].utilization;
+  double u_cold = samples_[cold].utilization;
+  if (hot == cold || u_hot < policy_.high || u_hot - u_cold < policy_.gap) return 0;
+  uint64_t active = samples_[hot].reactor->stats().active_connections.load(std::memory_order_relaxed);
+  if (active < 2) return 0;
+
+  // Moving this share would even the two loops if load were spread evenly across connections
+  double share = (u_hot - u_cold) / (2.0 * u_hot);
+  uint64_t moves = static_cast<uint64_t>(std::ceil(static_cast<double>(active) * share));
+  moves = std::min<uint64_t>({moves, active / 2, policy_.max_moves});
+  if (moves == 0) return 0;
+  samples_[hot].reactor->shed(*samples_[cold].reactor, static_cast<uint32_t>(moves));
+  return static_cast<uint32_t>(moves);
 }
 
-inline void Connection::check_low_watermark() {
-  if (write_paused_ && tx_buffer_.size() < kTxLowWatermark) {
-    write_paused_ = false;
-    if (on_drain) on_drain(shared_from_this());
-  }
+inline void Rebalancer::start(uint32_t interval_ms) {
+  if (running_.exchange(true)) return;
+  thread_ = std::thread([this, interval_ms]() {
+    while (running_.load(std::memory_order_relaxed)) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(interval_ms));
+      tick();
+    }
+  });
 }
 
-inline void Connection::log_error(const std::string&) {}
+inline void Rebalancer::stop() {
+  running_ = false;
+  if (thread_.joinable()) thread_.join();
+}
 
-// --- Server implementation ---
+// --- ClusterRelay implementation ---
 
-inline Server::Server(uint16_t port, const std::string& bind_addr)
-    : port_(port), bind_addr_(bind_addr) {
-  server_sock_ = ::socket(AF_INET, SOCK_STREAM, 0);
-  if (server_sock_ < 0)
-    EWSS_THROW(std::runtime_error("Failed to create socket"));
+inline ClusterRelay::ClusterRelay(PubSub& hub, const RelayConfig& cfg) : hub_(hub), cfg_(cfg) {
+  // Seed from wall-clock microseconds so a restarted node's seqs stay above what peers saw
+  next_seq_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count());
+  redial_at_.assign(cfg_.peers.size(), std::chrono::steady_clock::time_point{});
+  peer_linked_.assign(cfg_.peers.size(), false);
+}
 
-  int reuse = 1;
-  setsockopt(server_sock_, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+inline ClusterRelay::~ClusterRelay() {
+  stop();
+  for (size_t i = links_.size(); i-- > 0;) close_link(i);
+  if (listen_fd_ >= 0) ::close(listen_fd_);
+  if (wake_fd_ >= 0) ::close(wake_fd_);
+}
 
-  struct sockaddr_in addr;
-  memset(&addr, 0, sizeof(addr));
-  addr.sin_family = AF_INET;
-  addr.sin_port = htons(port_);
-  addr.sin_addr.s_addr = bind_addr_.empty() ? htonl(INADDR_ANY) : inet_addr(bind_addr_.c_str());
+// Non-blocking stream socket bound (listen) or connecting to addr; -1 on failure
+inline int ClusterRelay::open_socket(const std::string& addr, bool listen, bool& in_progress) {
+  in_progress = false;
+  struct sockaddr_storage ss{};
+  socklen_t len = 0;
+  int family = AF_INET;
+  if (addr.compare(0, 5, "unix:") == 0) {
+    family = AF_UNIX;
+    auto* un = reinterpret_cast<struct sockaddr_un*>(&ss);
+    un->sun_family = AF_UNIX;
+    std::string path = addr.substr(5);
+    if (path.size() >= sizeof(un->sun_path)) return -1;
+    std::memcpy(un->sun_path, path.c_str(), path.size() + 1);
+    len = static_cast<socklen_t>(sizeof(sa_family_t) + path.size() + 1);
+    if (listen) ::unlink(un->sun_path);
+  } else {
+    size_t colon = addr.rfind(':');
+    if (colon == std::string::npos) return -1;
+    auto* in = reinterpret_cast<struct sockaddr_in*>(&ss);
+    in->sin_family = AF_INET;
+    in->sin_port = htons(static_cast<uint16_t>(std::atoi(addr.c_str() + colon + 1)));
+    if (::inet_pton(AF_INET, addr.substr(0, colon).c_str(), &in->sin_addr) != 1) return -1;
+    len = sizeof(struct sockaddr_in);
+  }
 
-  if (bind(server_sock_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
-    int err = errno;
-    ::close(server_sock_);
-    EWSS_THROW(std::runtime_error(
-        "Failed to bind port " + std::to_string(port_) + ": " + strerror(err)));
+  int fd = ::socket(family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0) return -1;
+  int one = 1;
+  if (listen) {
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (::bind(fd, reinterpret_cast<struct sockaddr*>(&ss), len) < 0 || ::listen(fd, 16) < 0) {
+      ::close(fd);
+      return -1;
+    }
+    return fd;
+  }
+  if (family == AF_INET) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  if (::connect(fd, reinterpret_cast<struct sockaddr*>(&ss), len) < 0) {
+    if (errno != EINPROGRESS) {
+      ::close(fd);
+      return -1;
+    }
+    in_progress = true;
   }
+  return fd;
+}
 
-  if (listen(server_sock_, 128) < 0) {
-    ::close(server_sock_);
-    EWSS_THROW(std::runtime_error("Failed to listen"));
+inline expected<void, ErrorCode> ClusterRelay::start() {
+  if (running_.load()) return expected<void, ErrorCode>::success();
+  wake_fd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (wake_fd_ < 0) return expected<void, ErrorCode>::error(ErrorCode::kResourceUnavailable);
+  if (!cfg_.listen.empty()) {
+    bool unused;
+    listen_fd_ = open_socket(cfg_.listen, true, unused);
+    if (listen_fd_ < 0) return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
   }
+  running_ = true;
+  thread_ = std::thread([this]() { run(); });
+  return expected<void, ErrorCode>::success();
+}
 
-  fcntl(server_sock_, F_SETFL, O_NONBLOCK);
-  log_info("Server initialized on " + bind_addr_ + ":" + std::to_string(port_));
+inline void ClusterRelay::stop() {
+  if (!running_.exchange(false)) return;
+  uint64_t one = 1;
+  (void)!::write(wake_fd_, &one, sizeof(one));
+  if (thread_.joinable()) thread_.join();
 }
 
-inline Server::~Server() {
-  if (server_sock_ >= 0) ::close(server_sock_);
+inline bool ClusterRelay::publish(std::string_view topic, std::string_view payload, bool binary) {
+  // Receivers drop the link on a record past kMaxRecord, and topic_len is 16 bits
+  if (topic.size() > UINT16_MAX || kHeaderSize - 4 + topic.size() + payload.size() > kMaxRecord) {
+    stats_.oversize.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  SharedFrame frame = SharedFrame::encode(topic, payload, binary ? ws::OpCode::kBinary : ws::OpCode::kText);
+  if (!frame) return false;
+  hub_.publish(frame);
+  if (!outbox_.push(frame)) {
+    stats_.dropped.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+  stats_.published.fetch_add(1, std::memory_order_relaxed);
+  uint64_t one = 1;
+  (void)!::write(wake_fd_, &one, sizeof(one));
+  return true;
 }
 
-inline void Server::run() {
-  is_running_ = true;
-  stats_.reset();
+inline void ClusterRelay::dial(size_t peer) {
+  bool in_progress = false;
+  int fd = open_socket(cfg_.peers[peer], false, in_progress);
+  if (fd < 0) {
+    redial_at_[peer] = std::chrono::steady_clock::now() + std::chrono::milliseconds(cfg_.reconnect_ms);
+    return;
+  }
+  Link link;
+  link.fd = fd;
+  link.peer = static_cast<int>(peer);
+  link.connecting = in_progress;
+  if (!in_progress) queue_hello(link);
+  links_.push_back(std::move(link));
+  peer_linked_[peer] = true;
+}
 
-  while (is_running_) {
-    size_t nfds = 0;
-    poll_fds_[nfds++] = {server_sock_, POLLIN, 0};
+// Every link opens with magic + our node id, flushed without waiting for a batch
+inline void ClusterRelay::queue_hello(Link& link) {
+  char hello[8];
+  uint32_t magic = kMagic;
+  std::memcpy(hello, &magic, 4);
+  std::memcpy(hello + 4, &cfg_.node_id, 4);
+  link.out.insert(0, hello, sizeof(hello));
+  link.oldest = std::chrono::steady_clock::time_point{};
+}
 
-    for (uint32_t i = 0; i < connections_.size(); ++i) {
-      short events = POLLIN;
-      if (connections_[i]->has_data_to_send()) events |= POLLOUT;
-      poll_fds_[nfds++] = {static_cast<int>(connections_[i]->get_fd()), events, 0};
+inline void ClusterRelay::close_link(size_t idx) {
+  Link& link = links_[idx];
+  if (link.hello_done) stats_.links_up.fetch_sub(1, std::memory_order_relaxed);
+  if (link.peer >= 0) {
+    peer_linked_[static_cast<size_t>(link.peer)] = false;
+    redial_at_[static_cast<size_t>(link.peer)] =
+        std::chrono::steady_clock::now() + std::chrono::milliseconds(cfg_.reconnect_ms);
+  }
+  ::close(link.fd);
+  if (idx + 1 < links_.size()) links_[idx] = std::move(links_.back());
+  links_.pop_back();
+}
+
+// Append queued publishes to every link as records (seq assigned here: wire order == seq order)
+inline void ClusterRelay::drain_outbox(std::chrono::steady_clock::time_point now) {
+  while (outbox_.pop_with([this, now](SharedFrame& slot) {
+    SharedFrame frame = std::move(slot);
+    std::string_view topic = frame.topic();
+    std::string_view payload = frame.payload();
+    uint32_t body = static_cast<uint32_t>(kHeaderSize - 4 + topic.size() + payload.size());
+    uint32_t origin = cfg_.node_id;
+    uint64_t seq = next_seq_++;
+    uint16_t topic_len = static_cast<uint16_t>(topic.size());
+    uint8_t flags = frame.opcode() == ws::OpCode::kBinary ? 1 : 0;
+    char header[kHeaderSize];
+    std::memcpy(header, &body, 4);
+    std::memcpy(header + 4, &origin, 4);
+    std::memcpy(header + 8, &seq, 8);
+    std::memcpy(header + 16, &topic_len, 2);
+    header[18] = static_cast<char>(flags);
+
+    for (Link& link : links_) {
+      if (link.connecting) {
+        stats_.unlinked.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (link.out.size() - link.out_sent + body > kMaxBacklog) {
+        stats_.dropped.fetch_add(1, std::memory_order_relaxed);
+        continue;
+      }
+      if (link.out.size() == link.out_sent) link.oldest = now;
+      link.out.append(header, kHeaderSize);
+      link.out.append(topic.data(), topic.size());
+      link.out.append(payload.data(), payload.size());
+      stats_.records_out.fetch_add(1, std::memory_order_relaxed);
     }
+  })) {
+  }
+}
 
-    auto poll_start = std::chrono::steady_clock::now();
-    int ret = ::poll(poll_fds_.data(), static_cast<nfds_t>(nfds), poll_timeout_ms_);
-    auto poll_end = std::chrono::steady_clock::now();
+// Write pending bytes; false when the link failed
+inline bool ClusterRelay::flush(Link& link) {
+  if (link.out_sent == link.out.size()) return true;
+  ssize_t n = ::send(link.fd, link.out.data() + link.out_sent, link.out.size() - link.out_sent, MSG_NOSIGNAL);
+  if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+  link.out_sent += static_cast<size_t>(n);
+  stats_.batches_out.fetch_add(1, std::memory_order_relaxed);
+  if (link.out_sent == link.out.size()) {
+    link.out.clear();
+    link.out_sent = 0;
+  }
+  return true;
+}
 
-    uint64_t poll_us = static_cast<uint64_t>(
-        std::chrono::duration_cast<std::chrono::microseconds>(poll_end - poll_start).count());
-    stats_.last_poll_latency_us.store(poll_us, std::memory_order_relaxed);
-    uint64_t prev_max = stats_.max_poll_latency_us.load(std::memory_order_relaxed);
-    if (poll_us > prev_max)
-      stats_.max_poll_latency_us.store(poll_us, std::memory_order_relaxed);
+inline bool ClusterRelay::read_link(Link& link) {
+  char buf[16384];
+  while (true) {
+    ssize_t n = ::recv(link.fd, buf, sizeof(buf), 0);
+    if (n == 0) return false;
+    if (n < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) return false;
+      break;
+    }
+    link.in.append(buf, static_cast<size_t>(n));
+  }
 
-    if (ret < 0) break;
-    if (ret == 0) continue;
+  size_t pos = 0;
+  if (!link.hello_done) {
+    if (link.in.size() < 8) return true;
+    uint32_t magic;
+    std::memcpy(&magic, link.in.data(), 4);
+    std::memcpy(&link.peer_id, link.in.data() + 4, 4);
+    if (magic != kMagic) return false;
+    link.hello_done = true;
+    stats_.links_up.fetch_add(1, std::memory_order_relaxed);
+    pos = 8;
+  }
+  while (link.in.size() - pos >= 4) {
+    uint32_t body;
+    std::memcpy(&body, link.in.data() + pos, 4);
+    if (body < kHeaderSize - 4 || body > kMaxRecord) return false;
+    if (link.in.size() - pos < 4 + body) break;
+    deliver(std::string_view(link.in.data() + pos, 4 + body));
+    pos += 4 + body;
+  }
+  link.in.erase(0, pos);
+  return true;
+}
 
-    // Handle new connections (with overload protection)
-    if (poll_fds_[0].revents & POLLIN) {
-      if (stats_.is_overloaded(max_connections_)) {
-        stats_.rejected_connections.fetch_add(1, std::memory_order_relaxed);
-        struct sockaddr_in client_addr;
-        socklen_t client_addr_len = sizeof(client_addr);
-        int reject_sock = accept(server_sock_,
-            reinterpret_cast<struct sockaddr*>(&client_addr), &client_addr_len);
-        if (reject_sock >= 0) ::close(reject_sock);
+inline void ClusterRelay::deliver(std::string_view record) {
+  uint32_t origin;
+  uint64_t seq;
+  uint16_t topic_len;
+  std::memcpy(&origin, record.data() + 4, 4);
+  std::memcpy(&seq, record.data() + 8, 8);
+  std::memcpy(&topic_len, record.data() + 16, 2);
+  bool binary = (record[18] & 1) != 0;
+  if (kHeaderSize + topic_len > record.size()) return;
+
+  // Links carry each origin's records in seq order, so anything not newer was delivered already
+  uint64_t& last = last_seq_[origin];
+  if (origin == cfg_.node_id || seq <= last) {
+    stats_.duplicates.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  last = seq;
+  std::string_view topic = record.substr(kHeaderSize, topic_len);
+  std::string_view payload = record.substr(kHeaderSize + topic_len);
+  hub_.publish(topic, payload, binary);  // The one encode on this node
+  stats_.records_in.fetch_add(1, std::memory_order_relaxed);
+}
+
+inline void ClusterRelay::run() {
+  using Clock = std::chrono::steady_clock;
+  std::vector<pollfd> pfds;
+  while (running_.load(std::memory_order_relaxed)) {
+    auto now = Clock::now();
+    for (size_t p = 0; p < cfg_.peers.size(); ++p)
+      if (!peer_linked_[p] && now >= redial_at_[p]) dial(p);
+
+    drain_outbox(now);
+
+    // Flush links whose batch is full or whose oldest record has waited long enough
+    int timeout_ms = 100;
+    for (size_t i = links_.size(); i-- > 0;) {
+      Link& link = links_[i];
+      size_t pending = link.out.size() - link.out_sent;
+      if (link.connecting || pending == 0) continue;
+      auto waited = std::chrono::duration_cast<std::chrono::microseconds>(now - link.oldest).count();
+      if (pending >= cfg_.batch_bytes || waited >= static_cast<int64_t>(cfg_.batch_delay_us)) {
+        if (!flush(link)) {
+          close_link(i);
+          continue;
+        }
+        link.want_write = link.out_sent < link.out.size();
       } else {
-        accept_connection();
+        int left_ms = static_cast<int>((static_cast<int64_t>(cfg_.batch_delay_us) - waited + 999) / 1000);
+        timeout_ms = std::min(timeout_ms, left_ms);
       }
     }
 
-    // Handle client I/O
-    for (size_t i = 1; i < nfds; ++i) {
-      if (i - 1 >= connections_.size()) break;
-      handle_connection_io(connections_[i - 1], poll_fds_[i]);
+    pfds.clear();
+    pfds.push_back({wake_fd_, POLLIN, 0});
+    pfds.push_back({listen_fd_, POLLIN, 0});
+    for (const Link& link : links_) {
+      short events = link.connecting ? POLLOUT : POLLIN;
+      if (link.want_write) events |= POLLOUT;
+      pfds.push_back({link.fd, events, 0});
     }
+    if (::poll(pfds.data(), static_cast<nfds_t>(pfds.size()), timeout_ms) < 0 && errno != EINTR) break;
 
-    // Enforce timeouts
-    for (uint32_t i = 0; i < connections_.size(); ++i) {
-      auto& conn = connections_[i];
-      if (conn->is_handshake_timed_out() || conn->is_close_timed_out())
-        conn->close();
+    if (pfds[0].revents & POLLIN) {
+      uint64_t count;
+      (void)!::read(wake_fd_, &count, sizeof(count));
     }
 
-    remove_closed_connections();
+    // Links first (indices match pfds), then new accepts so the arrays stay aligned
+    for (size_t i = links_.size(); i-- > 0;) {
+      Link& link = links_[i];
+      short rev = pfds[i + 2].revents;
+      if (rev == 0) continue;
+      if (link.connecting) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+        ::getsockopt(link.fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err != 0 || (rev & (POLLERR | POLLHUP))) {
+          close_link(i);
+          continue;
+        }
+        link.connecting = false;
+        queue_hello(link);
+      }
+      if ((rev & POLLIN) && !read_link(link)) {
+        close_link(i);
+        continue;
+      }
+      if ((rev & (POLLERR | POLLHUP)) && !(rev & POLLIN)) {
+        close_link(i);
+        continue;
+      }
+      if (rev & POLLOUT) {
+        if (!flush(link)) {
+          close_link(i);
+          continue;
+        }
+        link.want_write = link.out_sent < link.out.size();
+      }
+    }
+
+    if (listen_fd_ >= 0 && (pfds[1].revents & POLLIN)) {
+      int fd;
+      while ((fd = ::accept4(listen_fd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+        Link link;
+        link.fd = fd;
+        queue_hello(link);
+        links_.push_back(std::move(link));
+      }
+    }
   }
 }
 
-inline expected<void, ErrorCode> Server::accept_connection() {
-  if (connections_.size() >= max_connections_ || connections_.full()) {
-    stats_.rejected_connections.fetch_add(1, std::memory_order_relaxed);
-    return expected<void, ErrorCode>::error(ErrorCode::kMaxConnectionsExceeded);
+#if EWSS_HAS_COROUTINES
+
+// ============================================================================
+// Coroutines (C++20) - Detached tasks with pooled frames, reactor awaitables
+// ============================================================================
+
+// Fixed-size frame blocks per thread; larger frames or an exhausted pool fall back to the heap
+class CoroFramePool {
+ public:
+  static constexpr size_t kBlockSize = 1024;
+  static constexpr size_t kBlocks = 64;
+
+  static CoroFramePool& instance() {
+    static thread_local CoroFramePool pool;
+    return pool;
   }
 
-  struct sockaddr_in client_addr;
-  socklen_t client_addr_len = sizeof(client_addr);
-  int client_sock = accept(server_sock_,
-      reinterpret_cast<struct sockaddr*>(&client_addr), &client_addr_len);
+  void* allocate(size_t n) {
+    int32_t idx = n <= kBlockSize ? pool_.acquire() : -1;
+    if (idx >= 0) return pool_.storage(idx);
+    ++heap_fallbacks_;
+    return ::operator new(n);
+  }
 
-  if (client_sock < 0) {
-    int err = errno;
-    if (err != EAGAIN && err != EWOULDBLOCK) {
-      stats_.socket_errors.fetch_add(1, std::memory_order_relaxed);
-      return expected<void, ErrorCode>::error(ErrorCode::kSocketError);
+  void deallocate(void* p, size_t n) noexcept {
+    auto* base = static_cast<uint8_t*>(pool_.storage(0));
+    auto* q = static_cast<uint8_t*>(p);
+    if (q >= base && q < base + kBlockSize * kBlocks) {
+      pool_.release(static_cast<int32_t>((q - base) / kBlockSize));
+      return;
     }
-    return expected<void, ErrorCode>::success();
+    ::operator delete(p, n);
   }
 
-  fcntl(client_sock, F_SETFL, O_NONBLOCK);
-  apply_tcp_tuning(client_sock);
+  size_t in_use() const { return pool_.in_use(); }
+  uint64_t heap_fallbacks() const { return heap_fallbacks_; }
 
-  auto conn = std::make_shared<Connection>(client_sock);
-  conn->on_open = on_connect;
-  conn->on_message = on_message;
-  conn->on_close = on_close;
-  conn->on_error = on_error;
-  conn->on_backpressure = on_backpressure;
-  conn->on_drain = on_drain;
+ private:
+  struct alignas(std::max_align_t) Block {
+    uint8_t bytes[kBlockSize];
+  };
+  ObjectPool<Block, kBlocks> pool_;
+  uint64_t heap_fallbacks_ = 0;
+};
 
-  connections_.push_back(conn);
-  stats_.total_connections.fetch_add(1, std::memory_order_relaxed);
-  stats_.active_connections.fetch_add(1, std::memory_order_relaxed);
-  return expected<void, ErrorCode>::success();
-}
+// Fire-and-forget coroutine: runs eagerly until its first suspension, frees itself on completion
+class Task {
+ public:
+  struct promise_type {
+    Task get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+
+    static void* operator new(size_t n) { return CoroFramePool::instance().allocate(n); }
+    static void operator delete(void* p, size_t n) noexcept { CoroFramePool::instance().deallocate(p, n); }
+  };
+};
 
-inline void Server::handle_connection_io(ConnPtr& conn, const pollfd& pfd) {
-  if (pfd.revents & POLLIN) {
-    if (!conn->handle_read().has_value()) conn->close();
+// Resumes the coroutine once; destroyed unresumed (waiter dropped, timer cancelled) it
+// destroys the frame instead, releasing what the frame holds (typically its ConnPtr)
+class CoroResume {
+ public:
+  explicit CoroResume(std::coroutine_handle<> h) noexcept : h_(h) {}
+  CoroResume(CoroResume&& o) noexcept : h_(std::exchange(o.h_, {})) {}
+  CoroResume& operator=(CoroResume&&) = delete;
+  ~CoroResume() { if (h_) h_.destroy(); }
+
+  void operator()() const { std::exchange(h_, {}).resume(); }
+
+ private:
+  mutable std::coroutine_handle<> h_;
+};
+
+class RecvAwaiter {
+ public:
+  explicit RecvAwaiter(Connection& conn) : conn_(conn) {}
+
+  bool await_ready() const noexcept { return conn_.get_state() != ConnectionState::kOpen; }
+  void await_suspend(std::coroutine_handle<> h) { conn_.await_message(CoroResume(h)); }
+  expected<std::string_view, ErrorCode> await_resume() const {
+    if (conn_.get_state() == ConnectionState::kOpen && conn_.async_error() == ErrorCode::kOk)
+      return expected<std::string_view, ErrorCode>::success(conn_.async_message());
+    return expected<std::string_view, ErrorCode>::error(ErrorCode::kConnectionClosed);
   }
-  if (pfd.revents & POLLOUT) {
-    auto result = use_writev_ ? conn->handle_write_vectored() : conn->handle_write();
-    if (!result.has_value()) conn->close();
+
+ private:
+  Connection& conn_;
+};
+
+class DrainAwaiter {
+ public:
+  DrainAwaiter(Connection& conn, std::string_view payload, bool binary) : conn_(conn) {
+    if (binary) conn_.send_binary(payload);
+    else conn_.send(payload);
   }
-  if (pfd.revents & (POLLERR | POLLHUP)) conn->close();
-}
 
-inline void Server::remove_closed_connections() {
-  uint32_t removed = 0;
-  uint32_t i = 0;
-  while (i < connections_.size()) {
-    if (connections_[i]->is_closed()) {
-      if (i < connections_.size() - 1)
-        connections_[i] = static_cast<ConnPtr&&>(connections_[connections_.size() - 1]);
-      connections_.pop_back();
-      ++removed;
-    } else {
-      ++i;
-    }
+  bool await_ready() const noexcept {
+    return conn_.get_state() != ConnectionState::kOpen || !conn_.has_data_to_send();
+  }
+  void await_suspend(std::coroutine_handle<> h) { conn_.await_drain(CoroResume(h)); }
+  expected<void, ErrorCode> await_resume() const {
+    if (conn_.get_state() == ConnectionState::kOpen && conn_.async_error() == ErrorCode::kOk)
+      return expected<void, ErrorCode>::success();
+    return expected<void, ErrorCode>::error(ErrorCode::kConnectionClosed);
   }
-  if (removed > 0)
-    stats_.active_connections.fetch_sub(removed, std::memory_order_relaxed);
-}
 
-inline void Server::apply_tcp_tuning(int fd) {
-  int opt = 1;
-  if (tcp_tuning_.tcp_nodelay)
-    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
-#ifdef TCP_QUICKACK
-  if (tcp_tuning_.tcp_quickack)
-    setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &opt, sizeof(opt));
-#endif
-  if (tcp_tuning_.so_keepalive) {
-    setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &opt, sizeof(opt));
-#ifdef TCP_KEEPIDLE
-    setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE,
-               &tcp_tuning_.keepalive_idle_s, sizeof(tcp_tuning_.keepalive_idle_s));
-#endif
-#ifdef TCP_KEEPINTVL
-    setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL,
-               &tcp_tuning_.keepalive_interval_s, sizeof(tcp_tuning_.keepalive_interval_s));
-#endif
-#ifdef TCP_KEEPCNT
-    setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT,
-               &tcp_tuning_.keepalive_count, sizeof(tcp_tuning_.keepalive_count));
-#endif
+ private:
+  Connection& conn_;
+};
+
+// co_await sleep_for(d): resumed by the current thread's reactor timer queue. Started from
+// a connection's callback or coroutine, the sleep is tracked by that connection.
+class SleepAwaiter {
+ public:
+  explicit SleepAwaiter(std::chrono::microseconds delay) : delay_(delay) {}
+  SleepAwaiter(const SleepAwaiter&) = delete;
+  SleepAwaiter& operator=(const SleepAwaiter&) = delete;
+  ~SleepAwaiter() { sleeper_.unlink(); }
+
+  // Runs inline when the timer queue is full
+  bool await_ready() const noexcept {
+    return delay_.count() <= 0 || TimerQueue::current() == nullptr || TimerQueue::current()->full();
   }
-}
+  void await_suspend(std::coroutine_handle<> h) {
+    sleeper_.queue = TimerQueue::current();
+    sleeper_.timer = sleeper_.queue->schedule(delay_, [this, r = CoroResume(h)]() {
+      Connection* conn = sleeper_.owner;
+      sleeper_.unlink();
+      Connection* prev = std::exchange(Connection::current(), conn);
+      r();
+      Connection::current() = prev;
+    });
+    if (Connection::current() != nullptr) sleeper_.link(*Connection::current());
+  }
+  void await_resume() const noexcept {}
 
-inline void Server::log_info(const std::string& msg) {
-  std::cout << "[EWSS INFO] " << msg << std::endl;
-}
+ private:
+  std::chrono::microseconds delay_;
+  Connection::Sleeper sleeper_;
+};
 
-inline void Server::log_error(const std::string& msg) {
-  std::cerr << "[EWSS ERROR] " << msg << std::endl;
+inline SleepAwaiter sleep_for(std::chrono::microseconds delay) { return SleepAwaiter(delay); }
+
+inline RecvAwaiter Connection::recv() { return RecvAwaiter(*this); }
+
+inline DrainAwaiter Connection::send_and_drain(std::string_view payload, bool binary) {
+  return DrainAwaiter(*this, payload, binary);
 }
 
+#endif  // EWSS_HAS_COROUTINES
+
 }  // namespace ewss
 
+// Replacement global allocation functions reporting to AllocationGuard. Define
+// EWSS_ALLOCATION_GUARD_IMPL in exactly one translation unit of the program.
+#ifdef EWSS_ALLOCATION_GUARD_IMPL
+namespace ewss::detail {
+// Out of line so inlined deletes do not look like free() of operator new memory
+#if defined(__GNUC__)
+__attribute__((noinline))
+#endif
+void guard_free(void* p) noexcept { std::free(p); }
+}  // namespace ewss::detail
+
+void* operator new(std::size_t n) {
+  ewss::AllocationGuard::on_allocation(n);
+  void* p = std::malloc(n > 0 ? n : 1);
+  if (p == nullptr) EWSS_THROW(std::bad_alloc());
+  return p;
+}
+void* operator new[](std::size_t n) { return ::operator new(n); }
+void* operator new(std::size_t n, std::align_val_t al) {
+  ewss::AllocationGuard::on_allocation(n);
+  size_t a = static_cast<size_t>(al);
+  void* p = std::aligned_alloc(a, (std::max<std::size_t>(n, 1) + a - 1) & ~(a - 1));
+  if (p == nullptr) EWSS_THROW(std::bad_alloc());
+  return p;
+}
+void* operator new[](std::size_t n, std::align_val_t al) { return ::operator new(n, al); }
+void operator delete(void* p) noexcept { ewss::detail::guard_free(p); }
+void operator delete[](void* p) noexcept { ewss::detail::guard_free(p); }
+void operator delete(void* p, std::size_t) noexcept { ewss::detail::guard_free(p); }
+void operator delete[](void* p, std::size_t) noexcept { ewss::detail::guard_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { ewss::detail::guard_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { ewss::detail::guard_free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { ewss::detail::guard_free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { ewss::detail::guard_free(p); }
+#endif  // EWSS_ALLOCATION_GUARD_IMPL
+
 #endif  // EWSS_HPP_
@@ -0,0 +1,179 @@
+#include "ewss.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+using namespace ewss;
+
+#if EWSS_HAS_COROUTINES
+
+namespace {
+
+// Open connection over a socketpair; the test plays the client on fds[1]
+struct LoopbackConn {
+  int fds[2] = {-1, -1};
+  std::shared_ptr<Connection> conn;
+
+  LoopbackConn() {
+    ::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds);
+    conn = std::make_shared<Connection>(fds[0]);
+    conn->transition_to_state(ConnectionState::kOpen);
+  }
+  ~LoopbackConn() { ::close(fds[1]); }
+
+  // Masked client frame -> server rx, then run the read path
+  void client_send(std::string_view text, ws::OpCode opcode = ws::OpCode::kText) {
+    uint8_t header[14];
+    size_t n = ws::encode_frame_header(header, opcode, text.size(), true);
+    const uint8_t mask[4] = {0, 0, 0, 0};
+    std::memcpy(header + n, mask, 4);
+    std::string frame(reinterpret_cast<const char*>(header), n + 4);
+    frame += text;
+    REQUIRE(::send(fds[1], frame.data(), frame.size(), 0) == static_cast<ssize_t>(frame.size()));
+    REQUIRE(conn->handle_read().has_value());
+  }
+
+  // Unframed payloads of everything the server has sent
+  std::vector<std::string> client_recv() {
+    while (conn->has_data_to_send()) REQUIRE(conn->handle_write_vectored().has_value());
+    std::string raw(65536, '\0');
+    ssize_t n = ::recv(fds[1], raw.data(), raw.size(), 0);
+    raw.resize(n > 0 ? static_cast<size_t>(n) : 0);
+    std::vector<std::string> out;
+    while (!raw.empty()) {
+      ws::FrameHeader h;
+      size_t hs = ws::parse_frame_header(raw, h);
+      REQUIRE(hs > 0);
+      out.push_back(raw.substr(hs, h.payload_len));
+      raw.erase(0, hs + h.payload_len);
+    }
+    return out;
+  }
+};
+
+Task echo_session(std::shared_ptr<Connection> conn, std::vector<std::string>* log) {
+  while (true) {
+    auto msg = co_await conn->recv();
+    if (!msg) {
+      log->push_back("closed");
+      co_return;
+    }
+    std::string text(msg.value());  // View dies at the next co_await
+    if (text == "nap") {
+      co_await sleep_for(std::chrono::milliseconds(5));
+      text = "woke";
+    }
+    auto drained = co_await conn->send_and_drain(text);
+    log->push_back(drained ? "sent:" + text : "drain-failed");
+  }
+}
+
+Task nap(std::shared_ptr<Connection> conn, int* woke) {
+  co_await sleep_for(std::chrono::milliseconds(5));
+  ++*woke;
+  conn->send("woke");
+}
+
+}  // namespace
+
+TEST_CASE("Coroutine recv/send_and_drain round trip", "[coro]") {
+  LoopbackConn lc;
+  std::vector<std::string> log;
+  size_t frames_before = CoroFramePool::instance().in_use();
+  echo_session(lc.conn, &log);
+  REQUIRE(CoroFramePool::instance().in_use() == frames_before + 1);
+  REQUIRE(CoroFramePool::instance().heap_fallbacks() == 0);
+
+  lc.client_send("one");
+  REQUIRE(log.empty());  // Suspended until tx_buffer_ drains
+  REQUIRE(lc.client_recv() == std::vector<std::string>{"one"});
+  REQUIRE(log == std::vector<std::string>{"sent:one"});
+
+  // Messages arriving while the task is not waiting stay queued in rx_buffer_
+  lc.client_send("two");
+  lc.client_send("three");
+  REQUIRE(lc.client_recv() == std::vector<std::string>{"two"});
+  lc.conn->resume_receiver();
+  REQUIRE(lc.client_recv() == std::vector<std::string>{"three"});
+  REQUIRE(log.size() == 3);
+
+  lc.conn->close();
+  REQUIRE(log.back() == "closed");
+  REQUIRE(CoroFramePool::instance().in_use() == frames_before);
+}
+
+TEST_CASE("Coroutine sleep_for resumes from the timer queue", "[coro]") {
+  LoopbackConn lc;
+  TimerQueue timers;
+  TimerQueue::current() = &timers;
+  std::vector<std::string> log;
+  echo_session(lc.conn, &log);
+
+  lc.client_send("nap");
+  REQUIRE(timers.size() == 1);
+  REQUIRE(lc.client_recv().empty());
+  timers.run_expired(TimerQueue::Clock::now() + std::chrono::milliseconds(10));
+  REQUIRE(lc.client_recv() == std::vector<std::string>{"woke"});
+  REQUIRE(log == std::vector<std::string>{"sent:woke"});
+
+  lc.conn->close();
+  TimerQueue::current() = nullptr;
+}
+
+TEST_CASE("Coroutine sleep_for pins its connection to the reactor", "[coro]") {
+  LoopbackConn lc;
+  TimerQueue timers;
+  TimerQueue::current() = &timers;
+  int woke = 0;
+  lc.conn->on_message = [&woke](const std::shared_ptr<Connection>& conn, std::string_view) { nap(conn, &woke); };
+  REQUIRE(lc.conn->is_migratable());
+
+  lc.client_send("go");
+  REQUIRE(timers.size() == 1);
+  REQUIRE_FALSE(lc.conn->is_migratable());
+  timers.run_expired(TimerQueue::Clock::now() + std::chrono::milliseconds(10));
+  REQUIRE(woke == 1);
+  REQUIRE(lc.conn->is_migratable());
+  REQUIRE(lc.client_recv() == std::vector<std::string>{"woke"});
+
+  lc.conn->close();
+  TimerQueue::current() = nullptr;
+}
+
+TEST_CASE("Coroutine frames suspended at shutdown are released", "[coro]") {
+  TimerQueue timers;
+  TimerQueue::current() = &timers;
+  size_t frames_before = CoroFramePool::instance().in_use();
+  std::weak_ptr<Connection> receiver, sleeper;
+  std::vector<std::string> log;
+  int woke = 0;
+  {
+    LoopbackConn a, b;
+    echo_session(a.conn, &log);  // Suspended in recv
+    b.conn->on_message = [&woke](const std::shared_ptr<Connection>& conn, std::string_view) { nap(conn, &woke); };
+    b.client_send("go");         // Suspended in sleep_for
+    REQUIRE(CoroFramePool::instance().in_use() == frames_before + 2);
+    receiver = a.conn;
+    sleeper = b.conn;
+
+    a.conn->release_coroutines();
+    b.conn->release_coroutines();
+    REQUIRE(timers.size() == 0);
+  }
+  REQUIRE(receiver.expired());
+  REQUIRE(sleeper.expired());
+  REQUIRE(CoroFramePool::instance().in_use() == frames_before);
+  REQUIRE(log.empty());  // Destroyed, not resumed
+  REQUIRE(woke == 0);
+  TimerQueue::current() = nullptr;
+}
+
+#else
+
+TEST_CASE("Coroutine API disabled below C++20", "[coro]") { REQUIRE(EWSS_HAS_COROUTINES == 0); }
+
+#endif  // EWSS_HAS_COROUTINES
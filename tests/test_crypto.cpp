@@ -86,6 +86,18 @@ TEST_CASE("Base64 decode all test vectors", "[crypto]") {
   }
 }
 
+TEST_CASE("Base64 decode into a memory resource", "[crypto]") {
+  AccountedResource resource;
+  auto decoded = Base64::decode("Zm9vYmFy", &resource);
+  REQUIRE(std::string(decoded.begin(), decoded.end()) == "foobar");
+  REQUIRE(resource.allocations() == 1);
+  REQUIRE(resource.bytes_in_use() == 6);
+
+  auto frame = ws::encode_frame(ws::OpCode::kText, "hi", false, &resource);
+  REQUIRE(frame == std::pmr::vector<uint8_t>({0x81, 0x02, 'h', 'i'}, &resource));
+  REQUIRE(resource.allocations() >= 2);
+}
+
 TEST_CASE("Base64 invalid input", "[crypto]") {
   // Odd-length input should return empty
   auto decoded = Base64::decode("abc");
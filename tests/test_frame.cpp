@@ -238,3 +238,209 @@ TEST_CASE("Unmask payload - roundtrip", "[frame]") {
   std::string result(data.begin(), data.end());
   REQUIRE(result == original);
 }
+
+TEST_CASE("Unmask copy - matches scalar for all lengths and phases", "[frame]") {
+  uint8_t mask_key[] = {0x37, 0xfa, 0x21, 0x3d};
+  std::vector<uint8_t> src(100);
+  for (size_t i = 0; i < src.size(); ++i) src[i] = static_cast<uint8_t>(i * 7 + 3);
+
+  for (size_t phase = 0; phase < 4; ++phase) {
+    for (size_t len = 0; len <= src.size(); ++len) {
+      std::vector<uint8_t> out(len);
+      ws::unmask_copy(out.data(), src.data(), len, mask_key, phase);
+      for (size_t i = 0; i < len; ++i) REQUIRE(out[i] == (src[i] ^ mask_key[(i + phase) % 4]));
+    }
+  }
+}
+
+TEST_CASE("Unmask copy - in place 'Hello'", "[frame]") {
+  uint8_t masked[] = {0x7f, 0x9f, 0x4d, 0x51, 0x58};
+  uint8_t mask_key[] = {0x37, 0xfa, 0x21, 0x3d};
+  ws::unmask_copy(masked, masked, sizeof(masked), mask_key);
+  REQUIRE(std::string(reinterpret_cast<const char*>(masked), sizeof(masked)) == "Hello");
+}
+
+// ============================================================================
+// SharedFrame
+// ============================================================================
+
+TEST_CASE("SharedFrame - encodes once and shares the bytes", "[frame]") {
+  SharedFrame f = SharedFrame::encode("news", "hello", ws::OpCode::kText);
+  REQUIRE(f);
+  REQUIRE(f.topic() == "news");
+  REQUIRE(f.use_count() == 1);
+
+  ws::FrameHeader header;
+  size_t header_size = ws::parse_frame_header(f.bytes(), header);
+  REQUIRE(header_size == 2);
+  REQUIRE(header.opcode == ws::OpCode::kText);
+  REQUIRE_FALSE(header.masked);
+  REQUIRE(f.bytes().substr(header_size) == "hello");
+
+  {
+    SharedFrame copy = f;
+    REQUIRE(copy.bytes().data() == f.bytes().data());
+    REQUIRE(f.use_count() == 2);
+  }
+  REQUIRE(f.use_count() == 1);
+
+  SharedFrame moved = std::move(f);
+  REQUIRE_FALSE(f);
+  REQUIRE(moved.use_count() == 1);
+
+  std::string big(70000, 'x');
+  SharedFrame large = SharedFrame::encode("", big, ws::OpCode::kBinary);
+  REQUIRE(ws::parse_frame_header(large.bytes(), header) == 10);
+  REQUIRE(header.payload_len == big.size());
+}
+
+TEST_CASE("Batch records - varint framing and protocol offers", "[frame]") {
+  std::string out;
+  batch::append_record(out, "hi", false);
+  REQUIRE(out.size() == 3);  // (2 << 1) fits one byte
+  REQUIRE(static_cast<uint8_t>(out[0]) == 4);
+  std::string big(100, 'b');
+  batch::append_record(out, big, true);
+  REQUIRE(out.size() == 3 + 2 + 100);  // (100 << 1 | 1) needs two bytes
+
+  std::string_view rest(out), msg;
+  bool binary = true;
+  size_t used = batch::parse_record(rest, msg, binary);
+  REQUIRE(used == 3);
+  REQUIRE(msg == "hi");
+  REQUIRE_FALSE(binary);
+  rest.remove_prefix(used);
+  REQUIRE(batch::parse_record(rest, msg, binary) == rest.size());
+  REQUIRE(msg == big);
+  REQUIRE(binary);
+
+  // Truncated payload, unterminated varint
+  REQUIRE(batch::parse_record(std::string_view(out).substr(0, 2), msg, binary) == 0);
+  REQUIRE(batch::parse_record("\x80\x80", msg, binary) == 0);
+
+  REQUIRE(ws::offers_protocol("chat, ewss.batch", batch::kProtocol));
+  REQUIRE(ws::offers_protocol("ewss.batch", batch::kProtocol));
+  REQUIRE_FALSE(ws::offers_protocol("ewss.batched, chat", batch::kProtocol));
+  REQUIRE_FALSE(ws::offers_protocol("", batch::kProtocol));
+
+  char response[320];
+  size_t n = ws::write_upgrade_response("dGhlIHNhbXBsZSBub25jZQ==", response, sizeof(response), batch::kProtocol);
+  REQUIRE(n > 0);
+  REQUIRE(ws::response_protocol(std::string_view(response, n)) == batch::kProtocol);
+  n = ws::write_upgrade_response("dGhlIHNhbXBsZSBub25jZQ==", response, sizeof(response));
+  REQUIRE(ws::response_protocol(std::string_view(response, n)).empty());
+}
+
+TEST_CASE("permessage-deflate - offer negotiation", "[frame]") {
+  deflate::Params p;
+  REQUIRE(deflate::parse_offer("permessage-deflate", p));
+  REQUIRE_FALSE(p.server_no_context_takeover);
+  REQUIRE(p.server_max_window_bits == 15);
+
+  REQUIRE(deflate::parse_offer("permessage-deflate; client_max_window_bits; server_max_window_bits=\"10\"", p));
+  REQUIRE(p.server_max_window_bits == 10);
+  REQUIRE(p.client_max_window_bits == 15);
+
+  // Unusable first offer falls through to the next one
+  REQUIRE(deflate::parse_offer("permessage-deflate; server_max_window_bits=8, permessage-deflate; "
+                               "client_no_context_takeover", p));
+  REQUIRE(p.client_no_context_takeover);
+  REQUIRE(p.server_max_window_bits == 15);
+  REQUIRE_FALSE(deflate::parse_offer("permessage-deflate; mystery", p));
+  REQUIRE_FALSE(deflate::parse_offer("x-webkit-deflate-frame", p));
+
+  p = deflate::Params{};
+  p.server_no_context_takeover = true;
+  p.server_max_window_bits = 12;
+  char out[128];
+  size_t n = deflate::write_response(p, out, sizeof(out));
+  REQUIRE(std::string_view(out, n) == "permessage-deflate; server_no_context_takeover; server_max_window_bits=12");
+  REQUIRE(deflate::write_response(p, out, 20) == 0);
+
+  char response[448];
+  n = ws::write_upgrade_response("dGhlIHNhbXBsZSBub25jZQ==", response, sizeof(response), {}, "permessage-deflate");
+  REQUIRE(std::string_view(response, n).find("\r\nSec-WebSocket-Extensions: permessage-deflate\r\n") !=
+          std::string_view::npos);
+}
+
+#if EWSS_HAS_DEFLATE
+TEST_CASE("permessage-deflate - codec roundtrip and limits", "[frame]") {
+  std::string msg;
+  for (int i = 0; i < 200; ++i) msg += "tick " + std::to_string(i % 10) + ";";
+
+  // Context takeover: the second copy of a message compresses to almost nothing
+  deflate::Compressor tx(15, 6);
+  deflate::Decompressor rx(15);
+  std::string first, second, text;
+  REQUIRE(tx.compress(msg, first, false));
+  REQUIRE(tx.compress(msg, second, false));
+  REQUIRE(second.size() < first.size());
+  REQUIRE(rx.decompress(first, text, 1 << 20, false).has_value());
+  REQUIRE(text == msg);
+  REQUIRE(rx.decompress(second, text, 1 << 20, false).has_value());
+  REQUIRE(text == msg);
+
+  // Shared frames carry RSV1 and decode without prior context
+  SharedFrame plain = SharedFrame::encode("t", msg, ws::OpCode::kText);
+  SharedFrame shared = deflate::compress_shared(plain, 15, 6);
+  REQUIRE(shared);
+  ws::FrameHeader header;
+  REQUIRE(ws::parse_frame_header(shared.bytes(), header) > 0);
+  REQUIRE(header.rsv1);
+  REQUIRE(header.opcode == ws::OpCode::kText);
+  REQUIRE(shared.topic() == "t");
+  deflate::Decompressor fresh(15);
+  REQUIRE(fresh.decompress(shared.payload(), text, 1 << 20, true).has_value());
+  REQUIRE(text == msg);
+
+  auto too_big = fresh.decompress(shared.payload(), text, 100, true);
+  REQUIRE_FALSE(too_big.has_value());
+  REQUIRE(too_big.get_error() == ErrorCode::kBufferFull);
+  auto corrupt = fresh.decompress("\xff\xff\xff\xff", text, 1 << 20, true);
+  REQUIRE_FALSE(corrupt.has_value());
+  REQUIRE(corrupt.get_error() == ErrorCode::kFrameParseError);
+}
+#endif
+
+TEST_CASE("Resume window - sequence numbers, bounds and coverage", "[frame]") {
+  ResumePolicy policy;
+  policy.window_messages = 4;
+  policy.window_bytes = 64;
+  ResumeSession session("tok", policy);
+  REQUIRE(session.next_seq() == 1);
+  REQUIRE(session.covers(0));  // Nothing sent yet
+  REQUIRE_FALSE(session.covers(1));
+
+  SharedFrame shared = SharedFrame::encode({}, "shared", ws::OpCode::kText);
+  for (int i = 0; i < 3; ++i) session.push(SharedFrame::encode({}, "m" + std::to_string(i), ws::OpCode::kText));
+  session.push(shared);
+  REQUIRE(shared.use_count() == 2);  // Retained by reference
+  REQUIRE(session.first_seq() == 1);
+  REQUIRE(session.next_seq() == 5);
+  REQUIRE(session.at(2).payload() == "m1");
+  REQUIRE(session.at(4).payload() == "shared");
+
+  // Count bound: the fifth frame evicts seq 1
+  session.push(SharedFrame::encode({}, "m4", ws::OpCode::kBinary));
+  REQUIRE(session.first_seq() == 2);
+  REQUIRE_FALSE(session.covers(0));
+  REQUIRE(session.covers(1));
+  REQUIRE(session.covers(5));
+
+  // Byte bound: a large frame keeps only itself
+  session.push(SharedFrame::encode({}, std::string(60, 'x'), ws::OpCode::kBinary));
+  REQUIRE(session.first_seq() == 6);
+  REQUIRE(session.retained_bytes() == 62);
+  REQUIRE(shared.use_count() == 1);
+
+  REQUIRE(ws::query_param("resume=abc&last_seq=12", "last_seq") == "12");
+  REQUIRE(ws::query_param("resume=abc&last_seq=12", "resume") == "abc");
+  REQUIRE(ws::query_param("resumed=1", "resume").empty());
+  uint64_t seq = 7;
+  REQUIRE(ws::parse_u64("18446744073709551615", seq));
+  REQUIRE(seq == UINT64_MAX);
+  for (const char* bad : {"", "1a2", "-1", "+3", "18446744073709551616", "99999999999999999999"})
+    REQUIRE_FALSE(ws::parse_u64(bad, seq));
+  REQUIRE(seq == UINT64_MAX);  // Left untouched on failure
+  REQUIRE(SharedFrame::copy_of(shared.bytes()).payload() == "shared");
+}
@@ -1,3 +1,5 @@
+// This binary also checks the static-memory heap guard
+#define EWSS_ALLOCATION_GUARD_IMPL
 #include "ewss.hpp"
 
 #include <cstring>
@@ -6,9 +8,14 @@
 #include <atomic>
 #include <catch2/catch_test_macros.hpp>
 #include <chrono>
+#include <linux/sockios.h>
+#include <memory>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <string>
 #include <string_view>
+#include <sys/ioctl.h>
+#include <sys/prctl.h>
 #include <sys/socket.h>
 #include <thread>
 #include <unistd.h>
@@ -38,10 +45,14 @@ class WsTestClient {
       fd_ = -1;
       return false;
     }
+    // Header and payload go out in separate sends; don't let Nagle hold the second one
+    int one = 1;
+    setsockopt(fd_, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
     return true;
   }
 
-  bool handshake(int timeout_ms = 2000) {
+  bool handshake(int timeout_ms = 2000, const std::string& path = "/", const std::string& protocols = "",
+                 const std::string& extensions = "") {
     // Set receive timeout for handshake
     struct timeval tv;
     tv.tv_sec = timeout_ms / 1000;
@@ -52,13 +63,15 @@ class WsTestClient {
     const char* client_key = "dGhlIHNhbXBsZSBub25jZQ==";
 
     std::string request =
-        "GET / HTTP/1.1\r\n"
+        "GET " + path + " HTTP/1.1\r\n"
         "Host: localhost\r\n"
         "Upgrade: websocket\r\n"
         "Connection: Upgrade\r\n"
         "Sec-WebSocket-Version: 13\r\n"
         "Sec-WebSocket-Key: ";
     request += client_key;
+    if (!protocols.empty()) request += "\r\nSec-WebSocket-Protocol: " + protocols;
+    if (!extensions.empty()) request += "\r\nSec-WebSocket-Extensions: " + extensions;
     request += "\r\n\r\n";
 
     if (!send_raw(request.data(), request.size()))
@@ -77,7 +90,13 @@ class WsTestClient {
         break;
     }
 
-    // Verify 101 status
+    // Verify 101 status; bytes past the header are the first frames
+    const char* end = strstr(buf, "\r\n\r\n");
+    if (end == nullptr)
+      return false;
+    size_t header_end = static_cast<size_t>(end - buf) + 4;
+    response_.assign(buf, header_end);
+    leftover_.assign(buf + header_end, total - header_end);
     return strstr(buf, "101") != nullptr;
   }
 
@@ -85,6 +104,9 @@ class WsTestClient {
 
   bool send_binary(const void* data, size_t len) { return send_frame(0x02, data, len); }
 
+  // Text frame with RSV1 set; payload is already deflated
+  bool send_compressed(std::string_view deflated) { return send_frame(0x41, deflated.data(), deflated.size()); }
+
   bool send_ping(std::string_view payload = "") { return send_frame(0x09, payload.data(), payload.size()); }
 
   bool send_close(uint16_t code = 1000) {
@@ -108,6 +130,7 @@ class WsTestClient {
       return {};
 
     uint8_t opcode = header[0] & 0x0F;
+    last_rsv1_ = (header[0] & 0x40) != 0;
     if (out_opcode)
       *out_opcode = opcode;
 
@@ -144,9 +167,16 @@ class WsTestClient {
   }
 
   int fd() const { return fd_; }
+  // Raw HTTP response to the last handshake
+  const std::string& response() const { return response_; }
+  // RSV1 (compressed) bit of the last received frame
+  bool last_rsv1() const { return last_rsv1_; }
 
  private:
   int fd_ = -1;
+  bool last_rsv1_ = false;
+  std::string response_;
+  std::string leftover_;
 
   bool send_raw(const void* data, size_t len) {
     const uint8_t* p = static_cast<const uint8_t*>(data);
@@ -161,7 +191,9 @@ class WsTestClient {
   }
 
   bool recv_exact(uint8_t* buf, size_t len) {
-    size_t got = 0;
+    size_t got = std::min(len, leftover_.size());
+    std::memcpy(buf, leftover_.data(), got);
+    leftover_.erase(0, got);
     while (got < len) {
       ssize_t n = ::recv(fd_, buf + got, len - got, 0);
       if (n <= 0)
@@ -566,3 +598,1807 @@ TEST_CASE("Integration - Empty message", "[integration]") {
   client.send_close(1000);
   client.disconnect();
 }
+
+TEST_CASE("Integration - Stall watchdog flags slow handler", "[integration]") {
+  std::atomic<int> stall_count{0};
+  std::atomic<uint64_t> stall_conn{0};
+  std::atomic<int> stall_kind{-1};
+  std::atomic<uint64_t> conn_id{0};
+
+  ServerFixture fixture;
+  fixture.server.set_stall_budget_us(5000);
+  fixture.server.on_message = [&](const auto& conn, std::string_view msg) {
+    conn_id = conn->get_id();
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    conn->send(msg);
+  };
+  fixture.server.on_stall = [&](const ewss::StallInfo& info) {
+    ++stall_count;
+    stall_conn = info.conn_id;
+    stall_kind = static_cast<int>(info.kind);
+  };
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake());
+  REQUIRE(client.send_text("slow"));
+  REQUIRE(client.recv_frame() == "slow");
+
+  // Stall is reported when the next iteration begins
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  REQUIRE(stall_count.load() >= 1);
+  REQUIRE(stall_conn.load() == conn_id.load());
+  REQUIRE(stall_kind.load() == static_cast<int>(ewss::CallbackKind::kMessage));
+  REQUIRE(fixture.server.stats().max_callback_us.load() >= 20000);
+  REQUIRE(fixture.server.stats().loop_utilization() > 0.0);
+
+  client.send_close(1000);
+  client.disconnect();
+}
+
+TEST_CASE("Integration - IPC bridge echo", "[integration]") {
+  ewss::IpcChannel server_side;
+  REQUIRE(server_side.create(1 << 16).has_value());
+  ewss::IpcChannel app_side;
+  REQUIRE(app_side
+              .attach(::dup(server_side.memfd()), ::dup(server_side.to_app_fd()),
+                      ::dup(server_side.to_server_fd()))
+              .has_value());
+
+  ServerFixture fixture;
+  fixture.server.set_ipc_channel(&server_side);
+  fixture.start();
+
+  // Application "process": echo every message back through the command ring
+  std::atomic<bool> app_running{true};
+  std::atomic<int> opens{0};
+  std::atomic<int> closes{0};
+  std::thread app([&]() {
+    while (app_running) {
+      app_side.wait(20);
+      app_side.drain([&](const ewss::IpcChannel::Message& m) {
+        if (m.kind == ewss::IpcChannel::Kind::kOpen) ++opens;
+        if (m.kind == ewss::IpcChannel::Kind::kClose) ++closes;
+        if (m.kind == ewss::IpcChannel::Kind::kText) app_side.send(m.kind, m.conn_id, m.payload);
+      });
+    }
+  });
+
+  // Gone before the upgrade: the app never saw it open, so it must not see it close
+  WsTestClient dropped;
+  REQUIRE(dropped.connect(kTestPort));
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  dropped.disconnect();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake());
+  REQUIRE(client.send_text("via shared memory"));
+
+  uint8_t opcode = 0;
+  std::string reply = client.recv_frame(&opcode);
+  REQUIRE(opcode == 0x01);
+  REQUIRE(reply == "via shared memory");
+  REQUIRE(opens.load() == 1);
+
+  client.send_close(1000);
+  client.disconnect();
+  for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  app_running = false;
+  app.join();
+  fixture.stop();
+  REQUIRE(opens.load() == 1);
+  REQUIRE(closes.load() == 1);
+  REQUIRE(fixture.server.stats().ipc_messages_in.load() == 1);
+  REQUIRE(fixture.server.stats().ipc_dropped.load() == 0);
+}
+
+// ============================================================================
+// Bridge mode: raw TCP backend
+// ============================================================================
+
+struct TcpBackend {
+  int listen_fd = -1;
+  uint16_t port = 0;
+  std::thread thread;
+  std::atomic<bool> running{true};
+
+  // bulk == 0: echo; otherwise stream `bulk` bytes once the first upstream
+  // bytes arrive (so they never share a read with the client's 101 response)
+  explicit TcpBackend(size_t bulk = 0) {
+    listen_fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    addr.sin_port = 0;
+    ::bind(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    ::listen(listen_fd, 4);
+    socklen_t len = sizeof(addr);
+    ::getsockname(listen_fd, reinterpret_cast<struct sockaddr*>(&addr), &len);
+    port = ntohs(addr.sin_port);
+    thread = std::thread([this, bulk]() {
+      int fd = ::accept(listen_fd, nullptr, nullptr);
+      if (fd < 0) return;
+      struct timeval tv = {0, 50000};
+      setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+      char buf[4096];
+      std::vector<uint8_t> data(bulk);
+      for (size_t i = 0; i < bulk; ++i) data[i] = static_cast<uint8_t>(i * 31);
+      while (bulk > 0 && running && ::recv(fd, buf, sizeof(buf), 0) < 0) {
+      }
+      size_t off = 0;
+      while (off < bulk) {
+        ssize_t n = ::send(fd, data.data() + off, bulk - off, MSG_NOSIGNAL);
+        if (n <= 0) break;
+        off += static_cast<size_t>(n);
+      }
+      while (bulk == 0 && running) {
+        ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+        if (n == 0) break;
+        if (n > 0) ::send(fd, buf, static_cast<size_t>(n), MSG_NOSIGNAL);
+      }
+      ::close(fd);
+    });
+  }
+
+  ~TcpBackend() {
+    running = false;
+    ::shutdown(listen_fd, SHUT_RDWR);
+    if (thread.joinable()) thread.join();
+    ::close(listen_fd);
+  }
+};
+
+TEST_CASE("Integration - Bridge forwards both directions", "[integration]") {
+  TcpBackend backend;
+  ServerFixture fixture;
+  ewss::BridgeConfig cfg;
+  cfg.host = "127.0.0.1";
+  cfg.port = backend.port;
+  fixture.server.set_bridge(cfg);
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake());
+
+  std::string msg(300, 'q');
+  for (size_t i = 0; i < msg.size(); ++i) msg[i] = static_cast<char>('a' + i % 26);
+  REQUIRE(client.send_binary(msg.data(), msg.size()));
+
+  std::string got;
+  while (got.size() < msg.size()) {
+    uint8_t opcode = 0;
+    std::string part = client.recv_frame(&opcode);
+    REQUIRE(opcode == 0x02);
+    REQUIRE_FALSE(part.empty());
+    got += part;
+  }
+  REQUIRE(got == msg);
+  REQUIRE(fixture.server.stats().bridge_bytes_up.load() == msg.size());
+
+  client.send_close(1000);
+  client.disconnect();
+}
+
+TEST_CASE("Integration - Bridge bulk downstream", "[integration]") {
+  constexpr size_t kBulk = 200000;
+  TcpBackend backend(kBulk);
+  ServerFixture fixture;
+  ewss::BridgeConfig cfg;
+  cfg.host = "127.0.0.1";
+  cfg.port = backend.port;
+  fixture.server.set_bridge(cfg);
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake());
+  REQUIRE(client.send_text("go"));
+
+  std::string got;
+  while (got.size() < kBulk) {
+    uint8_t opcode = 0;
+    std::string part = client.recv_frame(&opcode);
+    REQUIRE(opcode == 0x02);
+    REQUIRE_FALSE(part.empty());
+    got += part;
+  }
+  REQUIRE(got.size() == kBulk);
+  bool intact = true;
+  for (size_t i = 0; i < kBulk; ++i) intact = intact && static_cast<uint8_t>(got[i]) == static_cast<uint8_t>(i * 31);
+  REQUIRE(intact);
+  REQUIRE(fixture.server.stats().bridge_bytes_down.load() == kBulk);
+  REQUIRE(fixture.server.stats().bridge_spliced_bytes.load() > 0);
+
+  client.send_close(1000);
+  client.disconnect();
+}
+
+// ============================================================================
+// Path routing
+// ============================================================================
+
+TEST_CASE("Integration - Routes select handler set by path", "[integration]") {
+  ServerFixture fixture;
+  ewss::Route chat;
+  chat.path = "/chat";
+  chat.on_message = [](const auto& conn, std::string_view msg) { conn->send("chat:" + std::string(msg)); };
+  ewss::Route api;
+  api.path = "/api/*";
+  api.on_message = [](const auto& conn, std::string_view msg) {
+    conn->send(std::string(conn->path()) + ":" + std::string(msg));
+  };
+  fixture.server.add_route(chat).add_route(api);
+  fixture.start();
+
+  WsTestClient c1;
+  REQUIRE(c1.connect(kTestPort));
+  REQUIRE(c1.handshake(2000, "/chat?room=1"));
+  REQUIRE(c1.send_text("hi"));
+  REQUIRE(c1.recv_frame() == "chat:hi");
+
+  WsTestClient c2;
+  REQUIRE(c2.connect(kTestPort));
+  REQUIRE(c2.handshake(2000, "/api/v1/orders"));
+  REQUIRE(c2.send_text("x"));
+  REQUIRE(c2.recv_frame() == "/api/v1/orders:x");
+
+  WsTestClient c3;
+  REQUIRE(c3.connect(kTestPort));
+  REQUIRE_FALSE(c3.handshake(2000, "/nope"));
+  REQUIRE(c3.response().find("404") != std::string::npos);
+  REQUIRE(fixture.server.stats().route_rejects.load() == 1);
+  REQUIRE(fixture.server.stats().handshake_errors.load() == 1);
+
+  c1.send_close(1000);
+  c2.send_close(1000);
+}
+
+TEST_CASE("Integration - Route limits", "[integration]") {
+  ServerFixture fixture;
+  ewss::Route small;
+  small.path = "/small";
+  small.on_message = [](const auto& conn, std::string_view msg) { conn->send(msg); };
+  small.limits.max_message_size = 16;
+  small.limits.max_connections = 1;
+  fixture.server.add_route(small);
+  fixture.start();
+
+  WsTestClient c1;
+  REQUIRE(c1.connect(kTestPort));
+  REQUIRE(c1.handshake(2000, "/small"));
+  REQUIRE(c1.send_text("short"));
+  REQUIRE(c1.recv_frame() == "short");
+
+  // Route is full
+  WsTestClient c2;
+  REQUIRE(c2.connect(kTestPort));
+  REQUIRE_FALSE(c2.handshake(2000, "/small"));
+  REQUIRE(c2.response().find("503") != std::string::npos);
+  REQUIRE(fixture.server.stats().handshake_errors.load() == 1);
+
+  // Oversized message closes with 1009
+  REQUIRE(c1.send_text(std::string(64, 'x')));
+  uint8_t opcode = 0;
+  std::string close_payload = c1.recv_frame(&opcode);
+  REQUIRE(opcode == 0x08);
+  REQUIRE(close_payload.size() == 2);
+  REQUIRE(((static_cast<uint8_t>(close_payload[0]) << 8) | static_cast<uint8_t>(close_payload[1])) == 1009);
+}
+
+// ============================================================================
+// RPC
+// ============================================================================
+
+namespace {
+
+std::string rpc_envelope(ewss::rpc::MsgType type, uint16_t method, uint32_t id, std::string_view payload) {
+  uint8_t header[ewss::rpc::kHeaderSize];
+  ewss::rpc::encode_header(header, type, method, id);
+  return std::string(reinterpret_cast<const char*>(header), sizeof(header)) + std::string(payload);
+}
+
+}  // namespace
+
+TEST_CASE("Integration - RPC pipelined out-of-order replies", "[integration]") {
+  ServerFixture fixture;
+  ewss::RpcDispatcher dispatcher;
+  // Method 1 answers immediately, method 2 after a reactor timer
+  dispatcher.on(1, [](const ewss::RpcRequest& req) {
+    req.conn->rpc()->reply(*req.conn, req.correlation_id, req.payload);
+  });
+  dispatcher.on(2, [&fixture](const ewss::RpcRequest& req) {
+    fixture.server.timers().schedule(std::chrono::milliseconds(50), [conn = req.conn, id = req.correlation_id]() {
+      conn->rpc()->reply(*conn, id, "slow");
+    });
+  });
+  fixture.server.set_rpc(&dispatcher);
+  std::string plain;
+  fixture.server.on_message = [&plain](const auto&, std::string_view msg) { plain = std::string(msg); };
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake(2000, "/", "ewss.rpc"));
+  REQUIRE(client.response().find("Sec-WebSocket-Protocol: ewss.rpc\r\n") != std::string::npos);
+
+  std::string slow = rpc_envelope(ewss::rpc::MsgType::kRequest, 2, 100, "");
+  std::string fast = rpc_envelope(ewss::rpc::MsgType::kRequest, 1, 101, "fast");
+  REQUIRE(client.send_binary(slow.data(), slow.size()));
+  REQUIRE(client.send_binary(fast.data(), fast.size()));
+
+  ewss::rpc::Envelope env;
+  std::string first = client.recv_frame();
+  REQUIRE(ewss::rpc::parse(first, env));
+  REQUIRE(env.correlation_id == 101);
+  REQUIRE(env.payload == "fast");
+
+  std::string second = client.recv_frame();
+  REQUIRE(ewss::rpc::parse(second, env));
+  REQUIRE(env.type == ewss::rpc::MsgType::kResponse);
+  REQUIRE(env.correlation_id == 100);
+  REQUIRE(env.payload == "slow");
+
+  // Text frames still reach on_message
+  REQUIRE(client.send_text("hello"));
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  REQUIRE(plain == "hello");
+
+  // Without the subprotocol, an envelope-shaped binary message is application data
+  WsTestClient other;
+  REQUIRE(other.connect(kTestPort));
+  REQUIRE(other.handshake());
+  REQUIRE(other.response().find("Sec-WebSocket-Protocol") == std::string::npos);
+  REQUIRE(other.send_binary(fast.data(), fast.size()));
+  for (int i = 0; i < 100 && plain != fast; ++i) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  REQUIRE(plain == fast);
+
+  client.send_close(1000);
+}
+
+TEST_CASE("Integration - RPC server-initiated call times out", "[integration]") {
+  ServerFixture fixture;
+  ewss::RpcDispatcher dispatcher;
+  fixture.server.set_rpc(&dispatcher);
+  std::atomic<int> status{-1};
+  fixture.server.on_connect = [&status](const auto& conn) {
+    conn->rpc()->call(*conn, 9, "who?", [&status](ewss::RpcStatus st, std::string_view) {
+      status = static_cast<int>(st);
+    }, 50);
+  };
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake(2000, "/", "ewss.rpc"));
+
+  ewss::rpc::Envelope env;
+  std::string req = client.recv_frame();
+  REQUIRE(ewss::rpc::parse(req, env));
+  REQUIRE(env.type == ewss::rpc::MsgType::kRequest);
+  REQUIRE(env.method == 9);
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(200));
+  REQUIRE(status.load() == static_cast<int>(ewss::RpcStatus::kTimeout));
+  client.send_close(1000);
+}
+
+TEST_CASE("Integration - Handshake stage feeds reactors", "[integration]") {
+  ewss::Server reactors[2];
+  std::atomic<int> opened{0};
+  for (auto& r : reactors) {
+    r.set_poll_timeout_ms(50);
+    r.on_connect = [&opened](const auto&) { ++opened; };
+    r.on_message = [](const auto& conn, std::string_view msg) { conn->send(msg); };
+  }
+  ewss::HandshakeStage stage(kTestPort);
+  stage.add_reactor(reactors[0]).add_reactor(reactors[1]);
+  std::thread t0([&]() { reactors[0].run(); });
+  std::thread t1([&]() { reactors[1].run(); });
+  stage.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    std::vector<std::unique_ptr<WsTestClient>> clients;
+    for (int i = 0; i < 4; ++i) {
+      clients.push_back(std::make_unique<WsTestClient>());
+      REQUIRE(clients.back()->connect(kTestPort));
+      REQUIRE(clients.back()->handshake());
+      REQUIRE(clients.back()->send_text("hi" + std::to_string(i)));
+      REQUIRE(clients.back()->recv_frame() == "hi" + std::to_string(i));
+    }
+    REQUIRE(stage.completed() == 4);
+    REQUIRE(opened.load() == 4);
+    // Least-loaded placement spreads live connections across both reactors
+    REQUIRE(reactors[0].stats().handoffs_accepted == 2);
+    REQUIRE(reactors[1].stats().handoffs_accepted == 2);
+
+    // Non-upgrade request is refused by the stage
+    WsTestClient bad;
+    REQUIRE(bad.connect(kTestPort));
+    const char req[] = "GET / HTTP/1.1\r\nHost: x\r\n\r\n";
+    REQUIRE(::send(bad.fd(), req, sizeof(req) - 1, 0) > 0);
+    char buf[64] = {};
+    REQUIRE(::recv(bad.fd(), buf, sizeof(buf) - 1, 0) > 0);
+    REQUIRE(std::string(buf).find("400") != std::string::npos);
+    REQUIRE(stage.failed() == 1);
+
+    for (auto& c : clients) c->send_close(1000);
+  }
+
+  stage.stop();
+  for (auto& r : reactors) r.stop();
+  t0.join();
+  t1.join();
+}
+
+TEST_CASE("Integration - Full reactor refuses a handoff with 503", "[integration]") {
+  ewss::Server reactor;
+  reactor.set_poll_timeout_ms(50).set_max_connections(1);
+  ewss::HandshakeStage stage(kTestPort);
+  stage.add_reactor(reactor);
+  std::thread t([&]() { reactor.run(); });
+  stage.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    WsTestClient first;
+    REQUIRE(first.connect(kTestPort));
+    REQUIRE(first.handshake());
+    REQUIRE(first.send_text("x"));
+
+    WsTestClient second;
+    REQUIRE(second.connect(kTestPort));
+    REQUIRE_FALSE(second.handshake());
+    REQUIRE(second.response().find("503") != std::string::npos);
+    REQUIRE(reactor.stats().rejected_connections == 1);
+    first.send_close(1000);
+  }
+
+  stage.stop();
+  reactor.stop();
+  t.join();
+}
+
+namespace {
+thread_local bool tl_on_reactor_b = false;  // Tags replies with the thread that sent them
+}
+
+TEST_CASE("Integration - Live migration between reactors", "[integration]") {
+  ewss::Server a(kTestPort);
+  ewss::Server b;
+  a.enable_handoff();
+  b.enable_handoff();
+  for (auto* r : {&a, &b}) r->set_poll_timeout_ms(50);
+  a.on_message = [&a, &b](const auto& conn, std::string_view msg) {
+    if (msg == "move") REQUIRE(a.migrate(conn->get_id(), b).has_value());
+    conn->send(std::string(msg) + (tl_on_reactor_b ? "@b" : "@a"));
+  };
+  std::thread ta([&]() { a.run(); });
+  std::thread tb([&]() { tl_on_reactor_b = true; b.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    // Handler-requested move: applied after the frame, then served by b
+    WsTestClient first;
+    REQUIRE(first.connect(kTestPort));
+    REQUIRE(first.handshake());
+    REQUIRE(first.send_text("move"));
+    REQUIRE(first.recv_frame() == "move@a");
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(first.send_text("x"));
+    REQUIRE(first.recv_frame() == "x@b");
+    REQUIRE(a.stats().migrations_out == 1);
+    REQUIRE(b.stats().migrations_in == 1);
+    REQUIRE(a.stats().active_connections == 0);
+    REQUIRE(b.stats().active_connections == 1);
+
+    // Cross-thread shed request
+    std::vector<std::unique_ptr<WsTestClient>> clients;
+    for (int i = 0; i < 3; ++i) {
+      clients.push_back(std::make_unique<WsTestClient>());
+      REQUIRE(clients.back()->connect(kTestPort));
+      REQUIRE(clients.back()->handshake());
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    a.shed(b, 2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    REQUIRE(a.stats().migrations_out == 3);
+    int on_b = 0;
+    for (auto& c : clients) {
+      REQUIRE(c->send_text("y"));
+      std::string reply = c->recv_frame();
+      REQUIRE((reply == "y@a" || reply == "y@b"));
+      on_b += reply == "y@b" ? 1 : 0;
+    }
+    REQUIRE(on_b == 2);
+
+    first.send_close(1000);
+    for (auto& c : clients) c->send_close(1000);
+  }
+
+  a.stop();
+  b.stop();
+  ta.join();
+  tb.join();
+}
+
+TEST_CASE("Integration - Rebalancer sheds from a saturated reactor", "[integration]") {
+  ewss::Server a(kTestPort);
+  ewss::Server b;
+  for (auto* r : {&a, &b}) r->set_poll_timeout_ms(50);
+  a.on_message = [](const auto& conn, std::string_view msg) {
+    // CPU-bound handler keeps the loop busy
+    auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(2);
+    while (std::chrono::steady_clock::now() < until) {
+    }
+    conn->send(msg);
+  };
+  ewss::RebalancePolicy policy;
+  policy.high = 0.5;
+  policy.gap = 0.3;
+  ewss::Rebalancer rebalancer(policy);
+  rebalancer.add_reactor(a).add_reactor(b);
+  std::thread ta([&]() { a.run(); });
+  std::thread tb([&]() { b.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    std::vector<std::unique_ptr<WsTestClient>> clients;
+    for (int i = 0; i < 4; ++i) {
+      clients.push_back(std::make_unique<WsTestClient>());
+      REQUIRE(clients.back()->connect(kTestPort));
+      REQUIRE(clients.back()->handshake());
+    }
+    rebalancer.tick();  // Baseline
+    // One request in flight per round trip, so Nagle never holds a send back
+    for (int round = 0; round < 20; ++round) {
+      for (auto& c : clients) {
+        REQUIRE(c->send_text("work"));
+        REQUIRE(c->recv_frame() == "work");
+      }
+    }
+    REQUIRE(rebalancer.utilization(0) < 0.5);
+    REQUIRE(rebalancer.tick() == 2);
+    REQUIRE(rebalancer.utilization(0) > rebalancer.utilization(1));
+    std::this_thread::sleep_for(std::chrono::milliseconds(150));
+    REQUIRE(b.stats().migrations_in == 2);
+    REQUIRE(a.stats().active_connections == 2);
+
+    // Migrated connections keep their handlers
+    for (auto& c : clients) {
+      REQUIRE(c->send_text("after"));
+      REQUIRE(c->recv_frame() == "after");
+    }
+    for (auto& c : clients) c->send_close(1000);
+  }
+
+  a.stop();
+  b.stop();
+  ta.join();
+  tb.join();
+}
+
+TEST_CASE("Integration - Reuseport CPU steering", "[integration]") {
+  // Loopback SYNs are processed on the sending CPU; pin the client there
+  cpu_set_t saved;
+  REQUIRE(pthread_getaffinity_np(pthread_self(), sizeof(saved), &saved) == 0);
+  cpu_set_t cpu0;
+  CPU_ZERO(&cpu0);
+  CPU_SET(0, &cpu0);
+  REQUIRE(pthread_setaffinity_np(pthread_self(), sizeof(cpu0), &cpu0) == 0);
+
+  ewss::Server a(kTestPort, "", true);
+  ewss::Server b(kTestPort, "", true);
+  a.set_cpu(0).set_poll_timeout_ms(50);
+  b.set_poll_timeout_ms(50);
+  REQUIRE(a.enable_cpu_steering(2).has_value());
+  REQUIRE_FALSE(ewss::Server().enable_cpu_steering(2).has_value());
+  std::thread ta([&]() { a.run(); });
+  std::thread tb([&]() { b.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    std::vector<std::unique_ptr<WsTestClient>> clients;
+    for (int i = 0; i < 4; ++i) {
+      clients.push_back(std::make_unique<WsTestClient>());
+      REQUIRE(clients.back()->connect(kTestPort));
+      REQUIRE(clients.back()->handshake());
+    }
+    // CPU 0 % 2 selects the first listener bound
+    REQUIRE(a.stats().total_connections == 4);
+    REQUIRE(b.stats().total_connections == 0);
+    REQUIRE(a.stats().incoming_cpu_local == 4);
+    REQUIRE(a.stats().cpu_locality() == 1.0);
+    for (auto& c : clients) c->send_close(1000);
+  }
+
+  a.stop();
+  b.stop();
+  ta.join();
+  tb.join();
+  pthread_setaffinity_np(pthread_self(), sizeof(saved), &saved);
+}
+
+TEST_CASE("Integration - Pub/sub fans out on each reactor", "[integration]") {
+  ewss::Server reactors[2];
+  ewss::PubSub hub;
+  for (auto& r : reactors) {
+    r.set_poll_timeout_ms(50);
+    r.on_message = [&r, &hub](const auto& conn, std::string_view msg) {
+      if (msg.substr(0, 4) == "sub:") {
+        r.subscribe(*conn, msg.substr(4));
+        conn->send("ok");
+      } else if (msg.substr(0, 6) == "unsub:") {
+        r.unsubscribe(*conn, msg.substr(6));
+        conn->send("ok");
+      } else {
+        hub.publish("chat", msg);  // Publishing from a reactor thread goes through the inboxes too
+      }
+    };
+    hub.add_reactor(r);
+  }
+  ewss::HandshakeStage stage(kTestPort);
+  stage.add_reactor(reactors[0]).add_reactor(reactors[1]);
+  std::thread t0([&]() { reactors[0].run(); });
+  std::thread t1([&]() { reactors[1].run(); });
+  stage.start();
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    std::vector<std::unique_ptr<WsTestClient>> clients;
+    for (int i = 0; i < 4; ++i) {
+      clients.push_back(std::make_unique<WsTestClient>());
+      REQUIRE(clients.back()->connect(kTestPort));
+      REQUIRE(clients.back()->handshake());
+    }
+    REQUIRE(hub.publish("news", "nobody") == 0);  // No subscribers anywhere yet
+
+    // Clients 0-2 subscribe; 0 and 2 share a reactor, 1 is on the other
+    for (int i = 0; i < 3; ++i) {
+      REQUIRE(clients[i]->send_text("sub:news"));
+      REQUIRE(clients[i]->recv_frame() == "ok");
+    }
+    REQUIRE(hub.publish("news", "headline") == 2);
+    for (int i = 0; i < 3; ++i) REQUIRE(clients[i]->recv_frame() == "headline");
+    REQUIRE(reactors[0].stats().pubsub_deliveries + reactors[1].stats().pubsub_deliveries == 3);
+
+    REQUIRE(clients[2]->send_text("unsub:news"));
+    REQUIRE(clients[2]->recv_frame() == "ok");
+    REQUIRE(clients[3]->send_text("sub:chat"));
+    REQUIRE(clients[3]->recv_frame() == "ok");
+    REQUIRE(hub.publish("news", "second", true) == 2);
+    REQUIRE(clients[0]->recv_frame() == "second");
+    REQUIRE(clients[1]->recv_frame() == "second");
+
+    // Client 2 gets nothing from news; a chat message from it reaches only client 3
+    REQUIRE(clients[2]->send_text("hi all"));
+    REQUIRE(clients[3]->recv_frame() == "hi all");
+    REQUIRE(clients[2]->send_text("sub:other"));
+    REQUIRE(clients[2]->recv_frame() == "ok");  // Nothing from news queued ahead of it
+    REQUIRE(reactors[0].stats().pubsub_dropped + reactors[1].stats().pubsub_dropped == 0);
+
+    for (auto& c : clients) c->send_close(1000);
+  }
+
+  stage.stop();
+  for (auto& r : reactors) r.stop();
+  t0.join();
+  t1.join();
+}
+
+TEST_CASE("Integration - Cluster relay between nodes", "[integration]") {
+  const std::string addr_a = "unix:/tmp/ewss_relay_test_a.sock";
+  ewss::Server ra(kTestPort);
+  ewss::Server rb(kTestPort + 1);
+  ewss::PubSub ha;
+  ewss::PubSub hb;
+  ha.add_reactor(ra);
+  hb.add_reactor(rb);
+
+  ewss::RelayConfig cfg_a;
+  cfg_a.node_id = 1;
+  cfg_a.listen = addr_a;
+  ewss::RelayConfig cfg_b;
+  cfg_b.node_id = 2;
+  cfg_b.peers = {addr_a, addr_a};  // Redundant links: every record arrives twice
+  ewss::ClusterRelay relay_a(ha, cfg_a);
+  ewss::ClusterRelay relay_b(hb, cfg_b);
+
+  for (auto* r : {&ra, &rb}) {
+    r->set_poll_timeout_ms(50);
+    ewss::ClusterRelay* relay = r == &ra ? &relay_a : &relay_b;
+    r->on_message = [r, relay](const auto& conn, std::string_view msg) {
+      if (msg.substr(0, 4) == "sub:") {
+        r->subscribe(*conn, msg.substr(4));
+        conn->send("ok");
+      } else {
+        relay->publish("news", msg);
+      }
+    };
+  }
+  REQUIRE(relay_a.start().has_value());
+  REQUIRE(relay_b.start().has_value());
+  std::thread ta([&]() { ra.run(); });
+  std::thread tb([&]() { rb.run(); });
+  for (int i = 0; i < 100 && relay_a.stats().links_up < 2; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  REQUIRE(relay_a.stats().links_up == 2);
+
+  {
+    WsTestClient ca;
+    WsTestClient cb;
+    REQUIRE(ca.connect(kTestPort));
+    REQUIRE(ca.handshake());
+    REQUIRE(cb.connect(kTestPort + 1));
+    REQUIRE(cb.handshake());
+    for (auto* c : {&ca, &cb}) {
+      REQUIRE(c->send_text("sub:news"));
+      REQUIRE(c->recv_frame() == "ok");
+    }
+
+    // Local delivery plus one hop to the other node, once despite two links
+    REQUIRE(cb.send_text("from-b"));
+    REQUIRE(cb.recv_frame() == "from-b");
+    REQUIRE(ca.recv_frame() == "from-b");
+    REQUIRE(ca.send_text("from-a"));
+    REQUIRE(ca.recv_frame() == "from-a");
+    REQUIRE(cb.recv_frame() == "from-a");
+
+    // A burst is batched into fewer writes and arrives in order
+    for (int i = 0; i < 50; ++i) REQUIRE(relay_b.publish("news", "m" + std::to_string(i)));
+    for (int i = 0; i < 50; ++i) REQUIRE(ca.recv_frame() == "m" + std::to_string(i));
+    for (int i = 0; i < 50; ++i) REQUIRE(cb.recv_frame() == "m" + std::to_string(i));
+    REQUIRE(relay_a.stats().records_in == 51);
+    REQUIRE(relay_a.stats().duplicates == 51);
+    REQUIRE(relay_b.stats().records_in == 1);
+    REQUIRE(relay_b.stats().batches_out < relay_b.stats().records_out);
+
+    // Records the receiver would refuse are refused here, and the links stay up
+    REQUIRE_FALSE(relay_b.publish(std::string(70000, 't'), "x"));
+    REQUIRE_FALSE(relay_b.publish("news", std::string(ewss::ClusterRelay::kMaxRecord, 'p')));
+    REQUIRE(relay_b.stats().oversize == 2);
+    REQUIRE(relay_b.publish("news", "after"));
+    REQUIRE(cb.recv_frame() == "after");
+    REQUIRE(ca.recv_frame() == "after");
+    REQUIRE(relay_a.stats().links_up == 2);
+
+    ca.send_close(1000);
+    cb.send_close(1000);
+  }
+
+  relay_a.stop();
+  relay_b.stop();
+  ra.stop();
+  rb.stop();
+  ta.join();
+  tb.join();
+}
+
+TEST_CASE("Integration - Shared read buffer", "[integration]") {
+  ServerFixture fixture;
+  fixture.server.set_shared_read_buffer(1024);
+  fixture.server.on_message = [](const auto& conn, std::string_view msg) {
+    if (msg == "probe") {
+      conn->send(conn->has_rx_buffer() ? "ring" : "none");
+      return;
+    }
+    conn->send(msg);
+  };
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake());
+
+  auto masked_frame = [](std::string_view text) {
+    std::string frame;
+    frame += static_cast<char>(0x81);
+    if (text.size() < 126) {
+      frame += static_cast<char>(0x80 | text.size());
+    } else {
+      frame += static_cast<char>(0x80 | 126);
+      frame += static_cast<char>(text.size() >> 8);
+      frame += static_cast<char>(text.size() & 0xFF);
+    }
+    const char mask[4] = {0x0A, 0x0B, 0x0C, 0x0D};
+    frame.append(mask, 4);
+    for (size_t i = 0; i < text.size(); ++i) frame += static_cast<char>(text[i] ^ mask[i % 4]);
+    return frame;
+  };
+
+  // Many frames in one segment, larger than the scratch buffer in total
+  std::string burst;
+  for (int i = 0; i < 40; ++i) burst += masked_frame("burst_" + std::to_string(i) + std::string(40, 'x'));
+  REQUIRE(::send(client.fd(), burst.data(), burst.size(), 0) == static_cast<ssize_t>(burst.size()));
+  for (int i = 0; i < 40; ++i) REQUIRE(client.recv_frame() == "burst_" + std::to_string(i) + std::string(40, 'x'));
+
+  // A frame split across reads is held in a ring until complete, then released
+  std::string big(2000, 'b');
+  std::string split = masked_frame(big);
+  REQUIRE(::send(client.fd(), split.data(), 700, 0) == 700);
+  std::this_thread::sleep_for(std::chrono::milliseconds(30));
+  REQUIRE(::send(client.fd(), split.data() + 700, split.size() - 700, 0) == static_cast<ssize_t>(split.size() - 700));
+  REQUIRE(client.recv_frame() == big);
+
+  std::string probe = masked_frame("probe");  // One segment: parsed straight from scratch
+  REQUIRE(::send(client.fd(), probe.data(), probe.size(), 0) == static_cast<ssize_t>(probe.size()));
+  REQUIRE(client.recv_frame() == "none");
+
+  client.send_close(1000);
+  client.disconnect();
+}
+
+TEST_CASE("Integration - Negotiated message batching", "[integration]") {
+  ServerFixture fixture;
+  ewss::BatchPolicy policy;
+  policy.delay_us = 20000;
+  policy.max_bytes = 1200;
+  fixture.server.set_batching(policy);
+  std::atomic<int> delivered{0};
+  fixture.server.on_message = [&delivered](const auto& conn, std::string_view msg) {
+    ++delivered;
+    if (conn->message_opcode() == ewss::ws::OpCode::kBinary)
+      conn->send_binary(msg);
+    else
+      conn->send(msg);
+  };
+  fixture.start();
+
+  // Without the offer the connection keeps plain frames
+  WsTestClient plain;
+  REQUIRE(plain.connect(kTestPort));
+  REQUIRE(plain.handshake());
+  REQUIRE(plain.response().find("Sec-WebSocket-Protocol") == std::string::npos);
+  REQUIRE(plain.send_text("solo"));
+  uint8_t opcode = 0;
+  REQUIRE(plain.recv_frame(&opcode) == "solo");
+  REQUIRE(opcode == 0x01);
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake(2000, "/", "chat, ewss.batch"));
+  REQUIRE(client.response().find("Sec-WebSocket-Protocol: ewss.batch\r\n") != std::string::npos);
+
+  // One client frame carrying 30 messages: each reaches on_message on its own
+  std::string batch;
+  for (int i = 0; i < 30; ++i) ewss::batch::append_record(batch, "update_" + std::to_string(i), i % 3 == 0);
+  REQUIRE(client.send_binary(batch.data(), batch.size()));
+
+  // Replies are packed together within the window
+  std::vector<std::pair<std::string, bool>> replies;
+  int frames = 0;
+  while (replies.size() < 30) {
+    std::string frame = client.recv_frame(&opcode);
+    REQUIRE(opcode == 0x02);
+    ++frames;
+    std::string_view rest(frame);
+    while (!rest.empty()) {
+      std::string_view msg;
+      bool binary = false;
+      size_t used = ewss::batch::parse_record(rest, msg, binary);
+      REQUIRE(used > 0);
+      replies.emplace_back(std::string(msg), binary);
+      rest.remove_prefix(used);
+    }
+  }
+  REQUIRE(delivered.load() == 31);
+  REQUIRE(frames == 1);
+  for (int i = 0; i < 30; ++i) {
+    REQUIRE(replies[static_cast<size_t>(i)].first == "update_" + std::to_string(i));
+    REQUIRE(replies[static_cast<size_t>(i)].second == (i % 3 == 0));
+  }
+
+  // Plain text frames are still single messages; the echo waits out the delay window
+  auto start = std::chrono::steady_clock::now();
+  REQUIRE(client.send_text("late"));
+  std::string frame = client.recv_frame(&opcode);
+  REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+  std::string_view msg;
+  bool binary = true;
+  REQUIRE(ewss::batch::parse_record(frame, msg, binary) == frame.size());
+  REQUIRE(msg == "late");
+  REQUIRE_FALSE(binary);
+
+  // A malformed batch closes with 1007
+  REQUIRE(client.send_binary("\xff", 1));
+  frame = client.recv_frame(&opcode);
+  REQUIRE(opcode == 0x08);
+  REQUIRE(frame.size() == 2);
+  REQUIRE(((static_cast<uint8_t>(frame[0]) << 8) | static_cast<uint8_t>(frame[1])) == 1007);
+  client.disconnect();
+  plain.disconnect();
+}
+
+TEST_CASE("Integration - Egress shaping keeps interactive latency under bulk load", "[integration]") {
+  constexpr uint64_t kRate = 256 * 1024;
+  ServerFixture fixture;
+  ewss::EgressPolicy policy;
+  policy.rate_bytes_per_sec = kRate;
+  policy.burst_bytes = 8192;
+  policy.quantum_bytes = 1500;
+  fixture.server.set_egress_limit(policy);
+  auto fill = [](const std::shared_ptr<ewss::Connection>& conn) {
+    while (!conn->is_write_paused() && conn->get_state() == ewss::ConnectionState::kOpen)
+      conn->send(std::string(1000, 'x'));
+  };
+  fixture.server.on_drain = fill;
+  fixture.server.on_message = [&fill](const auto& conn, std::string_view msg) {
+    if (msg == "bulk") {
+      conn->set_egress(1, 1);
+      fill(conn);
+    } else {
+      conn->set_egress(0, 8);
+      conn->send("pong");
+    }
+  };
+  fixture.start();
+
+  WsTestClient bulk;
+  REQUIRE(bulk.connect(kTestPort));
+  REQUIRE(bulk.handshake());
+  REQUIRE(bulk.send_text("bulk"));
+  std::atomic<bool> reading{true};
+  std::atomic<uint64_t> bulk_bytes{0};
+  std::thread reader([&]() {
+    char buf[16384];
+    while (reading.load()) {
+      ssize_t n = ::recv(bulk.fd(), buf, sizeof(buf), MSG_DONTWAIT);
+      if (n > 0)
+        bulk_bytes += static_cast<uint64_t>(n);
+      else
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+  });
+
+  WsTestClient interactive;
+  REQUIRE(interactive.connect(kTestPort));
+  REQUIRE(interactive.handshake());
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+  auto start = std::chrono::steady_clock::now();
+  auto worst = std::chrono::steady_clock::duration::zero();
+  for (int i = 0; i < 20; ++i) {
+    auto sent = std::chrono::steady_clock::now();
+    REQUIRE(interactive.send_text("ping"));
+    REQUIRE(interactive.recv_frame() == "pong");
+    worst = std::max(worst, std::chrono::steady_clock::now() - sent);
+    std::this_thread::sleep_for(std::chrono::milliseconds(25));
+  }
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  uint64_t bulk_before = bulk_bytes.load();
+  reading = false;
+  reader.join();
+
+  // Weighted DRR puts the small reply ahead of queued bulk quanta
+  REQUIRE(worst < std::chrono::milliseconds(60));
+  ewss::StatsSnapshot stats{};
+  fixture.server.stats().snapshot(stats);
+  REQUIRE(stats.egress_bytes[0] >= 20 * 6);
+  REQUIRE(stats.egress_bytes[1] > 0);
+  // Total egress stays within the bucket: rate * time + burst (plus the 100 ms warm-up)
+  uint64_t total = stats.egress_bytes[0] + stats.egress_bytes[1];
+  REQUIRE(total <= static_cast<uint64_t>(kRate * (elapsed + 0.3)) + policy.burst_bytes);
+  REQUIRE(bulk_before > kRate * elapsed / 4);
+  REQUIRE(stats.egress_throttled > 0);
+
+  interactive.disconnect();
+  bulk.disconnect();
+}
+
+#if EWSS_HAS_DEFLATE
+TEST_CASE("Integration - permessage-deflate compresses a broadcast once per window", "[integration]") {
+  ServerFixture fixture;
+  fixture.server.set_permessage_deflate(ewss::DeflatePolicy{});
+  fixture.server.on_message = [&fixture](const auto& conn, std::string_view msg) {
+    if (msg == "go") {
+      std::string doc;
+      for (int i = 0; i < 100; ++i) doc += "{\"price\":" + std::to_string(100 + i % 7) + ",\"sym\":\"EWSS\"},";
+      fixture.server.broadcast(doc);
+      return;
+    }
+    conn->send(msg);
+  };
+  fixture.start();
+
+  WsTestClient a, b, c, plain;
+  REQUIRE(a.connect(kTestPort));
+  REQUIRE(a.handshake(2000, "/", "", "permessage-deflate; client_max_window_bits"));
+  REQUIRE(a.response().find("Sec-WebSocket-Extensions: permessage-deflate; server_no_context_takeover\r\n") !=
+          std::string::npos);
+  REQUIRE(b.connect(kTestPort));
+  REQUIRE(b.handshake(2000, "/", "", "permessage-deflate"));
+  REQUIRE(c.connect(kTestPort));
+  REQUIRE(c.handshake(2000, "/", "", "x-webkit-deflate-frame, permessage-deflate; server_max_window_bits=10"));
+  REQUIRE(c.response().find("server_max_window_bits=10") != std::string::npos);
+  REQUIRE(plain.connect(kTestPort));
+  REQUIRE(plain.handshake());
+  REQUIRE(plain.response().find("Sec-WebSocket-Extensions") == std::string::npos);
+
+  // Compressed client message is inflated before on_message; short replies stay plain
+  std::string deflated;
+  ewss::deflate::Compressor client_tx(15, 6);
+  REQUIRE(client_tx.compress("hello", deflated, false));
+  REQUIRE(a.send_compressed(deflated));
+  REQUIRE(a.recv_frame() == "hello");
+  REQUIRE_FALSE(a.last_rsv1());
+
+  REQUIRE(plain.send_text("go"));
+  std::string expected = plain.recv_frame();
+  REQUIRE(expected.size() > 2000);
+  REQUIRE_FALSE(plain.last_rsv1());
+
+  for (WsTestClient* client : {&a, &b, &c}) {
+    std::string frame = client->recv_frame();
+    REQUIRE(client->last_rsv1());
+    REQUIRE(frame.size() < expected.size() / 4);
+    ewss::deflate::Decompressor inflater(15);
+    std::string text;
+    REQUIRE(inflater.decompress(frame, text, 1 << 20, true).has_value());
+    REQUIRE(text == expected);
+  }
+  REQUIRE(fixture.server.stats().deflate_shared_frames.load() == 2);  // 15-bit and 10-bit windows
+  REQUIRE(fixture.server.stats().deflate_shared_deliveries.load() == 3);
+
+  // RSV1 without the extension is a protocol error
+  REQUIRE(plain.send_compressed(deflated));
+  plain.recv_frame();
+  REQUIRE(plain.recv_frame().empty());
+}
+
+TEST_CASE("Integration - permessage-deflate with context takeover", "[integration]") {
+  ServerFixture fixture;
+  ewss::DeflatePolicy policy;
+  policy.server_no_context_takeover = false;
+  fixture.server.set_permessage_deflate(policy);
+  std::string doc;
+  for (int i = 0; i < 40; ++i) doc += "{\"seq\":" + std::to_string(i) + ",\"body\":\"context\"},";
+  fixture.server.on_message = [&fixture, &doc](const auto&, std::string_view) { fixture.server.broadcast(doc); };
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake(2000, "/", "", "permessage-deflate"));
+  REQUIRE(client.response().find("server_no_context_takeover") == std::string::npos);
+
+  // The second copy is compressed against the first: one inflater must keep its window
+  ewss::deflate::Decompressor inflater(15);
+  std::string frames[2], text;
+  for (auto& frame : frames) {
+    REQUIRE(client.send_text("again"));
+    frame = client.recv_frame();
+    REQUIRE(client.last_rsv1());
+    REQUIRE(inflater.decompress(frame, text, 1 << 20, false).has_value());
+    REQUIRE(text == doc);
+  }
+  REQUIRE(frames[1].size() < frames[0].size() / 2);
+  REQUIRE(fixture.server.stats().deflate_shared_frames.load() == 0);
+}
+#endif
+
+TEST_CASE("Integration - Traffic capture records delivered frames", "[integration]") {
+  std::string path = "/tmp/ewss_capture_int_" + std::to_string(::getpid()) + ".cap";
+  ewss::TrafficCapture capture;
+  REQUIRE(capture.open(path).has_value());
+  ServerFixture fixture;
+  fixture.server.set_capture(&capture);
+  fixture.server.on_message = [](const auto& conn, std::string_view msg) { conn->send(msg); };
+  fixture.start();
+
+  WsTestClient client;
+  REQUIRE(client.connect(kTestPort));
+  REQUIRE(client.handshake());
+  REQUIRE(client.send_text("first"));
+  REQUIRE(client.recv_frame() == "first");
+  const uint8_t bin[4] = {1, 2, 3, 4};
+  REQUIRE(client.send_binary(bin, sizeof(bin)));
+  REQUIRE(client.recv_frame().size() == 4);
+  REQUIRE(client.send_ping("p"));
+  REQUIRE(client.recv_frame() == "p");
+  REQUIRE(client.send_close(1000));
+  client.recv_frame();
+  fixture.stop();
+  capture.close();
+
+  ewss::CaptureReader reader;
+  REQUIRE(reader.open(path).has_value());
+  ewss::CapturedFrame f;
+  std::vector<ewss::ws::OpCode> opcodes;
+  uint64_t conn_id = 0;
+  while (reader.next(f)) {
+    if (conn_id == 0) conn_id = f.conn_id;
+    REQUIRE(f.conn_id == conn_id);
+    REQUIRE((f.flags & 0x80) != 0);  // FIN
+    opcodes.push_back(f.opcode());
+    if (opcodes.size() == 1) REQUIRE(f.payload == "first");
+  }
+  REQUIRE(opcodes == std::vector<ewss::ws::OpCode>{ewss::ws::OpCode::kText, ewss::ws::OpCode::kBinary,
+                                                   ewss::ws::OpCode::kPing, ewss::ws::OpCode::kClose});
+  ::unlink(path.c_str());
+}
+
+namespace {
+
+// "X-Ewss-Session: <token> <seq>" from a 101 response
+std::pair<std::string, uint64_t> session_header(const std::string& response) {
+  const std::string key = "X-Ewss-Session: ";
+  size_t pos = response.find(key);
+  if (pos == std::string::npos) return {"", 0};
+  size_t start = pos + key.size();
+  size_t space = response.find(' ', start);
+  size_t end = response.find("\r\n", start);
+  return {response.substr(start, space - start), std::stoull(response.substr(space + 1, end - space - 1))};
+}
+
+}  // namespace
+
+TEST_CASE("Integration - Session resumption resends only the gap", "[integration]") {
+  ServerFixture fixture;
+  ewss::ResumePolicy policy;
+  policy.window_messages = 8;
+  fixture.server.set_resumption(policy);
+  fixture.server.on_message = [&fixture](const auto& conn, std::string_view msg) {
+    if (msg.substr(0, 6) == "burst ") {
+      int n = std::stoi(std::string(msg.substr(6)));
+      for (int i = 0; i < n; ++i) conn->send("m" + std::to_string(i));
+    } else if (msg == "all") {
+      fixture.server.broadcast("news");
+    }
+  };
+  fixture.start();
+  auto wait_active = [&fixture](uint64_t n) {
+    for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != n; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    return fixture.server.stats().active_connections.load() == n;
+  };
+
+  WsTestClient a;
+  REQUIRE(a.connect(kTestPort));
+  REQUIRE(a.handshake());
+  auto [token, seq] = session_header(a.response());
+  REQUIRE(token.size() == 32);
+  REQUIRE(seq == 0);
+  REQUIRE(a.send_text("burst 5"));
+  for (int i = 0; i < 5; ++i) REQUIRE(a.recv_frame() == "m" + std::to_string(i));
+  a.disconnect();  // Dropped after processing only m0..m2 (seq 1..3)
+  REQUIRE(wait_active(0));
+
+  WsTestClient b;
+  REQUIRE(b.connect(kTestPort));
+  REQUIRE(b.handshake(2000, "/feed?resume=" + token + "&last_seq=3"));
+  REQUIRE(session_header(b.response()) == std::make_pair(token, uint64_t{3}));
+  REQUIRE(b.recv_frame() == "m3");
+  REQUIRE(b.recv_frame() == "m4");
+  REQUIRE(b.send_text("burst 1"));
+  REQUIRE(b.recv_frame() == "m0");  // seq 6
+
+  // Reconnecting while the old socket still looks alive takes the session over
+  WsTestClient c;
+  REQUIRE(c.connect(kTestPort));
+  REQUIRE(c.handshake(2000, "/?resume=" + token + "&last_seq=6"));
+  REQUIRE(session_header(c.response()).second == 6);
+  uint8_t opcode = 0;
+  b.recv_frame(&opcode);
+  REQUIRE(opcode == 0x08);
+  b.disconnect();
+  REQUIRE(c.send_text("all"));
+  REQUIRE(c.recv_frame() == "news");  // seq 7, shared with every session
+
+  // Unknown token, or a sequence already out of the window: fresh session
+  WsTestClient d;
+  REQUIRE(d.connect(kTestPort));
+  REQUIRE(d.handshake(2000, "/?resume=feedfeed&last_seq=3"));
+  auto fresh = session_header(d.response());
+  REQUIRE(fresh.first != token);
+  REQUIRE(fresh.second == 0);
+  WsTestClient malformed;  // "6x" must not read as 6
+  REQUIRE(malformed.connect(kTestPort));
+  REQUIRE(malformed.handshake(2000, "/?resume=" + token + "&last_seq=6x"));
+  REQUIRE(session_header(malformed.response()).first != token);
+  REQUIRE(c.send_text("burst 4"));  // seq 8..11: seq 1..3 leave the 8-frame window
+  for (int i = 0; i < 4; ++i) REQUIRE(c.recv_frame() == "m" + std::to_string(i));
+  c.disconnect();
+  REQUIRE(wait_active(2));
+  WsTestClient e;
+  REQUIRE(e.connect(kTestPort));
+  REQUIRE(e.handshake(2000, "/?resume=" + token + "&last_seq=2"));
+  REQUIRE(session_header(e.response()).first != token);
+
+  REQUIRE(fixture.server.stats().sessions_resumed.load() == 2);
+  REQUIRE(fixture.server.stats().resent_frames.load() == 2);
+  REQUIRE(fixture.server.stats().sessions_resume_missed.load() == 3);
+}
+
+TEST_CASE("Integration - Resumable session drains a gap larger than the tx buffer", "[integration]") {
+  ServerFixture fixture;
+  fixture.server.set_resumption(ewss::ResumePolicy{});
+  std::string big(3000, 'z');
+  fixture.server.on_message = [&big](const auto& conn, std::string_view) {
+    for (int i = 0; i < 20; ++i) conn->send(std::to_string(i) + big);
+  };
+  fixture.start();
+
+  WsTestClient a;
+  REQUIRE(a.connect(kTestPort));
+  REQUIRE(a.handshake());
+  std::string token = session_header(a.response()).first;
+  REQUIRE(a.send_text("go"));
+  for (int i = 0; i < 20; ++i) REQUIRE(a.recv_frame() == std::to_string(i) + big);
+  a.disconnect();
+  for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+  // 60 KB of gap through an 8 KB tx buffer, then new messages behind it
+  WsTestClient b;
+  REQUIRE(b.connect(kTestPort));
+  REQUIRE(b.handshake(2000, "/?resume=" + token + "&last_seq=0"));
+  REQUIRE(b.send_text("again"));
+  for (int round = 0; round < 2; ++round)
+    for (int i = 0; i < 20; ++i) REQUIRE(b.recv_frame() == std::to_string(i) + big);
+}
+
+TEST_CASE("Integration - Resumed gap drains without writev", "[integration]") {
+  ServerFixture fixture;
+  fixture.server.set_resumption(ewss::ResumePolicy{}).set_use_writev(false);
+  std::string big(3000, 'z');
+  fixture.server.on_message = [&big](const auto& conn, std::string_view) {
+    for (int i = 0; i < 20; ++i) conn->send(std::to_string(i) + big);
+  };
+  fixture.start();
+
+  WsTestClient a;
+  REQUIRE(a.connect(kTestPort));
+  REQUIRE(a.handshake());
+  std::string token = session_header(a.response()).first;
+  REQUIRE(a.send_text("go"));
+  for (int i = 0; i < 20; ++i) REQUIRE(a.recv_frame() == std::to_string(i) + big);
+  a.disconnect();
+  for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+  // Nothing new is sent: each write of the plain path must queue more of the gap
+  WsTestClient b;
+  REQUIRE(b.connect(kTestPort));
+  REQUIRE(b.handshake(2000, "/?resume=" + token + "&last_seq=0"));
+  for (int i = 0; i < 20; ++i) REQUIRE(b.recv_frame() == std::to_string(i) + big);
+}
+
+#if EWSS_HAS_DEFLATE
+TEST_CASE("Integration - Resumption requires the same deflate parameters", "[integration]") {
+  ServerFixture fixture;
+  fixture.server.set_resumption(ewss::ResumePolicy{}).set_permessage_deflate(ewss::DeflatePolicy{});
+  std::string doc;
+  for (int i = 0; i < 40; ++i) doc += "{\"seq\":" + std::to_string(i) + ",\"body\":\"retained\"},";
+  fixture.server.on_message = [&doc](const auto& conn, std::string_view) { conn->send(doc); };
+  fixture.start();
+  auto wait_active = [&fixture](uint64_t n) {
+    for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != n; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  };
+
+  WsTestClient a;
+  REQUIRE(a.connect(kTestPort));
+  REQUIRE(a.handshake(2000, "/", "", "permessage-deflate"));
+  std::string token = session_header(a.response()).first;
+  REQUIRE(a.send_text("go"));
+  a.recv_frame();
+  REQUIRE(a.last_rsv1());  // Retained compressed for a 15-bit window
+  a.disconnect();
+  wait_active(0);
+
+  // Without the extension, or with a smaller window, the retained frame is unreadable
+  for (const char* extensions : {"", "permessage-deflate; server_max_window_bits=10"}) {
+    WsTestClient b;
+    REQUIRE(b.connect(kTestPort));
+    REQUIRE(b.handshake(2000, "/?resume=" + token + "&last_seq=0", "", extensions));
+    REQUIRE(session_header(b.response()).first != token);
+    b.disconnect();
+    wait_active(0);
+  }
+  REQUIRE(fixture.server.stats().sessions_resume_missed.load() == 2);
+
+  WsTestClient c;
+  REQUIRE(c.connect(kTestPort));
+  REQUIRE(c.handshake(2000, "/?resume=" + token + "&last_seq=0", "", "permessage-deflate"));
+  REQUIRE(session_header(c.response()).first == token);
+  std::string frame = c.recv_frame();
+  REQUIRE(c.last_rsv1());
+  ewss::deflate::Decompressor inflater(15);
+  std::string text;
+  REQUIRE(inflater.decompress(frame, text, 1 << 20, true).has_value());
+  REQUIRE(text == doc);
+}
+#endif
+
+TEST_CASE("Integration - Detached sessions expire after linger", "[integration]") {
+  ServerFixture fixture;
+  ewss::ResumePolicy policy;
+  policy.linger_ms = 20;
+  fixture.server.set_resumption(policy);
+  fixture.start();
+
+  WsTestClient a;
+  REQUIRE(a.connect(kTestPort));
+  REQUIRE(a.handshake());
+  std::string token = session_header(a.response()).first;
+  a.disconnect();
+  for (int i = 0; i < 200 && fixture.server.stats().sessions_expired.load() == 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  REQUIRE(fixture.server.stats().sessions_expired.load() == 1);
+
+  WsTestClient b;
+  REQUIRE(b.connect(kTestPort));
+  REQUIRE(b.handshake(2000, "/?resume=" + token + "&last_seq=0"));
+  REQUIRE(session_header(b.response()).first != token);
+}
+
+namespace {
+
+// One HTTP response (head + Content-Length body) from fd; empty on EOF/timeout
+std::string recv_http(int fd, std::string& pending) {
+  char buf[4096];
+  while (true) {
+    size_t head_end = pending.find("\r\n\r\n");
+    if (head_end != std::string::npos) {
+      size_t len_pos = pending.find("Content-Length: ");
+      size_t body = len_pos < head_end ? std::stoul(pending.substr(len_pos + 16)) : 0;
+      size_t total = head_end + 4 + body;
+      if (pending.size() >= total) {
+        std::string out = pending.substr(0, total);
+        pending.erase(0, total);
+        return out;
+      }
+    }
+    ssize_t n = ::recv(fd, buf, sizeof(buf), 0);
+    if (n <= 0) return {};
+    pending.append(buf, static_cast<size_t>(n));
+  }
+}
+
+}  // namespace
+
+TEST_CASE("Integration - Plain HTTP health probes and static files", "[integration]") {
+  std::string path = "/tmp/ewss_http_test_" + std::to_string(::getpid()) + ".json";
+  std::string file_body(100000, 'j');
+  FILE* f = std::fopen(path.c_str(), "wb");
+  REQUIRE(f != nullptr);
+  std::fwrite(file_body.data(), 1, file_body.size(), f);
+  std::fclose(f);
+
+  ServerFixture fixture;
+  fixture.server.http().add_health("/healthz");
+  REQUIRE(fixture.server.http().add_file("/data.json", path).has_value());
+  REQUIRE_FALSE(fixture.server.http().add_file("/missing", path + ".none").has_value());
+  fixture.server.on_message = [](const auto& conn, std::string_view msg) { conn->send(msg); };
+  fixture.start();
+
+  WsTestClient probe;
+  REQUIRE(probe.connect(kTestPort));
+  struct timeval tv{2, 0};
+  setsockopt(probe.fd(), SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+  // Keep-alive: health, file (sendfile), HEAD and 404 pipelined on one socket
+  std::string reqs =
+      "GET /healthz HTTP/1.1\r\nHost: x\r\n\r\n"
+      "GET /data.json?v=1 HTTP/1.1\r\nHost: x\r\n\r\n"
+      "HEAD /data.json HTTP/1.1\r\nHost: x\r\n\r\n"
+      "GET /nope HTTP/1.1\r\nHost: x\r\n\r\n";
+  REQUIRE(::send(probe.fd(), reqs.data(), reqs.size(), 0) == static_cast<ssize_t>(reqs.size()));
+  std::string pending;
+  std::string r = recv_http(probe.fd(), pending);
+  REQUIRE(r.substr(0, 15) == "HTTP/1.1 200 OK");
+  REQUIRE(r.substr(r.size() - 6) == "\r\n\r\nOK");
+  REQUIRE(r.find("Connection: close") == std::string::npos);
+  r = recv_http(probe.fd(), pending);
+  REQUIRE(r.find("Content-Type: application/json") != std::string::npos);
+  REQUIRE(r.substr(r.find("\r\n\r\n") + 4) == file_body);
+  // HEAD: length advertised, no body (recv_http would wait for it, so parse by hand)
+  while (pending.find("Not Found") == std::string::npos) {
+    char buf[1024];
+    ssize_t n = ::recv(probe.fd(), buf, sizeof(buf), 0);
+    REQUIRE(n > 0);
+    pending.append(buf, static_cast<size_t>(n));
+  }
+  REQUIRE(pending.find("HTTP/1.1 200 OK\r\n") == 0);
+  REQUIRE(pending.find("Content-Length: 100000") != std::string::npos);
+  REQUIRE(pending.find("HTTP/1.1 404 Not Found") != std::string::npos);
+
+  // Connection: close is honoured
+  std::string last = "GET /healthz HTTP/1.1\r\nConnection: close\r\n\r\n";
+  REQUIRE(::send(probe.fd(), last.data(), last.size(), 0) == static_cast<ssize_t>(last.size()));
+  pending.clear();
+  r = recv_http(probe.fd(), pending);
+  REQUIRE(r.find("Connection: close") != std::string::npos);
+  char byte;
+  REQUIRE(::recv(probe.fd(), &byte, 1, 0) == 0);
+
+  // Upgrades on the same port are unaffected
+  WsTestClient ws;
+  REQUIRE(ws.connect(kTestPort));
+  REQUIRE(ws.handshake());
+  REQUIRE(ws.send_text("hi"));
+  REQUIRE(ws.recv_frame() == "hi");
+
+  REQUIRE(fixture.server.stats().http_requests.load() == 5);
+  REQUIRE(fixture.server.stats().http_not_found.load() == 1);
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("Integration - Connections allocate from the server's memory resource", "[integration]") {
+  ewss::AccountedResource resource;
+  ewss::RpcDispatcher dispatcher;
+  ServerFixture fixture;
+  fixture.server.set_memory_resource(&resource).set_shared_read_buffer(32768);
+  fixture.server.set_rpc(&dispatcher);
+#if EWSS_HAS_DEFLATE
+  fixture.server.set_permessage_deflate({});
+#endif
+  fixture.server.on_message = [&fixture](const auto& conn, std::string_view msg) {
+    fixture.server.subscribe(*conn, "news");
+    conn->send(msg);
+  };
+  REQUIRE(resource.bytes_in_use() >= 32768);
+  size_t idle = resource.bytes_in_use();
+  fixture.start();
+
+  {
+    // Connection, rx ring, RPC and deflate state, subscription and topic index
+    WsTestClient client;
+    REQUIRE(client.connect(kTestPort));
+    REQUIRE(client.handshake(2000, "/", "ewss.rpc", "permessage-deflate"));
+    REQUIRE(client.send_text("hello"));
+    REQUIRE(client.recv_frame() == "hello");
+    REQUIRE(fixture.server.subscriber_count("news") == 1);
+    REQUIRE(resource.bytes_in_use() >= idle + sizeof(ewss::Connection) + sizeof(ewss::RpcSession));
+    REQUIRE(fixture.server.stats().mem_allocations.load() >= 5);
+  }
+  for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != 0; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  fixture.stop();
+  REQUIRE(resource.bytes_in_use() <= idle + ewss::ScratchArena::kDefaultSize);
+  REQUIRE(fixture.server.stats().mem_peak_bytes.load() == resource.peak_bytes());
+}
+
+TEST_CASE("Integration - Static memory mode serves without touching the heap", "[integration]") {
+  ServerFixture fixture;
+  ewss::StaticMemoryPolicy policy;
+  policy.connections = 8;
+  policy.read_buffer_bytes = 32768;
+  policy.scratch_bytes = 4096;
+  REQUIRE(fixture.server.reserve_static_memory(policy).has_value());
+  REQUIRE_FALSE(fixture.server.reserve_static_memory(policy).has_value());
+  REQUIRE(fixture.server.static_pool()->reserved_bytes() >= 32768 + 4096 + 8 * sizeof(ewss::Connection));
+  // RPC sessions have their own slab; deflate is declined rather than allocating zlib state
+  ewss::RpcDispatcher dispatcher;
+  fixture.server.set_rpc(&dispatcher);
+#if EWSS_HAS_DEFLATE
+  fixture.server.set_permessage_deflate({});
+#endif
+  ewss::AllocationGuard::fatal() = false;  // Count instead of aborting
+  std::atomic<bool> allocate{false};
+  fixture.server.on_message = [&fixture, &allocate](const auto& conn, std::string_view msg) {
+    if (allocate.load()) {
+      std::string copy(1000, 'x');  // Heap: caught by the guard
+      conn->send(copy.substr(0, msg.size()));
+      return;
+    }
+    conn->send(fixture.server.scratch().format("echo %.*s", static_cast<int>(msg.size()), msg.data()));
+  };
+  fixture.start();
+
+  for (int round = 0; round < 3; ++round) {
+    WsTestClient clients[3];
+    for (auto& c : clients) {
+      REQUIRE(c.connect(kTestPort));
+      REQUIRE(c.handshake(2000, "/", "ewss.rpc", "permessage-deflate"));
+      REQUIRE(c.response().find("permessage-deflate") == std::string::npos);
+    }
+    for (auto& c : clients) REQUIRE(c.send_text("ping"));
+    for (auto& c : clients) REQUIRE(c.recv_frame() == "echo ping");
+    for (auto& c : clients) c.send_close(1000);
+    for (auto& c : clients) c.disconnect();
+    for (int i = 0; i < 200 && fixture.server.stats().active_connections.load() != 0; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  REQUIRE(fixture.server.stats().heap_after_start.load() == 0);
+  REQUIRE(fixture.server.stats().static_pool_fallbacks.load() == 0);
+
+  allocate = true;
+  WsTestClient c;
+  REQUIRE(c.connect(kTestPort));
+  REQUIRE(c.handshake());
+  REQUIRE(c.send_text("hey"));
+  REQUIRE(c.recv_frame() == "xxx");
+  std::this_thread::sleep_for(std::chrono::milliseconds(60));
+  REQUIRE(fixture.server.stats().heap_after_start.load() > 0);
+  fixture.stop();
+  ewss::AllocationGuard::fatal() = true;
+}
+
+TEST_CASE("Integration - Realtime profile applies to the reactor and is undone", "[integration]") {
+  int slack_before = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+  cpu_set_t affinity_before;
+  REQUIRE(sched_getaffinity(0, sizeof(affinity_before), &affinity_before) == 0);
+  int cpu = 0;  // First CPU the test may run on (CPU 0 can be outside a container's cpuset)
+  while (cpu < CPU_SETSIZE && !CPU_ISSET(cpu, &affinity_before)) ++cpu;
+  REQUIRE(cpu < CPU_SETSIZE);
+  {
+    ewss::RealtimePolicy policy;
+    policy.priority = 10;
+    policy.cpu = cpu;
+    policy.timer_slack_ns = 1000;
+    ewss::RealtimeScope scope(policy);
+    REQUIRE(sched_getcpu() == cpu);
+    int slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    if (scope.failures() == 0) {
+      REQUIRE((sched_getscheduler(0) & ~SCHED_RESET_ON_FORK) == SCHED_FIFO);
+      REQUIRE((slack == 1000 || slack == 0));  // Newer kernels force zero slack on RT threads
+    } else {  // Unprivileged: only SCHED_FIFO is refused (pinning to an allowed CPU succeeds)
+      REQUIRE(scope.failures() == 1);
+      REQUIRE(scope.first_errno() == EPERM);
+      REQUIRE(sched_getscheduler(0) == SCHED_OTHER);
+      REQUIRE(slack == 1000);
+    }
+  }
+  REQUIRE(sched_getscheduler(0) == SCHED_OTHER);
+  REQUIRE(prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0) == slack_before);
+  cpu_set_t affinity_after;
+  REQUIRE(sched_getaffinity(0, sizeof(affinity_after), &affinity_after) == 0);
+  REQUIRE(CPU_EQUAL(&affinity_before, &affinity_after));
+
+  ServerFixture fixture;
+  ewss::RealtimePolicy policy;
+  policy.timer_slack_ns = 2000;
+  fixture.server.set_realtime(policy);
+  std::atomic<int> reactor_slack{-1};
+  fixture.server.on_message = [&reactor_slack](const auto& conn, std::string_view msg) {
+    reactor_slack = prctl(PR_GET_TIMERSLACK, 0, 0, 0, 0);
+    conn->send(msg);
+  };
+  fixture.start();
+  WsTestClient c;
+  REQUIRE(c.connect(kTestPort));
+  REQUIRE(c.handshake());
+  REQUIRE(c.send_text("tick"));
+  REQUIRE(c.recv_frame() == "tick");
+  REQUIRE(reactor_slack.load() == 2000);
+  REQUIRE(fixture.server.stats().realtime_failures.load() == 0);
+  fixture.stop();
+}
+
+TEST_CASE("Integration - TCP_INFO sampling rotates through open connections", "[integration]") {
+  ServerFixture fixture;
+  fixture.server.set_tcp_info_sampling({5, 1});
+  fixture.server.on_message = [](const auto& conn, std::string_view) {
+    const ewss::TcpHealth& h = conn->tcp_health();
+    bool sampled = h.sampled_at != std::chrono::steady_clock::time_point{};
+    conn->send(sampled && h.rtt_us > 0 && h.snd_cwnd > 0 ? "healthy" : "unsampled");
+  };
+  fixture.start();
+
+  WsTestClient clients[3];
+  for (auto& c : clients) {
+    REQUIRE(c.connect(kTestPort));
+    REQUIRE(c.handshake());
+  }
+  // One connection per 5 ms batch: every connection is visited within a few sweeps
+  for (int i = 0; i < 200 && fixture.server.stats().tcp_info_samples.load() < 9; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+  REQUIRE(fixture.server.stats().tcp_info_samples.load() >= 9);
+  for (auto& c : clients) {
+    REQUIRE(c.send_text("health?"));
+    REQUIRE(c.recv_frame() == "healthy");
+  }
+  fixture.stop();
+
+  ewss::StatsSnapshot snap;
+  fixture.server.stats().snapshot(snap);
+  uint64_t rtt_samples = 0;
+  for (uint64_t n : snap.tcp_rtt_us) rtt_samples += n;
+  REQUIRE(rtt_samples == snap.tcp_info_samples);
+  REQUIRE(snap.tcp_retransmits == 0);  // Loopback
+}
+
+TEST_CASE("Integration - Kernel send queue target holds data in tx_buffer", "[integration]") {
+  constexpr uint32_t kTarget = 4096;
+  ServerFixture fixture;
+  fixture.server.set_kernel_queue_target(kTarget);
+  std::atomic<int> flooded{0};
+  std::atomic<int> unsent{-1};
+  std::atomic<size_t> held{0};
+  fixture.server.on_message = [&](const auto& conn, std::string_view) {
+    int queued = 0;
+    ioctl(conn->get_fd(), SIOCOUTQNSD, &queued);
+    unsent = queued;
+    held = conn->tx_buffer_usage();  // Left over from the previous flood
+    while (conn->tx_buffer_usage() + 1100 < ewss::Connection::kTxBufferSize) {
+      conn->send(std::string(1000, static_cast<char>('a' + flooded % 26)));
+      ++flooded;
+    }
+  };
+  fixture.start();
+
+  // The client does not read: its receive window closes, then the server's unsent queue
+  // reaches the target and the next flood finds the previous one still in tx_buffer
+  WsTestClient c;
+  REQUIRE(c.connect(kTestPort));
+  REQUIRE(c.handshake());
+  for (int i = 0; i < 1000 && held.load() == 0; ++i) {
+    REQUIRE(c.send_text("flood"));
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+  REQUIRE(held.load() > 0);
+  REQUIRE(unsent.load() <= static_cast<int>(kTarget));
+  REQUIRE(fixture.server.stats().send_queue_holds.load() > 0);
+
+  // Reading reopens the window: POLLOUT below the low-water mark releases the rest in order
+  for (int received = 0; received < flooded.load(); ++received)
+    REQUIRE(c.recv_frame() == std::string(1000, static_cast<char>('a' + received % 26)));
+  fixture.stop();
+}
+
+TEST_CASE("Integration - Kernel send queue target stays off without SIOCOUTQNSD", "[integration]") {
+  // AF_UNIX answers SIOCOUTQ but not SIOCOUTQNSD: no hold, or POLLOUT could never release it
+  int fds[2];
+  REQUIRE(::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) == 0);
+  {
+    auto conn = std::make_shared<ewss::Connection>(fds[0]);
+    conn->transition_to_state(ewss::ConnectionState::kOpen);
+    conn->set_kernel_queue_target(4096);
+    REQUIRE(conn->kernel_queue_target() == 0);
+    for (int i = 0; i < 4; ++i) {
+      conn->send(std::string(4000, 'q'));
+      REQUIRE(conn->handle_write_vectored().has_value());
+      REQUIRE_FALSE(conn->send_held());
+    }
+    REQUIRE(conn->tx_buffer_usage() == 0);
+  }
+  ::close(fds[1]);
+}
+
+TEST_CASE("Integration - on_backpressure may unsubscribe during a publish", "[integration]") {
+  ServerFixture fixture;
+  ewss::PubSub hub;
+  hub.add_reactor(fixture.server);
+  fixture.server.on_message = [&fixture](const auto& conn, std::string_view msg) {
+    if (msg == "sub") {
+      fixture.server.subscribe(*conn, "news");
+      conn->send("ok");
+    } else {
+      conn->send(std::to_string(fixture.server.subscriber_count("news")));
+    }
+  };
+  // A frame past the high watermark makes every subscriber drop out as it is reached
+  fixture.server.on_backpressure = [&fixture](const auto& conn) { fixture.server.unsubscribe(*conn, "news"); };
+  fixture.start();
+
+  WsTestClient clients[3];
+  for (auto& c : clients) {
+    REQUIRE(c.connect(kTestPort));
+    REQUIRE(c.handshake());
+    REQUIRE(c.send_text("sub"));
+    REQUIRE(c.recv_frame() == "ok");
+  }
+  const std::string big(ewss::Connection::kTxHighWatermark + 100, 'n');
+  REQUIRE(hub.publish("news", big) == 1);
+  for (auto& c : clients) REQUIRE(c.recv_frame() == big);
+  REQUIRE(clients[0].send_text("count"));
+  REQUIRE(clients[0].recv_frame() == "0");
+  REQUIRE(fixture.server.stats().pubsub_deliveries.load() == 3);
+  fixture.stop();
+}
+
+TEST_CASE("Integration - Failed migration keeps the connection's RPC session", "[integration]") {
+  ewss::Server a(kTestPort);
+  ewss::Server b;  // Never runs: its migrant inbox fills up
+  a.enable_handoff();
+  b.enable_handoff();
+  a.set_poll_timeout_ms(20);
+  b.set_max_connections(4 * ewss::Server::kMaxConnections);
+  ewss::RpcDispatcher dispatcher;
+  dispatcher.on(1, [](const ewss::RpcRequest& req) { req.conn->rpc()->reply(*req.conn, req.correlation_id, "pong"); });
+  a.set_rpc(&dispatcher);
+  std::thread ta([&]() { a.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    // Fill b's inbox in rounds that stay below a's overload threshold
+    std::vector<std::unique_ptr<WsTestClient>> fillers;
+    while (fillers.size() < ewss::Server::kMaxConnections) {
+      for (int i = 0; i < 8; ++i) {
+        fillers.push_back(std::make_unique<WsTestClient>());
+        REQUIRE(fillers.back()->connect(kTestPort));
+        REQUIRE(fillers.back()->handshake());
+      }
+      a.shed(b, 8);
+      for (int i = 0; i < 200 && a.stats().active_connections.load() != 0; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    REQUIRE(a.stats().migrations_out.load() == ewss::Server::kMaxConnections);
+
+    WsTestClient client;
+    REQUIRE(client.connect(kTestPort));
+    REQUIRE(client.handshake(2000, "/", "ewss.rpc"));
+    for (int i = 0; i < 200 && a.stats().active_connections.load() != 1; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    a.shed(b, 1);
+    for (int i = 0; i < 200 && a.stats().migration_failures.load() == 0; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    REQUIRE(a.stats().migration_failures.load() == 1);
+
+    std::string request = rpc_envelope(ewss::rpc::MsgType::kRequest, 1, 7, "ping");
+    REQUIRE(client.send_binary(request.data(), request.size()));
+    ewss::rpc::Envelope env;
+    std::string reply = client.recv_frame();
+    REQUIRE(ewss::rpc::parse(reply, env));
+    REQUIRE(env.type == ewss::rpc::MsgType::kResponse);
+    REQUIRE(env.correlation_id == 7);
+    REQUIRE(env.payload == "pong");
+  }
+
+  a.stop();
+  ta.join();
+}
+
+TEST_CASE("Integration - Migrants are routed by path on the target", "[integration]") {
+  ewss::Server a(kTestPort);
+  ewss::Server b;
+  a.enable_handoff();
+  b.enable_handoff();
+  for (auto* r : {&a, &b}) r->set_poll_timeout_ms(20);
+  // Different tables: "/chat" is index 1 on a and index 0 (one connection) on b
+  auto echo = [&a, &b](const std::shared_ptr<ewss::Connection>& conn, std::string_view msg) {
+    if (msg == "move") REQUIRE(a.migrate(conn->get_id(), b).has_value());
+    conn->send(std::string(msg) + (tl_on_reactor_b ? "@b" : "@a"));
+  };
+  ewss::Route route;
+  route.on_message = echo;
+  route.path = "/admin";
+  a.add_route(route);
+  route.path = "/chat";
+  a.add_route(route);
+  ewss::Route limited;
+  limited.path = "/chat";
+  limited.limits.max_connections = 1;
+  b.add_route(limited);
+  std::thread ta([&]() { a.run(); });
+  std::thread tb([&]() { tl_on_reactor_b = true; b.run(); });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+
+  {
+    WsTestClient clients[3];
+    const char* paths[3] = {"/chat", "/chat", "/admin"};
+    for (int i = 0; i < 3; ++i) {
+      REQUIRE(clients[i].connect(kTestPort));
+      REQUIRE(clients[i].handshake(2000, paths[i]));
+      REQUIRE(clients[i].send_text("move"));
+      REQUIRE(clients[i].recv_frame() == "move@a");
+      for (int t = 0; t < 200 && a.stats().migrations_out.load() != static_cast<uint64_t>(i + 1); ++t)
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    REQUIRE(a.stats().migrations_out.load() == 3);
+
+    // The first fills b's "/chat"; the second finds it full, the third has no route on b
+    REQUIRE(clients[0].send_text("x"));
+    REQUIRE(clients[0].recv_frame() == "x@b");
+    for (int i = 1; i < 3; ++i) {
+      uint8_t opcode = 0;
+      std::string reason = clients[i].recv_frame(&opcode);
+      REQUIRE(opcode == 0x8);
+      REQUIRE(reason.substr(0, 2) == "\x03\xf5");  // 1013
+    }
+    REQUIRE(b.stats().migrations_in.load() == 1);
+    REQUIRE(b.stats().route_rejects.load() == 2);
+    REQUIRE(b.stats().active_connections.load() == 1);
+  }
+
+  a.stop();
+  b.stop();
+  ta.join();
+  tb.join();
+}
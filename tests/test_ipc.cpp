@@ -0,0 +1,312 @@
+#include "ewss.hpp"
+
+#include <cstring>
+
+#include <catch2/catch_test_macros.hpp>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace ewss;
+
+// ============================================================================
+// ShmRing
+// ============================================================================
+
+TEST_CASE("ShmRing - push and peek in order", "[ipc]") {
+  std::vector<uint8_t> mem(ShmRing::bytes_for(256));
+  ShmRing ring;
+  ring.format(mem.data(), 256);
+  REQUIRE(ring.empty());
+
+  REQUIRE(ring.push(1, 100, "abc", 3));
+  REQUIRE(ring.push(2, 200, "hello", 5));
+
+  ShmRing::Record rec;
+  REQUIRE(ring.peek(rec));
+  REQUIRE(rec.kind == 1);
+  REQUIRE(rec.key == 100);
+  REQUIRE(std::string(reinterpret_cast<const char*>(rec.data), rec.len) == "abc");
+  ring.pop();
+
+  REQUIRE(ring.peek(rec));
+  REQUIRE(rec.key == 200);
+  REQUIRE(std::string(reinterpret_cast<const char*>(rec.data), rec.len) == "hello");
+  ring.pop();
+  REQUIRE(ring.empty());
+}
+
+TEST_CASE("ShmRing - full ring rejects push", "[ipc]") {
+  std::vector<uint8_t> mem(ShmRing::bytes_for(64));
+  ShmRing ring;
+  ring.format(mem.data(), 64);
+  char payload[24] = {};
+  REQUIRE(ring.push(1, 1, payload, sizeof(payload)));  // 40 bytes
+  REQUIRE_FALSE(ring.push(1, 2, payload, sizeof(payload)));
+
+  ShmRing::Record rec;
+  REQUIRE(ring.peek(rec));
+  ring.pop();
+  REQUIRE(ring.push(1, 2, payload, sizeof(payload)));
+}
+
+TEST_CASE("ShmRing - records never straddle the end", "[ipc]") {
+  std::vector<uint8_t> mem(ShmRing::bytes_for(128));
+  ShmRing ring;
+  ring.format(mem.data(), 128);
+  std::string payload(40, 'x');
+
+  // Cycle many times so records land on every offset and wrap repeatedly
+  for (uint64_t i = 0; i < 100; ++i) {
+    payload[0] = static_cast<char>('a' + i % 26);
+    REQUIRE(ring.push(3, i, payload.data(), static_cast<uint32_t>(payload.size())));
+    ShmRing::Record rec;
+    REQUIRE(ring.peek(rec));
+    REQUIRE(rec.key == i);
+    REQUIRE(rec.len == payload.size());
+    REQUIRE(std::memcmp(rec.data, payload.data(), payload.size()) == 0);
+    ring.pop();
+  }
+  REQUIRE(ring.empty());
+}
+
+TEST_CASE("ShmRing - records the producer could not have written are refused", "[ipc]") {
+  std::vector<uint8_t> mem(ShmRing::bytes_for(128));
+  ShmRing ring;
+  ring.format(mem.data(), 128);
+  REQUIRE(ring.push(2, 1, "abc", 3));
+  uint8_t* data = mem.data() + sizeof(ShmRing::Header);
+
+  // A length running past the end of the ring
+  uint32_t len = 1U << 20;
+  std::memcpy(data + 4, &len, sizeof(len));
+  ShmRing::Record rec;
+  REQUIRE_FALSE(ring.peek(rec));
+  REQUIRE(ring.corrupt());
+
+  // A head further ahead than the capacity
+  ring.format(mem.data(), 128);
+  REQUIRE(ring.push(2, 1, "abc", 3));
+  ring.header()->head.store(1024);
+  REQUIRE_FALSE(ring.peek(rec));
+  REQUIRE(ring.corrupt());
+
+  // A length past what the producer published
+  ring.format(mem.data(), 128);
+  REQUIRE(ring.push(2, 1, "abc", 3));
+  len = 40;
+  std::memcpy(data + 4, &len, sizeof(len));
+  REQUIRE_FALSE(ring.peek(rec));
+  REQUIRE(ring.corrupt());
+}
+
+// ============================================================================
+// IpcChannel
+// ============================================================================
+
+TEST_CASE("IpcChannel - server/app round trip", "[ipc]") {
+  IpcChannel server_side;
+  REQUIRE(server_side.create(4096).has_value());
+
+  IpcChannel app_side;
+  REQUIRE(app_side
+              .attach(::dup(server_side.memfd()), ::dup(server_side.to_app_fd()),
+                      ::dup(server_side.to_server_fd()))
+              .has_value());
+
+  REQUIRE(server_side.send(IpcChannel::Kind::kText, 7, "ping"));
+
+  std::vector<std::string> got;
+  app_side.wait(100);
+  REQUIRE(app_side.drain([&](const IpcChannel::Message& m) {
+    REQUIRE(m.kind == IpcChannel::Kind::kText);
+    REQUIRE(m.conn_id == 7);
+    got.emplace_back(m.payload);
+  }) == 1);
+  REQUIRE(got.size() == 1);
+  REQUIRE(got[0] == "ping");
+
+  REQUIRE(app_side.send(IpcChannel::Kind::kBinary, 7, "pong"));
+  size_t n = server_side.drain([&](const IpcChannel::Message& m) {
+    REQUIRE(m.kind == IpcChannel::Kind::kBinary);
+    REQUIRE(m.payload == "pong");
+  });
+  REQUIRE(n == 1);
+}
+
+TEST_CASE("IpcChannel - wakeup only when consumer is armed", "[ipc]") {
+  IpcChannel server_side;
+  REQUIRE(server_side.create(4096).has_value());
+  IpcChannel app_side;
+  REQUIRE(app_side
+              .attach(::dup(server_side.memfd()), ::dup(server_side.to_app_fd()),
+                      ::dup(server_side.to_server_fd()))
+              .has_value());
+
+  uint64_t count = 0;
+  REQUIRE(server_side.send(IpcChannel::Kind::kOpen, 1, ""));
+  REQUIRE(::read(app_side.wait_fd(), &count, sizeof(count)) < 0);  // Not armed: no syscall
+
+  app_side.drain([](const IpcChannel::Message&) {});
+  REQUIRE(app_side.arm());
+  REQUIRE(server_side.send(IpcChannel::Kind::kOpen, 2, ""));
+  REQUIRE(::read(app_side.wait_fd(), &count, sizeof(count)) == sizeof(count));
+  app_side.disarm();
+
+  REQUIRE_FALSE(app_side.arm());  // Data already pending
+}
+
+TEST_CASE("IpcChannel - unknown record kind stops the channel", "[ipc]") {
+  IpcChannel server_side;
+  REQUIRE(server_side.create(4096).has_value());
+  IpcChannel app_side;
+  REQUIRE(app_side
+              .attach(::dup(server_side.memfd()), ::dup(server_side.to_app_fd()),
+                      ::dup(server_side.to_server_fd()))
+              .has_value());
+
+  REQUIRE(app_side.send(IpcChannel::Kind::kText, 1, "before"));
+  REQUIRE(app_side.send(static_cast<IpcChannel::Kind>(99), 1, "bogus"));
+  REQUIRE(app_side.send(IpcChannel::Kind::kText, 1, "after"));
+  std::vector<std::string> got;
+  REQUIRE(server_side.drain([&](const IpcChannel::Message& m) { got.emplace_back(m.payload); }) == 1);
+  REQUIRE(got == std::vector<std::string>{"before"});
+  REQUIRE(server_side.broken());
+  REQUIRE(server_side.drain([](const IpcChannel::Message&) {}) == 0);
+  REQUIRE(server_side.arm());  // Blocks instead of spinning on what it will not read
+  server_side.disarm();
+}
+
+TEST_CASE("IpcChannel - oversized payload rejected", "[ipc]") {
+  IpcChannel ch;
+  REQUIRE(ch.create(128).has_value());
+  std::string big(1024, 'x');
+  REQUIRE_FALSE(ch.send(IpcChannel::Kind::kText, 1, big));
+}
+
+// ============================================================================
+// MpscQueue
+// ============================================================================
+
+TEST_CASE("MpscQueue - full queue rejects push", "[ipc]") {
+  MpscQueue<int, 4> q;
+  for (int i = 0; i < 4; ++i) REQUIRE(q.push(i));
+  REQUIRE_FALSE(q.push(4));
+  int v = -1;
+  REQUIRE(q.pop(v));
+  REQUIRE(v == 0);
+  REQUIRE(q.push(4));
+}
+
+TEST_CASE("MpscQueue - concurrent producers, single consumer", "[ipc]") {
+  constexpr int kProducers = 4;
+  constexpr int kPerProducer = 5000;
+  MpscQueue<int, 64> q;
+  std::vector<std::thread> producers;
+  for (int p = 0; p < kProducers; ++p) {
+    producers.emplace_back([&q, p]() {
+      for (int i = 0; i < kPerProducer; ++i)
+        while (!q.push(p * kPerProducer + i)) std::this_thread::yield();
+    });
+  }
+
+  // Per-producer FIFO order must survive interleaving
+  std::vector<int> next(kProducers, 0);
+  int received = 0;
+  while (received < kProducers * kPerProducer) {
+    int v;
+    if (!q.pop(v)) {
+      std::this_thread::yield();
+      continue;
+    }
+    int p = v / kPerProducer;
+    REQUIRE(v % kPerProducer == next[p]);
+    ++next[p];
+    ++received;
+  }
+  for (auto& t : producers) t.join();
+  int v;
+  REQUIRE_FALSE(q.pop(v));
+}
+
+// ============================================================================
+// TrafficCapture
+// ============================================================================
+
+TEST_CASE("TrafficCapture - records round trip through the file", "[ipc]") {
+  std::string path = "/tmp/ewss_capture_test_" + std::to_string(::getpid()) + ".cap";
+  {
+    TrafficCapture cap;
+    REQUIRE(cap.open(path, 1U << 16).has_value());
+    cap.record(7, 0x81, "hello", 5);
+    cap.record(9, 0x82, "\x00\x01\x02", 3);
+    cap.record(7, 0x88, "", 0);
+    std::string big(1U << 16, 'x');
+    cap.record(7, 0x82, big.data(), big.size());  // Larger than the ring allows
+    REQUIRE(cap.captured() == 3);
+    REQUIRE(cap.dropped() == 1);
+
+    // Committed records are readable while the capture is still open
+    while (cap.written_bytes() < 3 * sizeof(CaptureRecordHeader)) std::this_thread::yield();
+    CaptureReader live;
+    REQUIRE(live.open(path).has_value());
+    CapturedFrame f;
+    REQUIRE(live.next(f));
+    REQUIRE(f.payload == "hello");
+  }
+
+  CaptureReader reader;
+  REQUIRE(reader.open(path).has_value());
+  CapturedFrame f;
+  REQUIRE(reader.next(f));
+  REQUIRE(f.conn_id == 7);
+  REQUIRE(f.opcode() == ws::OpCode::kText);
+  REQUIRE(f.ts_ns >= reader.start_ns());
+  uint64_t first_ts = f.ts_ns;
+  REQUIRE(reader.next(f));
+  REQUIRE(f.conn_id == 9);
+  REQUIRE(f.opcode() == ws::OpCode::kBinary);
+  REQUIRE(f.payload == std::string_view("\x00\x01\x02", 3));
+  REQUIRE(f.ts_ns >= first_ts);
+  REQUIRE(reader.next(f));
+  REQUIRE(f.opcode() == ws::OpCode::kClose);
+  REQUIRE(f.payload.empty());
+  REQUIRE_FALSE(reader.next(f));
+
+  reader.rewind();
+  REQUIRE(reader.next(f));
+  REQUIRE(f.payload == "hello");
+  ::unlink(path.c_str());
+}
+
+TEST_CASE("TrafficCapture - file mapping grows past the first chunk", "[ipc]") {
+  std::string path = "/tmp/ewss_capture_grow_" + std::to_string(::getpid()) + ".cap";
+  constexpr int kRecords = 1000;
+  std::string payload(20000, 'p');
+  {
+    TrafficCapture cap;
+    REQUIRE(cap.open(path).has_value());
+    for (int i = 0; i < kRecords; ++i) {
+      payload[0] = static_cast<char>(i);
+      cap.record(static_cast<uint64_t>(i), 0x82, payload.data(), payload.size());
+      if (i % 100 == 99) {  // Let the writer catch up instead of dropping
+        while (cap.written_bytes() < static_cast<uint64_t>(i + 1) * (payload.size() + sizeof(CaptureRecordHeader)))
+          std::this_thread::yield();
+      }
+    }
+    REQUIRE(cap.dropped() == 0);
+  }
+
+  CaptureReader reader;
+  REQUIRE(reader.open(path).has_value());
+  CapturedFrame f;
+  int n = 0;
+  while (reader.next(f)) {
+    REQUIRE(f.conn_id == static_cast<uint64_t>(n));
+    REQUIRE(f.payload.size() == payload.size());
+    REQUIRE(f.payload[0] == static_cast<char>(n));
+    ++n;
+  }
+  REQUIRE(n == kRecords);
+  ::unlink(path.c_str());
+}
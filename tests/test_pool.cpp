@@ -2,6 +2,11 @@
 
 #include <catch2/catch_test_macros.hpp>
 
+#include <cstring>
+#include <memory_resource>
+#include <sys/wait.h>
+#include <vector>
+
 using namespace ewss;
 
 // ============================================================================
@@ -199,3 +204,275 @@ TEST_CASE("ServerStats - all counters reset", "[stats]") {
   REQUIRE(stats.pool_releases.load() == 0);
   REQUIRE(stats.pool_exhausted.load() == 0);
 }
+
+TEST_CASE("ServerStats - loop utilization", "[stats]") {
+  ServerStats stats;
+  REQUIRE(stats.loop_utilization() == 0.0);
+
+  stats.loop_busy_us = 250;
+  stats.loop_poll_us = 750;
+  REQUIRE(stats.loop_utilization() == 0.25);
+
+  stats.reset();
+  REQUIRE(stats.loop_busy_us.load() == 0);
+  REQUIRE(stats.loop_poll_us.load() == 0);
+}
+
+// ============================================================================
+// LoopWatchdog
+// ============================================================================
+
+TEST_CASE("LoopWatchdog - records slowest callback", "[stats]") {
+  ServerStats stats;
+  LoopWatchdog wd(stats);
+  wd.record(7, CallbackKind::kOpen, 100);
+  wd.record(9, CallbackKind::kMessage, 3000);
+  wd.record(11, CallbackKind::kDrain, 50);
+
+  REQUIRE(stats.callback_us_total.load() == 3150);
+  REQUIRE(stats.max_callback_us.load() == 3000);
+
+  StallInfo info{};
+  REQUIRE(wd.end_iteration(3200, 1000, info));
+  REQUIRE(info.conn_id == 9);
+  REQUIRE(info.kind == CallbackKind::kMessage);
+  REQUIRE(info.callback_us == 3000);
+  REQUIRE(info.iteration_us == 3200);
+  REQUIRE(stats.stalled_iterations.load() == 1);
+}
+
+TEST_CASE("LoopWatchdog - within budget or disabled", "[stats]") {
+  ServerStats stats;
+  LoopWatchdog wd(stats);
+  StallInfo info{};
+  wd.record(1, CallbackKind::kMessage, 500);
+  REQUIRE_FALSE(wd.end_iteration(800, 1000, info));
+  REQUIRE_FALSE(wd.end_iteration(5000, 0, info));
+  REQUIRE(stats.stalled_iterations.load() == 0);
+}
+
+// ============================================================================
+// LatencyHistogram / StatsSegment
+// ============================================================================
+
+TEST_CASE("LatencyHistogram - log2 buckets and percentile", "[stats]") {
+  LatencyHistogram h;
+  REQUIRE(LatencyHistogram::bucket_for(0) == 0);
+  REQUIRE(LatencyHistogram::bucket_for(1) == 1);
+  REQUIRE(LatencyHistogram::bucket_for(3) == 2);
+  REQUIRE(LatencyHistogram::bucket_for(1024) == 11);
+
+  for (int i = 0; i < 99; ++i) h.record(10);
+  h.record(5000);
+  REQUIRE(h.count() == 100);
+
+  uint64_t counts[LatencyHistogram::kBuckets];
+  h.copy_to(counts);
+  REQUIRE(LatencyHistogram::percentile(counts, 50.0) == 15);
+  REQUIRE(LatencyHistogram::percentile(counts, 100.0) == 8191);
+
+  h.reset();
+  REQUIRE(h.count() == 0);
+}
+
+TEST_CASE("StatsSegment - publish and read back", "[stats]") {
+  std::string name = "/ewss_test_stats_" + std::to_string(::getpid());
+  StatsSegment writer;
+  REQUIRE(writer.create(name).has_value());
+
+  ServerStats stats;
+  stats.total_connections = 42;
+  stats.loop_busy_us = 10;
+  stats.loop_poll_us = 30;
+  stats.callback_latency_us.record(100);
+  writer.publish(stats);
+
+  StatsSegment reader;
+  REQUIRE(reader.open(name).has_value());
+  StatsSnapshot snap;
+  uint64_t publishes = 0;
+  REQUIRE(reader.read(snap, &publishes));
+  REQUIRE(publishes == 1);
+  REQUIRE(snap.total_connections == 42);
+  REQUIRE(snap.loop_utilization() == 0.25);
+  REQUIRE(snap.callback_latency_us[LatencyHistogram::bucket_for(100)] == 1);
+  REQUIRE(reader.writer_pid() == static_cast<uint32_t>(::getpid()));
+
+  // A second writer must not take over a live writer's segment
+  StatsSegment rival;
+  auto taken = rival.create(name);
+  REQUIRE_FALSE(taken.has_value());
+  REQUIRE(taken.get_error() == ErrorCode::kInvalidState);
+  rival.close();
+  REQUIRE(reader.read(snap));
+
+  writer.close();
+  StatsSegment missing;
+  REQUIRE_FALSE(missing.open(name).has_value());
+}
+
+TEST_CASE("StatsSegment - replaces a segment left by a dead writer", "[stats]") {
+  std::string name = "/ewss_test_stale_" + std::to_string(::getpid());
+  pid_t child = ::fork();
+  if (child == 0) ::_exit(0);
+  REQUIRE(child > 0);
+  REQUIRE(::waitpid(child, nullptr, 0) == child);
+
+  int fd = ::shm_open(name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+  REQUIRE(fd >= 0);
+  REQUIRE(::ftruncate(fd, sizeof(StatsShmLayout)) == 0);
+  void* p = ::mmap(nullptr, sizeof(StatsShmLayout), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  REQUIRE(p != MAP_FAILED);
+  auto* layout = static_cast<StatsShmLayout*>(p);
+  layout->magic = StatsShmLayout::kMagic;
+  layout->writer_pid = static_cast<uint32_t>(child);
+  ::munmap(p, sizeof(StatsShmLayout));
+  ::close(fd);
+
+  StatsSegment writer;
+  REQUIRE(writer.create(name).has_value());
+  REQUIRE(writer.writer_pid() == static_cast<uint32_t>(::getpid()));
+}
+
+// ============================================================================
+// ScratchArena
+// ============================================================================
+
+TEST_CASE("ScratchArena - bump allocation and reset", "[pool]") {
+  ScratchArena arena;
+  arena.reserve(256);
+  REQUIRE(arena.capacity() == 256);
+
+  std::string_view a = arena.format("Client #%d: %s", 7, "hi");
+  REQUIRE(a == "Client #7: hi");
+  std::string_view b = arena.copy("tail");
+  REQUIRE(b.data() > a.data());
+  REQUIRE(a == "Client #7: hi");  // Earlier allocations stay put
+
+  std::pmr::string built = arena.string();
+  built += "x";
+  built.append(40, 'y');
+  REQUIRE(built.size() == 41);
+  REQUIRE(arena.overflows() == 0);
+  size_t used = arena.used();
+  REQUIRE(used > 0);
+
+  arena.reset();
+  REQUIRE(arena.used() == 0);
+  REQUIRE(arena.high_water() == used);
+  REQUIRE(arena.copy("again").data() == a.data());  // Same bytes reused
+}
+
+TEST_CASE("ScratchArena - spill to heap grows the block at reset", "[pool]") {
+  ScratchArena arena;
+  arena.reserve(128);
+  void* inside = arena.allocate(100, 8);
+  void* spilled = arena.allocate(200, 64);
+  REQUIRE(inside != nullptr);
+  REQUIRE(reinterpret_cast<uintptr_t>(spilled) % 64 == 0);
+  std::memset(spilled, 0xAB, 200);
+  REQUIRE(arena.overflows() == 1);
+  REQUIRE(arena.used() == 300);
+
+  arena.reset();
+  REQUIRE(arena.capacity() >= 300);
+  REQUIRE(arena.allocate(200, 64) != nullptr);
+  REQUIRE(arena.allocate(100, 8) != nullptr);
+  REQUIRE(arena.overflows() == 1);  // Same load fits now
+
+  std::pmr::vector<int> v(&arena);
+  for (int i = 0; i < 1000; ++i) v.push_back(i);  // Grows past the block: spills
+  REQUIRE(v[999] == 999);
+  REQUIRE(arena.overflows() > 1);
+}
+
+TEST_CASE("AccountedResource - usage, peak and pmr helpers", "[pool]") {
+  AccountedResource resource;
+  {
+    auto bytes = pmr_bytes(&resource, 1000);
+    REQUIRE(reinterpret_cast<uintptr_t>(bytes.get()) % kCacheLine == 0);
+    auto obj = pmr_new<std::pair<int, int>>(&resource, 1, 2);
+    REQUIRE(obj->second == 2);
+    REQUIRE(resource.bytes_in_use() == 1000 + sizeof(std::pair<int, int>));
+    REQUIRE(resource.allocations() == 2);
+  }
+  REQUIRE(resource.bytes_in_use() == 0);
+  REQUIRE(resource.peak_bytes() == 1000 + sizeof(std::pair<int, int>));
+
+  // The scratch arena takes its block and spills from the upstream
+  ScratchArena arena(&resource);
+  arena.reserve(64);
+  REQUIRE(resource.bytes_in_use() == 64);
+  REQUIRE(arena.allocate(128, 8) != nullptr);
+  REQUIRE(resource.bytes_in_use() > 64 + 128);
+  arena.reset();
+  REQUIRE(resource.bytes_in_use() == arena.capacity());
+}
+
+TEST_CASE("AccountedResource - frames, sessions and codecs", "[pool]") {
+  AccountedResource resource;
+  {
+    SharedFrame frame = SharedFrame::encode("t", "payload", ws::OpCode::kText, false, &resource);
+    SharedFrame copy = frame;
+    REQUIRE(resource.allocations() == 1);
+    REQUIRE(resource.bytes_in_use() >= frame.bytes().size() + frame.topic().size());
+
+    ServerStats stats;
+    SessionStore store(ResumePolicy{}, stats, &resource);
+    bool resumed = false;
+    auto session = store.open({}, 0, 0, resumed);
+    REQUIRE(session != nullptr);
+    session->push(copy);
+    REQUIRE(resource.bytes_in_use() >= sizeof(ResumeSession) + ResumePolicy{}.window_messages * sizeof(SharedFrame));
+  }
+  REQUIRE(resource.bytes_in_use() == 0);
+
+#if EWSS_HAS_DEFLATE
+  {
+    deflate::Compressor tx(15, 6, &resource);
+    deflate::Decompressor rx(15, &resource);
+    size_t zlib_state = resource.bytes_in_use();
+    REQUIRE(zlib_state > 32768);  // At least the inflate window
+    std::pmr::string out(&resource);
+    std::pmr::string in(&resource);
+    std::string msg(500, 'a');
+    REQUIRE(tx.compress(msg, out, false));
+    REQUIRE(rx.decompress(out, in, 1 << 20, false).has_value());
+    REQUIRE(std::string_view(in) == msg);
+  }
+  REQUIRE(resource.bytes_in_use() == 0);
+#endif
+}
+
+// ============================================================================
+// StaticPool
+// ============================================================================
+
+TEST_CASE("StaticPool - best-fit slabs, reuse and heap fallback", "[pool]") {
+  StaticPool pool;
+  StaticPool::Class classes[] = {{1000, 2}, {100, 3}};
+  REQUIRE(pool.reserve(classes, 2, true).has_value());
+  REQUIRE_FALSE(pool.reserve(classes, 2, true).has_value());
+  REQUIRE(pool.reserved_bytes() == 128 * 3 + 1024 * 2);  // Rounded to cache lines
+  REQUIRE(pool.free_blocks(100) == 3);
+
+  bool fatal = AllocationGuard::fatal();
+  AllocationGuard::fatal() = false;
+  void* small[3];
+  for (auto& p : small) p = pool.allocate(64, 8);
+  REQUIRE(pool.free_blocks(100) == 0);
+  void* spill = pool.allocate(64, 8);  // Small slab empty: takes a large block
+  REQUIRE(pool.free_blocks(1000) == 1);
+  void* big = pool.allocate(1000, 64);
+  REQUIRE(reinterpret_cast<uintptr_t>(big) % kCacheLine == 0);
+  REQUIRE(pool.fallbacks() == 0);
+  void* heap = pool.allocate(1000, 8);  // Everything taken: global heap
+  REQUIRE(pool.fallbacks() == 1);
+
+  pool.deallocate(heap, 1000, 8);
+  pool.deallocate(spill, 64, 8);
+  REQUIRE(pool.free_blocks(1000) == 1);
+  pool.deallocate(small[1], 64, 8);
+  REQUIRE(pool.allocate(10, 1) == small[1]);  // LIFO reuse
+  AllocationGuard::fatal() = fatal;
+}
@@ -0,0 +1,201 @@
+#include "ewss.hpp"
+
+#include <catch2/catch_test_macros.hpp>
+
+#include <sys/socket.h>
+
+using namespace ewss;
+
+namespace {
+
+// Open connection over one end of a socketpair; frames land in its tx_buffer()
+struct LoopbackConn {
+  int fds[2] = {-1, -1};
+  std::shared_ptr<Connection> conn;
+
+  LoopbackConn() {
+    ::socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    conn = std::make_shared<Connection>(fds[0]);
+    conn->transition_to_state(ConnectionState::kOpen);
+  }
+  ~LoopbackConn() { ::close(fds[1]); }
+
+  // Pop the next server frame and parse its RPC envelope
+  bool next_envelope(rpc::Envelope& env, std::string& storage) {
+    auto& tx = conn->tx_buffer();
+    storage.assign(tx.view());
+    ws::FrameHeader header;
+    size_t header_size = ws::parse_frame_header(storage, header);
+    if (header_size == 0 || storage.size() < header_size + header.payload_len) return false;
+    tx.advance(header_size + header.payload_len);
+    storage = storage.substr(header_size, header.payload_len);
+    return rpc::parse(storage, env);
+  }
+};
+
+std::string envelope(rpc::MsgType type, uint16_t method, uint32_t id, std::string_view payload) {
+  uint8_t header[rpc::kHeaderSize];
+  rpc::encode_header(header, type, method, id);
+  return std::string(reinterpret_cast<const char*>(header), sizeof(header)) + std::string(payload);
+}
+
+}  // namespace
+
+TEST_CASE("RPC envelope encode/parse", "[rpc]") {
+  std::string msg = envelope(rpc::MsgType::kRequest, 0x1234, 0xA1B2C3D4, "args");
+  REQUIRE(msg.size() == rpc::kHeaderSize + 4);
+
+  rpc::Envelope env;
+  REQUIRE(rpc::parse(msg, env));
+  REQUIRE(env.type == rpc::MsgType::kRequest);
+  REQUIRE(env.method == 0x1234);
+  REQUIRE(env.correlation_id == 0xA1B2C3D4);
+  REQUIRE(env.payload == "args");
+
+  REQUIRE_FALSE(rpc::parse("short", env));
+  msg[0] = 9;  // Unknown type
+  REQUIRE_FALSE(rpc::parse(msg, env));
+}
+
+TEST_CASE("TimerQueue fires in deadline order and honours cancel", "[rpc]") {
+  TimerQueue timers;
+  auto now = TimerQueue::Clock::now();
+  std::string order;
+  timers.schedule_at(now + std::chrono::milliseconds(30), [&order]() { order += 'c'; });
+  timers.schedule_at(now + std::chrono::milliseconds(10), [&order]() { order += 'a'; });
+  auto b = timers.schedule_at(now + std::chrono::milliseconds(20), [&order]() { order += 'b'; });
+  REQUIRE(timers.size() == 3);
+  REQUIRE(timers.timeout_ms(now, 1000) == 10);
+  REQUIRE(timers.timeout_ms(now, 5) == 5);
+
+  REQUIRE(timers.cancel(b));
+  REQUIRE_FALSE(timers.cancel(b));
+  REQUIRE(timers.size() == 2);
+
+  REQUIRE(timers.run_expired(now) == 0);
+  REQUIRE(timers.run_expired(now + std::chrono::milliseconds(25)) == 1);
+  REQUIRE(order == "a");
+  REQUIRE(timers.run_expired(now + std::chrono::milliseconds(30)) == 1);
+  REQUIRE(order == "ac");
+  REQUIRE(timers.size() == 0);
+  REQUIRE(timers.timeout_ms(now, -1) == -1);
+}
+
+TEST_CASE("TimerQueue capacity and slot reuse", "[rpc]") {
+  TimerQueue timers;
+  auto now = TimerQueue::Clock::now();
+  int fired = 0;
+  for (uint32_t i = 0; i < TimerQueue::kCapacity; ++i)
+    REQUIRE(timers.schedule_at(now, [&fired]() { ++fired; }) != 0);
+  REQUIRE(timers.schedule_at(now, [&fired]() { ++fired; }) == 0);
+  REQUIRE(timers.run_expired(now) == TimerQueue::kCapacity);
+  REQUIRE(fired == static_cast<int>(TimerQueue::kCapacity));
+  REQUIRE(timers.schedule_at(now, [&fired]() { ++fired; }) != 0);
+}
+
+TEST_CASE("RpcSession completes pipelined calls out of order", "[rpc]") {
+  LoopbackConn lc;
+  TimerQueue timers;
+  RpcSession session(nullptr, timers);
+
+  std::string results;
+  auto id1 = session.call(*lc.conn, 7, "one", [&results](RpcStatus st, std::string_view p) {
+    REQUIRE(st == RpcStatus::kOk);
+    results += std::string(p) + ";";
+  });
+  auto id2 = session.call(*lc.conn, 8, "two", [&results](RpcStatus st, std::string_view p) {
+    REQUIRE(st == RpcStatus::kRemoteError);
+    results += std::string(p) + ";";
+  });
+  REQUIRE(id1.has_value());
+  REQUIRE(id2.has_value());
+  REQUIRE(id1.value() != id2.value());
+  REQUIRE(session.pending() == 2);
+  REQUIRE(timers.size() == 2);
+
+  rpc::Envelope env;
+  std::string storage;
+  REQUIRE(lc.next_envelope(env, storage));
+  REQUIRE(env.type == rpc::MsgType::kRequest);
+  REQUIRE(env.method == 7);
+  REQUIRE(env.correlation_id == id1.value());
+  REQUIRE(env.payload == "one");
+
+  REQUIRE(session.on_message(*lc.conn, envelope(rpc::MsgType::kError, 0, id2.value(), "bad")));
+  REQUIRE(session.on_message(*lc.conn, envelope(rpc::MsgType::kResponse, 0, id1.value(), "ok")));
+  REQUIRE(results == "bad;ok;");
+  REQUIRE(session.pending() == 0);
+  REQUIRE(timers.size() == 0);
+
+  // Late duplicate is ignored
+  REQUIRE(session.on_message(*lc.conn, envelope(rpc::MsgType::kResponse, 0, id1.value(), "again")));
+  REQUIRE(results == "bad;ok;");
+  REQUIRE_FALSE(session.on_message(*lc.conn, "plain"));
+}
+
+TEST_CASE("RpcSession timeouts, close and table limit", "[rpc]") {
+  LoopbackConn lc;
+  TimerQueue timers;
+  RpcSession session(nullptr, timers);
+
+  RpcStatus status = RpcStatus::kOk;
+  REQUIRE(session.call(*lc.conn, 1, "", [&status](RpcStatus st, std::string_view) { status = st; }, 10).has_value());
+  timers.run_expired(TimerQueue::Clock::now() + std::chrono::milliseconds(20));
+  REQUIRE(status == RpcStatus::kTimeout);
+  REQUIRE(session.pending() == 0);
+
+  int closed = 0;
+  for (uint32_t i = 0; i < RpcSession::kMaxPending; ++i) {
+    REQUIRE(session.call(*lc.conn, 1, "", [&closed](RpcStatus st, std::string_view) {
+      if (st == RpcStatus::kClosed) ++closed;
+    }, 0).has_value());
+    lc.conn->tx_buffer().advance(lc.conn->tx_buffer().size());
+  }
+  auto full = session.call(*lc.conn, 1, "", nullptr);
+  REQUIRE_FALSE(full.has_value());
+  REQUIRE(full.get_error() == ErrorCode::kBufferFull);
+
+  session.fail_all(RpcStatus::kClosed);
+  REQUIRE(closed == static_cast<int>(RpcSession::kMaxPending));
+  REQUIRE(session.pending() == 0);
+
+  // No timer slot left: the call is refused before anything is sent
+  for (uint32_t i = 0; i < TimerQueue::kCapacity; ++i)
+    REQUIRE(timers.schedule(std::chrono::seconds(10), []() {}) != 0);
+  auto no_timer = session.call(*lc.conn, 1, "", nullptr, 10);
+  REQUIRE_FALSE(no_timer.has_value());
+  REQUIRE(no_timer.get_error() == ErrorCode::kResourceUnavailable);
+  REQUIRE(session.pending() == 0);
+  REQUIRE(lc.conn->tx_buffer().empty());
+  REQUIRE(session.call(*lc.conn, 1, "", nullptr, 0).has_value());  // Without a timeout it still goes out
+}
+
+TEST_CASE("RpcSession dispatches requests and notifications", "[rpc]") {
+  LoopbackConn lc;
+  TimerQueue timers;
+  RpcDispatcher dispatcher;
+  std::string seen;
+  dispatcher.on(5, [&seen](const RpcRequest& req) {
+    seen += std::string(req.payload);
+    if (req.correlation_id != 0) req.conn->rpc()->reply(*req.conn, req.correlation_id, "pong");
+  });
+  lc.conn->attach_rpc(pmr_new<RpcSession>(std::pmr::new_delete_resource(), &dispatcher, timers));
+  RpcSession& session = *lc.conn->rpc();
+
+  REQUIRE(session.on_message(*lc.conn, envelope(rpc::MsgType::kRequest, 5, 77, "ping")));
+  rpc::Envelope env;
+  std::string storage;
+  REQUIRE(lc.next_envelope(env, storage));
+  REQUIRE(env.type == rpc::MsgType::kResponse);
+  REQUIRE(env.correlation_id == 77);
+  REQUIRE(env.payload == "pong");
+
+  REQUIRE(session.on_message(*lc.conn, envelope(rpc::MsgType::kNotify, 5, 0, "!")));
+  REQUIRE(seen == "ping!");
+  REQUIRE(lc.conn->tx_buffer().empty());
+
+  REQUIRE(session.on_message(*lc.conn, envelope(rpc::MsgType::kRequest, 99, 78, "")));
+  REQUIRE(lc.next_envelope(env, storage));
+  REQUIRE(env.type == rpc::MsgType::kError);
+  REQUIRE(env.correlation_id == 78);
+}
@@ -91,3 +91,36 @@ TEST_CASE("WebSocket frame unmask", "[utils]") {
   std::string result(reinterpret_cast<const char*>(masked), sizeof(masked));
   // REQUIRE(result == "Hello");
 }
+
+TEST_CASE("RouteTrie exact and prefix matching", "[utils]") {
+  RouteTrie trie;
+  trie.add("/chat", 0);
+  trie.add("/api/*", 1);
+  trie.add("/api/admin", 2);
+  trie.add("/*", 3);
+  REQUIRE(trie.find("/chat") == RouteTrie::kNoMatch);  // Not compiled yet
+  trie.compile();
+
+  REQUIRE(trie.find("/chat") == 0);
+  REQUIRE(trie.find("/api/users") == 1);
+  REQUIRE(trie.find("/api/") == 1);
+  REQUIRE(trie.find("/api/admin") == 2);
+  REQUIRE(trie.find("/api/admin/x") == 1);
+  REQUIRE(trie.find("/chatroom") == 3);
+  REQUIRE(trie.find("/") == 3);
+  REQUIRE(trie.find("") == RouteTrie::kNoMatch);
+}
+
+TEST_CASE("RouteTrie without catch-all", "[utils]") {
+  RouteTrie trie;
+  trie.add("/a", 7);
+  trie.add("/a", 8);  // Duplicate: first registration wins
+  trie.add("/b/*", 9);
+  trie.compile();
+  REQUIRE(trie.size() == 3);
+  REQUIRE(trie.node_count() == 5);
+  REQUIRE(trie.find("/a") == 7);
+  REQUIRE(trie.find("/ab") == RouteTrie::kNoMatch);
+  REQUIRE(trie.find("/b") == RouteTrie::kNoMatch);
+  REQUIRE(trie.find("/b/c") == 9);
+}